@@ -201,6 +201,9 @@ typedef  int64_t i64_t;
 #define INLINE 
 #define inline __inline
 #define vsnprintf _vsnprintf
+#if (_MSC_VER < 1900)
+#define snprintf _snprintf
+#endif
 #else
 #define INLINE inline
 #endif
@@ -289,6 +292,8 @@ typedef struct {
   s32 *relData;  /* This is where all the relation data is held, in a very
                     specific format: see rels.c for the format description.
                  */
+  void  *mapBase;   /* If non-NULL, relData points into this mapping of the */
+  size_t mapSize;   /* file (see mapRelList() in rellist.c).                */
 } rel_list;
 
 /* This is a more generic structure, (which will be) used
@@ -710,6 +715,11 @@ int  ll_read(llist_t *C, char *fname);
 
 /* combparts.c */
 u32 combParts(llist_t *R, llist_t *P, u32 maxRelsInFF, u32 minFF, u32 minFull);
+u32 combPartsGraph(llist_t *R, llist_t *P, u32 maxRelsInFF, u32 minFF, u32 minFull);
+
+/* combparts-ext.c */
+s32 combPartsExt(multi_file_t *prelF, char *colName, u32 maxRelsInFF,
+                 u32 minFull, s64 maxMem, u32 *numRels);
 
 /* rels.c */
 #define GETNUMRFB(_s) ((_s)>>24)
@@ -762,6 +772,46 @@ void   seedBlockLanczos(s32 seed);
 void MultB64(u64 *Product, u64 *x, void *P);
 void MultB_T64(u64 *Product, u64 *x, void *P);
 
+/* blanczos64-mt.c */
+/* Vectors shorter than this are not worth handing to the thread pool. */
+#define BL_MT_MIN_N 4096
+void MultB64_mt(u64 *Product, u64 *x, void *P);
+void MultB_T64_mt(u64 *Product, u64 *x, void *P);
+void multT_mt(u64 *c, u64 *a, u64 *b, s32 n);
+void multnx64_mt(u64 *c, u64 *a, u64 *b, s32 n);
+void addmultnx64_mt(u64 *c, u64 *a, u64 *b, s32 n);
+
+/* bwiedemann.c */
+/* Most sequences (of 64 columns each) block Wiedemann will use. */
+#define BW_MAX_SEQS 16
+int  blockWiedemann64(u64 *deps, MAT_MULT_FUNC_PTR64 MultB, void *P, s32 n,
+                      int numSeqs, u32 seed);
+int  blockWiedemannJob(MAT_MULT_FUNC_PTR64 MultB, void *P, s32 n, int numSeqs,
+                       int job, u32 seed);
+void blockWiedemannClean(void);
+
+/* matprune-mt.c */
+s32  rowWeights_mt(nfs_sparse_mat_t *M, s32 *rowWt);
+s32  removeCols_mt(nfs_sparse_mat_t *M, llist_t *C, s32 *cols, s32 m);
+s32  rowSingletons_mt(nfs_sparse_mat_t *M, s32 *rowMember);
+s32  mapRows_mt(nfs_sparse_mat_t *M, s32 *map);
+
+/* blanczos64-tiled.c */
+#define TILED_KERNEL_AUTO   -1
+#define TILED_KERNEL_SCALAR  0
+#define TILED_KERNEL_AVX2    1
+#define TILED_KERNEL_AVX512  2
+int  tiled_init(nfs_sparse_mat_t *M, s32 dim);
+void tiled_clear(void);
+int  tiled_isActive(nfs_sparse_mat_t *M);
+int  tiled_kernelSupported(int kernel);
+int  tiled_setKernel(int kernel);
+const char *tiled_kernelName(int kernel);
+s32  tiled_dim(void);
+s64  tiled_memUse(void);
+void MultB64_tiled(u64 *Product, u64 *x, void *P);
+void MultB_T64_tiled(u64 *Product, u64 *x, void *P);
+
         
 /* nfmisc.c */
 /* These aren't quite named consistently yet, I think. I want functions
@@ -791,6 +841,8 @@ u32 root_finder(u32 * root_buf, mpz_t * A, u32 adeg, u32 p);
 int    factorN(mpz_t p, mpz_t q, s32 *dep, relation_t *R, nfs_fb_t *FB, nf_t *N);
 int    montgomerySqrt(mpz_t rSqrt, mpz_t aSqrt, s32 *relsInDep, multi_file_t *prelF,
                       multi_file_t *lpF, nfs_fb_t *FB, nf_t *N);
+int    msqrtLoadRels(multi_file_t *prelF);
+void   msqrtClearRels();
 double dickman(double x);
 double dickmanStrong(double x, int numTerms);
 
@@ -6,4 +6,5 @@
 
 chmod a+x bin/autogplot.sh
 chmod a+x tests/factLat.pl
+chmod a+x tests/tuneLat.pl
 echo "Execute permissions have been fixed."
@@ -0,0 +1,401 @@
+/**************************************************************/
+/* abindex.c                                                  */
+/* A persistent, exact index of the (a,b) pairs procrels has  */
+/* seen, for throwing out duplicate relations. It is an open  */
+/* addressing (linear probing) hash table on the full 64-bit  */
+/* a and 32-bit b, living in the file <prefix>.abidx next to  */
+/* the processed relation files. The file is mmapped, so a    */
+/* run picks it up without reading the relation files, and    */
+/* it is only rebuilt from them when it is out of date.       */
+/**************************************************************/
+/*  This file is part of GGNFS.
+*
+*   GGNFS is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   GGNFS is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with GGNFS; if not, write to the Free Software
+*   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "abindex.h"
+#include "rellist.h"
+
+#if !defined(_MSC_VER) && !defined(__MINGW32__) && !defined(MINGW32)
+#define ABIDX_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#ifdef _MSC_VER
+#pragma warning (disable: 4996) /* warning C4996: 'function' was declared deprecated */
+#endif
+
+#define ABIDX_MAGIC "GGNFSABI"
+#define ABIDX_MIN_CAPACITY 65536
+/* The table is doubled when it gets more than 3/4 full. */
+#define ABIDX_FULL(_c, _n) (4*(_n) > 3*(_c))
+
+/* Empty slots hold (a,b) = (-1,-1). */
+#define SLOT_EMPTY(_s) (((_s)->a0 == 0xFFFFFFFF) && ((_s)->a1 == 0xFFFFFFFF) && ((_s)->b == -1))
+
+/*********************************************************************/
+static INLINE u64 abidx_hash(s64 a, s32 b)
+/*********************************************************************/
+{ u64 h;
+
+  h = (u64)a*0x9E3779B97F4A7C15ULL ^ (u64)(u32)b*0xC2B2AE3D27D4EB4FULL;
+  h ^= h >> 31;
+  h *= 0xBF58476D1CE4E5B9ULL;
+  h ^= h >> 29;
+  return h;
+}
+
+/*********************************************************************/
+static int abidx_map(ab_index_t *X, char *fName, s64 capacity)
+/*********************************************************************/
+/* Create (or truncate) fName as an empty index with 'capacity'      */
+/* slots, and map it.                                                */
+/*********************************************************************/
+{ size_t size = sizeof(ab_index_hdr_t) + capacity*sizeof(ab_slot_t);
+
+#ifdef ABIDX_MMAP
+  if ((X->fd = open(fName, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+    fprintf(stderr, "abidx_map() : Could not create %s!\n", fName);
+    return -1;
+  }
+  if (ftruncate(X->fd, (off_t)size)) {
+    fprintf(stderr, "abidx_map() : Could not resize %s!\n", fName);
+    close(X->fd);
+    return -1;
+  }
+  X->H = (ab_index_hdr_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, X->fd, 0);
+  if (X->H == MAP_FAILED) {
+    fprintf(stderr, "abidx_map() : Could not map %s!\n", fName);
+    close(X->fd);
+    X->H = NULL;
+    return -1;
+  }
+#else
+  X->fd = -1;
+  if (!(X->H = (ab_index_hdr_t *)malloc(size))) {
+    fprintf(stderr, "abidx_map() : Memory allocation error!\n");
+    return -1;
+  }
+#endif
+  X->mapSize = size;
+  X->T = (ab_slot_t *)(X->H + 1);
+  X->mask = capacity - 1;
+  memset(X->H, 0x00, sizeof(ab_index_hdr_t));
+  memset(X->T, 0xFF, capacity*sizeof(ab_slot_t));
+  memcpy(X->H->magic, ABIDX_MAGIC, 8);
+  X->H->version = ABIDX_VERSION;
+  X->H->capacity = capacity;
+  return 0;
+}
+
+/*********************************************************************/
+static void abidx_unmap(ab_index_t *X)
+/*********************************************************************/
+{
+  if (X->H == NULL) return;
+#ifdef ABIDX_MMAP
+  munmap((void *)X->H, X->mapSize);
+  close(X->fd);
+#else
+  { FILE *fp;
+    if ((fp = fopen(X->fName, "wb"))) {
+      fwrite(X->H, 1, X->mapSize, fp);
+      fclose(fp);
+    }
+    free(X->H);
+  }
+#endif
+  X->H = NULL; X->T = NULL;
+}
+
+/*********************************************************************/
+static int abidx_load(ab_index_t *X)
+/*********************************************************************/
+/* Map an existing index file. Return value: 0 if it looks sane.     */
+/*********************************************************************/
+{ struct stat    fileInfo;
+  ab_index_hdr_t H;
+  FILE          *fp;
+
+  if (stat(X->fName, &fileInfo) || !(fp = fopen(X->fName, "rb")))
+    return -1;
+  if (fread(&H, sizeof(H), 1, fp) != 1) {
+    fclose(fp);
+    return -1;
+  }
+  if (memcmp(H.magic, ABIDX_MAGIC, 8) || (H.version != ABIDX_VERSION) ||
+      (H.capacity < 1) || (H.capacity & (H.capacity-1)) ||
+      ((s64)fileInfo.st_size != (s64)(sizeof(H) + H.capacity*sizeof(ab_slot_t)))) {
+    fclose(fp);
+    return -1;
+  }
+  X->mapSize = fileInfo.st_size;
+#ifdef ABIDX_MMAP
+  fclose(fp);
+  if ((X->fd = open(X->fName, O_RDWR)) < 0)
+    return -1;
+  X->H = (ab_index_hdr_t *)mmap(NULL, X->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, X->fd, 0);
+  if (X->H == MAP_FAILED) {
+    close(X->fd);
+    X->H = NULL;
+    return -1;
+  }
+#else
+  X->fd = -1;
+  if (!(X->H = (ab_index_hdr_t *)malloc(X->mapSize))) {
+    fclose(fp);
+    return -1;
+  }
+  rewind(fp);
+  if (fread(X->H, 1, X->mapSize, fp) != X->mapSize) {
+    free(X->H); X->H = NULL;
+    fclose(fp);
+    return -1;
+  }
+  fclose(fp);
+#endif
+  X->T = (ab_slot_t *)(X->H + 1);
+  X->mask = X->H->capacity - 1;
+  return 0;
+}
+
+/*********************************************************************/
+void prelF_fileState(multi_file_t *prelF, s64 *fileSize, s32 *fileRels)
+/*********************************************************************/
+{ struct stat fileInfo;
+  char  prelName[sizeof(prelF->prefix) + 16];
+  s32   relsInFile;
+  int   i;
+  FILE *fp;
+
+  for (i=0; i<prelF->numFiles; i++) {
+    sprintf(prelName, "%s.%d", prelF->prefix, i);
+    relsInFile = 0;
+    if (stat(prelName, &fileInfo))
+      fileInfo.st_size = 0;
+    else if ((fp = fopen(prelName, "rb"))) {
+      if (fread(&relsInFile, sizeof(s32), 1, fp) != 1)
+        relsInFile = 0;
+      fclose(fp);
+    }
+    fileSize[i] = (s64)fileInfo.st_size;
+    fileRels[i] = relsInFile;
+  }
+}
+
+/*********************************************************************/
+static int abidx_filesMatch(ab_index_t *X, multi_file_t *prelF)
+/*********************************************************************/
+/* Do the processed files look the way they did when the index was   */
+/* last closed?                                                      */
+/*********************************************************************/
+{ s64   fileSize[ABIDX_MAX_FILES];
+  s32   fileRels[ABIDX_MAX_FILES];
+  int   i;
+
+  if (!X->H->clean || (X->H->numFiles != prelF->numFiles))
+    return 0;
+  prelF_fileState(prelF, fileSize, fileRels);
+  for (i=0; i<prelF->numFiles; i++)
+    if ((X->H->fileSize[i] != fileSize[i]) || (X->H->fileRels[i] != fileRels[i]))
+      return 0;
+  return 1;
+}
+
+/*********************************************************************/
+static int abidx_grow(ab_index_t *X)
+/*********************************************************************/
+/* Double the table: build the new one in <fName>.new, then rename.  */
+/*********************************************************************/
+{ ab_index_t Y;
+  char  newName[520];
+  s64   i;
+
+  sprintf(newName, "%s.new", X->fName);
+  strcpy(Y.fName, X->fName);
+  if (abidx_map(&Y, newName, 2*X->H->capacity))
+    return -1;
+  memcpy(Y.H->numLP, X->H->numLP, sizeof(Y.H->numLP));
+  Y.H->hasEmptyKey = X->H->hasEmptyKey;
+  Y.H->count = X->H->hasEmptyKey;
+  for (i=0; i<X->H->capacity; i++) {
+    ab_slot_t *S = &X->T[i];
+    if (!SLOT_EMPTY(S))
+      abidx_insert(&Y, (s64)(((u64)S->a1 << 32) | S->a0), S->b);
+  }
+  abidx_unmap(X);
+#ifdef ABIDX_MMAP
+  if (rename(newName, X->fName)) {
+    fprintf(stderr, "abidx_grow() : Could not rename %s to %s!\n", newName, X->fName);
+    abidx_unmap(&Y);
+    return -1;
+  }
+#endif
+  *X = Y;
+  return 0;
+}
+
+/*********************************************************************/
+int abidx_lookup(ab_index_t *X, s64 a, s32 b)
+/*********************************************************************/
+{ s64 h;
+  u32 a0 = (u32)a, a1 = (u32)((u64)a >> 32);
+  ab_slot_t *S;
+
+  if ((a == -1) && (b == -1))
+    return X->H->hasEmptyKey;
+  for (h = abidx_hash(a, b) & X->mask; ; h = (h+1) & X->mask) {
+    S = &X->T[h];
+    if (SLOT_EMPTY(S))
+      return 0;
+    if ((S->a0 == a0) && (S->a1 == a1) && (S->b == b))
+      return 1;
+  }
+}
+
+/*********************************************************************/
+int abidx_insert(ab_index_t *X, s64 a, s32 b)
+/*********************************************************************/
+{ s64 h;
+  u32 a0 = (u32)a, a1 = (u32)((u64)a >> 32);
+  ab_slot_t *S;
+
+  if ((a == -1) && (b == -1)) {
+    if (X->H->hasEmptyKey)
+      return 1;
+    X->H->hasEmptyKey = 1;
+    X->H->count++;
+    return 0;
+  }
+  for (h = abidx_hash(a, b) & X->mask; ; h = (h+1) & X->mask) {
+    S = &X->T[h];
+    if (SLOT_EMPTY(S))
+      break;
+    if ((S->a0 == a0) && (S->a1 == a1) && (S->b == b))
+      return 1;
+  }
+  S->a0 = a0; S->a1 = a1; S->b = b;
+  X->H->count++;
+  if (ABIDX_FULL(X->H->capacity, X->H->count) && abidx_grow(X)) {
+    fprintf(stderr, "abidx_insert() : Could not grow the (a,b) index!\n");
+    exit(-1);
+  }
+  return 0;
+}
+
+/*********************************************************************/
+static int abidx_build(ab_index_t *X, multi_file_t *prelF)
+/*********************************************************************/
+/* Build the index from scratch, from the processed files.           */
+/*********************************************************************/
+{ char     prelName[sizeof(prelF->prefix) + 16];
+  s64      total=0, capacity;
+  s32      loc, relsInFile;
+  u32      r;
+  u32      s;
+  int      i;
+  rel_list *RL;
+  FILE    *fp;
+
+  for (i=0; i<prelF->numFiles; i++) {
+    sprintf(prelName, "%s.%d", prelF->prefix, i);
+    if ((fp = fopen(prelName, "rb"))) {
+      if (fread(&relsInFile, sizeof(s32), 1, fp) == 1)
+        total += relsInFile;
+      fclose(fp);
+    }
+  }
+  for (capacity = ABIDX_MIN_CAPACITY; ABIDX_FULL(capacity, 2*total); capacity *= 2) ;
+  if (abidx_map(X, X->fName, capacity))
+    return -1;
+
+  printf("Building (a,b) index %s...", X->fName); fflush(stdout);
+  for (i=0; i<prelF->numFiles; i++) {
+    printf("%d..", i); fflush(stdout);
+    if (!(RL = getRelList(prelF, i)))
+      continue;
+    for (r=0; r<RL->numRels; r++) {
+      loc = RL->relIndex[r];
+      s = RL->relData[loc];
+      X->H->numLP[GETNUMLRP(s)+GETNUMLAP(s)] += 1;
+      abidx_insert(X, *((s64 *)&RL->relData[loc+1]), RL->relData[loc+3]);
+    }
+    clearRelList(RL);
+    free(RL);
+  }
+  printf("\n");
+  return 0;
+}
+
+/*********************************************************************/
+int abidx_open(ab_index_t *X, multi_file_t *prelF)
+/*********************************************************************/
+{
+  if (prelF->numFiles > ABIDX_MAX_FILES) {
+    fprintf(stderr, "abidx_open() : Too many processed files (%d)!\n", prelF->numFiles);
+    return -1;
+  }
+  if (strlen(prelF->prefix) + strlen(ABIDX_SUFFIX) + 2 > sizeof(X->fName)) {
+    fprintf(stderr, "abidx_open() : The file prefix is too long!\n");
+    return -1;
+  }
+  sprintf(X->fName, "%.*s.%s", (int)(sizeof(X->fName) - sizeof(ABIDX_SUFFIX) - 1),
+          prelF->prefix, ABIDX_SUFFIX);
+  X->H = NULL;
+  if (abidx_load(X) == 0) {
+    if (abidx_filesMatch(X, prelF)) {
+      printf("Loaded (a,b) index %s: %" PRId64 " pairs.\n", X->fName, X->H->count);
+    } else {
+      printf("(a,b) index %s is out of date.\n", X->fName);
+      abidx_unmap(X);
+    }
+  }
+  if ((X->H == NULL) && abidx_build(X, prelF))
+    return -1;
+  /* Until abidx_close(), the index may not match the files. */
+  X->H->clean = 0;
+#ifdef ABIDX_MMAP
+  msync((void *)X->H, sizeof(ab_index_hdr_t), MS_SYNC);
+#endif
+  return 0;
+}
+
+/*********************************************************************/
+void abidx_close(ab_index_t *X, multi_file_t *prelF, long *numLP)
+/*********************************************************************/
+{ int   i;
+
+  if (X->H == NULL) return;
+  X->H->numFiles = prelF->numFiles;
+  prelF_fileState(prelF, X->H->fileSize, X->H->fileRels);
+  if (numLP)
+    for (i=0; i<8; i++)
+      X->H->numLP[i] = numLP[i];
+#ifdef ABIDX_MMAP
+  msync((void *)X->H, X->mapSize, MS_SYNC);
+#endif
+  /* Only now that the table is on disk, mark it as good. */
+  X->H->clean = 1;
+#ifdef ABIDX_MMAP
+  msync((void *)X->H, sizeof(ab_index_hdr_t), MS_SYNC);
+#endif
+  abidx_unmap(X);
+}
@@ -0,0 +1,101 @@
+/**************************************************************/
+/* abindex.h                                                  */
+/* A persistent index of the (a,b) pairs that procrels has    */
+/* seen, kept in a file next to the processed relation files. */
+/**************************************************************/
+/*  This file is part of GGNFS.
+*
+*   GGNFS is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   GGNFS is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with GGNFS; if not, write to the Free Software
+*   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#ifndef __ABINDEX_H__
+#define __ABINDEX_H__
+#include "ggnfs.h"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+/* The index file is <prel prefix>.abidx. */
+#define ABIDX_SUFFIX     "abidx"
+#define ABIDX_VERSION    1
+#define ABIDX_MAX_FILES  256
+
+/* The file header, padded to 4096 bytes. The table of slots follows. */
+typedef struct {
+  char  magic[8];
+  s32   version;
+  s32   clean;        /* Nonzero if the table is in sync with the files. */
+  s64   capacity;     /* Number of slots; a power of 2.                  */
+  s64   count;        /* Number of (a,b) pairs in the table.             */
+  s32   numFiles;
+  s32   hasEmptyKey;  /* The pair used to mark empty slots is in the set. */
+  s64   numLP[8];     /* Processed relations, by number of large primes.  */
+  s64   fileSize[ABIDX_MAX_FILES];
+  s32   fileRels[ABIDX_MAX_FILES];
+  char  pad[4096 - 40 - 8*8 - ABIDX_MAX_FILES*(8+4)];
+} ab_index_hdr_t;
+
+/* An (a,b) pair. 'a' is split so a slot is 12 bytes. */
+typedef struct {
+  u32  a0, a1;
+  s32  b;
+} ab_slot_t;
+
+typedef struct {
+  char            fName[512];
+  ab_index_hdr_t *H;
+  ab_slot_t      *T;
+  s64             mask;
+  size_t          mapSize;
+  int             fd;
+} ab_index_t;
+
+/*********************************************************************/
+/* Open the index for the processed files 'prelF'. If it is missing, */
+/* or does not match the files (e.g., they were rewritten, or the    */
+/* last run did not finish), it is rebuilt from them.                */
+/* Return value: 0 on success, nonzero on error.                     */
+/*********************************************************************/
+int abidx_open(ab_index_t *X, multi_file_t *prelF);
+
+/*********************************************************************/
+/* Add (a,b) to the index. Return value: 0 if it was not there       */
+/* before, 1 if it was.                                              */
+/*********************************************************************/
+int abidx_insert(ab_index_t *X, s64 a, s32 b);
+
+/*********************************************************************/
+/* Is (a,b) in the index?                                            */
+/*********************************************************************/
+int abidx_lookup(ab_index_t *X, s64 a, s32 b);
+
+/*********************************************************************/
+/* Get the size and the relation count of each processed file (0 for */
+/* a missing one), to tell whether an index built from the files is  */
+/* still in sync with them.                                          */
+/*********************************************************************/
+void prelF_fileState(multi_file_t *prelF, s64 *fileSize, s32 *fileRels);
+
+/*********************************************************************/
+/* Record the current state of the processed files and the large     */
+/* prime counts 'numLP' (may be NULL) in the index, and close it.    */
+/*********************************************************************/
+void abidx_close(ab_index_t *X, multi_file_t *prelF, long *numLP);
+
+#if defined (__cplusplus)
+};
+#endif
+
+#endif /* __ABINDEX_H__ */
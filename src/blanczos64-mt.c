@@ -0,0 +1,382 @@
+/**************************************************************/
+/* blanczos64-mt.c                                            */
+/* Threaded versions of the block Lanczos matrix multiplies   */
+/* and of the n x 64 helpers. These are called from           */
+/* blanczos64.c/blanczos64-no-mmx.c when a thread pool has    */
+/* been started with thr_init().                              */
+/**************************************************************/
+/*  This file is part of GGNFS.
+*
+*   GGNFS is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   GGNFS is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with GGNFS; if not, write to the Free Software
+*   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ggnfs.h"
+#include "thrpool.h"
+
+/* Private product vectors of the other threads for MultB64_mt(),
+   the column split of the matrix they were made for, and the
+   lookup tables for the dense blocks in MultB_T64_mt().
+*/
+static nfs_sparse_mat_t *mt_M = NULL;
+static s32   mt_numCols = 0, mt_numThreads = 0;
+static s32   mt_split[THR_MAX_THREADS + 1];
+static u64  *mt_partial[THR_MAX_THREADS];
+static u64  *mt_dense = NULL, *mt_table = NULL;
+
+typedef struct {
+  u64 *c, *a, *b;
+  s32  n;
+  u64 *w;
+} mt_job_t;
+
+typedef struct {
+  u64 *Product, *x;
+  nfs_sparse_mat_t *M;
+} mt_mult_t;
+
+/*********************************************************************/
+static void mt_free(void)
+/*********************************************************************/
+{ int i;
+
+  for (i=1; i<mt_numThreads; i++)
+    free(mt_partial[i]);
+  mt_numThreads = 0;
+  mt_M = NULL;
+}
+
+/*********************************************************************/
+static int mt_setup(nfs_sparse_mat_t *M)
+/*********************************************************************/
+/* Split the columns of M among the threads so that each thread gets */
+/* about the same number of nonzero entries, and allocate the        */
+/* private product vectors. Done once per matrix.                    */
+/*********************************************************************/
+{ int nt = thr_numThreads(), t;
+  s32 i, weight;
+
+  if ((M == mt_M) && (M->numCols == mt_numCols) && (nt == mt_numThreads))
+    return 0;
+  mt_free();
+  for (i=1; i<nt; i++) {
+    if (!(mt_partial[i] = (u64 *)malloc(M->numCols*sizeof(u64)))) {
+      fprintf(stderr, "mt_setup(): Memory allocation error!\n");
+      mt_numThreads = i;
+      mt_free();
+      return -1;
+    }
+  }
+  weight = M->cIndex[M->numCols];
+  mt_split[0] = 0;
+  for (t=1, i=0; t<nt; t++) {
+    while ((i < M->numCols) && ((s64)M->cIndex[i]*nt < (s64)weight*t))
+      i++;
+    mt_split[t] = i;
+  }
+  mt_split[nt] = M->numCols;
+  mt_M = M;
+  mt_numCols = M->numCols;
+  mt_numThreads = nt;
+  return 0;
+}
+
+/*********************************************************************/
+static void mt_build_table(u64 *w, u64 *b)
+/*********************************************************************/
+/* w[256*j + v] <-- XOR of the b[8*j+k] for which bit k of v is set. */
+/*********************************************************************/
+{ int j, v, k;
+
+  for (j=0; j<8; j++, w += 256, b += 8) {
+    w[0] = 0;
+    for (k=0; k<8; k++)
+      for (v=0; v < (1<<k); v++)
+        w[(1<<k) + v] = w[v] ^ b[k];
+  }
+}
+
+/*********************************************************************/
+static void mt_finish_table(u64 *c, u64 *w)
+/*********************************************************************/
+/* The inverse of mt_build_table(): c[8*j+k] <-- XOR of the w[256*j+v]*/
+/* for which bit k of v is set.                                       */
+/*********************************************************************/
+{ int j, v, k;
+  u64 t;
+
+  for (j=0; j<8; j++, w += 256, c += 8) {
+    for (k=0; k<8; k++) {
+      t = 0;
+      for (v=0; v<256; v++)
+        if (v & (1<<k))
+          t ^= w[v];
+      c[k] = t;
+    }
+  }
+}
+
+/*********************************************************************/
+static void multT_job(void *arg, int thread, int numThreads)
+/*********************************************************************/
+{ mt_job_t *J = (mt_job_t *)arg;
+  u64 w[2048], *a = J->a, *b = J->b;
+  s32 i, lo, hi;
+  u32 t;
+
+  thr_range(&lo, &hi, J->n, thread, numThreads);
+  memset(w, 0, sizeof(w));
+  for (i=lo; i<hi; i++) {
+    u64 u = b[i];
+    t = (u32)a[i];
+    w[t & 255] ^= u;
+    w[256 + ((t >> 8) & 255)] ^= u;
+    w[512 + ((t >> 16) & 255)] ^= u;
+    w[768 + (t >> 24)] ^= u;
+    t = (u32)(a[i] >> 32);
+    w[1024 + (t & 255)] ^= u;
+    w[1280 + ((t >> 8) & 255)] ^= u;
+    w[1536 + ((t >> 16) & 255)] ^= u;
+    w[1792 + (t >> 24)] ^= u;
+  }
+  mt_finish_table(J->w + 64*thread, w);
+}
+
+/*********************************************************************/
+void multT_mt(u64 *c, u64 *a, u64 *b, s32 n)
+/*********************************************************************/
+/* c <-- (a^T)b, where a and b are n x 64 and c is 64 x 64.          */
+/*********************************************************************/
+{ mt_job_t J;
+  u64 res[64*THR_MAX_THREADS];
+  int nt = thr_numThreads(), i, t;
+
+  J.a = a; J.b = b; J.n = n; J.w = res;
+  thr_run(multT_job, &J);
+  for (i=0; i<64; i++) {
+    u64 r = res[i];
+    for (t=1; t<nt; t++)
+      r ^= res[64*t + i];
+    c[i] = r;
+  }
+}
+
+/*********************************************************************/
+static void multnx64_job(void *arg, int thread, int numThreads)
+/*********************************************************************/
+{ mt_job_t *J = (mt_job_t *)arg;
+  u64 *w = J->w, *a = J->a, *c = J->c;
+  s32 i, lo, hi;
+
+  thr_range(&lo, &hi, J->n, thread, numThreads);
+  for (i=lo; i<hi; i++) {
+    u64 t = a[i];
+    c[i] = w[t & 255] ^ w[256 + ((t >> 8) & 255)] ^
+           w[512 + ((t >> 16) & 255)] ^ w[768 + ((t >> 24) & 255)] ^
+           w[1024 + ((t >> 32) & 255)] ^ w[1280 + ((t >> 40) & 255)] ^
+           w[1536 + ((t >> 48) & 255)] ^ w[1792 + (t >> 56)];
+  }
+}
+
+/*********************************************************************/
+static void addmultnx64_job(void *arg, int thread, int numThreads)
+/*********************************************************************/
+{ mt_job_t *J = (mt_job_t *)arg;
+  u64 *w = J->w, *a = J->a, *c = J->c;
+  s32 i, lo, hi;
+
+  thr_range(&lo, &hi, J->n, thread, numThreads);
+  for (i=lo; i<hi; i++) {
+    u64 t = a[i];
+    c[i] ^= w[t & 255] ^ w[256 + ((t >> 8) & 255)] ^
+            w[512 + ((t >> 16) & 255)] ^ w[768 + ((t >> 24) & 255)] ^
+            w[1024 + ((t >> 32) & 255)] ^ w[1280 + ((t >> 40) & 255)] ^
+            w[1536 + ((t >> 48) & 255)] ^ w[1792 + (t >> 56)];
+  }
+}
+
+/*********************************************************************/
+void multnx64_mt(u64 *c, u64 *a, u64 *b, s32 n)
+/*********************************************************************/
+/* c <-- ab, where a and c are n x 64 and b is 64 x 64.              */
+/*********************************************************************/
+{ mt_job_t J;
+  u64 w[2048];
+
+  mt_build_table(w, b);
+  J.c = c; J.a = a; J.n = n; J.w = w;
+  thr_run(multnx64_job, &J);
+}
+
+/*********************************************************************/
+void addmultnx64_mt(u64 *c, u64 *a, u64 *b, s32 n)
+/*********************************************************************/
+/* c <-- c + ab, where a and c are n x 64 and b is 64 x 64.          */
+/*********************************************************************/
+{ mt_job_t J;
+  u64 w[2048];
+
+  mt_build_table(w, b);
+  J.c = c; J.a = a; J.n = n; J.w = w;
+  thr_run(addmultnx64_job, &J);
+}
+
+/*********************************************************************/
+static void MultB64_scatter_job(void *arg, int thread, int numThreads)
+/*********************************************************************/
+/* Each thread scatters its own columns into a private vector (thread*/
+/* 0 uses Product itself).                                           */
+/*********************************************************************/
+{ mt_mult_t *J = (mt_mult_t *)arg;
+  nfs_sparse_mat_t *M = J->M;
+  u64 *Product = (thread == 0) ? J->Product : mt_partial[thread];
+  u64 *x = J->x;
+  s32 *p, *s;
+  s32  i;
+
+  (void)numThreads;
+  memset(Product, 0, M->numCols*sizeof(u64));
+  p = M->cEntry + M->cIndex[mt_split[thread]];
+  for (i=mt_split[thread]; i<mt_split[thread+1]; i++) {
+    u64 t = x[i];
+    s = p + ((M->cIndex[i + 1] - M->cIndex[i]) & -8);
+    for (; p < s; p += 8) {
+      Product[p[0]] ^= t;
+      Product[p[1]] ^= t;
+      Product[p[2]] ^= t;
+      Product[p[3]] ^= t;
+      Product[p[4]] ^= t;
+      Product[p[5]] ^= t;
+      Product[p[6]] ^= t;
+      Product[p[7]] ^= t;
+    }
+    s = M->cEntry + M->cIndex[i + 1];
+    for (; p < s; p++)
+      Product[p[0]] ^= t;
+  }
+}
+
+/*********************************************************************/
+static void MultB64_reduce_job(void *arg, int thread, int numThreads)
+/*********************************************************************/
+{ mt_mult_t *J = (mt_mult_t *)arg;
+  u64 *Product = J->Product;
+  s32  i, lo, hi;
+  int  t;
+
+  thr_range(&lo, &hi, J->M->numCols, thread, numThreads);
+  for (t=1; t<numThreads; t++) {
+    u64 *q = mt_partial[t];
+    for (i=lo; i<hi; i++)
+      Product[i] ^= q[i];
+  }
+}
+
+/*********************************************************************/
+void MultB64_mt(u64 *Product, u64 *x, void *P)
+/*********************************************************************/
+{ nfs_sparse_mat_t *M = (nfs_sparse_mat_t *)P;
+  mt_mult_t J;
+  u64 *d;
+  int  i, j;
+
+  if (mt_setup(M)) {
+    fprintf(stderr, "MultB64_mt(): giving up.\n");
+    exit(-1);
+  }
+  if (M->numDenseBlocks) {
+    if (!(d = (u64 *)realloc(mt_dense, 64*M->numDenseBlocks*sizeof(u64)))) {
+      fprintf(stderr, "MultB64_mt(): Memory allocation error!\n");
+      exit(-1);
+    }
+    mt_dense = d;
+    for (i=0; i<M->numDenseBlocks; i++)
+      multT_mt(mt_dense + 64*i, M->denseBlocks[i], x, M->numCols);
+  }
+  J.Product = Product; J.x = x; J.M = M;
+  thr_run(MultB64_scatter_job, &J);
+  thr_run(MultB64_reduce_job, &J);
+  for (i=0; i<M->numDenseBlocks; i++) {
+    d = Product + M->denseBlockIndex[i];
+    for (j=0; j<64; j++)
+      d[j] ^= mt_dense[64*i + j];
+  }
+}
+
+/*********************************************************************/
+static void MultB_T64_job(void *arg, int thread, int numThreads)
+/*********************************************************************/
+{ mt_mult_t *J = (mt_mult_t *)arg;
+  nfs_sparse_mat_t *M = J->M;
+  u64 *Product = J->Product, *x = J->x, *w;
+  s32 *p, *s;
+  s32  i;
+  int  k;
+
+  (void)numThreads;
+  p = M->cEntry + M->cIndex[mt_split[thread]];
+  for (i=mt_split[thread]; i<mt_split[thread+1]; i++) {
+    u64 t = 0;
+    for (k=0, w=mt_table; k<M->numDenseBlocks; k++, w += 2048) {
+      u64 a = M->denseBlocks[k][i];
+      t ^= w[a & 255] ^ w[256 + ((a >> 8) & 255)] ^
+           w[512 + ((a >> 16) & 255)] ^ w[768 + ((a >> 24) & 255)] ^
+           w[1024 + ((a >> 32) & 255)] ^ w[1280 + ((a >> 40) & 255)] ^
+           w[1536 + ((a >> 48) & 255)] ^ w[1792 + (a >> 56)];
+    }
+    s = p + ((M->cIndex[i + 1] - M->cIndex[i]) & -8);
+    for (; p < s; p += 8) {
+      t ^= x[p[0]];
+      t ^= x[p[1]];
+      t ^= x[p[2]];
+      t ^= x[p[3]];
+      t ^= x[p[4]];
+      t ^= x[p[5]];
+      t ^= x[p[6]];
+      t ^= x[p[7]];
+    }
+    s = M->cEntry + M->cIndex[i + 1];
+    for (; p < s; p++)
+      t ^= x[p[0]];
+    Product[i] = t;
+  }
+}
+
+/*********************************************************************/
+void MultB_T64_mt(u64 *Product, u64 *x, void *P)
+/*********************************************************************/
+{ nfs_sparse_mat_t *M = (nfs_sparse_mat_t *)P;
+  mt_mult_t J;
+  u64 *w;
+  int  i;
+
+  if (mt_setup(M)) {
+    fprintf(stderr, "MultB_T64_mt(): giving up.\n");
+    exit(-1);
+  }
+  if (M->numDenseBlocks) {
+    if (!(w = (u64 *)realloc(mt_table, 2048*M->numDenseBlocks*sizeof(u64)))) {
+      fprintf(stderr, "MultB_T64_mt(): Memory allocation error!\n");
+      exit(-1);
+    }
+    mt_table = w;
+    for (i=0; i<M->numDenseBlocks; i++)
+      mt_build_table(mt_table + 2048*i, x + M->denseBlockIndex[i]);
+  }
+  J.Product = Product; J.x = x; J.M = M;
+  thr_run(MultB_T64_job, &J);
+}
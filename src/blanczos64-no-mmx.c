@@ -24,6 +24,7 @@
 #include <string.h>
 #include "ggnfs.h"
 #include "prand.h"
+#include "thrpool.h"
 
 
 #ifdef __GNUC__
@@ -181,6 +182,14 @@ int testMult(nfs_sparse_mat_t *P)
 
 void MultB64(u64 *Product, u64 *x, void *P) {
   nfs_sparse_mat_t *M = (nfs_sparse_mat_t *)P;
+  if (tiled_isActive(M)) {
+    MultB64_tiled(Product, x, P);
+    return;
+  }
+  if (thr_numThreads() > 1) {
+    MultB64_mt(Product, x, P);
+    return;
+  }
   memset(Product, 0, M->numCols * sizeof(u64)); 
   {
     int i;
@@ -260,6 +269,14 @@ void MultB64(u64 *Product, u64 *x, void *P) {
 
 void MultB_T64(u64 *Product, u64 *x, void *P) {
   nfs_sparse_mat_t *M = (nfs_sparse_mat_t *)P;
+  if (tiled_isActive(M)) {
+    MultB_T64_tiled(Product, x, P);
+    return;
+  }
+  if (thr_numThreads() > 1) {
+    MultB_T64_mt(Product, x, P);
+    return;
+  }
   memset(Product, 0, M->numCols * sizeof(u64));
   {
     int i;
@@ -683,6 +700,10 @@ SHORT_CIRC_STOP:
 u64 mult_w[2048] ALIGNED16;
 
 void multT(u64 *c, u64 *a, u64 *b, s32 n) {
+  if ((n >= BL_MT_MIN_N) && (thr_numThreads() > 1)) {
+    multT_mt(c, a, b, n);
+    return;
+  }
   memset(mult_w, 0, sizeof(u64) * 256 * 8);
   {
     int i;
@@ -1528,6 +1549,10 @@ void preMult(u64 *A, u64 *B)
   
 void multnx64(u64 *c, u64 *a, u64 *b, s32 n) {
   int i, j;
+  if ((n >= BL_MT_MIN_N) && (thr_numThreads() > 1)) {
+    multnx64_mt(c, a, b, n);
+    return;
+  }
   for (i = 0, j = 0; i < 64; i += 8, j += 256) {
     u64 b0 = b[i];
     u64 b1 = b[i + 1];
@@ -1808,6 +1833,10 @@ void multnx64(u64 *c, u64 *a, u64 *b, s32 n) {
 
 void addmultnx64(u64 *c, u64 *a, u64 *b, s32 n) {
   int i, j;
+  if ((n >= BL_MT_MIN_N) && (thr_numThreads() > 1)) {
+    addmultnx64_mt(c, a, b, n);
+    return;
+  }
   for (i = 0, j = 0; i < 64; i += 8, j += 256) {
     u64 b0 = b[i];
     u64 b1 = b[i + 1];
@@ -0,0 +1,473 @@
+/**************************************************************/
+/* blanczos64-tiled.c                                         */
+/* A cache-tiled copy of the sparse part of the matrix, for   */
+/* the block Lanczos multiplies. The matrix is cut into tiles */
+/* of dim x dim rows/columns, with dim chosen so that a piece */
+/* of x and a piece of the product fit in L2 together. Each   */
+/* tile holds its entries twice, with 16-bit offsets: grouped */
+/* by row (for Bx) and grouped by column (for (B^T)x). Both   */
+/* multiplies are then gathers: out[i] ^= XOR of in[j] over   */
+/* one group, which is done with the SIMD gather instructions */
+/* when the CPU has them.                                     */
+/**************************************************************/
+/*  This file is part of GGNFS.
+*
+*   GGNFS is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   GGNFS is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with GGNFS; if not, write to the Free Software
+*   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if !defined(_MSC_VER)
+#include <unistd.h>
+#endif
+#include "ggnfs.h"
+#include "thrpool.h"
+
+#if defined(__GNUC__) && defined(__x86_64__) && \
+    ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))
+#define TILED_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#define TILED_MAX_DIM 32768
+
+/* From the Lanczos file in use. */
+void multT(u64 *res, u64 *A, u64 *B, s32 n);
+void addmultnx64(u64 *C_n, u64 *A_n, u64 *B, s32 n);
+
+/* A group is stored as: index, count, then 'count' offsets. */
+typedef struct {
+  s32  r0, c0;           /* First row and column of the tile.    */
+  s64  rowOfs, colOfs;   /* Where its row and column groups are. */
+  s32  rowLen, colLen;   /* Their lengths, in u16's.             */
+} tile_t;
+
+typedef void (* TILE_KERNEL_PTR)(u64 *out, const u64 *in, const u16 *p, const u16 *end);
+
+static nfs_sparse_mat_t *tl_M = NULL;
+static s32     tl_dim, tl_shift, tl_nrb, tl_ncb;
+static tile_t *tl_tiles = NULL;
+static u16    *tl_data = NULL;
+static s64     tl_dataLen = 0;
+static s64    *tl_rowWt = NULL, *tl_colWt = NULL; /* Cumulative weights. */
+static int     tl_kernel = TILED_KERNEL_SCALAR;
+static TILE_KERNEL_PTR tl_kern = NULL;
+
+typedef struct {
+  u64 *Product, *x;
+} tl_job_t;
+
+/*********************************************************************/
+static void tile_scalar(u64 *out, const u64 *in, const u16 *p, const u16 *end)
+/*********************************************************************/
+{ const u16 *s, *e;
+  u64 t;
+
+  while (p < end) {
+    s = p + 2;
+    e = s + p[1];
+    t = 0;
+    for (; s+4 <= e; s += 4)
+      t ^= in[s[0]] ^ in[s[1]] ^ in[s[2]] ^ in[s[3]];
+    for (; s < e; s++)
+      t ^= in[*s];
+    out[p[0]] ^= t;
+    p = e;
+  }
+}
+
+#ifdef TILED_X86_SIMD
+/*********************************************************************/
+__attribute__((target("avx2")))
+static void tile_avx2(u64 *out, const u64 *in, const u16 *p, const u16 *end)
+/*********************************************************************/
+{ const u16 *s, *e;
+  __m256i acc;
+  __m128i h;
+  u64 t;
+
+  while (p < end) {
+    s = p + 2;
+    e = s + p[1];
+    t = 0;
+    if (p[1] >= 8) {
+      acc = _mm256_setzero_si256();
+      for (; s+4 <= e; s += 4) {
+        __m128i idx = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)s));
+        acc = _mm256_xor_si256(acc, _mm256_i32gather_epi64((const long long *)in, idx, 8));
+      }
+      h = _mm_xor_si128(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+      t = (u64)_mm_cvtsi128_si64(h) ^ (u64)_mm_extract_epi64(h, 1);
+    }
+    for (; s < e; s++)
+      t ^= in[*s];
+    out[p[0]] ^= t;
+    p = e;
+  }
+}
+
+/*********************************************************************/
+__attribute__((target("avx512f,avx2")))
+static void tile_avx512(u64 *out, const u64 *in, const u16 *p, const u16 *end)
+/*********************************************************************/
+{ const u16 *s, *e;
+  __m512i acc;
+  __m256i h4;
+  __m128i h2;
+  u64 t;
+
+  while (p < end) {
+    s = p + 2;
+    e = s + p[1];
+    t = 0;
+    if (p[1] >= 16) {
+      acc = _mm512_setzero_si512();
+      for (; s+8 <= e; s += 8) {
+        __m256i idx = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)s));
+        acc = _mm512_xor_si512(acc, _mm512_i32gather_epi64(idx, (const void *)in, 8));
+      }
+      h4 = _mm256_xor_si256(_mm512_castsi512_si256(acc), _mm512_extracti64x4_epi64(acc, 1));
+      h2 = _mm_xor_si128(_mm256_castsi256_si128(h4), _mm256_extracti128_si256(h4, 1));
+      t = (u64)_mm_cvtsi128_si64(h2) ^ (u64)_mm_extract_epi64(h2, 1);
+    }
+    for (; s < e; s++)
+      t ^= in[*s];
+    out[p[0]] ^= t;
+    p = e;
+  }
+}
+#endif
+
+/*********************************************************************/
+const char *tiled_kernelName(int kernel)
+/*********************************************************************/
+{
+  switch (kernel) {
+    case TILED_KERNEL_SCALAR: return "scalar";
+    case TILED_KERNEL_AVX2:   return "AVX2";
+    case TILED_KERNEL_AVX512: return "AVX-512";
+  }
+  return "unknown";
+}
+
+/*********************************************************************/
+int tiled_kernelSupported(int kernel)
+/*********************************************************************/
+{
+  switch (kernel) {
+    case TILED_KERNEL_SCALAR: return 1;
+#ifdef TILED_X86_SIMD
+    case TILED_KERNEL_AVX2:   return __builtin_cpu_supports("avx2");
+    case TILED_KERNEL_AVX512: return __builtin_cpu_supports("avx512f") &&
+                                     __builtin_cpu_supports("avx2");
+#endif
+  }
+  return 0;
+}
+
+/*********************************************************************/
+int tiled_setKernel(int kernel)
+/*********************************************************************/
+/* Select the kernel, or the best one the CPU can run if 'kernel' is */
+/* TILED_KERNEL_AUTO. Returns the kernel selected, or -1 if the one  */
+/* asked for is not supported.                                       */
+/*********************************************************************/
+{
+  if (kernel == TILED_KERNEL_AUTO) {
+    for (kernel = TILED_KERNEL_AVX512; kernel > TILED_KERNEL_SCALAR; kernel--)
+      if (tiled_kernelSupported(kernel))
+        break;
+  }
+  if (!tiled_kernelSupported(kernel))
+    return -1;
+  tl_kernel = kernel;
+  tl_kern = tile_scalar;
+#ifdef TILED_X86_SIMD
+  if (kernel == TILED_KERNEL_AVX2)   tl_kern = tile_avx2;
+  if (kernel == TILED_KERNEL_AVX512) tl_kern = tile_avx512;
+#endif
+  return kernel;
+}
+
+/*********************************************************************/
+static s32 tiled_defaultDim(void)
+/*********************************************************************/
+/* A piece of x and a piece of the product, dim words each, should   */
+/* take no more than half of L2.                                     */
+/*********************************************************************/
+{ long l2 = 0;
+
+#if defined(_SC_LEVEL2_CACHE_SIZE)
+  l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+#if defined(L2_CACHE_SIZE) && (L2_CACHE_SIZE > 0)
+  if (l2 <= 0) l2 = L2_CACHE_SIZE*1024;
+#endif
+  if (l2 <= 0) l2 = 256*1024;
+  return (s32)MIN(TILED_MAX_DIM, l2/(4*sizeof(u64)));
+}
+
+/*********************************************************************/
+static int cmpU32(const void *a, const void *b)
+/*********************************************************************/
+{ u32 A = *(const u32 *)a, B = *(const u32 *)b;
+
+  return (A < B) ? -1 : (A > B);
+}
+
+/*********************************************************************/
+static int tl_emit(u32 *pairs, s32 n, s64 *size)
+/*********************************************************************/
+/* Append the groups for 'pairs' (sorted on the high half) to        */
+/* tl_data. The high half of each pair is the group index and the    */
+/* low half the offset.                                              */
+/*********************************************************************/
+{ s32 i, j;
+  u16 *d;
+
+  if (tl_dataLen + 3*(s64)n > *size) {
+    *size = MAX(2*(*size), tl_dataLen + 3*(s64)n);
+    if (!(d = (u16 *)realloc(tl_data, *size*sizeof(u16)))) {
+      fprintf(stderr, "tiled_init(): Memory allocation error!\n");
+      return -1;
+    }
+    tl_data = d;
+  }
+  for (i=0; i<n; i=j) {
+    u32 g = pairs[i] >> 16;
+    for (j=i; (j<n) && ((pairs[j] >> 16) == g); j++)
+      tl_data[tl_dataLen + 2 + j-i] = (u16)(pairs[j] & 0xFFFF);
+    tl_data[tl_dataLen] = (u16)g;
+    tl_data[tl_dataLen+1] = (u16)(j-i);
+    tl_dataLen += 2 + j-i;
+  }
+  return 0;
+}
+
+/*********************************************************************/
+void tiled_clear(void)
+/*********************************************************************/
+{
+  if (tl_tiles) free(tl_tiles);
+  if (tl_data) free(tl_data);
+  if (tl_rowWt) free(tl_rowWt);
+  if (tl_colWt) free(tl_colWt);
+  tl_tiles = NULL; tl_data = NULL; tl_rowWt = tl_colWt = NULL;
+  tl_dataLen = 0;
+  tl_M = NULL;
+}
+
+/*********************************************************************/
+int tiled_init(nfs_sparse_mat_t *M, s32 dim)
+/*********************************************************************/
+/* Build the tiled copy of M, with tiles of dim x dim (or a size     */
+/* chosen from the L2 cache size, if dim <= 0). After this, MultB64  */
+/* and MultB_T64 use it whenever they are called with M.             */
+/*********************************************************************/
+{ s64  numTiles, t, *start, *pos, size;
+  u32 *pairs, *cnt;
+  s32  c, r, i, rb, cb, n;
+
+  tiled_clear();
+  if (dim <= 0) dim = tiled_defaultDim();
+  for (tl_shift=10; ((1<<(tl_shift+1)) <= dim) && ((1<<tl_shift) < TILED_MAX_DIM); tl_shift++) ;
+  tl_dim = 1<<tl_shift;
+  tl_nrb = (M->numRows + tl_dim-1) >> tl_shift;
+  tl_ncb = (M->numCols + tl_dim-1) >> tl_shift;
+  numTiles = (s64)tl_nrb*tl_ncb;
+
+  tl_tiles = (tile_t *)lxmalloc(numTiles*sizeof(tile_t), 1);
+  start = (s64 *)lxmalloc((numTiles+1)*sizeof(s64), 1);
+  cnt = (u32 *)lxmalloc(numTiles*sizeof(u32), 1);
+  memset(cnt, 0, numTiles*sizeof(u32));
+  for (c=0; c<M->numCols; c++) {
+    cb = c >> tl_shift;
+    for (i=M->cIndex[c]; i<M->cIndex[c+1]; i++)
+      cnt[(s64)(M->cEntry[i] >> tl_shift)*tl_ncb + cb]++;
+  }
+  for (t=0, start[0]=0; t<numTiles; t++)
+    start[t+1] = start[t] + cnt[t];
+  free(cnt);
+
+  /* Put the entries in their tiles, as (row << 16) | col. The   */
+  /* entries of a tile are then sorted by column, since they are */
+  /* added column by column.                                     */
+  pairs = (u32 *)lxmalloc((start[numTiles]+1)*sizeof(u32), 1);
+  pos = (s64 *)lxmalloc(numTiles*sizeof(s64), 1);
+  memcpy(pos, start, numTiles*sizeof(s64));
+  for (c=0; c<M->numCols; c++) {
+    cb = c >> tl_shift;
+    for (i=M->cIndex[c]; i<M->cIndex[c+1]; i++) {
+      r = M->cEntry[i];
+      pairs[pos[(s64)(r >> tl_shift)*tl_ncb + cb]++] =
+        ((u32)(r & (tl_dim-1)) << 16) | (u32)(c & (tl_dim-1));
+    }
+  }
+  free(pos);
+
+  size = 4*start[numTiles] + 1024;
+  if (!(tl_data = (u16 *)malloc(size*sizeof(u16)))) {
+    fprintf(stderr, "tiled_init(): Memory allocation error!\n");
+    free(pairs); free(start); tiled_clear();
+    return -1;
+  }
+  for (rb=0; rb<tl_nrb; rb++) {
+    for (cb=0; cb<tl_ncb; cb++) {
+      tile_t *T = &tl_tiles[(s64)rb*tl_ncb + cb];
+      u32 *P = pairs + start[(s64)rb*tl_ncb + cb];
+
+      n = (s32)(start[(s64)rb*tl_ncb + cb + 1] - start[(s64)rb*tl_ncb + cb]);
+      T->r0 = rb << tl_shift;
+      T->c0 = cb << tl_shift;
+      /* Column groups: swap the halves so the column is on top. */
+      for (i=0; i<n; i++)
+        P[i] = (P[i] << 16) | (P[i] >> 16);
+      T->colOfs = tl_dataLen;
+      if (tl_emit(P, n, &size)) {
+        free(pairs); free(start); tiled_clear();
+        return -1;
+      }
+      T->colLen = (s32)(tl_dataLen - T->colOfs);
+      /* Row groups. */
+      for (i=0; i<n; i++)
+        P[i] = (P[i] << 16) | (P[i] >> 16);
+      qsort(P, n, sizeof(u32), cmpU32);
+      T->rowOfs = tl_dataLen;
+      if (tl_emit(P, n, &size)) {
+        free(pairs); free(start); tiled_clear();
+        return -1;
+      }
+      T->rowLen = (s32)(tl_dataLen - T->rowOfs);
+    }
+  }
+  free(pairs);
+  tl_data = (u16 *)realloc(tl_data, (tl_dataLen+1)*sizeof(u16));
+
+  /* Cumulative weights of the row and column blocks, for */
+  /* splitting the work between threads.                  */
+  tl_rowWt = (s64 *)lxmalloc((tl_nrb+1)*sizeof(s64), 1);
+  tl_colWt = (s64 *)lxmalloc((tl_ncb+1)*sizeof(s64), 1);
+  memset(tl_rowWt, 0, (tl_nrb+1)*sizeof(s64));
+  memset(tl_colWt, 0, (tl_ncb+1)*sizeof(s64));
+  for (rb=0; rb<tl_nrb; rb++)
+    for (cb=0; cb<tl_ncb; cb++) {
+      t = start[(s64)rb*tl_ncb + cb + 1] - start[(s64)rb*tl_ncb + cb];
+      tl_rowWt[rb+1] += t + 1;
+      tl_colWt[cb+1] += t + 1;
+    }
+  for (rb=0; rb<tl_nrb; rb++) tl_rowWt[rb+1] += tl_rowWt[rb];
+  for (cb=0; cb<tl_ncb; cb++) tl_colWt[cb+1] += tl_colWt[cb];
+  free(start);
+
+  if (tl_kern == NULL)
+    tiled_setKernel(TILED_KERNEL_AUTO);
+  tl_M = M;
+  return 0;
+}
+
+/*********************************************************************/
+int tiled_isActive(nfs_sparse_mat_t *M)
+/*********************************************************************/
+{
+  return (tl_M != NULL) && (tl_M == M);
+}
+
+/*********************************************************************/
+s32 tiled_dim(void)
+/*********************************************************************/
+{
+  return tl_dim;
+}
+
+/*********************************************************************/
+s64 tiled_memUse(void)
+/*********************************************************************/
+{
+  if (tl_M == NULL) return 0;
+  return tl_dataLen*sizeof(u16) + (s64)tl_nrb*tl_ncb*sizeof(tile_t);
+}
+
+/*********************************************************************/
+static void tl_split(s32 *lo, s32 *hi, s64 *cw, s32 nb, int thread, int numThreads)
+/*********************************************************************/
+/* Blocks [*lo, *hi) have about 1/numThreads of the weight in 'cw'.  */
+/*********************************************************************/
+{ s32 b;
+
+  for (b=0; (b < nb) && (cw[b]*numThreads < cw[nb]*thread); b++) ;
+  *lo = b;
+  for (; (b < nb) && (cw[b]*numThreads < cw[nb]*(thread+1)); b++) ;
+  *hi = (thread == numThreads-1) ? nb : b;
+}
+
+/*********************************************************************/
+static void tl_MultB_job(void *arg, int thread, int numThreads)
+/*********************************************************************/
+{ tl_job_t *J = (tl_job_t *)arg;
+  s32 rb, cb, lo, hi;
+
+  tl_split(&lo, &hi, tl_rowWt, tl_nrb, thread, numThreads);
+  for (rb=lo; rb<hi; rb++) {
+    tile_t *T = tl_tiles + (s64)rb*tl_ncb;
+    for (cb=0; cb<tl_ncb; cb++, T++)
+      tl_kern(J->Product + T->r0, J->x + T->c0, tl_data + T->rowOfs,
+              tl_data + T->rowOfs + T->rowLen);
+  }
+}
+
+/*********************************************************************/
+static void tl_MultB_T_job(void *arg, int thread, int numThreads)
+/*********************************************************************/
+{ tl_job_t *J = (tl_job_t *)arg;
+  s32 rb, cb, lo, hi;
+
+  tl_split(&lo, &hi, tl_colWt, tl_ncb, thread, numThreads);
+  for (cb=lo; cb<hi; cb++) {
+    for (rb=0; rb<tl_nrb; rb++) {
+      tile_t *T = tl_tiles + (s64)rb*tl_ncb + cb;
+      tl_kern(J->Product + T->c0, J->x + T->r0, tl_data + T->colOfs,
+              tl_data + T->colOfs + T->colLen);
+    }
+  }
+}
+
+/*********************************************************************/
+void MultB64_tiled(u64 *Product, u64 *x, void *P)
+/*********************************************************************/
+{ nfs_sparse_mat_t *M = (nfs_sparse_mat_t *)P;
+  tl_job_t J;
+  int i;
+
+  memset(Product, 0, M->numCols * sizeof(u64));
+  for (i = 0; i < M->numDenseBlocks; i++)
+    multT(Product + M->denseBlockIndex[i], M->denseBlocks[i], x, M->numCols);
+  J.Product = Product; J.x = x;
+  thr_run(tl_MultB_job, &J);
+}
+
+/*********************************************************************/
+void MultB_T64_tiled(u64 *Product, u64 *x, void *P)
+/*********************************************************************/
+{ nfs_sparse_mat_t *M = (nfs_sparse_mat_t *)P;
+  tl_job_t J;
+  int i;
+
+  memset(Product, 0, M->numCols * sizeof(u64));
+  for (i = 0; i < M->numDenseBlocks; i++)
+    addmultnx64(Product, M->denseBlocks[i], x + M->denseBlockIndex[i], M->numCols);
+  J.Product = Product; J.x = x;
+  thr_run(tl_MultB_T_job, &J);
+}
@@ -25,6 +25,7 @@
 
 #include "ggnfs.h"
 #include "prand.h"
+#include "thrpool.h"
 #include "blanczos64.h"
 
 /*************************************************************/ 
@@ -230,6 +231,14 @@ int testMult(nfs_sparse_mat_t *P)
 
 void MultB64(u64 *Product, u64 *x, void *P) {
   nfs_sparse_mat_t *M = (nfs_sparse_mat_t *)P;
+  if (tiled_isActive(M)) {
+    MultB64_tiled(Product, x, P);
+    return;
+  }
+  if (thr_numThreads() > 1) {
+    MultB64_mt(Product, x, P);
+    return;
+  }
   memset(Product, 0, M->numCols * sizeof(u64)); 
   {
     int i;
@@ -523,6 +532,14 @@ void MultB64(u64 *Product, u64 *x, void *P) {
 
 void MultB_T64(u64 *Product, u64 *x, void *P) {
   nfs_sparse_mat_t *M = (nfs_sparse_mat_t *)P;
+  if (tiled_isActive(M)) {
+    MultB_T64_tiled(Product, x, P);
+    return;
+  }
+  if (thr_numThreads() > 1) {
+    MultB_T64_mt(Product, x, P);
+    return;
+  }
   memset(Product, 0, M->numCols * sizeof(u64));
   {
     int i;
@@ -1165,6 +1182,10 @@ ALIGNED16(u64 mult_w[2048]);
 #endif
 
 void multT(u64 *c, u64 *a, u64 *b, s32 n) {
+    if ((n >= BL_MT_MIN_N) && (thr_numThreads() > 1)) {
+      multT_mt(c, a, b, n);
+      return;
+    }
     memset(mult_w, 0, sizeof(u64) * 256 * 8);
     #if defined(GGNFS_x86_32_ATTASM_MMX)
         asm volatile("\
@@ -3069,6 +3090,10 @@ void preMult(u64 *A, u64 *B)
 }
   
 void multnx64(u64 *c, u64 *a, u64 *b, s32 n) {
+    if ((n >= BL_MT_MIN_N) && (thr_numThreads() > 1)) {
+      multnx64_mt(c, a, b, n);
+      return;
+    }
     #if defined(GGNFS_x86_32_ATTASM_MMX)
         asm volatile("\
             xorl	%%eax, %%eax					\n\
@@ -3796,6 +3821,10 @@ void multnx64(u64 *c, u64 *a, u64 *b, s32 n) {
 }
 
 void addmultnx64(u64 *c, u64 *a, u64 *b, s32 n) {
+    if ((n >= BL_MT_MIN_N) && (thr_numThreads() > 1)) {
+      addmultnx64_mt(c, a, b, n);
+      return;
+    }
     #if defined(GGNFS_x86_32_ATTASM_MMX)
         asm volatile("\
             xorl	%%eax, %%eax					\n\
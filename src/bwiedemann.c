@@ -0,0 +1,917 @@
+/**************************************************************/
+/* bwiedemann.c                                               */
+/* Block Wiedemann (Coppersmith's algorithm), as an           */
+/* alternative to block Lanczos in matsolve. With A the       */
+/* matrix padded to n x n, c sequences of 64 columns each are */
+/*     a_i = (X^T)(A^i)(A R_j),  i = 0..L-1,                  */
+/* where X is m = 64c unit vectors and R_j is random. Each    */
+/* sequence is a separate job, checkpointed on its own, so it */
+/* can be run by a separate process (matsolve -bwjob j).      */
+/* A matrix Berlekamp-Massey step (an order basis, computed   */
+/* one term at a time) finds a generator F, and the solution  */
+/*     w = sum_j sum_k (A^k) R_j F_{k,j}                      */
+/* is again split into one job per sequence. A few more       */
+/* multiplies then take w into the kernel of A.               */
+/* All the multiplies go through the same MultB64() as block  */
+/* Lanczos, so they use the same SIMD/tiled/threaded kernels. */
+/**************************************************************/
+/*  This file is part of GGNFS.
+*
+*   GGNFS is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   GGNFS is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with GGNFS; if not, write to the Free Software
+*   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "ggnfs.h"
+#include "if.h"
+#include "prand.h"
+
+#define BW_MAGIC      0x4257464E
+#define BW_VERSION    2
+#define BW_INFO_NAME  "bw.info"
+#define BW_GEN_NAME   "bw.gen"
+/* Sequence terms beyond the n/m + n/64c the theory asks for. */
+#define BW_EXTRA      32
+/* Most multiplies by A it may take to get from w to the kernel. */
+#define BW_MAX_LEVELS 64
+
+/* The sequence files can be over 2GB, and long is 32 bits on Win64. */
+#ifdef _MSC_VER
+#define bw_fseek        _fseeki64
+typedef __int64         bw_off_t;
+#else
+#define bw_fseek        fseeko
+typedef off_t           bw_off_t;
+#endif
+
+/* In blanczos64.c; they use the thread pool when it is running. */
+void multnx64(u64 *C_n, u64 *A_n, u64 *B, s32 n);
+void addmultnx64(u64 *C_n, u64 *A_n, u64 *B, s32 n);
+
+typedef struct {
+  s32  n;          /* Dimension of A.                             */
+  s32  numSeqs;    /* c: each sequence is 64 columns of Y = AR.   */
+  u32  seed;
+  s32  L;          /* Terms in each sequence.                     */
+  s32  m;          /* 64c: the rows of X, and of each term.       */
+  s32 *xIdx;       /* X is the unit vectors e_xIdx[0], ...        */
+  s32  weight;     /* Weight of the sparse part of the matrix.    */
+  u32  hash;       /* Hash of the whole matrix.                   */
+} bw_info_t;
+
+/*********************************************************************/
+static void bw_transpose64(u64 *out, u64 *in)
+/*********************************************************************/
+/* out[b] bit a = in[a] bit b.                                       */
+/*********************************************************************/
+{ int a, b;
+
+  for (b=0; b<64; b++)
+    out[b] = 0;
+  for (a=0; a<64; a++)
+    for (b=0; b<64; b++)
+      out[b] |= ((in[a]>>b)&1) << a;
+}
+
+/*********************************************************************/
+static int bw_cmpU64(const void *a, const void *b)
+/*********************************************************************/
+{ u64 x = *(u64 *)a, y = *(u64 *)b;
+
+  if (x < y) return -1;
+  if (x > y) return 1;
+  return 0;
+}
+
+/*********************************************************************/
+static int bw_lowBit(u64 x)
+/*********************************************************************/
+{ int b=0;
+
+  while (!(x & BIT64(b))) b++;
+  return b;
+}
+
+/*********************************************************************/
+static void bw_randomBlock(u64 *R, s32 n, u32 seed, int j)
+/*********************************************************************/
+/* R_j depends only on the seed and j, so any process can make it.   */
+/*********************************************************************/
+{ s32 i;
+  u32 r1, r2;
+
+  prandseed(seed + 1000003*(j+1), 712*seed + 21283 + j, seed^0xF3C91D1A);
+  for (i=0; i<n; i++) {
+    r1 = prand(); r2 = prand();
+    R[i] = ((u64)r1) ^ (((u64)r2)<<32);
+  }
+}
+
+/*********************************************************************/
+static u32 bw_matHash(nfs_sparse_mat_t *M)
+/*********************************************************************/
+/* FNV-1a over the 32-bit words of the matrix: sizes, cIndex, cEntry */
+/* and the dense blocks.                                             */
+/*********************************************************************/
+{ u32 h=0x811C9DC5;
+  s32 i, j;
+
+#define BW_HASH(_x) h = (h ^ (u32)(_x))*0x01000193
+  BW_HASH(M->numRows);
+  BW_HASH(M->numCols);
+  for (i=0; i<=M->numCols; i++)
+    BW_HASH(M->cIndex[i]);
+  for (i=0; i<M->cIndex[M->numCols]; i++)
+    BW_HASH(M->cEntry[i]);
+  for (j=0; j<M->numDenseBlocks; j++) {
+    BW_HASH(M->denseBlockIndex[j]);
+    for (i=0; i<M->numCols; i++) {
+      BW_HASH(M->denseBlocks[j][i]);
+      BW_HASH(M->denseBlocks[j][i]>>32);
+    }
+  }
+#undef BW_HASH
+  return h;
+}
+
+/*********************************************************************/
+static int bw_writeInfo(bw_info_t *I)
+/*********************************************************************/
+/* The -bwjob processes trust bw.info, so it only replaces the old   */
+/* one once it has been written in full.                             */
+/*********************************************************************/
+{ FILE *fp;
+  u32   hdr[2] = {BW_MAGIC, BW_VERSION};
+  int   err=0;
+
+  if (!(fp = fopen(BW_INFO_NAME ".tmp", "wb"))) {
+    fprintf(stderr, "bw_writeInfo(): Error opening %s for write!\n", BW_INFO_NAME ".tmp");
+    return -1;
+  }
+  if ((write_u32(fp, hdr, 2) != 2) || (write_i32(fp, &I->n, 1) != 1) ||
+      (write_i32(fp, &I->numSeqs, 1) != 1) || (write_u32(fp, &I->seed, 1) != 1) ||
+      (write_i32(fp, &I->L, 1) != 1) || (write_i32(fp, &I->weight, 1) != 1) ||
+      (write_u32(fp, &I->hash, 1) != 1) ||
+      (write_i32(fp, I->xIdx, I->m) != (size_t)I->m))
+    err=1;
+  if (fclose(fp) || err) {
+    fprintf(stderr, "bw_writeInfo(): Error writing %s!\n", BW_INFO_NAME ".tmp");
+    remove(BW_INFO_NAME ".tmp");
+    return -1;
+  }
+  remove(BW_INFO_NAME);
+  return rename(BW_INFO_NAME ".tmp", BW_INFO_NAME);
+}
+
+/*********************************************************************/
+static int bw_setup(bw_info_t *I, nfs_sparse_mat_t *M, s32 n, int numSeqs, u32 seed)
+/*********************************************************************/
+/* Read bw.info, or make it if there is none. All the processes      */
+/* working on one matrix must agree on it, so once it exists it      */
+/* overrides numSeqs and the seed. It is refused if it was made for  */
+/* another matrix.                                                   */
+/*********************************************************************/
+{ FILE *fp;
+  u32   hdr[2], hash;
+  s32   i, k, x, weight;
+
+  memset(I, 0x00, sizeof(bw_info_t));
+  weight = M->cIndex[M->numCols];
+  hash = bw_matHash(M);
+  if ((fp = fopen(BW_INFO_NAME, "rb"))) {
+    if ((read_u32(fp, hdr, 2) != 2) || (hdr[0] != BW_MAGIC) || (hdr[1] != BW_VERSION)) {
+      fprintf(stderr, "bw_setup(): %s is not a block Wiedemann info file!\n", BW_INFO_NAME);
+      fclose(fp); return -1;
+    }
+    read_i32(fp, &I->n, 1);
+    read_i32(fp, &I->numSeqs, 1);
+    read_u32(fp, &I->seed, 1);
+    read_i32(fp, &I->L, 1);
+    read_i32(fp, &I->weight, 1);
+    read_u32(fp, &I->hash, 1);
+    I->m = 64*I->numSeqs;
+    if ((I->n != n) || (I->weight != weight) || (I->hash != hash) ||
+        (I->numSeqs < 1) || (I->numSeqs > BW_MAX_SEQS)) {
+      fprintf(stderr, "bw_setup(): %s does not match this matrix! Remove the bw.* files.\n",
+              BW_INFO_NAME);
+      fclose(fp); return -1;
+    }
+    if ((numSeqs > 0) && (numSeqs != I->numSeqs))
+      printf("Note: %s was made with %d sequences; using those.\n", BW_INFO_NAME, I->numSeqs);
+    if (I->seed != seed)
+      printf("Warning: %s was made with seed=%" PRIu32 "; using it instead of seed=%" PRIu32 ".\n",
+             BW_INFO_NAME, I->seed, seed);
+    I->xIdx = (s32 *)malloc(I->m*sizeof(s32));
+    if (read_i32(fp, I->xIdx, I->m) != (size_t)I->m) {
+      fprintf(stderr, "bw_setup(): %s is truncated!\n", BW_INFO_NAME);
+      fclose(fp); free(I->xIdx); return -1;
+    }
+    fclose(fp);
+    return 0;
+  }
+
+  if ((numSeqs < 1) || (numSeqs > BW_MAX_SEQS)) {
+    fprintf(stderr, "bw_setup(): The number of sequences must be in [1, %d].\n", BW_MAX_SEQS);
+    return -1;
+  }
+  I->n = n;
+  I->numSeqs = numSeqs;
+  I->seed = seed;
+  I->weight = weight;
+  I->hash = hash;
+  I->m = 64*numSeqs;
+  I->L = 2*((n + I->m - 1)/I->m) + BW_EXTRA;
+  if (M->numRows < I->m) {
+    fprintf(stderr, "bw_setup(): The matrix is too small for %d sequences.\n", numSeqs);
+    return -1;
+  }
+  /* The rows of A below numRows are zero, so X must avoid them. */
+  I->xIdx = (s32 *)malloc(I->m*sizeof(s32));
+  prandseed(seed, 712*seed + 21283, seed^0xF3C91D1A);
+  for (i=0; i<I->m; ) {
+    x = prand() % M->numRows;
+    for (k=0; (k<i) && (I->xIdx[k] != x); k++) ;
+    if (k == i)
+      I->xIdx[i++] = x;
+  }
+  if (bw_writeInfo(I)) {
+    free(I->xIdx);
+    return -1;
+  }
+  printf("Block Wiedemann: %d sequences of %" PRId32 " terms (seed=%" PRIu32 ").\n",
+         I->numSeqs, I->L, I->seed);
+  return 0;
+}
+
+/*********************************************************************/
+static s32 bw_seqTerms(bw_info_t *I, int j)
+/*********************************************************************/
+{ struct stat fileInfo;
+  char   name[64];
+
+  sprintf(name, "bw.seq.%d", j);
+  if (stat(name, &fileInfo))
+    return 0;
+  return (s32)(fileInfo.st_size/(I->m*sizeof(u64)));
+}
+
+/*********************************************************************/
+static int bw_haveFile(char *fmt, int j)
+/*********************************************************************/
+/* j < 0 means 'fmt' is the name itself.                             */
+/*********************************************************************/
+{ struct stat fileInfo;
+  char   name[64];
+
+  if (j < 0)
+    strcpy(name, fmt);
+  else
+    sprintf(name, fmt, j);
+  return (stat(name, &fileInfo) == 0);
+}
+
+/*********************************************************************/
+static int bw_saveCkpt(char *name, s32 i, s32 n, u64 *V, u64 *W)
+/*********************************************************************/
+/* Save the state of a job: i steps done, V and (for mksol) W. It is */
+/* written under another name first, so a crash while saving leaves  */
+/* the previous checkpoint.                                          */
+/*********************************************************************/
+{ FILE *fp;
+  char  tmpName[80];
+  u32   hdr[2] = {BW_MAGIC, BW_VERSION};
+  s32   hasW = (W != NULL);
+  int   err=0;
+
+  sprintf(tmpName, "%s.tmp", name);
+  if (!(fp = fopen(tmpName, "wb"))) {
+    fprintf(stderr, "bw_saveCkpt(): Error opening %s for write!\n", tmpName);
+    return -1;
+  }
+  write_u32(fp, hdr, 2);
+  write_i32(fp, &n, 1);
+  write_i32(fp, &i, 1);
+  write_i32(fp, &hasW, 1);
+  if (write_u64(fp, V, n) != (size_t)n) err=1;
+  if (W && (write_u64(fp, W, n) != (size_t)n)) err=1;
+  if (fclose(fp) || err) {
+    fprintf(stderr, "bw_saveCkpt(): Error writing %s!\n", tmpName);
+    remove(tmpName);
+    return -1;
+  }
+  remove(name);
+  return rename(tmpName, name);
+}
+
+/*********************************************************************/
+static s32 bw_loadCkpt(char *name, s32 n, u64 *V, u64 *W)
+/*********************************************************************/
+/* Returns the number of steps done, or 0 if there is no usable      */
+/* checkpoint.                                                       */
+/*********************************************************************/
+{ FILE *fp;
+  u32   hdr[2];
+  s32   cn, i, hasW;
+
+  if (!(fp = fopen(name, "rb")))
+    return 0;
+  if ((read_u32(fp, hdr, 2) != 2) || (hdr[0] != BW_MAGIC) || (hdr[1] != BW_VERSION) ||
+      (read_i32(fp, &cn, 1) != 1) || (read_i32(fp, &i, 1) != 1) ||
+      (read_i32(fp, &hasW, 1) != 1) || (cn != n) || (hasW != (W != NULL)) ||
+      (read_u64(fp, V, n) != (size_t)n) || (W && (read_u64(fp, W, n) != (size_t)n))) {
+    fprintf(stderr, "Ignoring bad checkpoint %s.\n", name);
+    fclose(fp);
+    return 0;
+  }
+  fclose(fp);
+  return i;
+}
+
+/*********************************************************************/
+static int bw_krylov(bw_info_t *I, MAT_MULT_FUNC_PTR64 MultB, void *P, int j)
+/*********************************************************************/
+/* Compute (or finish) the terms of sequence j into bw.seq.<j>.      */
+/*********************************************************************/
+{ FILE  *fp;
+  char   seqName[64], ckName[80];
+  u64   *V, *tmp, *t, *s;
+  s32    n=I->n, m=I->m, i, i0, r;
+  double startTime, now, save_time;
+
+  sprintf(seqName, "bw.seq.%d", j);
+  sprintf(ckName, "%s.ckpt", seqName);
+  V = (u64 *)malloc(n*sizeof(u64));
+  tmp = (u64 *)malloc(n*sizeof(u64));
+  s = (u64 *)malloc(m*sizeof(u64));
+  if (!(V && tmp && s)) {
+    fprintf(stderr, "bw_krylov(): Memory allocation error!\n");
+    free(V); free(tmp); free(s);
+    return -1;
+  }
+  i0 = bw_loadCkpt(ckName, n, V, NULL);
+  if ((i0 > 0) && (bw_seqTerms(I, j) < i0))
+    i0 = 0;
+  if (i0 > 0) {
+    printf("Resuming sequence %d at term %" PRId32 ".\n", j, i0);
+    fp = fopen(seqName, "r+b");
+    if (fp && bw_fseek(fp, (bw_off_t)i0*m*sizeof(u64), SEEK_SET)) {
+      fclose(fp); fp = NULL;
+    }
+  } else {
+    bw_randomBlock(tmp, n, I->seed, j);
+    MultB(V, tmp, P);
+    fp = fopen(seqName, "wb");
+  }
+  if (!fp) {
+    fprintf(stderr, "bw_krylov(): Error opening %s for write!\n", seqName);
+    free(V); free(tmp); free(s);
+    return -1;
+  }
+
+  startTime = sTime();
+  save_time = startTime + matsave_interval;
+  for (i=i0; i<I->L; i++) {
+    for (r=0; r<m; r++)
+      s[r] = V[I->xIdx[r]];
+    if (write_u64(fp, s, m) != (size_t)m) {
+      fprintf(stderr, "bw_krylov(): Error writing %s!\n", seqName);
+      fclose(fp); free(V); free(tmp); free(s);
+      return -1;
+    }
+    if (i+1 < I->L) {
+      MultB(tmp, V, P);
+      t = V; V = tmp; tmp = t;
+    }
+    now = sTime();
+    printTmp("BW sequence %d: %1.1lf%% complete (%1.1lf secs / %1.1lf secs)...", j,
+             100.0*(i+1)/I->L, now-startTime, (now-startTime)*(I->L-i0)/(i+1-i0));
+    if ((matsave_interval > 0) && (now > save_time) && (i+1 < I->L)) {
+      fflush(fp);
+      bw_saveCkpt(ckName, i+1, n, V, NULL);
+      save_time += matsave_interval;
+    }
+  }
+  printf("\n");
+  fclose(fp);
+  remove(ckName);
+  free(V); free(tmp); free(s);
+  return 0;
+}
+
+/*********************************************************************/
+static int bw_lingen(bw_info_t *I)
+/*********************************************************************/
+/* Find a generator of the sequences and write it to bw.gen.         */
+/* With a(X) = sum a_i X^i (m x 64c), we want g (64c x 1) with       */
+/*     a(X)g(X) = r(X) mod X^L,  deg r < deg g.                      */
+/* That is an order basis of [a(X) | I_m] to order L. It is built    */
+/* one term at a time: E = [a|I]P is kept alongside the basis P, its */
+/* term k is brought to column echelon form, taking the columns of   */
+/* least degree as pivots, and the pivot columns are multiplied by X.*/
+/* Both E and P are kept by column, so the column operations are     */
+/* word XORs. The work is quadratic in L.                            */
+/*********************************************************************/
+{ FILE  *fp;
+  char   name[64];
+  s32    c=I->numSeqs, m=I->m, nn=I->m, s=2*I->m, ws=2*I->numSeqs, L=I->L;
+  s32    i, j, k, t, w, a, b, col, p, q, numPiv, numOps, maxDelta, numSol, dmax;
+  s32   *delta, *pivRow, *pivList, *ops, *sol, *solDeg, dg, dr;
+  u64   *seq, *E, *P, *D, *F, *keys, in[64], out[64], x;
+  u32    hdr[2] = {BW_MAGIC, BW_VERSION};
+  int    isZero;
+  double startTime;
+
+  seq = (u64 *)malloc((size_t)L*m*c*sizeof(u64));
+  E = (u64 *)calloc((size_t)L*s*c, sizeof(u64));
+  P = (u64 *)calloc((size_t)(L+2)*s*ws, sizeof(u64));
+  D = (u64 *)malloc(s*c*sizeof(u64));
+  keys = (u64 *)malloc(s*sizeof(u64));
+  delta = (s32 *)calloc(s, sizeof(s32));
+  pivRow = (s32 *)malloc(s*sizeof(s32));
+  pivList = (s32 *)malloc(s*sizeof(s32));
+  ops = (s32 *)malloc(2*(size_t)s*m*sizeof(s32));
+  sol = (s32 *)malloc(s*sizeof(s32));
+  solDeg = (s32 *)malloc(s*sizeof(s32));
+  if (!(seq && E && P && D && keys && delta && pivRow && pivList && ops && sol && solDeg)) {
+    fprintf(stderr, "bw_lingen(): Memory allocation error!\n");
+    free(seq); free(E); free(P); free(D); free(keys); free(delta); free(pivRow);
+    free(pivList); free(ops); free(sol); free(solDeg);
+    return -1;
+  }
+
+  /* seq[(t*m + r)*c + j] = row r of term t of sequence j. */
+  for (j=0; j<c; j++) {
+    sprintf(name, "bw.seq.%d", j);
+    if (!(fp = fopen(name, "rb"))) {
+      fprintf(stderr, "bw_lingen(): Error opening %s for read!\n", name);
+      goto LINGEN_FAIL;
+    }
+    for (t=0; t<L; t++) {
+      if (read_u64(fp, D, m) != (size_t)m) {
+        fprintf(stderr, "bw_lingen(): %s is truncated!\n", name);
+        fclose(fp); goto LINGEN_FAIL;
+      }
+      for (i=0; i<m; i++)
+        seq[((size_t)t*m + i)*c + j] = D[i];
+    }
+    fclose(fp);
+  }
+
+  /* E[(t*s + col)*c + w]: the first nn columns are a(X), by column, */
+  /* the other m are I_m. P[(t*s + col)*ws + w] starts as I_s.       */
+  for (t=0; t<L; t++) {
+    for (j=0; j<c; j++) {
+      for (w=0; w<c; w++) {
+        for (a=0; a<64; a++)
+          in[a] = seq[((size_t)t*m + 64*w + a)*c + j];
+        bw_transpose64(out, in);
+        for (b=0; b<64; b++)
+          E[((size_t)t*s + 64*j + b)*c + w] = out[b];
+      }
+    }
+  }
+  free(seq); seq=NULL;
+  for (i=0; i<m; i++)
+    E[(nn + i)*c + i/64] = BIT64(i%64);
+  for (col=0; col<s; col++)
+    P[col*ws + col/64] = BIT64(col%64);
+
+  startTime = sTime();
+  maxDelta = 0;
+  for (k=0; k<L; k++) {
+    memcpy(D, &E[(size_t)k*s*c], s*c*sizeof(u64));
+    /* Columns in order of degree, then index. */
+    for (col=0; col<s; col++)
+      keys[col] = (((u64)delta[col])<<32) | (u64)col;
+    qsort(keys, s, sizeof(u64), bw_cmpU64);
+    numPiv = numOps = 0;
+    for (q=0; q<s; q++) {
+      col = (s32)(keys[q] & 0xFFFFFFFF);
+      for (i=0; i<numPiv; i++) {
+        p = pivList[i];
+        if ((D[col*c + pivRow[p]/64] >> (pivRow[p]%64)) & 1) {
+          for (w=0; w<c; w++)
+            D[col*c + w] ^= D[p*c + w];
+          ops[2*numOps] = col;
+          ops[2*numOps+1] = p;
+          numOps++;
+        }
+      }
+      for (w=0; (w<c) && !D[col*c + w]; w++) ;
+      if (w < c) {
+        pivRow[col] = 64*w + bw_lowBit(D[col*c + w]);
+        pivList[numPiv++] = col;
+      }
+    }
+    /* Do the same column operations on the rest of E, and on P. */
+    for (t=k; t<L; t++) {
+      u64 *Et = &E[(size_t)t*s*c];
+      for (i=0; i<numOps; i++)
+        for (w=0; w<c; w++)
+          Et[ops[2*i]*c + w] ^= Et[ops[2*i+1]*c + w];
+    }
+    for (t=0; t<=maxDelta; t++) {
+      u64 *Pt = &P[(size_t)t*s*ws];
+      for (i=0; i<numOps; i++)
+        for (w=0; w<ws; w++)
+          Pt[ops[2*i]*ws + w] ^= Pt[ops[2*i+1]*ws + w];
+    }
+    /* Multiply the pivot columns by X. */
+    for (i=0; i<numPiv; i++) {
+      p = pivList[i];
+      for (t=L-1; t>k; t--)
+        memcpy(&E[((size_t)t*s + p)*c], &E[((size_t)(t-1)*s + p)*c], c*sizeof(u64));
+      memset(&E[((size_t)k*s + p)*c], 0x00, c*sizeof(u64));
+      for (t=maxDelta+1; t>0; t--)
+        memcpy(&P[((size_t)t*s + p)*ws], &P[((size_t)(t-1)*s + p)*ws], ws*sizeof(u64));
+      memset(&P[p*ws], 0x00, ws*sizeof(u64));
+      delta[p]++;
+      maxDelta = MAX(maxDelta, delta[p]);
+    }
+    if ((k & 63) == 63)
+      printTmp("BW generator: %1.1lf%% complete (%1.1lf secs)...", 100.0*(k+1)/L,
+               sTime()-startTime);
+  }
+  printf("\n");
+
+  /* The generator columns are those with deg r < deg g. */
+  numSol = 0;
+  for (col=0; col<s; col++) {
+    dg = dr = -1;
+    for (t=0; t<=maxDelta; t++) {
+      for (w=0, isZero=1; w<c; w++)
+        if (P[((size_t)t*s + col)*ws + w]) isZero = 0;
+      if (!isZero) dg = t;
+      for (w=c, isZero=1; w<ws; w++)
+        if (P[((size_t)t*s + col)*ws + w]) isZero = 0;
+      if (!isZero) dr = t;
+    }
+    if ((dg >= 0) && (dr < dg))
+      keys[numSol++] = (((u64)delta[col])<<32) | (u64)col;
+  }
+  if (numSol == 0) {
+    fprintf(stderr, "bw_lingen(): No generator found! Try more sequences or another seed.\n");
+    goto LINGEN_FAIL;
+  }
+  qsort(keys, numSol, sizeof(u64), bw_cmpU64);
+  numSol = MIN(numSol, 64);
+  dmax = 0;
+  for (b=0; b<numSol; b++) {
+    sol[b] = (s32)(keys[b] & 0xFFFFFFFF);
+    for (t=maxDelta, solDeg[b]=-1; (t>=0) && (solDeg[b]<0); t--)
+      for (w=0; w<c; w++)
+        if (P[((size_t)t*s + sol[b])*ws + w]) solDeg[b] = t;
+    dmax = MAX(dmax, solDeg[b]);
+  }
+  printf("BW generator: %" PRId32 " solution columns of degree %" PRId32 "..%" PRId32 ".\n",
+         numSol, solDeg[0], dmax);
+  msgLog("", "BW generator: %" PRId32 " columns, degree <= %" PRId32, numSol, dmax);
+
+  /* F[(j*(dmax+1) + k)*64 + a] bit b: coefficient k of the reversed */
+  /* g of solution b, at row 64j+a.                                   */
+  F = (u64 *)calloc((size_t)c*(dmax+1)*64, sizeof(u64));
+  if (!F) {
+    fprintf(stderr, "bw_lingen(): Memory allocation error!\n");
+    goto LINGEN_FAIL;
+  }
+  for (b=0; b<numSol; b++) {
+    for (k=0; k<=solDeg[b]; k++) {
+      t = solDeg[b] - k;
+      for (j=0; j<c; j++) {
+        x = P[((size_t)t*s + sol[b])*ws + j];
+        for (a=0; x; a++, x >>= 1)
+          if (x & 1)
+            F[((size_t)j*(dmax+1) + k)*64 + a] |= BIT64(b);
+      }
+    }
+  }
+  if (!(fp = fopen(BW_GEN_NAME ".tmp", "wb"))) {
+    fprintf(stderr, "bw_lingen(): Error opening %s for write!\n", BW_GEN_NAME ".tmp");
+    free(F); goto LINGEN_FAIL;
+  }
+  write_u32(fp, hdr, 2);
+  write_i32(fp, &I->n, 1);
+  write_i32(fp, &c, 1);
+  write_i32(fp, &dmax, 1);
+  write_i32(fp, &numSol, 1);
+  write_u64(fp, F, (size_t)c*(dmax+1)*64);
+  fclose(fp);
+  remove(BW_GEN_NAME);
+  rename(BW_GEN_NAME ".tmp", BW_GEN_NAME);
+  free(F);
+
+  free(E); free(P); free(D); free(keys); free(delta); free(pivRow);
+  free(pivList); free(ops); free(sol); free(solDeg);
+  return 0;
+
+LINGEN_FAIL:
+  free(seq); free(E); free(P); free(D); free(keys); free(delta); free(pivRow);
+  free(pivList); free(ops); free(sol); free(solDeg);
+  return -1;
+}
+
+/*********************************************************************/
+static int bw_mksol(bw_info_t *I, MAT_MULT_FUNC_PTR64 MultB, void *P, int j)
+/*********************************************************************/
+/* The part of the solution from sequence j:                         */
+/*     w_j = sum_k (A^k) R_j F_{k,j},                                */
+/* written to bw.sol.<j>.                                            */
+/*********************************************************************/
+{ FILE  *fp;
+  char   solName[64], ckName[80];
+  u64   *F, *V, *W, *tmp, *t;
+  u32    hdr[2];
+  s32    n=I->n, hn, hc, dmax, numSol, k, k0;
+  double startTime, now, save_time;
+
+  if (!(fp = fopen(BW_GEN_NAME, "rb"))) {
+    fprintf(stderr, "bw_mksol(): Error opening %s for read!\n", BW_GEN_NAME);
+    return -1;
+  }
+  if ((read_u32(fp, hdr, 2) != 2) || (hdr[0] != BW_MAGIC) || (hdr[1] != BW_VERSION) ||
+      (read_i32(fp, &hn, 1) != 1) || (read_i32(fp, &hc, 1) != 1) ||
+      (read_i32(fp, &dmax, 1) != 1) || (read_i32(fp, &numSol, 1) != 1) ||
+      (hn != n) || (hc != I->numSeqs)) {
+    fprintf(stderr, "bw_mksol(): %s does not match bw.info!\n", BW_GEN_NAME);
+    fclose(fp); return -1;
+  }
+  F = (u64 *)malloc((size_t)(dmax+1)*64*sizeof(u64));
+  V = (u64 *)malloc(n*sizeof(u64));
+  W = (u64 *)malloc(n*sizeof(u64));
+  tmp = (u64 *)malloc(n*sizeof(u64));
+  if (!(F && V && W && tmp)) {
+    fprintf(stderr, "bw_mksol(): Memory allocation error!\n");
+    fclose(fp); free(F); free(V); free(W); free(tmp);
+    return -1;
+  }
+  if (bw_fseek(fp, (bw_off_t)j*(dmax+1)*64*sizeof(u64), SEEK_CUR) ||
+      (read_u64(fp, F, (size_t)(dmax+1)*64) != (size_t)(dmax+1)*64)) {
+    fprintf(stderr, "bw_mksol(): %s is truncated!\n", BW_GEN_NAME);
+    fclose(fp); free(F); free(V); free(W); free(tmp);
+    return -1;
+  }
+  fclose(fp);
+
+  sprintf(solName, "bw.sol.%d", j);
+  sprintf(ckName, "%s.ckpt", solName);
+  if ((k0 = bw_loadCkpt(ckName, n, V, W)) > 0) {
+    printf("Resuming solution %d at step %" PRId32 ".\n", j, k0);
+  } else {
+    bw_randomBlock(V, n, I->seed, j);
+    memset(W, 0x00, n*sizeof(u64));
+  }
+  startTime = sTime();
+  save_time = startTime + matsave_interval;
+  for (k=k0; k<=dmax; k++) {
+    addmultnx64(W, V, &F[k*64], n);
+    if (k < dmax) {
+      MultB(tmp, V, P);
+      t = V; V = tmp; tmp = t;
+    }
+    now = sTime();
+    printTmp("BW solution %d: %1.1lf%% complete (%1.1lf secs / %1.1lf secs)...", j,
+             100.0*(k+1)/(dmax+1), now-startTime, (now-startTime)*(dmax+1-k0)/(k+1-k0));
+    if ((matsave_interval > 0) && (now > save_time) && (k < dmax)) {
+      bw_saveCkpt(ckName, k+1, n, V, W);
+      save_time += matsave_interval;
+    }
+  }
+  printf("\n");
+
+  hdr[0] = BW_MAGIC; hdr[1] = BW_VERSION;
+  if (!(fp = fopen(solName, "wb"))) {
+    fprintf(stderr, "bw_mksol(): Error opening %s for write!\n", solName);
+    free(F); free(V); free(W); free(tmp);
+    return -1;
+  }
+  write_u32(fp, hdr, 2);
+  write_i32(fp, &n, 1);
+  write_u64(fp, W, n);
+  fclose(fp);
+  remove(ckName);
+  free(F); free(V); free(W); free(tmp);
+  return 0;
+}
+
+/*********************************************************************/
+static void bw_buildTable(u64 tab[8][256], u64 *T)
+/*********************************************************************/
+{ int k, v;
+
+  for (k=0; k<8; k++) {
+    tab[k][0] = 0;
+    for (v=1; v<256; v++)
+      tab[k][v] = tab[k][v & (v-1)] ^ T[8*k + bw_lowBit((u64)v)];
+  }
+}
+
+/*********************************************************************/
+static u64 bw_nullSpace(u64 *A, s32 n, u64 *T)
+/*********************************************************************/
+/* Column echelon form of the n x 64 block A: find T (T[a] = row a)  */
+/* such that the columns of AT flagged in the return value are zero  */
+/* and the others are independent.                                   */
+/*********************************************************************/
+{ u64 tab[8][256], active=~(u64)0, r, y;
+  s32 i;
+  int a, k, p;
+
+  for (a=0; a<64; a++)
+    T[a] = BIT64(a);
+  bw_buildTable(tab, T);
+  for (i=0; (i<n) && active; i++) {
+    if (!(y = A[i])) continue;
+    for (k=0, r=0; k<8; k++, y >>= 8)
+      r ^= tab[k][y & 255];
+    if (!(r &= active)) continue;
+    p = bw_lowBit(r);
+    r ^= BIT64(p);
+    for (a=0; a<64; a++)
+      if ((T[a] >> p) & 1)
+        T[a] ^= r;
+    active ^= BIT64(p);
+    bw_buildTable(tab, T);
+  }
+  return active;
+}
+
+/*********************************************************************/
+static int bw_extract(bw_info_t *I, MAT_MULT_FUNC_PTR64 MultB, void *P, u64 *deps)
+/*********************************************************************/
+/* Sum the solution parts into w, and collect kernel vectors from    */
+/* w, Aw, (A^2)w, ...: if (A^(k+1))w T has zero columns, the same    */
+/* columns of (A^k)w T are in the kernel. Returns the number of      */
+/* independent dependencies put in deps.                             */
+/*********************************************************************/
+{ FILE  *fp;
+  char   name[64];
+  u64   *U, *AU, *K, *Kall, *t, T[64], null, use, nz, x;
+  u32    hdr[2];
+  s32    n=I->n, hn, i;
+  int    j, b, q, lev, numK=0, numDeps, list[64], cnt;
+
+  U = (u64 *)calloc(n, sizeof(u64));
+  AU = (u64 *)malloc(n*sizeof(u64));
+  K = (u64 *)malloc(n*sizeof(u64));
+  Kall = (u64 *)calloc(n, sizeof(u64));
+  if (!(U && AU && K && Kall)) {
+    fprintf(stderr, "bw_extract(): Memory allocation error!\n");
+    free(U); free(AU); free(K); free(Kall);
+    return -1;
+  }
+  for (j=0; j<I->numSeqs; j++) {
+    sprintf(name, "bw.sol.%d", j);
+    if (!(fp = fopen(name, "rb")) || (read_u32(fp, hdr, 2) != 2) || (hdr[0] != BW_MAGIC) ||
+        (read_i32(fp, &hn, 1) != 1) || (hn != n) || (read_u64(fp, AU, n) != (size_t)n)) {
+      fprintf(stderr, "bw_extract(): Error reading %s!\n", name);
+      if (fp) fclose(fp);
+      free(U); free(AU); free(K); free(Kall);
+      return -1;
+    }
+    fclose(fp);
+    for (i=0; i<n; i++)
+      U[i] ^= AU[i];
+  }
+
+  for (lev=0; (lev<BW_MAX_LEVELS) && (numK<64); lev++) {
+    for (i=0, nz=0; i<n; i++)
+      nz |= U[i];
+    if (!nz) break;
+    MultB(AU, U, P);
+    null = bw_nullSpace(AU, n, T);
+    multnx64(K, U, T, n);
+    for (i=0, nz=0; i<n; i++)
+      nz |= K[i];
+    use = null & nz;
+    for (b=0, cnt=0; (b<64) && (numK+cnt<64); b++)
+      if ((use >> b) & 1)
+        list[cnt++] = b;
+    for (i=0; i<n; i++) {
+      if (!(x = K[i] & use)) continue;
+      for (q=0; q<cnt; q++)
+        if ((x >> list[q]) & 1)
+          Kall[i] |= BIT64(numK+q);
+    }
+    numK += cnt;
+    t = U; U = AU; AU = t;
+  }
+
+  /* Keep an independent set of them. */
+  null = bw_nullSpace(Kall, n, T);
+  multnx64(K, Kall, T, n);
+  use = (numK < 64) ? ~null & (BIT64(numK)-1) : ~null;
+  for (b=0, cnt=0; b<64; b++)
+    if ((use >> b) & 1)
+      list[cnt++] = b;
+  for (i=0; i<n; i++) {
+    for (q=0, x=0; q<cnt; q++)
+      x |= ((K[i] >> list[q]) & 1) << q;
+    deps[i] = x;
+  }
+  numDeps = cnt;
+
+  /* Check them. */
+  MultB(AU, deps, P);
+  for (i=0, nz=0; i<n; i++)
+    nz |= AU[i];
+  if (nz) {
+    fprintf(stderr, "bw_extract(): Some dependencies are wrong (mask %016" PRIx64 ")!\n", nz);
+    numDeps = -1;
+  }
+  free(U); free(AU); free(K); free(Kall);
+  return numDeps;
+}
+
+/*********************************************************************/
+int blockWiedemannJob(MAT_MULT_FUNC_PTR64 MultB, void *P, s32 n, int numSeqs,
+                      int job, u32 seed)
+/*********************************************************************/
+/* Do the pending work of sequence 'job': its terms, or once bw.gen  */
+/* exists, its part of the solution. Meant to be run by separate     */
+/* processes, one per sequence.                                      */
+/*********************************************************************/
+{ bw_info_t I;
+  int res=0;
+
+  if (bw_setup(&I, (nfs_sparse_mat_t *)P, n, numSeqs, seed))
+    return -1;
+  if ((job < 0) || (job >= I.numSeqs)) {
+    fprintf(stderr, "blockWiedemannJob(): There is no sequence %d.\n", job);
+    free(I.xIdx);
+    return -1;
+  }
+  if (bw_seqTerms(&I, job) < I.L)
+    res = bw_krylov(&I, MultB, P, job);
+  else if (!bw_haveFile(BW_GEN_NAME, -1))
+    printf("Sequence %d is done; the generator is not computed yet.\n", job);
+  else if (!bw_haveFile("bw.sol.%d", job))
+    res = bw_mksol(&I, MultB, P, job);
+  else
+    printf("Sequence %d and its solution part are done.\n", job);
+  free(I.xIdx);
+  return res;
+}
+
+/*********************************************************************/
+int blockWiedemann64(u64 *deps, MAT_MULT_FUNC_PTR64 MultB, void *P, s32 n,
+                     int numSeqs, u32 seed)
+/*********************************************************************/
+/* Do whatever is left of the block Wiedemann steps, and put up to   */
+/* 64 dependencies in deps. Returns the number found, or a negative  */
+/* value on error.                                                   */
+/*********************************************************************/
+{ bw_info_t I;
+  int j, res=0;
+
+  if (bw_setup(&I, (nfs_sparse_mat_t *)P, n, numSeqs, seed))
+    return -1;
+  for (j=0; (j<I.numSeqs) && !res; j++)
+    if (bw_seqTerms(&I, j) < I.L)
+      res = bw_krylov(&I, MultB, P, j);
+  if (!res && !bw_haveFile(BW_GEN_NAME, -1))
+    res = bw_lingen(&I);
+  for (j=0; (j<I.numSeqs) && !res; j++)
+    if (!bw_haveFile("bw.sol.%d", j))
+      res = bw_mksol(&I, MultB, P, j);
+  if (!res)
+    res = bw_extract(&I, MultB, P, deps);
+  free(I.xIdx);
+  return res;
+}
+
+/*********************************************************************/
+void blockWiedemannClean(void)
+/*********************************************************************/
+/* Remove the bw.* files, once the dependencies have been written.   */
+/*********************************************************************/
+{ static const char *jobFiles[] = {"bw.seq.%d", "bw.seq.%d.ckpt", "bw.seq.%d.ckpt.tmp",
+                                   "bw.sol.%d", "bw.sol.%d.ckpt", "bw.sol.%d.ckpt.tmp"};
+  char name[80];
+  int  j, k;
+
+  for (j=0; j<BW_MAX_SEQS; j++) {
+    for (k=0; k<(int)(sizeof(jobFiles)/sizeof(jobFiles[0])); k++) {
+      sprintf(name, jobFiles[k], j);
+      remove(name);
+    }
+  }
+  remove(BW_GEN_NAME);
+  remove(BW_GEN_NAME ".tmp");
+  remove(BW_INFO_NAME);
+  remove(BW_INFO_NAME ".tmp");
+}
@@ -0,0 +1,614 @@
+/**************************************************************/
+/* combparts-ext.c                                            */
+/* An external-memory version of combParts(), for when the    */
+/* large prime lists of all the relations do not fit in RAM.  */
+/**************************************************************/
+/*  This file is part of GGNFS.
+*
+*   GGNFS is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   GGNFS is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with GGNFS; if not, write to the Free Software
+*   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+/* The relation-sets live in a file, one record per set:
+     numRels, numLP, Rels[numRels], LP[numLP]
+   with the relations (s32) and large primes (u64) each sorted. A large
+   prime is stored as p<<32 | r for an algebraic one, and p<<32 | 0xFFFFFFFF
+   for a rational one, so no global index of the large primes is needed.
+
+   Each pass streams the set file and writes one (large prime, set) entry
+   per large prime occurrence into one of several shard files, chosen by
+   a hash of the large prime, so that all occurrences of a large prime land
+   in the same shard and each shard fits in the memory limit. The shards
+   are then sorted one at a time to find the singletons, or the merges to
+   do, and the set file is rewritten with the changes applied. The merge
+   rules are those of combParts(): for each large prime, the lightest set
+   having only that large prime is added to every other set having it.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ggnfs.h"
+#include "rellist.h"
+
+#define XC_SET_FILE     "tmpsets.%03d"
+#define XC_SHARD_FILE   "tmpshard.%03d"
+#define XC_LP_FILE      "lpindex.L"
+#define XC_MAX_SHARDS   256
+#define XC_MAX_RELS     128
+#define XC_MAX_LP       8
+#define XC_RAT_R        0xFFFFFFFF
+#define XC_MIN_MEM      (16*1048576)
+
+/* Shards can be over 2GB, and long is 32 bits on Win64. */
+#ifdef _MSC_VER
+#define xc_fseek        _fseeki64
+#define xc_ftell        _ftelli64
+#else
+#define xc_fseek        fseeko
+#define xc_ftell        ftello
+#endif
+
+typedef struct {
+  s32 numRels, numLP;
+  s32 Rels[XC_MAX_RELS];
+  u64 LP[XC_MAX_LP];
+} xc_set_t;
+
+typedef struct {
+  u64 key;
+  u32 set;
+  u16 numLP, numRels;
+} xc_ent_t;
+
+typedef struct {
+  int   cur;               /* The current set file is XC_SET_FILE.cur */
+  s64   numSets, numKeys, numFull;
+  int   numShards;
+  s64   maxMem;
+  FILE *lpfp;              /* If not NULL, list the large primes here.      */
+  s32   numLP;
+  u32  *dead;              /* Bitmap of sets to remove on the next rewrite. */
+  lpair_t *pairs;          /* (target, pivot) pairs for the next rewrite.   */
+  s32   numPairs, maxPairs;
+  s32  *pivots;            /* Sorted unique pivots of 'pairs'...            */
+  s32  *poolIndex;         /* ...and where their records are in 'pool'.     */
+  s32  *pool;
+  s32   numPivots, poolSize, maxPoolSize;
+} xc_state_t;
+
+/* The size, in s32's, of the record of a set. */
+#define XC_RECSIZE(_numRels, _numLP) (2 + (_numRels) + 2*(_numLP))
+
+#define XC_ISDEAD(_X, _i) ((_X)->dead[(_i)>>5] & BIT((_i)&0x1F))
+#define XC_SETDEAD(_X, _i) ((_X)->dead[(_i)>>5] |= BIT((_i)&0x1F))
+
+/*********************************************************/
+static int xc_readSet(FILE *fp, xc_set_t *S)
+/*********************************************************/
+{ s32 hdr[2];
+
+  if (fread(hdr, sizeof(s32), 2, fp) != 2)
+    return 0;
+  if ((hdr[0] > XC_MAX_RELS) || (hdr[1] > XC_MAX_LP)) {
+    fprintf(stderr, "combPartsExt() : corrupt relation-set file!\n");
+    exit(-1);
+  }
+  S->numRels = hdr[0];
+  S->numLP = hdr[1];
+  if ((fread(S->Rels, sizeof(s32), S->numRels, fp) != (size_t)S->numRels) ||
+      (fread(S->LP, sizeof(u64), S->numLP, fp) != (size_t)S->numLP)) {
+    fprintf(stderr, "combPartsExt() : truncated relation-set file!\n");
+    exit(-1);
+  }
+  return 1;
+}
+
+/*********************************************************/
+static void xc_writeSet(FILE *fp, xc_set_t *S)
+/*********************************************************/
+{
+  fwrite(&S->numRels, sizeof(s32), 1, fp);
+  fwrite(&S->numLP, sizeof(s32), 1, fp);
+  fwrite(S->Rels, sizeof(s32), S->numRels, fp);
+  fwrite(S->LP, sizeof(u64), S->numLP, fp);
+}
+
+/*********************************************************/
+static FILE *xc_open(const char *fmt, int i, const char *mode)
+/*********************************************************/
+{ char  fName[64];
+  FILE *fp;
+
+  sprintf(fName, fmt, i);
+  if (!(fp = fopen(fName, mode))) {
+    fprintf(stderr, "combPartsExt() : Error opening %s!\n", fName);
+    exit(-1);
+  }
+  return fp;
+}
+
+/*********************************************************/
+static void xc_remove(const char *fmt, int i)
+/*********************************************************/
+{ char fName[64];
+
+  sprintf(fName, fmt, i);
+  remove(fName);
+}
+
+/*********************************************************/
+static int xc_cmpEnt(const void *a, const void *b)
+/*********************************************************/
+{ const xc_ent_t *A=(const xc_ent_t *)a, *B=(const xc_ent_t *)b;
+
+  if (A->key < B->key) return -1;
+  if (A->key > B->key) return 1;
+  if (A->set < B->set) return -1;
+  if (A->set > B->set) return 1;
+  return 0;
+}
+
+/*********************************************************/
+static int xc_cmpPair(const void *a, const void *b)
+/*********************************************************/
+{ const lpair_t *A=(const lpair_t *)a, *B=(const lpair_t *)b;
+
+  if (A->x < B->x) return -1;
+  if (A->x > B->x) return 1;
+  return 0;
+}
+
+/*********************************************************/
+static int xc_cmpU64(const void *a, const void *b)
+/*********************************************************/
+{ u64 A=*(const u64 *)a, B=*(const u64 *)b;
+
+  if (A < B) return -1;
+  if (A > B) return 1;
+  return 0;
+}
+
+/*********************************************************/
+/* Symmetric difference of the sorted lists x and y into */
+/* z. Returns the size of z.                             */
+/*********************************************************/
+#define XC_MOD2(_T, _name) \
+static s32 _name(_T *z, _T *x, s32 nx, _T *y, s32 ny) \
+{ s32 i=0, j=0, k=0; \
+  while ((i<nx) && (j<ny)) { \
+    if (x[i] < y[j]) z[k++] = x[i++]; \
+    else if (y[j] < x[i]) z[k++] = y[j++]; \
+    else { i++; j++; } \
+  } \
+  while (i<nx) z[k++] = x[i++]; \
+  while (j<ny) z[k++] = y[j++]; \
+  return k; \
+}
+XC_MOD2(s32, xc_mod2S32)
+XC_MOD2(u64, xc_mod2U64)
+
+/*********************************************************/
+static void xc_setShards(xc_state_t *X)
+/*********************************************************/
+/* Choose the number of shards so that a shard, and the  */
+/* sort of it, take at most about half the memory limit. */
+/*********************************************************/
+{ s64 bytes = X->numKeys*(s64)sizeof(xc_ent_t);
+
+  X->numShards = (int)(1 + (2*bytes)/X->maxMem);
+  if (X->numShards > XC_MAX_SHARDS) {
+    printf("Warning: -maxmem is too small for %" PRId64 " large prime occurences.\n", X->numKeys);
+    X->numShards = XC_MAX_SHARDS;
+  }
+}
+
+/*********************************************************/
+static void xc_initSets(xc_state_t *X, multi_file_t *prelF)
+/*********************************************************/
+/* Write the initial set file: one set per relation.     */
+/*********************************************************/
+{ s32 i, k, n, numLR, numLA, lrpi, lapi;
+  u32 j, sF, relNum=0;
+  s32 *rel;
+  rel_list *RL;
+  xc_set_t S;
+  FILE *fp;
+
+  fp = xc_open(XC_SET_FILE, X->cur, "wb");
+  X->numSets = X->numKeys = X->numFull = 0;
+  for (i=0; i<prelF->numFiles; i++) {
+    printf("Loading processed file %" PRId32 "/%d...", i+1, prelF->numFiles);
+    fflush(stdout);
+    RL = getRelList(prelF, i);
+    printf("Done. Processing...\n");
+    for (j=0; j<RL->numRels; j++) {
+      rel = RL->relData + RL->relIndex[j];
+      sF = rel[0];
+      numLR = GETNUMLRP(sF);
+      numLA = GETNUMLAP(sF);
+      lrpi = 4 + 2*(GETNUMRFB(sF) + GETNUMAFB(sF) + GETNUMSPB(sF)) + 2;
+      lapi = lrpi + numLR;
+      for (k=0, n=0; k<numLR; k++)
+        S.LP[n++] = ((u64)(u32)rel[lrpi+k]<<32) | XC_RAT_R;
+      for (k=0; k<numLA; k++)
+        S.LP[n++] = ((u64)(u32)rel[lapi+2*k]<<32) | (u32)rel[lapi+2*k+1];
+      qsort(S.LP, n, sizeof(u64), xc_cmpU64);
+      /* A large prime occurring twice cancels. */
+      for (k=0, S.numLP=0; k<n; k++) {
+        if ((k+1<n) && (S.LP[k]==S.LP[k+1]))
+          k++;
+        else
+          S.LP[S.numLP++] = S.LP[k];
+      }
+      S.numRels = 1;
+      S.Rels[0] = relNum++;
+      xc_writeSet(fp, &S);
+      X->numSets++;
+      X->numKeys += S.numLP;
+      if (S.numLP == 0)
+        X->numFull++;
+    }
+    clearRelList(RL);
+    free(RL);
+  }
+  fclose(fp);
+}
+
+/*********************************************************/
+static void xc_writeShards(xc_state_t *X)
+/*********************************************************/
+{ FILE *ofp[XC_MAX_SHARDS], *fp;
+  xc_set_t S;
+  xc_ent_t E;
+  u32 setNum;
+  s32 k;
+  int h;
+
+  xc_setShards(X);
+  for (h=0; h<X->numShards; h++)
+    ofp[h] = xc_open(XC_SHARD_FILE, h, "wb");
+  fp = xc_open(XC_SET_FILE, X->cur, "rb");
+  for (setNum=0; xc_readSet(fp, &S); setNum++) {
+    for (k=0; k<S.numLP; k++) {
+      E.key = S.LP[k];
+      E.set = setNum;
+      E.numLP = (u16)S.numLP;
+      E.numRels = (u16)S.numRels;
+      h = (int)(((E.key*0x9E3779B97F4A7C15ULL)>>32) % (u64)X->numShards);
+      fwrite(&E, sizeof(xc_ent_t), 1, ofp[h]);
+    }
+  }
+  fclose(fp);
+  for (h=0; h<X->numShards; h++)
+    fclose(ofp[h]);
+}
+
+/*********************************************************/
+static xc_ent_t *xc_readShard(int h, s32 *num)
+/*********************************************************/
+/* Read shard h, sorted by large prime, and remove it.   */
+/*********************************************************/
+{ FILE *fp;
+  xc_ent_t *E;
+  s64   size;
+
+  fp = xc_open(XC_SHARD_FILE, h, "rb");
+  xc_fseek(fp, 0, SEEK_END);
+  size = (s64)xc_ftell(fp);
+  rewind(fp);
+  if ((size < 0) || (size/(s64)sizeof(xc_ent_t) >= 0x7FFFFFFF)) {
+    fprintf(stderr, "combPartsExt() : shard %d is too large (%" PRId64 " bytes)!\n", h, size);
+    exit(-1);
+  }
+  *num = (s32)(size/(s64)sizeof(xc_ent_t));
+  E = (xc_ent_t *)lxmalloc(((size_t)*num + 1)*sizeof(xc_ent_t), 1);
+  if (fread(E, sizeof(xc_ent_t), *num, fp) != (size_t)*num) {
+    fprintf(stderr, "combPartsExt() : Error reading shard %d!\n", h);
+    exit(-1);
+  }
+  fclose(fp);
+  xc_remove(XC_SHARD_FILE, h);
+  qsort(E, *num, sizeof(xc_ent_t), xc_cmpEnt);
+  return E;
+}
+
+/*********************************************************/
+static s64 xc_markSingletons(xc_state_t *X)
+/*********************************************************/
+{ xc_ent_t *E;
+  s32 i, num, L[4];
+  s64 numDead=0;
+  int h;
+
+  xc_writeShards(X);
+  for (h=0; h<X->numShards; h++) {
+    E = xc_readShard(h, &num);
+    for (i=0; i<num; i++) {
+      if ((X->lpfp != NULL) && ((i==0) || (E[i-1].key != E[i].key))) {
+        /* In the format getLPList() in matbuild.c writes, for sqrt. */
+        L[0] = (s32)(E[i].key>>32);
+        L[1] = ((u32)E[i].key == XC_RAT_R) ? -1 : (s32)(u32)E[i].key;
+        L[2] = X->numLP++;
+        L[3] = (L[1] < 0) ? 2 : 3;
+        fwrite(L, sizeof(s32), 4, X->lpfp);
+      }
+      if (((i==0) || (E[i-1].key != E[i].key)) &&
+          ((i+1==num) || (E[i+1].key != E[i].key))) {
+        XC_SETDEAD(X, E[i].set);
+        numDead++;
+      }
+    }
+    free(E);
+  }
+  if (X->lpfp != NULL) {
+    fclose(X->lpfp);
+    X->lpfp = NULL;
+  }
+  return numDead;
+}
+
+/*********************************************************/
+static s32 xc_findMerges(xc_state_t *X, s32 level, s64 *numRemoved)
+/*********************************************************/
+/* Fill X->pairs with (target, pivot) pairs as merge()   */
+/* in combparts.c does, and mark the sets which would    */
+/* become too heavy for removal.                         */
+/*********************************************************/
+{ xc_ent_t *E;
+  s32 i, j, k, num, piv, poolSize=0;
+  int h;
+
+  X->numPairs = 0;
+  *numRemoved = 0;
+  xc_writeShards(X);
+  for (h=0; h<X->numShards; h++) {
+    E = xc_readShard(h, &num);
+    for (i=0; i<num; i=k) {
+      for (k=i+1; (k<num) && (E[k].key==E[i].key); k++);
+      if ((k-i < 2) || (X->numPairs + (k-i) > X->maxPairs))
+        continue;
+      /* The lightest set with only this large prime is the pivot. */
+      for (j=i, piv=-1; j<k; j++)
+        if ((E[j].numLP==1) && ((piv<0) || (E[j].numRels < E[piv].numRels)))
+          piv = j;
+      if ((piv < 0) || (E[piv].numRels > level))
+        continue;
+      /* The rest waits for the next pass if the pivot would not fit. */
+      if (poolSize + XC_RECSIZE(E[piv].numRels, 1) > X->maxPoolSize)
+        continue;
+      poolSize += XC_RECSIZE(E[piv].numRels, 1);
+      for (j=i; j<k; j++) {
+        if (j==piv) continue;
+        if (E[j].numRels + E[piv].numRels <= level) {
+          X->pairs[X->numPairs].x = E[j].set;
+          X->pairs[X->numPairs].y = E[piv].set;
+          X->numPairs++;
+        } else if (!(XC_ISDEAD(X, E[j].set))) {
+          XC_SETDEAD(X, E[j].set);
+          (*numRemoved)++;
+        }
+      }
+    }
+    free(E);
+  }
+  /* One merge per target, and none into a set being removed. */
+  qsort(X->pairs, X->numPairs, sizeof(lpair_t), xc_cmpPair);
+  for (i=0, j=0; i<X->numPairs; i++) {
+    if (XC_ISDEAD(X, X->pairs[i].x))
+      continue;
+    if ((j>0) && (X->pairs[j-1].x == X->pairs[i].x))
+      continue;
+    X->pairs[j++] = X->pairs[i];
+  }
+  X->numPairs = j;
+  return X->numPairs;
+}
+
+/*********************************************************/
+static void xc_loadPivots(xc_state_t *X)
+/*********************************************************/
+{ FILE *fp;
+  xc_set_t S;
+  s32 i, j;
+  u32 setNum;
+
+  for (i=0; i<X->numPairs; i++)
+    X->pivots[i] = X->pairs[i].y;
+  qsort(X->pivots, X->numPairs, sizeof(s32), cmpS32s);
+  for (i=0, j=0; i<X->numPairs; i++)
+    if ((j==0) || (X->pivots[j-1] != X->pivots[i]))
+      X->pivots[j++] = X->pivots[i];
+  X->numPivots = j;
+  if (j==0)
+    return;
+  fp = xc_open(XC_SET_FILE, X->cur, "rb");
+  X->poolSize = 0;
+  for (setNum=0, j=0; (j<X->numPivots) && xc_readSet(fp, &S); setNum++) {
+    if ((s32)setNum == X->pivots[j]) {
+      X->poolIndex[j++] = X->poolSize;
+      X->pool[X->poolSize++] = S.numRels;
+      X->pool[X->poolSize++] = S.numLP;
+      memcpy(X->pool + X->poolSize, S.Rels, S.numRels*sizeof(s32));
+      X->poolSize += S.numRels;
+      memcpy(X->pool + X->poolSize, S.LP, S.numLP*sizeof(u64));
+      X->poolSize += 2*S.numLP;
+    }
+  }
+  fclose(fp);
+}
+
+/*********************************************************/
+static void xc_rewrite(xc_state_t *X)
+/*********************************************************/
+/* Rewrite the set file, dropping the dead sets and      */
+/* applying the merges in X->pairs.                      */
+/*********************************************************/
+{ FILE *fp, *ofp;
+  xc_set_t S, T;
+  s32 pi=0, *loc, *P, pRels, pLP;
+  u32 setNum;
+
+  xc_loadPivots(X);
+  fp = xc_open(XC_SET_FILE, X->cur, "rb");
+  ofp = xc_open(XC_SET_FILE, 1-X->cur, "wb");
+  X->numSets = X->numKeys = X->numFull = 0;
+  for (setNum=0; xc_readSet(fp, &S); setNum++) {
+    if (XC_ISDEAD(X, setNum))
+      continue;
+    while ((pi < X->numPairs) && ((u32)X->pairs[pi].x < setNum))
+      pi++;
+    if ((pi < X->numPairs) && ((u32)X->pairs[pi].x == setNum)) {
+      loc = (s32 *)bsearch(&X->pairs[pi].y, X->pivots, X->numPivots, sizeof(s32), cmpS32s);
+      P = X->pool + X->poolIndex[loc - X->pivots];
+      pRels = P[0]; pLP = P[1];
+      T.numRels = xc_mod2S32(T.Rels, S.Rels, S.numRels, P+2, pRels);
+      T.numLP = xc_mod2U64(T.LP, S.LP, S.numLP, (u64 *)(P+2+pRels), pLP);
+      S = T;
+    }
+    if (S.numRels == 0)
+      continue;
+    xc_writeSet(ofp, &S);
+    X->numSets++;
+    X->numKeys += S.numLP;
+    if (S.numLP == 0)
+      X->numFull++;
+  }
+  fclose(fp);
+  fclose(ofp);
+  xc_remove(XC_SET_FILE, X->cur);
+  X->cur = 1-X->cur;
+  memset(X->dead, 0x00, ((X->numSets>>5)+1)*sizeof(u32));
+  X->numPairs = 0;
+}
+
+/*********************************************************/
+static s32 xc_writeCols(xc_state_t *X, char *colName, s32 maxRelsInFF, u32 minFull)
+/*********************************************************/
+/* Write the full relation-sets no heavier than          */
+/* maxRelsInFF (0 = automatic, as removeHeavyRelSets())  */
+/* to the unprocessed column file and its index.         */
+/*********************************************************/
+{ FILE *fp, *ofp, *ofp2;
+  xc_set_t S;
+  s32 i, numFF=0, zero[2]={0,0};
+  u32 byWt[XC_MAX_RELS+1], cum, cwt;
+  char indexName[80];
+
+  memset(byWt, 0x00, sizeof(byWt));
+  fp = xc_open(XC_SET_FILE, X->cur, "rb");
+  while (xc_readSet(fp, &S))
+    if (S.numLP == 0)
+      byWt[S.numRels]++;
+  if (maxRelsInFF == 0) {
+    for (i=0, cum=0; (cum<minFull) && (i<=XC_MAX_RELS); i++)
+      cum += byWt[i];
+    maxRelsInFF = MIN(i-1, MAX_RELS_IN_FF);
+    printf("Before deleting relation sets heavier than wt %" PRId32 " [auto], there were:\n", maxRelsInFF);
+  } else
+    printf("Before deleting relation sets heavier than wt %" PRId32 ", there were:\n", maxRelsInFF);
+  printf("Wt  |  # R-S   | Cum. R-S | Cum. wt.\n");
+  printf("---------------------------------\n");
+  for (i=0, cum=0, cwt=0; i<=XC_MAX_RELS; i++) {
+    cum += byWt[i];
+    cwt += i*byWt[i];
+    if (byWt[i]>0)
+      printf("%3" PRId32 " |%10" PRIu32 "|%10" PRIu32 "|%" PRIu32 "\n", i, byWt[i], cum, cwt);
+  }
+  printf("---------------------------------\n");
+
+  sprintf(indexName, "%s.index", colName);
+  if (!(ofp = fopen(colName, "wb")) || !(ofp2 = fopen(indexName, "wb"))) {
+    fprintf(stderr, "combPartsExt() : Error opening %s for write!\n", colName);
+    exit(-1);
+  }
+  rewind(fp);
+  while (xc_readSet(fp, &S)) {
+    if ((S.numLP > 0) || (S.numRels > maxRelsInFF))
+      continue;
+    /* Unprocessed LF format: no primes yet, and zero QCB bits. */
+    fwrite(&S.numRels, sizeof(s32), 1, ofp);
+    fwrite(zero, sizeof(s32), 1, ofp);
+    fwrite(S.Rels, sizeof(s32), S.numRels, ofp);
+    fwrite(zero, sizeof(s32), 2, ofp);
+    fwrite(&S.numRels, sizeof(s32), 1, ofp2);
+    fwrite(S.Rels, sizeof(s32), S.numRels, ofp2);
+    numFF++;
+  }
+  fclose(fp);
+  fclose(ofp);
+  fclose(ofp2);
+  return numFF;
+}
+
+/*****************************************************************/
+s32 combPartsExt(multi_file_t *prelF, char *colName, u32 maxRelsInFF,
+                 u32 minFull, s64 maxMem, u32 *numRels)
+/*****************************************************************/
+/* Combine the partial relations of 'prelF' into full            */
+/* relation-sets, using at most about 'maxMem' bytes of RAM      */
+/* beyond that needed for one processed file. If there are at    */
+/* least 'minFull' of them, the unprocessed column file and its  */
+/* index are written, as getCols() does from the output of       */
+/* combParts(). Return value: the number of full relation-sets.  */
+/*****************************************************************/
+{ xc_state_t X;
+  s32 level = (s32)(1.5*MAX_RELS_IN_FF), numFF, pass=0;
+  s64 numDead, numSingletons, numRemoved, numAdds;
+
+  memset(&X, 0x00, sizeof(X));
+  X.maxMem = MAX(maxMem, XC_MIN_MEM);
+  xc_initSets(&X, prelF);
+  *numRels = (u32)X.numSets;
+  printf("There are %" PRId64 " large prime occurences in %" PRId64 " relations.\n",
+         X.numKeys, X.numSets);
+  msgLog(NULL, "largePrimeOccurences: %" PRId64 " , relations: %" PRId64,
+         X.numKeys, X.numSets);
+  /* A quarter of the memory for the pairs of a pass, and another */
+  /* quarter for their pivots.                                    */
+  X.maxPairs = (s32)MIN((X.maxMem/4)/(sizeof(lpair_t) + 2*sizeof(s32)), 0x7FFFFFFF);
+  X.maxPoolSize = (s32)MIN((X.maxMem/4)/sizeof(s32), 0x7FFFFFFF);
+  X.pairs = (lpair_t *)lxmalloc(X.maxPairs*sizeof(lpair_t), 1);
+  X.pivots = (s32 *)lxmalloc(X.maxPairs*sizeof(s32), 1);
+  X.poolIndex = (s32 *)lxmalloc(X.maxPairs*sizeof(s32), 1);
+  X.pool = (s32 *)lxmalloc(X.maxPoolSize*sizeof(s32), 1);
+  X.dead = (u32 *)lxcalloc(((X.numSets>>5)+1)*sizeof(u32), 1);
+
+  /* The first pass sees all the large primes: list them then. */
+  if (!(X.lpfp = fopen(XC_LP_FILE, "wb"))) {
+    fprintf(stderr, "combPartsExt() : Error opening %s for write!\n", XC_LP_FILE);
+    exit(-1);
+  }
+  do {
+    pass++;
+    /* Remove the singletons until there are none left. */
+    for (numSingletons=0; (numDead = xc_markSingletons(&X)) > 0; numSingletons += numDead)
+      xc_rewrite(&X);
+    numAdds = xc_findMerges(&X, level, &numRemoved);
+    if (numAdds + numRemoved > 0)
+      xc_rewrite(&X);
+    printf("Pass %" PRId32 ": %" PRId64 " singletons, %" PRId64 " merges, %" PRId64 " removed (%d shards): %"
+           PRId64 " sets, %" PRId64 " full.\n", pass, numSingletons, numAdds, numRemoved,
+           X.numShards, X.numSets, X.numFull);
+  } while (numAdds + numRemoved > 0);
+  msgLog("", "combPartsExt: %" PRId64 " full relation-sets after %" PRId32 " passes.",
+         X.numFull, pass);
+  free(X.pairs); free(X.pivots); free(X.poolIndex); free(X.pool); free(X.dead);
+
+  numFF = (s32)X.numFull;
+  if (numFF >= (s32)minFull)
+    numFF = xc_writeCols(&X, colName, maxRelsInFF, minFull);
+  xc_remove(XC_SET_FILE, X.cur);
+  return numFF;
+}
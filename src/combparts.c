@@ -820,6 +820,52 @@ s32 removeHeavyRelSets(llist_t *R, llist_t *P, s32 maxRelsInRS, u32 minFull)
   return R->numFields;
 }
 
+/****************************************************************************/
+static u32 finishRelSets(llist_t *R, llist_t *P, u32 maxRelsInFF, u32 minFF,
+                         u32 minFull, u32 full)
+/****************************************************************************/
+/* Keep only the full relation-sets, reduce their weight and drop the heavy */
+/* ones. Common to combParts() and combPartsGraph().                        */
+/****************************************************************************/
+{ s32 wt0, wt1;
+  double shrink;
+
+  /* Drop any relation-sets still containing a large prime: */
+  keepFulls(R, P); 
+  printf("After keepFulls(), R->numFields = %" PRId32 "\n", R->numFields);
+
+  /* Don't bother with the weight reduction unless we're close
+     to having enough relations.
+  */
+  if (full < minFF) {
+    return full;
+  }
+#ifdef RS_WT_REDUCTION
+  printf("Reducing the weight of relation sets. This is painfully\n");
+  printf("slow at the moment, but it's worth it.\n");
+  do {
+    wt0 = R->index[R->numFields];
+    reduceRelSets(R, P);
+    wt1 = R->index[R->numFields];
+    msgLog("", "reduceRelSets dropped relation-set weight from %" PRId32 " to %" PRId32 ".",
+           wt0, wt1);
+    shrink = (double)(wt0-wt1)/wt0;
+  }  while (shrink > 0.15);
+#endif
+  full = removeHeavyRelSets(R, P, maxRelsInFF, minFull);
+  msgLog("", "After removing heavy rel-sets, weight is %" PRId32 ".", R->index[R->numFields]);
+  printf("After removing heavy rel-sets, weight is %" PRId32 ".\n", R->index[R->numFields]);
+  if (ll_verify(R)) {
+    printf("ll_verify() reported an error for R!\n");
+    exit(-1);
+  }
+  if (ll_verify(P)) {
+    printf("ll_verify() reported an error for P!\n");
+    exit(-1);
+  }
+  return full;
+}
+
 /****************************************************************************/
 u32 combParts(llist_t *R, llist_t *P, u32 maxRelsInFF, u32 minFF, u32 minFull)
 /****************************************************************************/
@@ -851,10 +897,9 @@ u32 combParts(llist_t *R, llist_t *P, u32 maxRelsInFF, u32 minFF, u32 minFull)
   an optimal algorithm which is at the same time efficient.
 */
 /**************************************************************/ 
-{ s32 i, wt0, wt1;
+{ s32 i;
   u32 lastFull, full;
   int  pass=0;
-  double shrink;
 
   /* We can reallocate if necessary. So if this seems to be way
      too much memory, decrease it at will.
@@ -890,38 +935,261 @@ u32 combParts(llist_t *R, llist_t *P, u32 maxRelsInFF, u32 minFF, u32 minFull)
     printf("* There are now %" PRId32 " full relations.\n", full);
   } while ((lastFull < full) || pass < 1);
 
-  /* Drop any relation-sets still containing a large prime: */
-  keepFulls(R, P); 
-  printf("After keepFulls(), R->numFields = %" PRId32 "\n", R->numFields);
+  return finishRelSets(R, P, maxRelsInFF, minFF, minFull, full);
+}
 
-  /* Don't bother with the weight reduction unless we're close
-     to having enough relations.
-  */
-  if (full < minFF) {
-    return full;
+#define GRAPH_MAX_PATH (2*MAX_RELS_IN_FF)
+/*************************************************************/
+static s32 ufFind(s32 *parent, s32 x)
+/*************************************************************/
+/* Union-find lookup, with path halving.                     */
+/*************************************************************/
+{
+  while (parent[x] != x) {
+    parent[x] = parent[parent[x]];
+    x = parent[x];
   }
-#ifdef RS_WT_REDUCTION
-  printf("Reducing the weight of relation sets. This is painfully\n");
-  printf("slow at the moment, but it's worth it.\n");
-  do {
-    wt0 = R->index[R->numFields];
-    reduceRelSets(R, P);
-    wt1 = R->index[R->numFields];
-    msgLog("", "reduceRelSets dropped relation-set weight from %" PRId32 " to %" PRId32 ".",
-           wt0, wt1);
-    shrink = (double)(wt0-wt1)/wt0;
-  }  while (shrink > 0.15);
-#endif
-  full = removeHeavyRelSets(R, P, maxRelsInFF, minFull);
-  msgLog("", "After removing heavy rel-sets, weight is %" PRId32 ".", R->index[R->numFields]);
-  printf("After removing heavy rel-sets, weight is %" PRId32 ".\n", R->index[R->numFields]);
-  if (ll_verify(R)) {
-    printf("ll_verify() reported an error for R!\n");
-    exit(-1);
+  return x;
+}
+
+/*************************************************************/
+static int edgeEnds(llist_t *P, s32 f, s32 *u, s32 *v)
+/*************************************************************/
+/* If relation-set f has one or two large primes, it is an   */
+/* edge of the large prime graph: put its ends in u and v    */
+/* and return 1. Vertex 0 is '1', and large prime index i is */
+/* vertex i+1.                                               */
+/*************************************************************/
+{ s32 k = FIELDSIZE(P, f);
+
+  if ((k < 1) || (k > 2))
+    return 0;
+  *u = (k==1) ? 0 : P->data[P->index[f]]+1;
+  *v = P->data[P->index[f]+k-1]+1;
+  return 1;
+}
+
+/*************************************************************/
+static int addFullRelSet(llist_t *R, llist_t *P, s32 *fields, s32 num, int level)
+/*************************************************************/
+/* Append the sum (mod 2) of the given relation-sets, if it  */
+/* is full and has at most 'level' relations.                */
+/*************************************************************/
+{ s32 i, numRels=0, numLP=0;
+  s32 rels[GRAPH_MAX_PATH+1], lps[GRAPH_MAX_PATH+1];
+
+  for (i=0; i<num; i++) {
+    if ((numRels + FIELDSIZE(R, fields[i]) > GRAPH_MAX_PATH) ||
+        (numLP + FIELDSIZE(P, fields[i]) > GRAPH_MAX_PATH))
+      return 0;
+    memcpy(rels+numRels, R->data+R->index[fields[i]], FIELDSIZE(R, fields[i])*sizeof(s32));
+    numRels += FIELDSIZE(R, fields[i]);
+    memcpy(lps+numLP, P->data+P->index[fields[i]], FIELDSIZE(P, fields[i])*sizeof(s32));
+    numLP += FIELDSIZE(P, fields[i]);
+  }
+  numRels = removeS32Pairs(rels, numRels);
+  numLP = removeS32Pairs(lps, numLP);
+  if ((numLP > 0) || (numRels == 0) || (numRels > level))
+    return 0;
+  ll_appendField(R, rels, numRels);
+  ll_appendField(P, NULL, 0);
+  return 1;
+}
+
+/*************************************************************/
+s32 graphPass(llist_t *R, llist_t *P, int level)
+/*************************************************************/
+/* Find the full relation-sets among those with one or two   */
+/* large primes without any merge passes: count the cycles   */
+/* of the large prime graph with a union-find, then take a   */
+/* BFS spanning forest and append the fundamental cycle of   */
+/* each edge not in it as a new (full) relation-set, if it   */
+/* has at most 'level' relations. BFS trees have short paths */
+/* to their roots, so these are short cycles, and they are   */
+/* independent. A relation-set with more large primes is     */
+/* completed the same way, with the tree paths from each of  */
+/* its large primes. The relation-sets so used are deleted.  */
+/* Return value: the number of relation-sets appended.       */
+/*************************************************************/
+{ s32  i, j, x=0, y=0, u, v, a, b, f, numV, numEdges=0, numCycles=0;
+  s32  numLong=0, numAdded=0, len, qHead, qTail, numRemove=0;
+  s32 *parent, *start, *adj, *depth, *pEdge, *queue, *remove;
+  s32  path[GRAPH_MAX_PATH+8];
+
+  numV = getMaxEntry(P) + 2;
+  parent = (s32 *)lxmalloc(numV*sizeof(s32), 1);
+  start = (s32 *)lxcalloc((numV+1)*sizeof(s32), 1);
+  for (i=0; i<numV; i++)
+    parent[i] = i;
+  /* One pass: each edge joining two components is in the spanning */
+  /* forest, and each other edge closes one independent cycle.      */
+  for (i=0; i<P->numFields; i++) {
+    if (!(edgeEnds(P, i, &u, &v)))
+      continue;
+    numEdges++;
+    start[u]++; start[v]++;
+    a = ufFind(parent, u);
+    b = ufFind(parent, v);
+    if (a == b)
+      numCycles++;
+    else
+      parent[a] = b;
+  }
+  free(parent);
+  printf("graphPass(): %" PRId32 " relation-sets with 1 or 2 large primes, %" PRId32 " cycles.\n",
+         numEdges, numCycles);
+  msgLog("", "graphPass: edges: %" PRId32 " , cycles: %" PRId32, numEdges, numCycles);
+  if (numCycles == 0) {
+    free(start);
+    return 0;
+  }
+
+  /* Adjacency lists, holding the field of each edge. */
+  for (i=0, j=0; i<=numV; i++) {
+    x = start[i];
+    start[i] = j;
+    j += x;
+  }
+  adj = (s32 *)lxmalloc((2*numEdges+1)*sizeof(s32), 1);
+  depth = (s32 *)lxcalloc(numV*sizeof(s32), 1);
+  for (i=0; i<P->numFields; i++) {
+    if (edgeEnds(P, i, &u, &v)) {
+      adj[start[u] + depth[u]++] = i;
+      if (v != u)
+        adj[start[v] + depth[v]++] = i;
+    }
+  }
+  /* (depth[] was only used as a fill counter for that.) */
+
+  /* BFS spanning forest, rooted at '1' where possible. */
+  pEdge = (s32 *)lxmalloc(numV*sizeof(s32), 1);
+  queue = (s32 *)lxmalloc(numV*sizeof(s32), 1);
+  for (i=0; i<numV; i++) {
+    depth[i] = -1;
+    pEdge[i] = -1;
+  }
+  for (i=0; i<numV; i++) {
+    if ((depth[i] >= 0) || (start[i] == start[i+1]))
+      continue;
+    depth[i] = 0;
+    queue[0] = i;
+    for (qHead=0, qTail=1; qHead < qTail; qHead++) {
+      x = queue[qHead];
+      for (j=start[x]; j<start[x+1]; j++) {
+        edgeEnds(P, adj[j], &u, &v);
+        y = (u==x) ? v : u;
+        if (depth[y] < 0) {
+          depth[y] = depth[x]+1;
+          pEdge[y] = adj[j];
+          queue[qTail++] = y;
+        }
+      }
+    }
+  }
+  free(queue); free(adj); free(start);
+
+  /* The fundamental cycle of each non-tree edge. A relation-set with */
+  /* more large primes is made full with the tree paths from each of  */
+  /* them to its root, if they meet at the roots (mod 2).             */
+  remove = (s32 *)lxmalloc((P->numFields+1)*sizeof(s32), 1);
+  for (i=0; i<P->numFields; i++) {
+    len = 0;
+    path[len++] = i;
+    if (edgeEnds(P, i, &u, &v)) {
+      if ((pEdge[u]==i) || (pEdge[v]==i))
+        continue;
+      a = u; b = v;
+      while ((a != b) && (len <= GRAPH_MAX_PATH)) {
+        if (depth[a] >= depth[b]) {
+          f = pEdge[a];
+          edgeEnds(P, f, &x, &y);
+          a = (x==a) ? y : x;
+        } else {
+          f = pEdge[b];
+          edgeEnds(P, f, &x, &y);
+          b = (x==b) ? y : x;
+        }
+        path[len++] = f;
+      }
+    } else if (FIELDSIZE(P, i) > 2) {
+      for (j=P->index[i]; j<P->index[i+1]; j++) {
+        a = P->data[j]+1;
+        if (depth[a] < 0)
+          break;
+        while ((pEdge[a] >= 0) && (len <= GRAPH_MAX_PATH)) {
+          f = pEdge[a];
+          edgeEnds(P, f, &x, &y);
+          a = (x==a) ? y : x;
+          path[len++] = f;
+        }
+      }
+      if (j < P->index[i+1])
+        continue;
+    } else
+      continue;
+    if ((len <= GRAPH_MAX_PATH) && addFullRelSet(R, P, path, len, level)) {
+      remove[numRemove++] = i;
+      numAdded++;
+    } else
+      numLong++;
   }
+  free(pEdge); free(depth);
+  ll_deleteFields(R, remove, numRemove);
+  ll_deleteFields(P, remove, numRemove);
+  free(remove);
+  printf("graphPass(): %" PRId32 " full relation-sets added, %" PRId32 " too heavy.\n",
+         numAdded, numLong);
+  return numAdded;
+}
+
+/****************************************************************************/
+u32 combPartsGraph(llist_t *R, llist_t *P, u32 maxRelsInFF, u32 minFF, u32 minFull)
+/****************************************************************************/
+/* As combParts(), but the relation-sets are combined by graphPass() in one */
+/* go. The merge passes of combParts() are only made for what is left of   */
+/* the relation-sets with more than two large primes.                       */
+/****************************************************************************/
+{ s32 i, lastSize, lastWt, numHeavy;
+  u32 lastFull, full;
+  int  pass=0;
+
   if (ll_verify(P)) {
-    printf("ll_verify() reported an error for P!\n");
+    printf("ll_verify() reported an error!\n");
     exit(-1);
   }
-  return full;
+  if (ll_init(R, P->maxDataSize, P->maxFields)) {
+    fprintf(stderr, "combPartsGraph: ll_init() reports severe error!\n");
+    exit(-1);
+  }
+  for (i=0; i<P->numFields; i++) {
+    ll_appendField(R, &i, 1);
+  }
+  do {
+    lastSize = P->numFields;
+    removeLPSingletons(R, P);
+  } while (P->numFields < lastSize);
+
+  graphPass(R, P, (s32)(1.5*MAX_RELS_IN_FF));
+
+  for (i=0, full=0, numHeavy=0; i<P->numFields; i++) {
+    if (FIELDSIZE(P, i) == 0)
+      full++;
+    else if (FIELDSIZE(P, i) > 2)
+      numHeavy++;
+  }
+  printf("* There are now %" PRId32 " full relations, and %" PRId32 " relation-sets with\n"
+         "  more than 2 large primes.\n", full, numHeavy);
+  /* The trees the heavy relation-sets hang on take a few passes */
+  /* to merge down, so keep going while the large primes shrink. */
+  if (numHeavy > 0) {
+    do {
+      printf("  pass %d...\n", ++pass);
+      lastFull = full;
+      lastWt = P->index[P->numFields];
+      full = makePass(R, P);
+      checkR(R);
+      printf("* There are now %" PRId32 " full relations.\n", full);
+    } while ((lastFull < full) || (P->index[P->numFields] < lastWt));
+  }
+  return finishRelSets(R, P, maxRelsInFF, minFF, minFull, full);
 }
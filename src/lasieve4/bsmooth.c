@@ -0,0 +1,177 @@
+/**************************************************************/
+/* bsmooth.c                                                  */
+/* Bernstein's batch smoothness test, for the cofactors left  */
+/* over by the trial division of the lattice siever: with P   */
+/* the product of the primes in ]lo,hi], a number n without   */
+/* prime factors up to lo has all its prime factors up to hi  */
+/* iff n divides P^(2^e) for 2^e >= log(n)/log(lo). P mod n   */
+/* is computed for a whole batch of n at once, from P mod     */
+/* (the product of the batch), down a remainder tree.         */
+/**************************************************************/
+/*  This file is part of GGNFS.
+*
+*   GGNFS is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   GGNFS is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with GGNFS; if not, write to the Free Software
+*   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <gmp.h>
+#include "lasieve.h"
+
+/* Cache file: BS_MAGIC, lo, hi (u32), then P by mpz_out_raw(). */
+#define BS_MAGIC 0x31505342
+
+/**************************************************/
+static void bs_primeprod(mpz_t P, u32_t lo, u32_t hi)
+/**************************************************/
+/* P = product of the primes in ]lo,hi]. Products   */
+/* of about equal size are multiplied, as they come */
+/* in, so that this takes O(M(log P) log log P).    */
+/**************************************************/
+{ pr32_struct ps;
+  mpz_t st[64];
+  size_t nst = 0, k;
+  u32_t p, np = 0;
+
+  initprime32(&ps);
+  mpz_init_set_ui(st[0], 1);
+  for (p = pr32_seek(&ps, lo + 1); p != 0 && p <= hi; p = nextprime32(&ps)) {
+    mpz_mul_ui(st[nst], st[nst], p);
+    if (++np < 64)
+      continue;
+    np = 0;
+    while (nst > 0 && mpz_size(st[nst - 1]) <= mpz_size(st[nst])) {
+      mpz_mul(st[nst - 1], st[nst - 1], st[nst]);
+      mpz_clear(st[nst--]);
+    }
+    mpz_init_set_ui(st[++nst], 1);
+  }
+  for (k = nst; k > 0; k--) {
+    mpz_mul(st[k - 1], st[k - 1], st[k]);
+    mpz_clear(st[k]);
+  }
+  mpz_swap(P, st[0]);
+  mpz_clear(st[0]);
+  clearprime32(&ps);
+}
+
+/**************************************************/
+void bsmooth_product(mpz_t P, u32_t lo, u32_t hi, const char *cache)
+/**************************************************/
+/* P = product of the primes in ]lo,hi], from the   */
+/* file cache if it has the product for these       */
+/* bounds, else computed and written to cache.      */
+/**************************************************/
+{ FILE *f;
+  u32_t head[3];
+  char *tmp;
+
+  if ((f = fopen(cache, "rb")) != NULL) {
+    if (read_u32(f, head, 3) == 3 && head[0] == BS_MAGIC && head[1] == lo &&
+        head[2] == hi && mpz_inp_raw(P, f) != 0) {
+      fclose(f);
+      return;
+    }
+    fclose(f);
+  }
+  bs_primeprod(P, lo, hi);
+  /* Written under another name first, so that a sieving job started */
+  /* at the same time does not read half a file.                     */
+  tmp = xmalloc(strlen(cache) + 16);
+  sprintf(tmp, "%s.tmp%u", cache, (unsigned int)getpid());
+  if ((f = fopen(tmp, "wb")) == NULL) {
+    errprintf("Cannot write %s: %m\n", tmp);
+    free(tmp);
+    return;
+  }
+  head[0] = BS_MAGIC;
+  head[1] = lo;
+  head[2] = hi;
+  if (write_u32(f, head, 3) != 3 || mpz_out_raw(f, P) == 0) {
+    errprintf("Cannot write %s: %m\n", tmp);
+    fclose(f);
+    remove(tmp);
+  } else if (fclose(f) != 0 || rename(tmp, cache) != 0) {
+    errprintf("Cannot write %s: %m\n", cache);
+    remove(tmp);
+  }
+  free(tmp);
+}
+
+/**************************************************/
+void bsmooth_test(mpz_t P, mpz_ptr *n, size_t nn, u32_t lo, unsigned char *smooth)
+/**************************************************/
+/* smooth[k] = 1 if all prime factors of n[k] > 1   */
+/* divide P, 0 otherwise. The n[k] have no prime    */
+/* factors up to lo.                                */
+/**************************************************/
+{ mpz_t **T;
+  size_t *len, h, k, i;
+  u32_t lb;
+
+  if (nn == 0)
+    return;
+  for (h = 0; ((size_t)1 << h) < nn; h++);
+  T = xmalloc((h + 1) * sizeof(*T));
+  len = xmalloc((h + 1) * sizeof(*len));
+
+  /* Product tree; T[0] are the n[k]. */
+  len[0] = nn;
+  T[0] = xmalloc(nn * sizeof(**T));
+  for (i = 0; i < nn; i++)
+    mpz_init_set(T[0][i], n[i]);
+  for (k = 1; k <= h; k++) {
+    len[k] = (len[k - 1] + 1) / 2;
+    T[k] = xmalloc(len[k] * sizeof(**T));
+    for (i = 0; i < len[k]; i++) {
+      mpz_init(T[k][i]);
+      if (2 * i + 1 < len[k - 1])
+        mpz_mul(T[k][i], T[k - 1][2 * i], T[k - 1][2 * i + 1]);
+      else
+        mpz_set(T[k][i], T[k - 1][2 * i]);
+    }
+  }
+
+  /* Remainder tree, replacing the products from the top down. */
+  mpz_mod(T[h][0], P, T[h][0]);
+  for (k = h; k > 0; k--) {
+    for (i = 0; i < len[k - 1]; i++)
+      mpz_mod(T[k - 1][i], T[k][i / 2], T[k - 1][i]);
+    for (i = 0; i < len[k]; i++)
+      mpz_clear(T[k][i]);
+    free(T[k]);
+  }
+
+  for (lb = 0; lo >> (lb + 1) != 0; lb++);
+  if (lb == 0)
+    lb = 1;
+  for (i = 0; i < nn; i++) {
+    size_t m;
+
+    /* n[i] has at most m prime factors, counted with multiplicity. */
+    m = mpz_sizeinbase(n[i], 2) / lb;
+    for (k = 1; k < m && mpz_sgn(T[0][i]) != 0; k *= 2) {
+      mpz_mul(T[0][i], T[0][i], T[0][i]);
+      mpz_mod(T[0][i], T[0][i], n[i]);
+    }
+    smooth[i] = mpz_sgn(T[0][i]) == 0;
+    mpz_clear(T[0][i]);
+  }
+  free(T[0]);
+  free(T);
+  free(len);
+}
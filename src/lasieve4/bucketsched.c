@@ -0,0 +1,113 @@
+/* Bucket scheduling function for the lattice siever.
+Derived from lasched.c, Copyright (C) 2002 Jens Franke, T. Kleinjung.
+This file is part of gnfs4linux, distributed under the terms of the
+GNU General Public Licence and WITHOUT ANY WARRANTY.
+
+You should have received a copy of the GNU General Public License along
+with this program; see the file COPYING.  If not, write to the Free
+Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA. */
+
+/* Like lasched(), but each sieve location goes to the bucket of its
+   strip as one 64-bit record
+
+     bits  0..15  offset in the strip,
+     bits 16..23  log of the prime,
+     bits 32..63  factor base index - fbi_offs,
+
+   so a schedule needs neither pieces of at most 2^16 primes of equal
+   log, nor a fixed amount of memory per strip. Primes are larger than
+   L1_SIZE, so a prime hits each line of a strip at most once, except
+   for line 0, which it hits everywhere if it divides the norm of
+   (a0,b0). bucketsched() returns after the first prime which took
+   some bucket beyond its limit (and after n_fb primes otherwise), with
+   the number of primes done; the caller makes room and calls again. */
+
+/* Compiled through sched-kernel.h, after lasieve.h. */
+
+#ifndef BUCKETSCHED_ONCE
+#define BUCKETSCHED_ONCE
+#if defined(BUCKET_STREAM) && defined(__SSE2__) && defined(__x86_64__)
+#include <emmintrin.h>
+/* The buckets are written once and read much later, so they need
+   not take the place of the sieve interval in the cache. But the
+   stores go to many buckets at once, which is more than the write
+   combining buffers of current CPUs can merge: with I=12 or 13 and
+   factor bases up to 3e7, -DBUCKET_STREAM was slower or no faster. */
+#define BUCKET_STORE(p, x) _mm_stream_si64((long long *)(p), (long long)(x))
+#define BUCKET_FENCE()     _mm_sfence()
+#else
+#define BUCKET_STORE(p, x) (*(p) = (x))
+#define BUCKET_FENCE()
+#endif
+#endif
+
+#define L1_SIZE (1<<L1_BITS)
+#define i_bits (I_bits-1)
+#define n_i (1<<i_bits)
+
+u32_t
+bucketsched(u32_t *ri, u32_t *ij_ptr, u32_t n_fb, u32_t n1_j,
+            u64_t **bucket_ptr, u64_t **bucket_lim, u32_t fbi_offs,
+            unsigned char *logs, u32_t ot)
+{
+  u32_t ij,ij_ub,n,full;
+  u32_t ot_mask=0,ot_tester=0;
+
+  ij_ub=n1_j<<i_bits;
+
+  if(ot!=0) {
+    ot_tester=(ot&1)|((ot&2)<<(i_bits-1));
+    ot_mask=n_i|1;
+  }
+
+  for (n = 0, full = 0; n < n_fb && full == 0; n++) {
+    u32_t a,b;
+    u64_t rec;
+
+    a=n_i-(ri[0]&(n_i-1));
+    b=n_i-(ri[1]&(n_i-1));
+    if(ot == 0) ij=ij_ptr[n];
+    else
+{
+  ij=0;
+  if( (ri[0]&ot_mask) == ot_tester ) ij=ri[0];
+  else {
+    if( (ri[1]&ot_mask) == (ot_tester^n_i) ) ij=ri[1];
+    else {
+      if((ri[0]&(n_i-1))<=(ri[1]&(n_i-1)) && ri[0]<=ri[1]) {
+	if((ri[0]&(n_i-1))==(ri[1]&(n_i-1))) ij=ri[1]-ri[0];
+	else ij=n_i;
+	if(ot != 2)
+	  Schlendrian("Exceptional situation for oddness type %u ?\n",
+		      ot);
+      }
+      else ij=ri[0]+ri[1];
+    }
+  }
+  ij=(ij+((~ot_tester)&n_i))/2;
+}
+    rec=((u64_t)(fbi_offs+n)<<32) | ((u64_t)logs[n]<<16);
+    while(ij<ij_ub) {
+      u32_t i,k;
+      u64_t *p;
+
+      k=ij>>L1_BITS;
+      p=bucket_ptr[k];
+      BUCKET_STORE(p, rec | (ij&(L1_SIZE-1)));
+      bucket_ptr[k]=++p;
+      full|=(p>bucket_lim[k]);
+      i=ij&(n_i-1);
+      if(i<b) ij+=ri[0];
+      if(i>=a) ij+=ri[1];
+    }
+    ri+=2;
+    ij_ptr[n]=ij-ij_ub;
+  }
+  BUCKET_FENCE();
+  return n;
+}
+
+#undef L1_SIZE
+#undef i_bits
+#undef n_i
@@ -0,0 +1,325 @@
+/**************************************************************/
+/* candsearch.c                                               */
+/* The candidate search of the lattice siever: find the bytes */
+/* of a piece of the sieve interval which are >= a threshold. */
+/* There is a portable kernel, which tests a machine word at  */
+/* a time, and SSE2, AVX2 and AVX-512BW kernels on x86-64,    */
+/* one of which is picked at run time (-C).                   */
+/**************************************************************/
+/*  This file is part of GGNFS.
+*
+*   GGNFS is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   GGNFS is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with GGNFS; if not, write to the Free Software
+*   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lasieve.h"
+
+#ifdef CANDSEARCH_SIMD
+#include <immintrin.h>
+#endif
+
+/* A candidate at p: its offset from base, and its sieve value plus */
+/* the horizontal sieve sum of its line.                            */
+#define CS_TEST(p) \
+  if (*(p) >= st1) { \
+    cand[n] = (u16_t)((p) - base); \
+    fss[n++] = (unsigned char)(*(p) + hs); \
+  }
+
+typedef unsigned long bc_t;
+#define BC_ONES ((~0UL)/0xFFU)
+#define BC_MASK (BC_ONES*0x80U)
+
+/**************************************************/
+static u32_t cs_scalar(unsigned char st1, unsigned char *lo, unsigned char *hi,
+                       unsigned char *base, u16_t *cand, unsigned char *fss,
+                       unsigned char hs)
+/**************************************************/
+/* The reference kernel. A word with no byte >= st1 */
+/* is skipped after one or two tests of its bits.   */
+/**************************************************/
+{ u32_t n = 0;
+  unsigned char *p;
+
+  for (p = lo; p < hi && ((size_t)p & (sizeof(bc_t) - 1)); p++)
+    CS_TEST(p);
+  if (st1 < 0x80) {
+    bc_t bc = BC_MASK - (BC_ONES * st1);
+
+    for (; p + sizeof(bc_t) <= hi; p += sizeof(bc_t)) {
+      bc_t v = *(bc_t *)p;
+      unsigned char *q;
+
+      if (((v & BC_MASK) | ((v + bc) & BC_MASK)) == 0)
+        continue;
+      for (q = p; q < p + sizeof(bc_t); q++)
+        CS_TEST(q);
+    }
+  } else {
+    for (; p + sizeof(bc_t) <= hi; p += sizeof(bc_t)) {
+      unsigned char *q;
+
+      if ((*(bc_t *)p & BC_MASK) == 0)
+        continue;
+      for (q = p; q < p + sizeof(bc_t); q++)
+        CS_TEST(q);
+    }
+  }
+  for (; p < hi; p++)
+    CS_TEST(p);
+  return n;
+}
+
+#ifdef CANDSEARCH_SIMD
+/* Append the candidates flagged in the bit mask m, for the bytes */
+/* starting at p.                                                 */
+#define CS_MASK(m, p) \
+  while (m != 0) { \
+    unsigned char *q = (p) + __builtin_ctzll(m); \
+    cand[n] = (u16_t)(q - base); \
+    fss[n++] = (unsigned char)(*q + hs); \
+    m &= m - 1; \
+  }
+
+/* The bits of the bytes >= st1 among the 16 (32) at p. */
+#define CS_SSE2_BITS(p) \
+  (0xFFFFULL & ~(u32_t)_mm_movemask_epi8(_mm_cmpeq_epi8( \
+     _mm_max_epu8(_mm_loadu_si128((__m128i *)(p)), t), t)))
+#define CS_AVX2_BITS(p) \
+  (0xFFFFFFFFULL & ~(u32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8( \
+     _mm256_max_epu8(_mm256_loadu_si256((__m256i *)(p)), t), t)))
+
+/**************************************************/
+static u32_t cs_sse2(unsigned char st1, unsigned char *lo, unsigned char *hi,
+                     unsigned char *base, u16_t *cand, unsigned char *fss,
+                     unsigned char hs)
+/**************************************************/
+/* Bytes x < st1 are those with max(x, st1-1) ==    */
+/* st1-1. The last piece of less than a vector is   */
+/* done by a load which ends at hi, whose bytes      */
+/* below p are masked off.                          */
+/**************************************************/
+{ u32_t n = 0;
+  unsigned char *p;
+  unsigned long long m;
+  __m128i t = _mm_set1_epi8((char)(st1 - 1));
+
+  for (p = lo; p + 64 <= hi; p += 64) {
+    __m128i x;
+
+    x = _mm_max_epu8(_mm_max_epu8(_mm_loadu_si128((__m128i *)p),
+                                  _mm_loadu_si128((__m128i *)(p + 16))),
+                     _mm_max_epu8(_mm_loadu_si128((__m128i *)(p + 32)),
+                                  _mm_loadu_si128((__m128i *)(p + 48))));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(x, t), t)) == 0xFFFF)
+      continue;
+    m = CS_SSE2_BITS(p);
+    CS_MASK(m, p);
+    m = CS_SSE2_BITS(p + 16);
+    CS_MASK(m, p + 16);
+    m = CS_SSE2_BITS(p + 32);
+    CS_MASK(m, p + 32);
+    m = CS_SSE2_BITS(p + 48);
+    CS_MASK(m, p + 48);
+  }
+  for (; p + 16 <= hi; p += 16) {
+    m = CS_SSE2_BITS(p);
+    CS_MASK(m, p);
+  }
+  if (p < hi) {
+    if (hi - lo >= 16) {
+      m = CS_SSE2_BITS(hi - 16) & (0xFFFFULL << (p - (hi - 16)));
+      CS_MASK(m, hi - 16);
+    } else {
+      for (; p < hi; p++)
+        CS_TEST(p);
+    }
+  }
+  return n;
+}
+
+/**************************************************/
+__attribute__((target("avx2")))
+static u32_t cs_avx2(unsigned char st1, unsigned char *lo, unsigned char *hi,
+                     unsigned char *base, u16_t *cand, unsigned char *fss,
+                     unsigned char hs)
+/**************************************************/
+{ u32_t n = 0;
+  unsigned char *p;
+  unsigned long long m;
+  __m256i t = _mm256_set1_epi8((char)(st1 - 1));
+
+  for (p = lo; p + 64 <= hi; p += 64) {
+    __m256i x;
+
+    x = _mm256_max_epu8(_mm256_loadu_si256((__m256i *)p),
+                        _mm256_loadu_si256((__m256i *)(p + 32)));
+    if ((u32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(x, t), t)) ==
+        0xFFFFFFFFU)
+      continue;
+    m = CS_AVX2_BITS(p);
+    CS_MASK(m, p);
+    m = CS_AVX2_BITS(p + 32);
+    CS_MASK(m, p + 32);
+  }
+  for (; p + 32 <= hi; p += 32) {
+    m = CS_AVX2_BITS(p);
+    CS_MASK(m, p);
+  }
+  if (p < hi) {
+    if (hi - lo >= 32) {
+      m = CS_AVX2_BITS(hi - 32) & (0xFFFFFFFFULL << (p - (hi - 32)));
+      CS_MASK(m, hi - 32);
+    } else {
+      for (; p < hi; p++)
+        CS_TEST(p);
+    }
+  }
+  return n;
+}
+
+/**************************************************/
+__attribute__((target("avx512f,avx512bw")))
+static u32_t cs_avx512(unsigned char st1, unsigned char *lo, unsigned char *hi,
+                       unsigned char *base, u16_t *cand, unsigned char *fss,
+                       unsigned char hs)
+/**************************************************/
+/* The tail is done with a masked load, so there is */
+/* no byte loop at all.                             */
+/**************************************************/
+{ u32_t n = 0;
+  unsigned char *p;
+  __m512i t = _mm512_set1_epi8((char)st1);
+
+  for (p = lo; p + 128 <= hi; p += 128) {
+    __m512i a, b;
+    unsigned long long m;
+
+    a = _mm512_loadu_si512((void *)p);
+    b = _mm512_loadu_si512((void *)(p + 64));
+    if (_mm512_cmpge_epu8_mask(_mm512_max_epu8(a, b), t) == 0)
+      continue;
+    m = _mm512_cmpge_epu8_mask(a, t);
+    CS_MASK(m, p);
+    m = _mm512_cmpge_epu8_mask(b, t);
+    CS_MASK(m, p + 64);
+  }
+  for (; p < hi; p += 64) {
+    unsigned long long m;
+    __mmask64 k = hi - p >= 64 ? ~0ULL : (1ULL << (hi - p)) - 1;
+
+    m = _mm512_mask_cmpge_epu8_mask(k, _mm512_maskz_loadu_epi8(k, p), t);
+    CS_MASK(m, p);
+  }
+  return n;
+}
+#endif
+
+typedef struct {
+  const char   *name;
+  candsearch_t  fn;
+  int           (*usable)(void);
+} cs_kernel_t;
+
+static int cs_always(void) { return 1; }
+#ifdef CANDSEARCH_SIMD
+static int cs_have_avx2(void) { return __builtin_cpu_supports("avx2"); }
+static int cs_have_avx512(void)
+{ return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+}
+#endif
+
+/* Best last. */
+static const cs_kernel_t cs_kernels[] = {
+  { "scalar", cs_scalar, cs_always },
+#ifdef CANDSEARCH_SIMD
+  { "sse2",   cs_sse2,   cs_always },
+  { "avx2",   cs_avx2,   cs_have_avx2 },
+  { "avx512", cs_avx512, cs_have_avx512 },
+#endif
+};
+#define CS_NKERNELS (sizeof(cs_kernels) / sizeof(cs_kernels[0]))
+
+static candsearch_t cs_checked;
+static const char  *cs_checked_name;
+
+/**************************************************/
+static u32_t cs_check(unsigned char st1, unsigned char *lo, unsigned char *hi,
+                      unsigned char *base, u16_t *cand, unsigned char *fss,
+                      unsigned char hs)
+/**************************************************/
+/* Run the selected kernel and the reference kernel */
+/* and stop if they find different candidates.      */
+/**************************************************/
+{ u32_t n, n1, i;
+  u16_t *cand1;
+  unsigned char *fss1;
+
+  n = cs_checked(st1, lo, hi, base, cand, fss, hs);
+  cand1 = xmalloc((hi - lo + 1) * sizeof(*cand1));
+  fss1 = xmalloc(hi - lo + 1);
+  n1 = cs_scalar(st1, lo, hi, base, cand1, fss1, hs);
+  if (n != n1)
+    complain("candidate search: %s found %u candidates, scalar %u (threshold %u, offset %u)\n",
+             cs_checked_name, n, n1, st1, (u32_t)(lo - base));
+  for (i = 0; i < n; i++)
+    if (cand[i] != cand1[i] || fss[i] != fss1[i])
+      complain("candidate search: %s and scalar differ at candidate %u (%u/%u, %u/%u)\n",
+               cs_checked_name, i, cand[i], cand1[i], fss[i], fss1[i]);
+  free(cand1);
+  free(fss1);
+  return n;
+}
+
+/**************************************************/
+int candsearch_select(const char *name, candsearch_t *fn, const char **chosen)
+/**************************************************/
+/* Pick the candidate search kernel 'name': scalar, */
+/* sse2, avx2, avx512, or auto (or NULL) for the    */
+/* best one this CPU has. "check" is auto, with     */
+/* every call compared against the scalar kernel.   */
+/* Return value: 0 on success, -1 if the kernel is  */
+/* unknown or not supported here.                   */
+/**************************************************/
+{ int k, check = 0;
+
+  if (name == NULL)
+    name = "auto";
+  if (strcmp(name, "check") == 0) {
+    check = 1;
+    name = "auto";
+  }
+  if (strcmp(name, "auto") == 0) {
+    for (k = CS_NKERNELS - 1; k > 0; k--)
+      if (cs_kernels[k].usable())
+        break;
+  } else {
+    for (k = 0; k < (int)CS_NKERNELS; k++)
+      if (strcmp(name, cs_kernels[k].name) == 0)
+        break;
+    if (k == (int)CS_NKERNELS || !cs_kernels[k].usable())
+      return -1;
+  }
+  *fn = cs_kernels[k].fn;
+  *chosen = cs_kernels[k].name;
+  if (check) {
+    cs_checked = cs_kernels[k].fn;
+    cs_checked_name = cs_kernels[k].name;
+    *fn = cs_check;
+  }
+  return 0;
+}
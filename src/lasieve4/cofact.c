@@ -0,0 +1,697 @@
+/**************************************************************/
+/* cofact.c                                                   */
+/* P-1 and ECM (Montgomery curves, Suyama parametrization)    */
+/* for the cofactors left over from the trial division of the */
+/* lattice siever. cofact_run() takes the cofactors of a      */
+/* whole batch of sieve reports and runs P-1, then one curve  */
+/* after another, over all of them which are still open, so  */
+/* that the easy ones are out of the way before anything      */
+/* expensive is done. The bounds depend on the size of the    */
+/* factors which are looked for. What is still open at the    */
+/* end is left to mpqs_factor().                              */
+/**************************************************************/
+/*  This file is part of GGNFS.
+*
+*   GGNFS is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   GGNFS is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with GGNFS; if not, write to the Free Software
+*   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gmp.h>
+#include "lasieve.h"
+
+/* Bounds by the number of bits of the factors looked for, i.e.   */
+/* min(lpbits, bits(n)/2). P-1 is run once, with B2 = 50 B1; then */
+/* up to 'curves' ECM curves with B2 = 25 B1.                     */
+static const struct {
+  u32_t bits, pm1_B1, ecm_B1, curves;
+} cf_plan[] = {
+  { 18, 100,  50,  3 },
+  { 22, 200,  80,  4 },
+  { 26, 300, 150,  6 },
+  { 30, 500, 250, 10 },
+  { 34, 800, 400, 16 },
+  {  0, 1200, 600, 24 }
+};
+#define CF_NPLANS (sizeof(cf_plan) / sizeof(cf_plan[0]))
+#define CF_PM1_B2 50
+#define CF_ECM_B2 25
+#define CF_B2_MAX (CF_PM1_B2 * 1200)
+#define CF_D 210
+/* mpqs_factor() does up to CF_MPQS_BITS bits. Up to there, it is  */
+/* faster than ECM on mpz, and as fast as ECM on 64 bit numbers     */
+/* once the factors have more than CF_ECM_BITS bits. So ECM is used */
+/* for n of more than CF_MPQS_BITS bits, or with small factors.     */
+#define CF_MPQS_BITS 96
+#define CF_ECM_BITS  28
+
+#if defined(__GNUC__) && defined(__SIZEOF_INT128__)
+#define CF_U64
+#define CF_U64_BITS 64
+#else
+#define CF_U64_BITS 0
+#endif
+
+static int cf_isinit = 0;
+static unsigned char *cf_isprime;       /* Odd numbers below CF_B2_MAX. */
+static u32_t cf_baby[CF_D / 4];         /* Odd j < D/2 prime to D.      */
+static u32_t cf_nbaby;
+static mpz_t cf_t[8], cf_a24, cf_acc, cf_g;
+static mpz_t cf_X[2], cf_Z[2];          /* Montgomery ladder.            */
+static mpz_t cf_GX[3], cf_GZ[3];        /* Giant steps, and DQ.          */
+static mpz_t cf_bX[CF_D / 2], cf_bZ[CF_D / 2];
+
+#define CF_ISPRIME(q) ((q) == 2 || (((q) & 1) && cf_isprime[(q) >> 1]))
+
+/**************************************************/
+static void cf_init(void)
+/**************************************************/
+{ u32_t i, j;
+
+  cf_isprime = xmalloc(CF_B2_MAX / 2 + 1);
+  memset(cf_isprime, 1, CF_B2_MAX / 2 + 1);
+  cf_isprime[0] = 0;
+  for (i = 3; i * i < CF_B2_MAX; i += 2)
+    if (cf_isprime[i >> 1])
+      for (j = i * i; j < CF_B2_MAX; j += 2 * i)
+        cf_isprime[j >> 1] = 0;
+  for (j = 1, cf_nbaby = 0; j < CF_D / 2; j += 2)
+    if (j % 3 != 0 && j % 5 != 0 && j % 7 != 0)
+      cf_baby[cf_nbaby++] = j;
+  for (i = 0; i < 8; i++)
+    mpz_init(cf_t[i]);
+  for (i = 0; i < 2; i++) {
+    mpz_init(cf_X[i]);
+    mpz_init(cf_Z[i]);
+  }
+  for (i = 0; i < 3; i++) {
+    mpz_init(cf_GX[i]);
+    mpz_init(cf_GZ[i]);
+  }
+  for (i = 0; i < CF_D / 2; i++) {
+    mpz_init(cf_bX[i]);
+    mpz_init(cf_bZ[i]);
+  }
+  mpz_init(cf_a24);
+  mpz_init(cf_acc);
+  mpz_init(cf_g);
+  cf_isinit = 1;
+}
+
+#define MULMOD(r, a, b) { mpz_mul(r, a, b); mpz_mod(r, r, n); }
+
+/**************************************************/
+static void cf_dbl(mpz_t X2, mpz_t Z2, mpz_t X, mpz_t Z, mpz_t n)
+/**************************************************/
+/* (X2:Z2) = 2(X:Z); may be done in place.          */
+/**************************************************/
+{
+  mpz_add(cf_t[0], X, Z);
+  mpz_mul(cf_t[0], cf_t[0], cf_t[0]);
+  mpz_sub(cf_t[1], X, Z);
+  mpz_mul(cf_t[1], cf_t[1], cf_t[1]);
+  mpz_sub(cf_t[2], cf_t[0], cf_t[1]);           /* 4XZ */
+  MULMOD(X2, cf_t[0], cf_t[1]);
+  MULMOD(cf_t[3], cf_t[2], cf_a24);
+  mpz_add(cf_t[3], cf_t[3], cf_t[1]);
+  MULMOD(Z2, cf_t[2], cf_t[3]);
+}
+
+/**************************************************/
+static void cf_add(mpz_t X3, mpz_t Z3, mpz_t X1, mpz_t Z1, mpz_t X2, mpz_t Z2,
+                   mpz_t Xd, mpz_t Zd, mpz_t n)
+/**************************************************/
+/* (X3:Z3) = P1 + P2, where P1 - P2 = (Xd:Zd). X3   */
+/* and Z3 may be X1, Z1 or X2, Z2, but not Xd, Zd.  */
+/**************************************************/
+{
+  mpz_sub(cf_t[0], X1, Z1);
+  mpz_add(cf_t[1], X2, Z2);
+  mpz_mul(cf_t[0], cf_t[0], cf_t[1]);
+  mpz_add(cf_t[1], X1, Z1);
+  mpz_sub(cf_t[2], X2, Z2);
+  mpz_mul(cf_t[1], cf_t[1], cf_t[2]);
+  mpz_add(cf_t[2], cf_t[0], cf_t[1]);
+  mpz_sub(cf_t[3], cf_t[0], cf_t[1]);
+  mpz_mod(cf_t[2], cf_t[2], n);
+  mpz_mod(cf_t[3], cf_t[3], n);
+  mpz_mul(cf_t[2], cf_t[2], cf_t[2]);
+  mpz_mul(cf_t[3], cf_t[3], cf_t[3]);
+  mpz_mod(cf_t[2], cf_t[2], n);
+  mpz_mod(cf_t[3], cf_t[3], n);
+  MULMOD(X3, Zd, cf_t[2]);
+  MULMOD(Z3, Xd, cf_t[3]);
+}
+
+/**************************************************/
+static void cf_mul(mpz_t X, mpz_t Z, u32_t k, mpz_t n)
+/**************************************************/
+/* (X:Z) = k(X:Z), k >= 1, by the Montgomery ladder. */
+/**************************************************/
+{ int b;
+
+  if (k == 1)
+    return;
+  mpz_set(cf_X[0], X);
+  mpz_set(cf_Z[0], Z);
+  cf_dbl(cf_X[1], cf_Z[1], X, Z, n);
+  for (b = 30; b >= 0 && (k >> b) == 0; b--);
+  for (b--; b >= 0; b--) {
+    if ((k >> b) & 1) {
+      cf_add(cf_X[0], cf_Z[0], cf_X[1], cf_Z[1], cf_X[0], cf_Z[0], X, Z, n);
+      cf_dbl(cf_X[1], cf_Z[1], cf_X[1], cf_Z[1], n);
+    } else {
+      cf_add(cf_X[1], cf_Z[1], cf_X[1], cf_Z[1], cf_X[0], cf_Z[0], X, Z, n);
+      cf_dbl(cf_X[0], cf_Z[0], cf_X[0], cf_Z[0], n);
+    }
+  }
+  mpz_set(X, cf_X[0]);
+  mpz_set(Z, cf_Z[0]);
+}
+
+/**************************************************/
+static int cf_pm1(mpz_t g, mpz_t n, u32_t B1)
+/**************************************************/
+/* P-1 with base 3, stage 2 up to CF_PM1_B2*B1, one  */
+/* prime at a time. Return value: 1 if g is a proper */
+/* factor of n, 0 otherwise.                         */
+/**************************************************/
+{ u32_t p, q, B2, d;
+  mpz_t *a = cf_t + 4, *x = cf_t + 5, *ad = cf_bX;
+
+  mpz_set_ui(*a, 3);
+  for (p = 2; p <= B1; p++) {
+    if (!CF_ISPRIME(p))
+      continue;
+    for (q = p; q <= B1 / p; q *= p);
+    mpz_powm_ui(*a, *a, q, n);
+  }
+  mpz_sub_ui(g, *a, 1);
+  mpz_gcd(g, g, n);
+  if (mpz_cmp_ui(g, 1) != 0)
+    return mpz_cmp(g, n) != 0;
+
+  /* ad[i] = a^(2i) for the gaps between consecutive primes. */
+  B2 = CF_PM1_B2 * B1;
+  mpz_mul(ad[1], *a, *a);
+  mpz_mod(ad[1], ad[1], n);
+  for (d = 2; d < CF_D / 2; d++)
+    MULMOD(ad[d], ad[d - 1], ad[1]);
+  for (p = B1 + 1; !CF_ISPRIME(p); p++);
+  mpz_powm_ui(*x, *a, p, n);
+  mpz_sub_ui(cf_acc, *x, 1);
+  for (q = p + 2; q <= B2; q += 2) {
+    if (!cf_isprime[q >> 1])
+      continue;
+    if ((q - p) / 2 >= CF_D / 2)
+      mpz_powm_ui(*x, *a, q, n);
+    else
+      MULMOD(*x, *x, ad[(q - p) / 2]);
+    p = q;
+    mpz_sub_ui(cf_t[6], *x, 1);
+    MULMOD(cf_acc, cf_acc, cf_t[6]);
+  }
+  mpz_gcd(g, cf_acc, n);
+  return mpz_cmp_ui(g, 1) != 0 && mpz_cmp(g, n) != 0;
+}
+
+
+/**************************************************/
+static int cf_curve(mpz_t g, mpz_t n, u32_t sigma)
+/**************************************************/
+/* Put the starting point of the curve with Suyama  */
+/* parameter sigma into cf_t[4]:cf_t[5], and its    */
+/* (A+2)/4 into cf_a24. Return value: 1 on success, */
+/* 0 if the setup hit a factor g of n.              */
+/**************************************************/
+{ mpz_t *X = cf_t + 4, *Z = cf_t + 5, *u = cf_t + 6, *v = cf_t + 7;
+
+  /* Suyama: u = sigma^2-5, v = 4 sigma, start at (u^3:v^3), */
+  /* (A+2)/4 = (v-u)^3 (3u+v) / (16 u^3 v).                  */
+  mpz_set_ui(*u, sigma);
+  mpz_mul(*u, *u, *u);
+  mpz_sub_ui(*u, *u, 5);
+  mpz_set_ui(*v, 4 * sigma);
+  mpz_powm_ui(*X, *u, 3, n);
+  mpz_powm_ui(*Z, *v, 3, n);
+  mpz_sub(cf_acc, *v, *u);
+  mpz_powm_ui(cf_acc, cf_acc, 3, n);
+  mpz_mul_ui(cf_a24, *u, 3);
+  mpz_add(cf_a24, cf_a24, *v);
+  MULMOD(cf_a24, cf_a24, cf_acc);
+  MULMOD(cf_g, *X, *v);
+  mpz_mul_ui(cf_g, cf_g, 16);
+  if (mpz_invert(cf_acc, cf_g, n) == 0) {
+    mpz_gcd(g, cf_g, n);
+    return 0;
+  }
+  MULMOD(cf_a24, cf_a24, cf_acc);
+  return 1;
+}
+
+/**************************************************/
+static int cf_ecm(mpz_t g, mpz_t n, u32_t B1, u32_t sigma)
+/**************************************************/
+/* One ECM curve, with baby step giant step stage 2  */
+/* up to CF_ECM_B2*B1. Return value as for cf_pm1(). */
+/**************************************************/
+{ u32_t p, q, m, m0, m1, i, j, B2;
+  mpz_t *X = cf_t + 4, *Z = cf_t + 5;
+
+  if (!cf_curve(g, n, sigma))
+    return mpz_cmp_ui(g, 1) != 0 && mpz_cmp(g, n) != 0;
+
+  for (p = 2; p <= B1; p++) {
+    if (!CF_ISPRIME(p))
+      continue;
+    for (q = p; q <= B1 / p; q *= p);
+    cf_mul(*X, *Z, q, n);
+  }
+  mpz_gcd(g, *Z, n);
+  if (mpz_cmp_ui(g, 1) != 0)
+    return mpz_cmp(g, n) != 0;
+
+  /* Baby steps: cf_bX[j]:cf_bZ[j] = jQ for odd j < D/2, */
+  /* with 2Q in cf_bX[0]:cf_bZ[0].                       */
+  mpz_set(cf_bX[1], *X);
+  mpz_set(cf_bZ[1], *Z);
+  cf_dbl(cf_bX[0], cf_bZ[0], *X, *Z, n);
+  cf_add(cf_bX[3], cf_bZ[3], cf_bX[0], cf_bZ[0], *X, *Z, *X, *Z, n);
+  for (i = 5; i < CF_D / 2; i += 2)
+    cf_add(cf_bX[i], cf_bZ[i], cf_bX[i - 2], cf_bZ[i - 2], cf_bX[0], cf_bZ[0],
+           cf_bX[i - 4], cf_bZ[i - 4], n);
+
+  /* Giant steps: G_m = mDQ for m0 <= m <= m1, so that mD +- j */
+  /* covers the primes in ]B1,B2] (those below D/2 excepted).   */
+  B2 = CF_ECM_B2 * B1;
+  m0 = (B1 + CF_D / 2) / CF_D;
+  if (m0 == 0)
+    m0 = 1;
+  m1 = (B2 + CF_D / 2) / CF_D;
+  mpz_set(cf_GX[2], *X);
+  mpz_set(cf_GZ[2], *Z);
+  cf_mul(cf_GX[2], cf_GZ[2], CF_D, n);
+  mpz_set(cf_GX[0], cf_GX[2]);
+  mpz_set(cf_GZ[0], cf_GZ[2]);
+  cf_mul(cf_GX[0], cf_GZ[0], m0, n);
+  mpz_set(cf_GX[1], cf_GX[2]);
+  mpz_set(cf_GZ[1], cf_GZ[2]);
+  cf_mul(cf_GX[1], cf_GZ[1], m0 + 1, n);
+  mpz_set_ui(cf_acc, 1);
+  for (m = m0; ; m++) {
+    for (i = 0; i < cf_nbaby; i++) {
+      j = cf_baby[i];
+      if ((m * CF_D + j <= B2 && cf_isprime[(m * CF_D + j) >> 1]) ||
+          (m * CF_D - j > B1 && cf_isprime[(m * CF_D - j) >> 1])) {
+        /* X_m Z_j - X_j Z_m vanishes mod p iff G_m = +-jQ mod p. */
+        MULMOD(cf_t[6], cf_GX[0], cf_bZ[j]);
+        MULMOD(cf_t[7], cf_bX[j], cf_GZ[0]);
+        mpz_sub(cf_t[6], cf_t[6], cf_t[7]);
+        MULMOD(cf_acc, cf_acc, cf_t[6]);
+      }
+    }
+    if (m == m1)
+      break;
+    /* G_{m+2} = G_{m+1} + DQ, the difference being G_m. */
+    cf_add(cf_X[0], cf_Z[0], cf_GX[1], cf_GZ[1], cf_GX[2], cf_GZ[2],
+           cf_GX[0], cf_GZ[0], n);
+    mpz_swap(cf_GX[0], cf_GX[1]);
+    mpz_swap(cf_GZ[0], cf_GZ[1]);
+    mpz_swap(cf_GX[1], cf_X[0]);
+    mpz_swap(cf_GZ[1], cf_Z[0]);
+  }
+  mpz_gcd(g, cf_acc, n);
+  return mpz_cmp_ui(g, 1) != 0 && mpz_cmp(g, n) != 0;
+}
+
+#ifdef CF_U64
+/* The same for n < 2^64, in Montgomery representation (R = 2^64),  */
+/* which is an order of magnitude faster than mpz for such n.        */
+typedef unsigned __int128 u128_t;
+
+typedef struct {
+  u64_t n, ninv, one;
+} cf64_mod_t;
+
+static u64_t cf64_bX[CF_D / 2], cf64_bZ[CF_D / 2], cf64_ad[CF_D / 2];
+
+static inline u64_t cf64_mul(u64_t a, u64_t b, const cf64_mod_t *M)
+{ u128_t t, mn;
+  u64_t m, h, r;
+  int c;
+
+  t = (u128_t)a * b;
+  m = (u64_t)t * M->ninv;
+  mn = (u128_t)m * M->n;
+  h = (u64_t)(t >> 64);
+  r = h + (u64_t)(mn >> 64);
+  c = r < h;
+  /* The low halves add up to 0 or to 2^64. */
+  if ((u64_t)t != 0) {
+    r++;
+    c |= r == 0;
+  }
+  if (c || r >= M->n)
+    r -= M->n;
+  return r;
+}
+
+static inline u64_t cf64_add(u64_t a, u64_t b, const cf64_mod_t *M)
+{ u64_t r = a + b;
+
+  if (r < a || r >= M->n)
+    r -= M->n;
+  return r;
+}
+
+static inline u64_t cf64_sub(u64_t a, u64_t b, const cf64_mod_t *M)
+{
+  return a >= b ? a - b : a - b + M->n;
+}
+
+static u64_t cf64_to(mpz_t x, const cf64_mod_t *M)
+{
+  return (u64_t)((((u128_t)mpz_get_ull(x)) << 64) % M->n);
+}
+
+static u64_t cf64_gcd(u64_t a, u64_t b)
+{
+  while (b != 0) {
+    u64_t t = a % b;
+
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+/**************************************************/
+static void cf64_setup(cf64_mod_t *M, mpz_t n)
+/**************************************************/
+{ u64_t inv;
+  int k;
+
+  M->n = mpz_get_ull(n);
+  /* Newton iteration for 1/n mod 2^64. */
+  for (inv = M->n, k = 0; k < 5; k++)
+    inv *= 2 - M->n * inv;
+  M->ninv = -inv;
+  M->one = (u64_t)(((u128_t)1 << 64) % M->n);
+}
+
+static void cf64_dbl(u64_t *X2, u64_t *Z2, u64_t X, u64_t Z, u64_t a24,
+                     const cf64_mod_t *M)
+{ u64_t s, d, t;
+
+  s = cf64_add(X, Z, M);
+  s = cf64_mul(s, s, M);
+  d = cf64_sub(X, Z, M);
+  d = cf64_mul(d, d, M);
+  t = cf64_sub(s, d, M);
+  *X2 = cf64_mul(s, d, M);
+  *Z2 = cf64_mul(t, cf64_add(d, cf64_mul(t, a24, M), M), M);
+}
+
+static void cf64_sum(u64_t *X3, u64_t *Z3, u64_t X1, u64_t Z1, u64_t X2, u64_t Z2,
+                     u64_t Xd, u64_t Zd, const cf64_mod_t *M)
+{ u64_t u, v, s, d;
+
+  u = cf64_mul(cf64_sub(X1, Z1, M), cf64_add(X2, Z2, M), M);
+  v = cf64_mul(cf64_add(X1, Z1, M), cf64_sub(X2, Z2, M), M);
+  s = cf64_add(u, v, M);
+  d = cf64_sub(u, v, M);
+  *X3 = cf64_mul(Zd, cf64_mul(s, s, M), M);
+  *Z3 = cf64_mul(Xd, cf64_mul(d, d, M), M);
+}
+
+static void cf64_ladder(u64_t *X, u64_t *Z, u32_t k, u64_t a24, const cf64_mod_t *M)
+{ u64_t X0, Z0, X1, Z1;
+  int b;
+
+  if (k == 1)
+    return;
+  X0 = *X;
+  Z0 = *Z;
+  cf64_dbl(&X1, &Z1, X0, Z0, a24, M);
+  for (b = 30; b >= 0 && (k >> b) == 0; b--);
+  for (b--; b >= 0; b--) {
+    if ((k >> b) & 1) {
+      cf64_sum(&X0, &Z0, X1, Z1, X0, Z0, *X, *Z, M);
+      cf64_dbl(&X1, &Z1, X1, Z1, a24, M);
+    } else {
+      cf64_sum(&X1, &Z1, X1, Z1, X0, Z0, *X, *Z, M);
+      cf64_dbl(&X0, &Z0, X0, Z0, a24, M);
+    }
+  }
+  *X = X0;
+  *Z = Z0;
+}
+
+static u64_t cf64_pow(u64_t a, u32_t k, const cf64_mod_t *M)
+{ u64_t r = M->one;
+
+  for (; k != 0; k >>= 1) {
+    if (k & 1)
+      r = cf64_mul(r, a, M);
+    a = cf64_mul(a, a, M);
+  }
+  return r;
+}
+
+/* The result of a gcd, for the callers below. */
+static int cf64_found(mpz_t g, u64_t x, const cf64_mod_t *M)
+{ u64_t h = cf64_gcd(M->n, x);
+
+  mpz_set_ull(g, h);
+  return h != 1 && h != M->n;
+}
+
+/**************************************************/
+static int cf64_pm1(mpz_t g, mpz_t n, u32_t B1)
+/**************************************************/
+{ cf64_mod_t M;
+  u64_t a, x, acc;
+  u32_t p, q, B2, d;
+
+  cf64_setup(&M, n);
+  a = cf64_add(M.one, cf64_add(M.one, M.one, &M), &M);
+  for (p = 2; p <= B1; p++) {
+    if (!CF_ISPRIME(p))
+      continue;
+    for (q = p; q <= B1 / p; q *= p);
+    a = cf64_pow(a, q, &M);
+  }
+  if (cf64_gcd(M.n, cf64_sub(a, M.one, &M)) != 1)
+    return cf64_found(g, cf64_sub(a, M.one, &M), &M);
+
+  B2 = CF_PM1_B2 * B1;
+  cf64_ad[1] = cf64_mul(a, a, &M);
+  for (d = 2; d < CF_D / 2; d++)
+    cf64_ad[d] = cf64_mul(cf64_ad[d - 1], cf64_ad[1], &M);
+  for (p = B1 + 1; !CF_ISPRIME(p); p++);
+  x = cf64_pow(a, p, &M);
+  acc = cf64_sub(x, M.one, &M);
+  for (q = p + 2; q <= B2; q += 2) {
+    if (!cf_isprime[q >> 1])
+      continue;
+    if ((q - p) / 2 >= CF_D / 2)
+      x = cf64_pow(a, q, &M);
+    else
+      x = cf64_mul(x, cf64_ad[(q - p) / 2], &M);
+    p = q;
+    acc = cf64_mul(acc, cf64_sub(x, M.one, &M), &M);
+  }
+  return cf64_found(g, acc, &M);
+}
+
+/**************************************************/
+static int cf64_ecm(mpz_t g, mpz_t n, u32_t B1, u32_t sigma)
+/**************************************************/
+{ cf64_mod_t M;
+  u64_t X, Z, a24, GX[3], GZ[3], acc, t;
+  u32_t p, q, m, m0, m1, i, j, B2;
+
+  if (!cf_curve(g, n, sigma))
+    return mpz_cmp_ui(g, 1) != 0 && mpz_cmp(g, n) != 0;
+  cf64_setup(&M, n);
+  X = cf64_to(cf_t[4], &M);
+  Z = cf64_to(cf_t[5], &M);
+  a24 = cf64_to(cf_a24, &M);
+
+  for (p = 2; p <= B1; p++) {
+    if (!CF_ISPRIME(p))
+      continue;
+    for (q = p; q <= B1 / p; q *= p);
+    cf64_ladder(&X, &Z, q, a24, &M);
+  }
+  if (cf64_gcd(M.n, Z) != 1)
+    return cf64_found(g, Z, &M);
+
+  cf64_bX[1] = X;
+  cf64_bZ[1] = Z;
+  cf64_dbl(cf64_bX, cf64_bZ, X, Z, a24, &M);
+  cf64_sum(cf64_bX + 3, cf64_bZ + 3, cf64_bX[0], cf64_bZ[0], X, Z, X, Z, &M);
+  for (i = 5; i < CF_D / 2; i += 2)
+    cf64_sum(cf64_bX + i, cf64_bZ + i, cf64_bX[i - 2], cf64_bZ[i - 2],
+             cf64_bX[0], cf64_bZ[0], cf64_bX[i - 4], cf64_bZ[i - 4], &M);
+
+  B2 = CF_ECM_B2 * B1;
+  m0 = (B1 + CF_D / 2) / CF_D;
+  if (m0 == 0)
+    m0 = 1;
+  m1 = (B2 + CF_D / 2) / CF_D;
+  GX[2] = X;
+  GZ[2] = Z;
+  cf64_ladder(GX + 2, GZ + 2, CF_D, a24, &M);
+  GX[0] = GX[1] = GX[2];
+  GZ[0] = GZ[1] = GZ[2];
+  cf64_ladder(GX, GZ, m0, a24, &M);
+  cf64_ladder(GX + 1, GZ + 1, m0 + 1, a24, &M);
+  acc = M.one;
+  for (m = m0; ; m++) {
+    for (i = 0; i < cf_nbaby; i++) {
+      j = cf_baby[i];
+      if ((m * CF_D + j <= B2 && cf_isprime[(m * CF_D + j) >> 1]) ||
+          (m * CF_D - j > B1 && cf_isprime[(m * CF_D - j) >> 1]))
+        acc = cf64_mul(acc, cf64_sub(cf64_mul(GX[0], cf64_bZ[j], &M),
+                                     cf64_mul(cf64_bX[j], GZ[0], &M), &M), &M);
+    }
+    if (m == m1)
+      break;
+    cf64_sum(&X, &t, GX[1], GZ[1], GX[2], GZ[2], GX[0], GZ[0], &M);
+    GX[0] = GX[1];
+    GZ[0] = GZ[1];
+    GX[1] = X;
+    GZ[1] = t;
+  }
+  return cf64_found(g, acc, &M);
+}
+#endif
+
+/**************************************************/
+static void cf_split(cofact_t *c, mpz_t g)
+/**************************************************/
+/* Record the factor g of c->n.                     */
+/**************************************************/
+{ mpz_t *part = cf_GX, *comp = NULL;
+  int k;
+
+  mpz_set(part[0], g);
+  mpz_divexact(part[1], c->n, g);
+  for (k = 0; k < 2; k++) {
+    if (psp(part[k])) {
+      if (mpz_sizeinbase(part[k], 2) > c->lpbits || c->nf == CF_MAX_FACTORS) {
+        c->status = CF_NOT_SMOOTH;
+        return;
+      }
+      mpz_set(c->f[c->nf++], part[k]);
+      continue;
+    }
+    /* Two composite parts would make four large primes. */
+    if (comp != NULL) {
+      c->status = CF_NOT_SMOOTH;
+      return;
+    }
+    comp = part + k;
+  }
+  if (comp == NULL) {
+    mpz_set_ui(c->n, 1);
+    c->status = CF_SMOOTH;
+  } else
+    mpz_set(c->n, *comp);
+}
+
+/**************************************************/
+static int cf_plan_of(cofact_t *c)
+/**************************************************/
+/* Index into cf_plan[] for c, or -1 if c is better */
+/* left to mpqs_factor().                           */
+/**************************************************/
+{ size_t nb = mpz_sizeinbase(c->n, 2), d;
+  int k;
+
+  d = nb / 2;
+  if (d > c->lpbits)
+    d = c->lpbits;
+  if (nb <= CF_MPQS_BITS && (nb > CF_U64_BITS || d > CF_ECM_BITS))
+    return -1;
+  for (k = 0; k < (int)CF_NPLANS - 1 && d > cf_plan[k].bits; k++);
+  return k;
+}
+
+/**************************************************/
+static int cf_try(cofact_t *c, u32_t curve, int pl)
+/**************************************************/
+/* P-1 (curve 0) or ECM curve number 'curve' on c,  */
+/* with the arithmetic which fits the size of c->n. */
+/* Return value: 1 if c->n was split.               */
+/**************************************************/
+{
+#ifdef CF_U64
+  if (mpz_sizeinbase(c->n, 2) <= 64) {
+    if (curve == 0)
+      return cf64_pm1(cf_g, c->n, cf_plan[pl].pm1_B1);
+    return cf64_ecm(cf_g, c->n, cf_plan[pl].ecm_B1, 5 + curve);
+  }
+#endif
+  if (curve == 0)
+    return cf_pm1(cf_g, c->n, cf_plan[pl].pm1_B1);
+  return cf_ecm(cf_g, c->n, cf_plan[pl].ecm_B1, 5 + curve);
+}
+
+/**************************************************/
+void cofact_init(cofact_t *c)
+/**************************************************/
+{ int k;
+
+  mpz_init(c->n);
+  for (k = 0; k < CF_MAX_FACTORS; k++)
+    mpz_init(c->f[k]);
+  c->nf = 0;
+  c->status = CF_OPEN;
+}
+
+/**************************************************/
+void cofact_run(cofact_t **c, size_t nc)
+/**************************************************/
+/* Try to split the composite c[k]->n of all open   */
+/* c[k] into primes of at most c[k]->lpbits bits.   */
+/* P-1 goes first, then the ECM curves one by one.  */
+/* A cofactor which is found to be not smooth is    */
+/* dropped at once. Those which are still CF_OPEN   */
+/* at the end may have some of their primes in      */
+/* c[k]->f already, the rest of them is in c[k]->n. */
+/**************************************************/
+{ size_t k;
+  u32_t curve, more;
+
+  if (!cf_isinit)
+    cf_init();
+  for (curve = 0, more = 1; more; curve++) {
+    for (k = 0, more = 0; k < nc; k++) {
+      int pl;
+
+      if (c[k]->status != CF_OPEN)
+        continue;
+      pl = cf_plan_of(c[k]);
+      if (pl < 0 || curve > cf_plan[pl].curves)
+        continue;
+      more = 1;
+      if (cf_try(c[k], curve, pl))
+        cf_split(c[k], cf_g);
+    }
+  }
+}
@@ -48,6 +48,28 @@
 #include <gmp.h>
 #include <signal.h>
 #include <setjmp.h>
+#ifdef __APPLE__
+#include <sys/sysctl.h>
+#endif
+
+#if !defined (_MSC_VER) && !defined (__MINGW32__) && !defined (MINGW32)
+#define LASIEVE_WORKERS
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#endif
+
+/* Built-in gzip output needs zlib, and open_memstream() for the buffers. */
+#if defined (HAVE_ZLIB) && defined (LASIEVE_WORKERS)
+#define LASIEVE_ZLIB
+#include <zlib.h>
+#endif
 
 #ifdef GGNFS_HOST_GENERIC
 const u32_t schedule_primebounds[N_PRIMEBOUNDS]={0x100000,0x200000,0x400000,0x800000,0x1000000,0x2000000,UINT_MAX};
@@ -56,12 +78,16 @@ const u32_t schedule_sizebits[N_PRIMEBOUNDS]={20,21,22,23,24,25,32};
 
 #define GCD_SIEVE_BOUND 10
 #define MAX_TINY_2POW 4
-#define L1_SIZE (1UL<<L1_BITS)
+#define L1_SIZE (1UL<<l1_bits)
 #define CANDIDATE_SEARCH_STEPS 128
 #define MAX_LPFACTORS 3
 #define RI_SIZE 2
 #define SE_SIZE 2
 #define SCHEDFBI_MAXSTEP 0x10000
+#define BUCKET_PAD 64
+#define BUCKET_TOL 1.25
+/* The most records one prime can add to strip k; see bucketsched.c. */
+#define BUCKET_GUARD(k) ((k) == 0 ? n_i + j_per_strip : j_per_strip)
 #define USE_MEDSCHED
 #define TINY_SIEVEBUFFER_SIZE 420
 #define TINY_SIEVE_MIN 8
@@ -70,6 +96,8 @@ const u32_t schedule_sizebits[N_PRIMEBOUNDS]={20,21,22,23,24,25,32};
 #define NO_SIDE 2
 #define USER_INTERRUPT 1
 #define SCHED_PATHOLOGY 2
+#define MAX_WORKERS 256
+#define WORKER_SPQ_CHUNK 100
 
 static float FB_bound[2], sieve_report_multiplier[2];
 static size_t sieve_min[2], max_primebits[2], max_factorbits[2];
@@ -94,6 +122,7 @@ u32_t  g_resume;
 static mpz_t rational_rest, algebraic_rest;
 mpz_t factors[MAX_LPFACTORS];
 static u32_t yield=0, n_mpqsfail[2]={0,0}, n_mpqsvain[2]={0,0};
+static u32_t n_cofsplit[2]={0,0}, n_cofdrop[2]={0,0}, n_bsdrop=0;
 static u32_t mpqs_clock=0;
 static clock_t sieve_clock=0, sch_clock=0, td_clock=0, tdi_clock=0;
 static u32_t cs_clock[2]={0,0}, Schedule_clock=0, medsched_clock=0;
@@ -107,6 +136,7 @@ size_t input_line_alloc=0;
 static u32_t ncand;
 static u16_t *cand;
 static unsigned char *fss_sv;
+static u32_t n_workers = 1;
 u32_t process_no;
 char *sysload_cmd;
 double sieveStartTime;
@@ -134,9 +164,48 @@ static u32_t add_primepowers2xaFB(size_t * aFB_alloc_ptr,
 
 i32_t a0, a1, b0, b1;
 
-#if 0
+/* Set at run time (-I, -l); see sched-kernels.c. */
 u32_t I_bits;
-#endif
+static u32_t l1_bits;
+static lasched_t lasched_fn;
+static medsched_t medsched_fn;
+static bucketsched_t bucketsched_fn;
+/* With -B, the primes above L1_SIZE are scheduled into buckets of
+   64-bit records by bucketsched(). */
+static u32_t use_buckets = 0;
+/* With -E, the cofactors which need to be factored are collected over
+   a special q and handed to cofact_run() together. */
+static u32_t use_cofact = 0;
+/* With -X <n>, the rational side cofactors are first put through
+   bsmooth_test(), in batches of at least n reports, which may come
+   from several special q. bs_P is the product of the primes between
+   the factor base bound and the large prime bound. */
+static u32_t bsmooth_batch = 0, bs_side;
+static mpz_t bs_P;
+/* With -K, getFB() maps the factor base from <base>.fbi.<key>, or
+   writes that file for the next siever; see fbimage_load(). */
+static u32_t use_fbimage = 0;
+/* With -Q <server>, the special q come from spqserver; see spq_connect(). */
+static char *spq_server = NULL;
+/* With -m <file>, a line of metrics for each special q; see metrics_end(). */
+static char *metrics_name = NULL;
+/* The sieve reports which wait for cofact_flush() (-E, -X), with their
+   factor base primes in cof_fbp[]. cof_first_spq is the special q of
+   the first of them, where sieving has to resume if they are lost. */
+typedef struct {
+  mpz_t a, b;
+  cofact_t cf[2];
+  i16_t need_mpqs[2];
+  u16_t first_mpqs_side;
+  size_t fbp[2], fbp_ub[2];
+} cof_report_t;
+static cof_report_t *cof_reports;
+static cofact_t **cof_open;
+static size_t cof_n, cof_alloc;
+static u32_t *cof_fbp;
+static size_t cof_fbp_n, cof_fbp_alloc;
+static u32_t cof_first_spq;
+
 u32_t J_bits, i_shift, n_I, n_J;
 u32_t root_no;
 float sigma;
@@ -159,6 +228,10 @@ static struct schedule_struct {
   u16_t n_strips, current_strip;
   size_t alloc, alloc1;
   u32_t *ri;
+  /* Only with -B: the records of strip k are bucket[k]...bucket_ptr[k]-1.
+     bucket_lim[k] is BUCKET_GUARD(k) records below the end of bucket[k]. */
+  u64_t **bucket, **bucket_ptr, **bucket_lim;
+  size_t *bucket_alloc;
 } *(schedules[2]);
 
 u32_t n_schedules[2];
@@ -224,7 +297,7 @@ u32_t **tds_fbi_curpos = NULL;
 static size_t tds_fbi_alloc = TDFBI_ALLOC;
 #endif
 
-static mpz_t td_rests[L1_SIZE];
+static mpz_t *td_rests;
 static mpz_t large_factors[2], *(large_primes[2]);
 static mpz_t FBb_sq[2];
 static mpz_t FBb_cu[2];
@@ -240,6 +313,7 @@ static u32_t n_prereports = 0, n_reports = 0, n_rep1 = 0, n_rep2 = 0;
 static u32_t n_tdsurvivors[2] = { 0, 0 };
 static FILE *g_ofile;
 static char *g_ofile_name;
+static char *candsearch_name = NULL;
 
 #ifdef STC_DEBUG
 FILE *debugfile;
@@ -259,27 +333,243 @@ static void terminate_sieving(int signo)
   longjmp(termination_jb, USER_INTERRUPT);
 }
 
+#ifdef LASIEVE_WORKERS
+/******************************************************/
+/* Factor base image (-K): FB, proots, FB_logs and    */
+/* xFB of both sides as getFB() leaves them, in one   */
+/* file which is mapped read-only. Sievers for the    */
+/* same job on one host then share one copy of the    */
+/* factor base in the page cache, and skip building   */
+/* it. The file name carries a hash of everything the */
+/* image depends on; a new image is written under a   */
+/* temporary name and renamed into place.             */
+/******************************************************/
+#define FBI_MAGIC "GGNFSFBI"
+#define FBI_VERSION 1
+#define FBI_BYTEORDER 0x01020304
+#define FBI_ALIGN 64
+#define FBI_ROUND(x) (((x) + FBI_ALIGN - 1) & ~(u64_t)(FBI_ALIGN - 1))
+
+typedef struct {
+  char  magic[8];
+  u32_t version, byteorder, hdrsize, xfbsize;
+  u64_t key, size, cksum;
+  struct {
+    u64_t fb, roots, logs, xfb;
+    u32_t fbsize, xfbs, fbi1, fbis;
+    double multiplier, maxlog;
+  } side[2];
+} fbimage_t;
+
+#define FBI_HDR FBI_ROUND(sizeof(fbimage_t))
+
+/* FNV-1a, on bytes for the key and on 64-bit words for the payload. */
+static u64_t fbimage_hash(u64_t h, const void *p, size_t n)
+{ const unsigned char *s = p;
+
+  while (n-- > 0)
+    h = (h ^ *s++) * 0x100000001b3ULL;
+  return h;
+}
+
+static u64_t fbimage_sum(const unsigned char *p, u64_t n)
+{ const u64_t *w = (const u64_t *)p;
+  u64_t h = 0xcbf29ce484222325ULL, i;
+
+  for (i = 0; i < n / 8; i++)
+    h = (h ^ w[i]) * 0x100000001b3ULL;
+  return h;
+}
+
+static u64_t fbimage_key(void)
+{ u64_t h = 0xcbf29ce484222325ULL;
+  u32_t side, i, v[5];
+  size_t k;
+
+  v[0] = FBI_VERSION;
+  v[1] = n_I;
+  v[2] = n_J;
+  v[3] = l1_bits;
+  v[4] = sizeof(mp_limb_t);
+  h = fbimage_hash(h, v, sizeof(v));
+  for (side = 0; side < 2; side++) {
+    h = fbimage_hash(h, &(g_poldeg[side]), sizeof(g_poldeg[side]));
+    h = fbimage_hash(h, &(FB_bound[side]), sizeof(FB_bound[side]));
+    h = fbimage_hash(h, &(poly_norm[side]), sizeof(poly_norm[side]));
+    for (i = 0; i <= g_poldeg[side]; i++) {
+      int sg = mpz_sgn(g_poly[side][i]);
+
+      h = fbimage_hash(h, &sg, sizeof(sg));
+      for (k = 0; k < mpz_size(g_poly[side][i]); k++) {
+        mp_limb_t l = mpz_getlimbn(g_poly[side][i], k);
+
+        h = fbimage_hash(h, &l, sizeof(l));
+      }
+    }
+  }
+  return h;
+}
+
+/******************************************************/
+static int fbimage_load(const char *name, u64_t key)
+/******************************************************/
+/* Map the image name and point the factor base at  */
+/* it. Returns 0 if there is no valid image.        */
+/******************************************************/
+{ int fd;
+  struct stat st;
+  unsigned char *map;
+  fbimage_t *h;
+  u32_t side;
+
+  if ((fd = open(name, O_RDONLY)) < 0)
+    return 0;
+  if (fstat(fd, &st) != 0 || (u64_t)st.st_size < FBI_HDR) {
+    close(fd);
+    return 0;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return 0;
+  h = (fbimage_t *)map;
+  if (memcmp(h->magic, FBI_MAGIC, 8) != 0 || h->version != FBI_VERSION ||
+      h->byteorder != FBI_BYTEORDER || h->hdrsize != sizeof(*h) ||
+      h->xfbsize != sizeof(struct xFBstruct) || h->key != key ||
+      h->size != (u64_t)st.st_size)
+    goto bad;
+  for (side = 0; side < 2; side++) {
+    if (h->side[side].fb < FBI_HDR ||
+        h->side[side].roots < h->side[side].fb + 4 * (u64_t)h->side[side].fbsize ||
+        h->side[side].logs < h->side[side].roots + 4 * (u64_t)h->side[side].fbsize ||
+        h->side[side].xfb < h->side[side].logs + h->side[side].fbsize ||
+        h->size < h->side[side].xfb +
+          sizeof(struct xFBstruct) * (u64_t)h->side[side].xfbs)
+      goto bad;
+  }
+  if (fbimage_sum(map + FBI_HDR, h->size - FBI_HDR) != h->cksum)
+    goto bad;
+
+  for (side = 0; side < 2; side++) {
+    FBsize[side] = h->side[side].fbsize;
+    xFBs[side] = h->side[side].xfbs;
+    fbi1[side] = h->side[side].fbi1;
+    fbis[side] = h->side[side].fbis;
+    sieve_multiplier[side] = h->side[side].multiplier;
+    FB_maxlog[side] = h->side[side].maxlog;
+    FB[side] = (u32_t *)(map + h->side[side].fb);
+    proots[side] = (u32_t *)(map + h->side[side].roots);
+    FB_logs[side] = map + h->side[side].logs;
+    xFB[side] = (xFBptr)(map + h->side[side].xfb);
+  }
+  logbook(0, "Mapped factor base image %s\n", name);
+  return 1;
+
+bad:
+  errprintf("%s is not a valid factor base image, rebuilding it\n", name);
+  munmap(map, st.st_size);
+  return 0;
+}
+
+/******************************************************/
+static void fbimage_save(const char *name, u64_t key)
+/******************************************************/
+{ fbimage_t h;
+  unsigned char *buf;
+  char *tmp;
+  u64_t off;
+  u32_t side;
+  FILE *f;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, FBI_MAGIC, 8);
+  h.version = FBI_VERSION;
+  h.byteorder = FBI_BYTEORDER;
+  h.hdrsize = sizeof(h);
+  h.xfbsize = sizeof(struct xFBstruct);
+  h.key = key;
+  for (side = 0, off = FBI_HDR; side < 2; side++) {
+    h.side[side].fbsize = FBsize[side];
+    h.side[side].xfbs = xFBs[side];
+    h.side[side].fbi1 = fbi1[side];
+    h.side[side].fbis = fbis[side];
+    h.side[side].multiplier = sieve_multiplier[side];
+    h.side[side].maxlog = FB_maxlog[side];
+    h.side[side].fb = off;
+    off = FBI_ROUND(off + 4 * (u64_t)FBsize[side]);
+    h.side[side].roots = off;
+    off = FBI_ROUND(off + 4 * (u64_t)FBsize[side]);
+    h.side[side].logs = off;
+    off = FBI_ROUND(off + FBsize[side]);
+    h.side[side].xfb = off;
+    off = FBI_ROUND(off + sizeof(struct xFBstruct) * (u64_t)xFBs[side]);
+  }
+  h.size = off;
+
+  buf = xmalloc(h.size);
+  memset(buf, 0, h.size);
+  for (side = 0; side < 2; side++) {
+    memcpy(buf + h.side[side].fb, FB[side], 4 * (size_t)FBsize[side]);
+    memcpy(buf + h.side[side].roots, proots[side], 4 * (size_t)FBsize[side]);
+    memcpy(buf + h.side[side].logs, FB_logs[side], FBsize[side]);
+    memcpy(buf + h.side[side].xfb, (void *)xFB[side],
+           sizeof(struct xFBstruct) * (size_t)xFBs[side]);
+  }
+  h.cksum = fbimage_sum(buf + FBI_HDR, h.size - FBI_HDR);
+  memcpy(buf, &h, sizeof(h));
+
+  /* Sievers started at the same time may all write the image; */
+  /* each renames a complete file into place.                  */
+  asprintf(&tmp, "%s.tmp%u", name, (unsigned int)getpid());
+  if ((f = fopen(tmp, "wb")) == NULL) {
+    errprintf("Cannot write %s: %m\n", tmp);
+  } else if (fwrite(buf, 1, h.size, f) != h.size) {
+    errprintf("Cannot write %s: %m\n", tmp);
+    fclose(f);
+    remove(tmp);
+  } else if (fclose(f) != 0 || rename(tmp, name) != 0) {
+    errprintf("Cannot write %s: %m\n", name);
+    remove(tmp);
+  } else
+    logbook(0, "Wrote factor base image %s\n", name);
+  free(tmp);
+  free(buf);
+}
+#endif
+
 /******************************************************/
 void getFB(int force_aFBcalc)
 /******************************************************/
 { size_t FBS_alloc = 4096;
   u32_t  prime;
   pr32_struct ps;
-  char  *afbname;
+  char  *afbname = NULL;
   FILE  *afbfile;
   u32_t  side, i, j, k, l=0, nr, x;
   u32_t  srfbs, safbs;
   double ld;
+  int    from_image = 0;
+#ifdef LASIEVE_WORKERS
+  char  *fbiname = NULL;
+  u64_t  fbikey = 0;
+
+  if (use_fbimage != 0) {
+    fbikey = fbimage_key();
+    asprintf(&fbiname, "%s.fbi.%016llx", base_name, (unsigned long long)fbikey);
+    if (force_aFBcalc == 0)
+      from_image = fbimage_load(fbiname, fbikey);
+  }
+#endif
 
   initprime32(&ps);
 
-  for (side = 0; side < 2; side++) {
+  for (side = 0; side < 2 && from_image == 0; side++) {
     if (g_poldeg[side] == 1) {
       FB[side] = xmalloc(FBS_alloc * sizeof(u32_t));
       proots[side] = xmalloc(FBS_alloc * sizeof(u32_t));
       prime = firstprime32(&ps);
       for (prime = nextprime32(&ps), fbi1[side] = 0, FBsize[side] = 0;
-           prime < FB_bound[side]; prime = nextprime32(&ps)) {
+           prime > 0 && prime < FB_bound[side]; prime = nextprime32(&ps)) {
         x = mpz_fdiv_ui(g_poly[side][1], prime);
         if (x > 0) {
           modulo32 = prime;
@@ -316,7 +606,7 @@ void getFB(int force_aFBcalc)
         FB[side] = xmalloc(aFB_alloc * sizeof(**FB));
         proots[side] = xmalloc(aFB_alloc * sizeof(**proots));
         for (prime = firstprime32(&ps), FBsize[side] = 0;
-             prime < FB_bound[side]; prime = nextprime32(&ps)) {
+             prime > 0 && prime < FB_bound[side]; prime = nextprime32(&ps)) {
 
           nr = root_finder(root_buffer, g_poly[side], g_poldeg[side], prime);
           for (i = 0; i < nr; i++) {
@@ -403,10 +693,10 @@ void getFB(int force_aFBcalc)
   plog_lb1 = xmalloc(2 * n_J / CANDIDATE_SEARCH_STEPS);
   plog_lb2 = xmalloc(2 * n_J / CANDIDATE_SEARCH_STEPS);
 
-  if (sieve_count == 0)
+  if (sieve_count == 0 && use_fbimage == 0)
     exit(0);
 
-  for (side = 0; side < 2; side++) {
+  for (side = 0; side < 2 && from_image == 0; side++) {
     struct xFBstruct *s;
     u32_t *root_buffer;
     size_t xaFB_alloc = 0;
@@ -460,6 +750,15 @@ void getFB(int force_aFBcalc)
     FB_maxlog[side] *= sieve_multiplier[side];
     qsort(xFB[side], xFBs[side], sizeof(*(xFB[side])), xFBcmp);
   }
+#ifdef LASIEVE_WORKERS
+  if (fbiname != NULL) {
+    if (from_image == 0)
+      fbimage_save(fbiname, fbikey);
+    free(fbiname);
+  }
+#endif
+  if (sieve_count == 0)
+    exit(0);
 }
 /*******************************************************/
 double sTime()
@@ -467,11 +766,9 @@ double sTime()
 #if !defined (_MSC_VER) && !defined (__MINGW32__) && !defined (MINGW32)
 { static struct  timeval  this_tv;
   static struct  timezone dumbTZ;
-  double t;
 
   gettimeofday(&this_tv, &dumbTZ);
-  t = this_tv.tv_sec + 0.000001*this_tv.tv_usec;
-  return t;
+  return this_tv.tv_sec + 0.000001*this_tv.tv_usec;
 }
 #else
 {
@@ -482,6 +779,15 @@ double sTime()
 typedef unsigned long bc_t;
 #define BC_ONES ((~0UL)/0xFFU)
 #define BC_MASK (BC_ONES*0x80U)
+#ifdef CANDSEARCH_SIMD
+/* See candsearch.c; -C picks the kernel. */
+static candsearch_t candsearch_fn;
+
+inline void optsieve(uint32_t st1, uchar* i_o, uchar* i_max, size_t j) {
+  ncand += candsearch_fn((unsigned char)st1, i_o, i_max, sieve_interval,
+                         cand + ncand, fss_sv + ncand, horizontal_sievesums[j]);
+}
+#else
 inline void optsieve(uint32_t st1, uchar* i_o, uchar* i_max, size_t j) {
   // align i_o & i_max to 32-byte boundary
   for(;i_o<i_max && ((size_t)i_o & 0x1F);++i_o) {
@@ -535,6 +841,7 @@ inline void optsieve(uint32_t st1, uchar* i_o, uchar* i_max, size_t j) {
 
   {
   uint64_t x;
+  size_t dummy;
 
   x = st1 - 1;
   x |= x << 8;
@@ -582,8 +889,8 @@ inline void optsieve(uint32_t st1, uchar* i_o, uchar* i_max, size_t j) {
     "cmpq     %%rsi,%%rdi\n"
     "ja       1b\n"
     "2:\n"
-    "emms":"=S" (i_o):"a"(&x),
-    "S"(i_o), "D"(i_max)
+    "emms":"=S" (i_o), "=a" (dummy):"a"(&x),
+    "S"(i_o), "D"(i_max):"cc", "memory"
   );
 #elif defined(GGNFS_x86_32_ATTASM_MMX)
   asm volatile (
@@ -603,8 +910,8 @@ inline void optsieve(uint32_t st1, uchar* i_o, uchar* i_max, size_t j) {
     "cmpl     %%esi,%%edi\n"
     "ja       1b\n"
     "2:\n"
-    "emms":"=S" (i_o):"a"(&x),
-    "S"(i_o), "D"(i_max)
+    "emms":"=S" (i_o), "=a" (dummy):"a"(&x),
+    "S"(i_o), "D"(i_max):"cc", "memory"
    );
 #else
     #error Unsupported assembler model!
@@ -625,6 +932,1029 @@ inline void optsieve(uint32_t st1, uchar* i_o, uchar* i_max, size_t j) {
   }
 #endif
 }
+#endif
+
+#ifdef LASIEVE_ZLIB
+/* Built-in gzip output (-z, -Z level).
+   The relations of each special q are collected in a memory buffer (g_ofile
+   while sieving) and written to the output file as one complete gzip member.
+   A gzip file may consist of any number of members, and gunzip and zlib read
+   them as one stream; so the file is valid up to the last finished special q
+   whenever the siever stops, and -R can append to it (see zip_resume()).
+*/
+static int zip_level = 0;    /* 0: plain output. */
+static FILE *zip_ofile;
+static char *zip_obuf;
+static size_t zip_obuf_len;
+static z_stream zip_strm;
+static int zip_strm_ready = 0;
+static unsigned char *zip_zbuf = NULL;
+static size_t zip_zbuf_alloc = 0;
+
+/* Compress len bytes at data into one gzip member in zip_zbuf, and return
+   its size. */
+static size_t zip_member(char *data, size_t len)
+{ size_t bound;
+
+  if (!zip_strm_ready) {
+    memset(&zip_strm, 0, sizeof(zip_strm));
+    if (deflateInit2(&zip_strm, zip_level, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+      complain("Cannot initialize zlib\n");
+    zip_strm_ready = 1;
+  } else
+    deflateReset(&zip_strm);
+  bound = deflateBound(&zip_strm, len);
+  if (bound > zip_zbuf_alloc) {
+    zip_zbuf_alloc = bound;
+    zip_zbuf = xrealloc(zip_zbuf, zip_zbuf_alloc);
+  }
+  zip_strm.next_in = (Bytef *)data;
+  zip_strm.avail_in = (uInt)len;
+  zip_strm.next_out = zip_zbuf;
+  zip_strm.avail_out = (uInt)zip_zbuf_alloc;
+  if (deflate(&zip_strm, Z_FINISH) != Z_STREAM_END)
+    complain("zlib: deflate failed\n");
+  return zip_zbuf_alloc - zip_strm.avail_out;
+}
+
+/* Write the buffered relations to the output file as one gzip member. */
+static void zip_flush_output(void)
+{ size_t len;
+
+  fclose(g_ofile);
+  if (zip_obuf_len > 0) {
+    len = zip_member(zip_obuf, zip_obuf_len);
+    if (fwrite(zip_zbuf, 1, len, zip_ofile) != len)
+      complain("Cannot write output: %m\n");
+    fflush(zip_ofile);
+  }
+  free(zip_obuf);
+  zip_obuf = NULL;
+  if ((g_ofile = open_memstream(&zip_obuf, &zip_obuf_len)) == NULL)
+    complain("Cannot open output buffer: %m\n");
+}
+
+/* Switch g_ofile, the output file, to a memory buffer. */
+static void zip_begin(void)
+{
+  zip_ofile = g_ofile;
+  zip_obuf = NULL;
+  if ((g_ofile = open_memstream(&zip_obuf, &zip_obuf_len)) == NULL)
+    complain("Cannot open output buffer: %m\n");
+}
+
+/* Write what is left in the buffer and switch back to the output file. */
+static void zip_end(void)
+{
+  zip_flush_output();
+  fclose(g_ofile);
+  free(zip_obuf);
+  g_ofile = zip_ofile;
+}
+#endif
+
+#ifdef LASIEVE_WORKERS
+/* Multi-worker mode (-T n).
+   The factor base, its logs, xFB and all the tables built in main() are
+   set up once and then the process forks into n workers. Those pages are
+   never written again, so the workers share them through copy-on-write,
+   while the sieve interval, schedules and trial division buffers (and all
+   the other file-level statics, which the assembler modules rely on) become
+   private to each worker. Special q are leased from a shared counter in
+   chunks of WORKER_SPQ_CHUNK, and the relations of each special q are
+   collected in a private buffer and appended to the common output under a
+   lock, so that lines from different workers are never interleaved.
+*/
+static struct worker_shared {
+  volatile u32_t lock;
+  volatile u32_t next_spq;
+  volatile u32_t cur_spq[MAX_WORKERS];
+  volatile u32_t yield;
+  /* Totals reported back to the parent by the workers when they exit. */
+  u32_t n_spq, n_spq_discard, n_iter;
+  u32_t n_prereports, n_reports, n_rep1, n_rep2, n_tdsurvivors[2];
+  u32_t n_mpqsfail[2], n_mpqsvain[2], n_cofsplit[2], n_cofdrop[2], n_bsdrop;
+  u32_t sieve_clock, sch_clock, td_clock, mpqs_clock;
+  u32_t Schedule_clock, medsched_clock;
+  u32_t cs_clock[2], s3_clock[2], tds4_clock[2];
+} *wsh = NULL;
+static i32_t worker_id = -1;
+static FILE *worker_ofile;
+static char *worker_obuf;
+static size_t worker_obuf_len;
+static u32_t worker_yield;
+
+static void worker_lock(void)
+{ while (__sync_lock_test_and_set(&(wsh->lock), 1))
+    sched_yield();
+}
+
+static void worker_unlock(void)
+{ __sync_lock_release(&(wsh->lock));
+}
+
+/* Append the relations of the last special q to the common output. */
+static void worker_flush_output(void)
+{ char *data;
+  size_t len;
+
+  if (spq_server != NULL) {
+    /* The relations stay in the buffer until spq_put(). */
+    worker_lock();
+    wsh->yield += yield - worker_yield;
+    worker_unlock();
+    worker_yield = yield;
+    return;
+  }
+  fclose(g_ofile);
+  data = worker_obuf;
+  len = worker_obuf_len;
+#ifdef LASIEVE_ZLIB
+  /* Compress before taking the lock, so the workers do this in parallel. */
+  if (zip_level > 0 && len > 0) {
+    len = zip_member(worker_obuf, worker_obuf_len);
+    data = (char *)zip_zbuf;
+  }
+#endif
+  worker_lock();
+  if (len > 0) {
+    if (fwrite(data, 1, len, worker_ofile) != len)
+      complain("Worker %d: cannot write output: %m\n", worker_id);
+    fflush(worker_ofile);
+  }
+  wsh->yield += yield - worker_yield;
+  worker_unlock();
+  worker_yield = yield;
+  free(worker_obuf);
+  if ((g_ofile = open_memstream(&worker_obuf, &worker_obuf_len)) == NULL)
+    complain("Worker %d: cannot open output buffer: %m\n", worker_id);
+}
+
+static void worker_report_stats(void)
+{ u32_t s;
+
+  worker_lock();
+  wsh->n_spq += n_spq;
+  wsh->n_spq_discard += n_spq_discard;
+  wsh->n_iter += n_iter;
+  wsh->n_prereports += n_prereports;
+  wsh->n_reports += n_reports;
+  wsh->n_rep1 += n_rep1;
+  wsh->n_rep2 += n_rep2;
+  wsh->sieve_clock += sieve_clock;
+  wsh->sch_clock += sch_clock;
+  wsh->td_clock += td_clock;
+  wsh->mpqs_clock += mpqs_clock;
+  wsh->n_bsdrop += n_bsdrop;
+  wsh->Schedule_clock += Schedule_clock;
+  wsh->medsched_clock += medsched_clock;
+  for (s = 0; s < 2; s++) {
+    wsh->n_tdsurvivors[s] += n_tdsurvivors[s];
+    wsh->n_mpqsfail[s] += n_mpqsfail[s];
+    wsh->n_mpqsvain[s] += n_mpqsvain[s];
+    wsh->n_cofsplit[s] += n_cofsplit[s];
+    wsh->n_cofdrop[s] += n_cofdrop[s];
+    wsh->cs_clock[s] += cs_clock[s];
+    wsh->s3_clock[s] += s3_clock[s];
+    wsh->tds4_clock[s] += tds4_clock[s];
+  }
+  worker_unlock();
+}
+
+static void worker_collect_stats(void)
+{ u32_t s;
+
+  yield = wsh->yield;
+  n_spq = wsh->n_spq;
+  n_spq_discard = wsh->n_spq_discard;
+  n_iter = wsh->n_iter;
+  n_prereports = wsh->n_prereports;
+  n_reports = wsh->n_reports;
+  n_rep1 = wsh->n_rep1;
+  n_rep2 = wsh->n_rep2;
+  sieve_clock = wsh->sieve_clock;
+  sch_clock = wsh->sch_clock;
+  td_clock = wsh->td_clock;
+  mpqs_clock = wsh->mpqs_clock;
+  n_bsdrop = wsh->n_bsdrop;
+  Schedule_clock = wsh->Schedule_clock;
+  medsched_clock = wsh->medsched_clock;
+  for (s = 0; s < 2; s++) {
+    n_tdsurvivors[s] = wsh->n_tdsurvivors[s];
+    n_mpqsfail[s] = wsh->n_mpqsfail[s];
+    n_mpqsvain[s] = wsh->n_mpqsvain[s];
+    n_cofsplit[s] = wsh->n_cofsplit[s];
+    n_cofdrop[s] = wsh->n_cofdrop[s];
+    cs_clock[s] = wsh->cs_clock[s];
+    s3_clock[s] = wsh->s3_clock[s];
+    tds4_clock[s] = wsh->tds4_clock[s];
+  }
+}
+
+/* The first special q which is not yet completely sieved. */
+static u32_t worker_resume_spq(void)
+{ u32_t k, q;
+
+  q = wsh->next_spq;
+  for (k = 0; k < n_workers; k++)
+    if (wsh->cur_spq[k] < q)
+      q = wsh->cur_spq[k];
+  return q;
+}
+
+static void worker_write_last_spq(u32_t q)
+{ char *ofn;
+  FILE *of;
+
+  asprintf(&ofn, ".last_spq%d", process_no);
+  if ((of = fopen(ofn, "wb")) != 0) {
+    fprintf(of, "%u\n", (unsigned int)q);
+    fclose(of);
+  }
+  free(ofn);
+}
+
+static pid_t worker_pids[MAX_WORKERS];
+int lasieve();
+
+static void worker_forward_signal(int signo)
+{ u32_t k;
+
+  for (k = 0; k < n_workers; k++)
+    if (worker_pids[k] > 0)
+      kill(worker_pids[k], signo);
+}
+
+/* Fork the workers and wait for them. Returns in the parent only. */
+static void lasieve_workers(void)
+{ u32_t k, n_alive;
+  double tStart, lastReport;
+
+  wsh = mmap(NULL, sizeof(*wsh), PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (wsh == MAP_FAILED)
+    complain("Cannot map shared worker state: %m\n");
+  memset((void *)wsh, 0, sizeof(*wsh));
+  wsh->next_spq = first_spq;
+  for (k = 0; k < n_workers; k++)
+    wsh->cur_spq[k] = UINT_MAX;
+
+  fflush(stdout);
+  fflush(stderr);
+  fflush(g_ofile);
+  for (k = 0; k < n_workers; k++) {
+    if ((worker_pids[k] = fork()) < 0)
+      complain("Cannot fork worker %u: %m\n", k);
+    if (worker_pids[k] == 0) {
+      worker_id = k;
+      worker_ofile = g_ofile;
+      worker_obuf = NULL;
+      if ((g_ofile = open_memstream(&worker_obuf, &worker_obuf_len)) == NULL)
+        complain("Worker %d: cannot open output buffer: %m\n", worker_id);
+      lasieve();
+      fclose(g_ofile);
+      free(worker_obuf);
+      worker_report_stats();
+      _exit(0);
+    }
+  }
+  signal(SIGTERM, worker_forward_signal);
+  signal(SIGINT, worker_forward_signal);
+
+  tStart = lastReport = sTime();
+  for (n_alive = n_workers; n_alive > 0; ) {
+    int status;
+    pid_t pid;
+
+    pid = waitpid(-1, &status, WNOHANG);
+    if (pid > 0) {
+      for (k = 0; k < n_workers; k++)
+        if (worker_pids[k] == pid)
+          worker_pids[k] = 0;
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        errprintf("Worker process %d terminated abnormally\n", (int)pid);
+      n_alive--;
+      continue;
+    }
+    if (pid < 0)
+      complain("waitpid: %m\n");
+    sleep(1);
+    if (sTime() > lastReport + 5.0) {
+      lastReport = sTime();
+      fprintf(stderr, "\rtotal yield: %u, q=%u (%1.5lf sec/rel)",
+              (unsigned int)wsh->yield, (unsigned int)MIN(wsh->next_spq, last_spq),
+              (lastReport - tStart)/wsh->yield);
+      fflush(stderr);
+      worker_write_last_spq(worker_resume_spq());
+    }
+  }
+  fprintf(stderr, "\rtotal yield: %u, q=%u (%1.5lf sec/rel)\n",
+          (unsigned int)wsh->yield, (unsigned int)MIN(wsh->next_spq, last_spq),
+          (sTime() - tStart)/wsh->yield);
+
+  worker_collect_stats();
+  special_q = worker_resume_spq();
+  if (special_q < last_spq) {
+    worker_write_last_spq(special_q);
+    all_spq_done = 0;
+  }
+}
+#endif
+
+static void cofact_flush(void);
+
+/* Per special q metrics (-m <file>): one JSON line per special q, with
+   the time spent in each stage and the counters of the sieve reports on
+   their way to relations. The stages are timed at the same places as the
+   millisecond clocks above, with the cycle counter where there is one.
+   Cofactorization is timed where it runs; with -E or -X that is when the
+   saved reports are flushed, so it is counted for the special q at which
+   that happens, together with the relations it yields, or in a record
+   with q 0 when that is at the end of the run or of a -Q lease.
+*/
+#define M_CHANGE 0
+#define M_SCHED  1
+#define M_SIEVE  2
+#define M_CANDS  3
+#define M_TD     4
+#define M_COFACT 5
+#define M_STAGES 6
+static const char *metrics_stage_name[M_STAGES] = {
+  "change", "sched", "sieve", "cands", "td", "cofact"
+};
+static FILE *metrics_file = NULL;
+static u64_t metrics_cycles[M_STAGES], metrics_last;
+static double metrics_t0;
+static struct {
+  u32_t n_spq, prereports, reports, rep1, rep2, tdsurvivors[2];
+  u32_t mpqsfail[2], mpqsvain[2], cofsplit[2], cofdrop[2], bsdrop, yield;
+} metrics_start;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define METRICS_UNIT "cycles"
+static inline u64_t metrics_now(void)
+{ u32_t lo, hi;
+
+  __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((u64_t)hi << 32) | lo;
+}
+#elif defined(CLOCK_MONOTONIC)
+#define METRICS_UNIT "ns"
+static inline u64_t metrics_now(void)
+{ struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#else
+#define METRICS_UNIT "clock"
+static inline u64_t metrics_now(void)
+{ return clock();
+}
+#endif
+
+/* The time since the last mark goes to stage s. */
+#define metrics_mark(s) \
+  do { if (metrics_file != NULL) { u64_t t_ = metrics_now(); \
+         metrics_cycles[s] += t_ - metrics_last; metrics_last = t_; } } while (0)
+
+/* Cofactorization from t0 until now, which is not counted */
+/* for the stage it interrupts.                            */
+static void metrics_cofact(u64_t t0)
+{ u64_t d;
+
+  if (metrics_file == NULL)
+    return;
+  d = metrics_now() - t0;
+  metrics_cycles[M_COFACT] += d;
+  metrics_last += d;
+}
+
+static void metrics_open(char *name)
+{ u32_t s;
+
+  if (strcmp(name, "-") == 0)
+    metrics_file = stderr;
+  else if ((metrics_file = fopen(name, "a")) == NULL)
+    complain("Cannot open %s for the metrics: %m\n", name);
+  fprintf(metrics_file, "{\"unit\":\"%s\",\"I\":%u,\"J\":%u,\"side\":%u",
+          METRICS_UNIT, I_bits, J_bits, special_q_side);
+  for (s = 0; s < 2; s++)
+    fprintf(metrics_file, ",\"fb%u\":%.0f,\"lpb%u\":%u,\"mfb%u\":%u,\"lambda%u\":%g",
+            s, FB_bound[s], s, (u32_t)max_primebits[s], s,
+            (u32_t)max_factorbits[s], s, sieve_report_multiplier[s]);
+  fprintf(metrics_file, "}\n");
+  fflush(metrics_file);
+}
+
+static void metrics_begin(void)
+{ u32_t s;
+
+  if (metrics_file == NULL)
+    return;
+  memset(metrics_cycles, 0, sizeof(metrics_cycles));
+  metrics_start.n_spq = n_spq;
+  metrics_start.prereports = n_prereports;
+  metrics_start.reports = n_reports;
+  metrics_start.rep1 = n_rep1;
+  metrics_start.rep2 = n_rep2;
+  metrics_start.bsdrop = n_bsdrop;
+  metrics_start.yield = yield;
+  for (s = 0; s < 2; s++) {
+    metrics_start.tdsurvivors[s] = n_tdsurvivors[s];
+    metrics_start.mpqsfail[s] = n_mpqsfail[s];
+    metrics_start.mpqsvain[s] = n_mpqsvain[s];
+    metrics_start.cofsplit[s] = n_cofsplit[s];
+    metrics_start.cofdrop[s] = n_cofdrop[s];
+  }
+  metrics_t0 = sTime();
+  metrics_last = metrics_now();
+}
+
+/* Write the record of special q, as one write to the O_APPEND file, */
+/* so that the lines of several workers are not mixed.               */
+static void metrics_end(u32_t q)
+{ char buf[1024];
+  size_t n;
+  u32_t s;
+
+  if (metrics_file == NULL)
+    return;
+  n = snprintf(buf, sizeof(buf), "{\"q\":%u,\"lattices\":%u,\"w\":%d,\"sec\":%.6f",
+               q, n_spq - metrics_start.n_spq,
+#ifdef LASIEVE_WORKERS
+               worker_id < 0 ? 0 : worker_id,
+#else
+               0,
+#endif
+               sTime() - metrics_t0);
+  for (s = 0; s < M_STAGES; s++)
+    n += snprintf(buf + n, sizeof(buf) - n, ",\"%s\":%llu", metrics_stage_name[s],
+                  (unsigned long long)metrics_cycles[s]);
+  n += snprintf(buf + n, sizeof(buf) - n,
+                ",\"cand\":%u,\"reports\":%u,\"coprime\":%u,\"normok\":%u"
+                ",\"tdsurv\":[%u,%u],\"mpqsfail\":[%u,%u],\"mpqsvain\":[%u,%u]"
+                ",\"cofsplit\":[%u,%u],\"cofdrop\":[%u,%u],\"bsdrop\":%u,\"rels\":%u}\n",
+                n_prereports - metrics_start.prereports,
+                n_reports - metrics_start.reports,
+                n_rep1 - metrics_start.rep1, n_rep2 - metrics_start.rep2,
+                n_tdsurvivors[0] - metrics_start.tdsurvivors[0],
+                n_tdsurvivors[1] - metrics_start.tdsurvivors[1],
+                n_mpqsfail[0] - metrics_start.mpqsfail[0],
+                n_mpqsfail[1] - metrics_start.mpqsfail[1],
+                n_mpqsvain[0] - metrics_start.mpqsvain[0],
+                n_mpqsvain[1] - metrics_start.mpqsvain[1],
+                n_cofsplit[0] - metrics_start.cofsplit[0],
+                n_cofsplit[1] - metrics_start.cofsplit[1],
+                n_cofdrop[0] - metrics_start.cofdrop[0],
+                n_cofdrop[1] - metrics_start.cofdrop[1],
+                n_bsdrop - metrics_start.bsdrop, yield - metrics_start.yield);
+  if (n >= sizeof(buf))
+    n = sizeof(buf) - 1;
+  fwrite(buf, 1, n, metrics_file);
+  fflush(metrics_file);
+}
+
+/* cofact_flush() outside of a special q; its relations are */
+/* counted in a record with q 0.                            */
+static void metrics_cofact_flush(void)
+{
+  if (cof_n == 0)
+    return;
+  metrics_begin();
+  cofact_flush();
+  metrics_end(0);
+}
+
+#ifdef LASIEVE_WORKERS
+/* Client of spqserver (-Q <server>). The special q are leased from the
+   server in chunks, instead of being taken from -f/-c, and the relations
+   of a chunk are collected in the output buffer (worker_obuf) and sent
+   to the server when the chunk is done, before the next one is leased.
+   The lease is renewed between special q. <server> is host:port, or the
+   path of a Unix socket if it contains a '/'. With -T, each worker has
+   its own connection and leases.
+*/
+static FILE *spq_in = NULL, *spq_out;
+static u32_t spq_lease = 0, spq_lease_secs;
+static double spq_renewed;
+
+static void spq_connect(void)
+{ int fd;
+
+  if (strchr(spq_server, '/') != NULL) {
+    struct sockaddr_un sun;
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strncpy(sun.sun_path, spq_server, sizeof(sun.sun_path) - 1);
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+        connect(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+      complain("Cannot connect to %s: %m\n", spq_server);
+  } else {
+    struct addrinfo hints, *ai, *a;
+    char *host, *port;
+
+    host = xmalloc(strlen(spq_server) + 1);
+    strcpy(host, spq_server);
+    if ((port = strrchr(host, ':')) == NULL)
+      complain("-Q %s: expected host:port or a socket path\n", spq_server);
+    *port++ = 0;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &ai) != 0)
+      complain("Cannot resolve %s\n", spq_server);
+    for (a = ai, fd = -1; a != NULL && fd < 0; a = a->ai_next) {
+      if ((fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol)) < 0)
+        continue;
+      if (connect(fd, a->ai_addr, a->ai_addrlen) < 0) {
+        close(fd);
+        fd = -1;
+      }
+    }
+    freeaddrinfo(ai);
+    free(host);
+    if (fd < 0)
+      complain("Cannot connect to %s: %m\n", spq_server);
+  }
+  signal(SIGPIPE, SIG_IGN);
+  if ((spq_in = fdopen(fd, "r")) == NULL ||
+      (spq_out = fdopen(dup(fd), "w")) == NULL)
+    complain("fdopen: %m\n");
+}
+
+/* Send a request, and read the reply line into reply. */
+static void spq_request(char *reply, size_t len, const char *data,
+                        size_t dlen, const char *fmt, ...)
+{ va_list ap;
+
+  if (spq_in == NULL)
+    spq_connect();
+  va_start(ap, fmt);
+  vfprintf(spq_out, fmt, ap);
+  va_end(ap);
+  if ((dlen > 0 && fwrite(data, 1, dlen, spq_out) != dlen) ||
+      fflush(spq_out) != 0 || fgets(reply, len, spq_in) == NULL)
+    complain("Lost connection to %s\n", spq_server);
+}
+
+/* Send the relations of the current lease, and start a new buffer. */
+static void spq_put(void)
+{ char reply[64];
+
+  metrics_cofact_flush();
+  fflush(g_ofile);
+  spq_request(reply, sizeof(reply), worker_obuf, worker_obuf_len,
+              "PUT %u %lu\n", spq_lease, (unsigned long)worker_obuf_len);
+  if (strncmp(reply, "OK", 2) != 0)
+    errprintf("Lease %u was taken over, its relations were dropped\n", spq_lease);
+  spq_lease = 0;
+  fclose(g_ofile);
+  free(worker_obuf);
+  worker_obuf = NULL;
+  if ((g_ofile = open_memstream(&worker_obuf, &worker_obuf_len)) == NULL)
+    complain("Cannot open output buffer: %m\n");
+}
+
+static int spq_next_range(u32_t *lb, u32_t *ub)
+{ char reply[128];
+  u32_t w;
+
+  if (spq_lease != 0)
+    spq_put();
+  for (;;) {
+    spq_request(reply, sizeof(reply), NULL, 0, "LEASE\n");
+    if (sscanf(reply, "RANGE %u %u %u %u", &spq_lease, lb, ub, &spq_lease_secs) == 4) {
+      if (*lb < first_spq || *ub > last_spq || *lb >= *ub)
+        complain("%s leased [%u,%u) outside [%u,%u)\n", spq_server,
+                 *lb, *ub, first_spq, last_spq);
+      spq_renewed = sTime();
+      if (wsh != NULL && wsh->next_spq < *ub)
+        wsh->next_spq = *ub;
+      return 1;
+    }
+    if (sscanf(reply, "WAIT %u", &w) == 1) {
+      sleep(w);
+      continue;
+    }
+    if (strncmp(reply, "DONE", 4) == 0)
+      break;
+    complain("Unexpected reply from %s: %s", spq_server, reply);
+  }
+  if (wsh != NULL) {
+    wsh->cur_spq[worker_id] = UINT_MAX;
+    wsh->next_spq = last_spq;
+  }
+  return 0;
+}
+
+/* Renew the lease if a third of its time has passed. */
+static void spq_heartbeat(void)
+{ char reply[64];
+
+  if (spq_lease == 0 || sTime() < spq_renewed + spq_lease_secs / 3.0)
+    return;
+  spq_request(reply, sizeof(reply), NULL, 0, "RENEW %u\n", spq_lease);
+  if (strncmp(reply, "OK", 2) != 0)
+    errprintf("Lease %u has expired at %s\n", spq_lease, spq_server);
+  spq_renewed = sTime();
+}
+
+/* Give back an unfinished lease, after an interrupt. */
+static void spq_drop(void)
+{ char reply[64];
+
+  if (spq_lease == 0)
+    return;
+  spq_request(reply, sizeof(reply), NULL, 0, "DROP %u\n", spq_lease);
+  spq_lease = 0;
+}
+
+/* The whole range of the job; the connection is not kept, so that */
+/* the workers forked later do not share it.                       */
+static void spq_job(u32_t *q0, u32_t *count)
+{ char reply[128];
+  u32_t a, b;
+
+  spq_request(reply, sizeof(reply), NULL, 0, "JOB\n");
+  if (sscanf(reply, "JOB %u %u", &a, &b) != 2 || a >= b)
+    complain("Unexpected reply from %s: %s", spq_server, reply);
+  *q0 = a;
+  *count = b - a;
+  fclose(spq_in);
+  fclose(spq_out);
+  spq_in = NULL;
+}
+#endif
+
+/* Hand out the next range [lb,ub) of special q to be sieved. */
+static int next_spq_range(u32_t *lb, u32_t *ub)
+{
+#ifdef LASIEVE_WORKERS
+  if (spq_server != NULL)
+    return spq_next_range(lb, ub);
+  if (wsh != NULL) {
+    u32_t q;
+
+    /* Reports from earlier special q may still wait for cofact_flush(). */
+    if (cof_n == 0)
+      wsh->cur_spq[worker_id] = wsh->next_spq;
+    q = __sync_fetch_and_add(&(wsh->next_spq), WORKER_SPQ_CHUNK);
+    if (q >= last_spq) {
+      if (cof_n == 0)
+        wsh->cur_spq[worker_id] = UINT_MAX;
+      return 0;
+    }
+    if (cof_n == 0)
+      wsh->cur_spq[worker_id] = q;
+    *lb = q;
+    *ub = last_spq - q > WORKER_SPQ_CHUNK ? q + WORKER_SPQ_CHUNK : last_spq;
+    return 1;
+  }
+#endif
+  static int range_done = 0;
+
+  if (range_done++)
+    return 0;
+  *lb = first_spq;
+  *ub = last_spq;
+  return 1;
+}
+
+/* The special q following q (or the first one if q is 0), or 0 if
+   there are none left.
+*/
+static u32_t next_special_q(u32_t q)
+{ static u32_t spq_ub = 0;
+  u32_t spq_lb;
+
+  if (q != 0) {
+    q = nextprime32(&special_q_ps);
+    if (q != 0 && q < spq_ub)
+      return q;
+  }
+  while (next_spq_range(&spq_lb, &spq_ub)) {
+    q = pr32_seek(&special_q_ps, spq_lb);
+    if (q != 0 && q < spq_ub)
+      return q;
+  }
+  return 0;
+}
+
+/**************************************************/
+static int factor_large(u16_t s1, u32_t ov, size_t *nlp)
+/**************************************************/
+/* Factor large_factors[s1], a composite, into the  */
+/* large_primes[s1][]: with mpqs_factor(), else     */
+/* with rho_factor(), else as a square. Return      */
+/* value: 1 on success, 0 if the relation is lost.  */
+/**************************************************/
+{ long nf;
+  u32_t i;
+  mpz_t *mf;
+
+#define KLEINJUNG_MPQS
+#ifdef KLEINJUNG_MPQS
+  if ((nf = mpqs_factor(large_factors[s1], max_primebits[s1], &mf)) < 0) {
+#if 0
+    n_mpqsfail[s1]++;
+    return 0;
+#else
+    goto attempt_mpqs4linux;
+#endif
+  }
+  if (nf == 0) {
+    n_mpqsvain[s1]++;
+    return 0;
+  }
+  for (i = 0; i < nf; i++)
+    mpz_set(large_primes[s1][i], mf[i]);
+  nlp[s1] = nf;
+  return 1;
+#endif
+attempt_mpqs4linux:
+#if 0
+  nlp[s1] = mpqs(large_primes[s1], large_factors[s1], NULL);
+#endif
+#define TRY_RHO_ON_FAILURES
+#ifdef TRY_RHO_ON_FAILURES
+  nlp[s1] = 0;
+  { unsigned long small_factors[10];
+
+    nf = rho_factor(small_factors, large_factors[s1]);
+    if(nf > 0)
+    {
+      for (i = 0; i < nf; i++) {
+        mpz_set_ui(large_primes[s1][i], small_factors[i]);
+        if (mpz_sizeinbase(large_primes[s1][i],2) > max_primebits[s1]) {
+          n_mpqsvain[s1]++;
+          break;
+        }
+      }
+      if (i >= nf)
+        nlp[s1] = nf;
+    }
+  }
+#endif
+  if (nlp[s1] == 0) {
+    /* did it fail on a square? */
+    mpz_sqrtrem(large_primes[s1][0],large_primes[s1][1],large_factors[s1]);
+    if(mpz_sgn(large_primes[s1][1]) == 0) { /* remainder == 0? */
+      mpz_set(large_primes[s1][1],large_primes[s1][0]);
+      nlp[s1]= 2;
+      if(ov > 1) {
+        fprintf(stderr," mpqs on a prime square ");
+        mpz_out_str(stderr,10,large_primes[s1][0]);
+        fprintf(stderr,"^2  ");
+      }
+      return 1;
+    }
+    if (ov > 1) {
+      fprintf(stderr, "mpqs failed for ");
+      mpz_out_str(stderr, 10, large_factors[s1]);
+      fprintf(stderr, "(a,b): ");
+      mpz_out_str(stderr, 10, g_sr_a);
+      fprintf(stderr, " ");
+      mpz_out_str(stderr, 10, g_sr_b);
+      fprintf(stderr, "\n");
+    }
+    n_mpqsfail[s1]++;
+    return 0;
+  }
+#ifdef KLEINJUNG_MPQS
+  if (ov > 1) {
+    fprintf(stderr, "mpqs factored ");
+    mpz_out_str(stderr, 10, large_factors[s1]);
+    fprintf(stderr, "\n");
+  }
+#endif
+  for (i = 0; i < nlp[s1]; i++) {
+    if (mpz_sizeinbase(large_primes[s1][i], 2) >
+        max_primebits[s1]) {
+      n_mpqsvain[s1]++;
+printf("Too large!\n");
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/**************************************************/
+static void output_relation(size_t *nlp, u32_t **fbp_buffers, u32_t **fbp_buffers_ub)
+/**************************************************/
+/* Write the relation g_sr_a, g_sr_b with the large */
+/* primes large_primes[s][0..nlp[s]-1] and the      */
+/* factor base primes in fbp_buffers[s].            */
+/**************************************************/
+{ u32_t i;
+
+//                        fprintf(ofile, "W ");
+#define OBASE 16
+  yield++;
+  mpz_out_str(g_ofile, 10, g_sr_a);
+  fprintf(g_ofile, ",");
+  mpz_out_str(g_ofile, 10, g_sr_b);
+
+  if (short_output == 0) /* Sten: added -s parameter to the command line. */
+  {
+#ifdef _ORIG_OUTPUT_FORMAT
+     u32_t s;
+
+     for (s = 0; s < 2; s++) {
+       u32_t *x;
+
+       fprintf(ofile, "\n%c", 'X' + s);
+       for (i = 0; i < nlp[s]; i++) {
+         fprintf(ofile, " ");
+         mpz_out_str(ofile, OBASE, large_primes[s][i]);
+       }
+       for (x = fbp_buffers[s]; x < fbp_buffers_ub[s]; x++) {
+         fprintf(ofile, " %X", *x);
+       }
+     }
+#else
+     { int numR=0;
+      u32_t *x;
+
+      fprintf(g_ofile, ":");
+      for (i = 0; i < nlp[1]; i++) { /* rational first. */
+        if (i>0) fprintf(g_ofile, ",");
+        mpz_out_str(g_ofile, OBASE, large_primes[1][i]);
+        numR++;
+      }
+      for (x = fbp_buffers[1]; x < fbp_buffers_ub[1];x++) {
+        if (numR>0) fprintf(g_ofile, ",%X", (unsigned int)*x);
+        else { fprintf(g_ofile, "%X", (unsigned int)*x); numR++;}
+      }
+    }
+    { int numA=0;
+      u32_t *x;
+
+      fprintf(g_ofile, ":");
+      for (i = 0; i < nlp[0]; i++) { /* algebraic next. */
+        if (i>0) fprintf(g_ofile, ",");
+        mpz_out_str(g_ofile, OBASE, large_primes[0][i]);
+        numA++;
+      }
+      for (x = fbp_buffers[0]; x < fbp_buffers_ub[0];x++) {
+        if (numA>0) fprintf(g_ofile, ",%X", (unsigned int)*x);
+        else { fprintf(g_ofile, "%X", (unsigned int)*x); numA++;}
+      }
+    }
+#endif
+  } /* if (short_output == 0) */
+
+  fprintf(g_ofile, "\n");
+}
+
+/**************************************************/
+static void cofact_save(i16_t *need_mpqs, size_t *nlp, u32_t **fbp_buffers,
+                        u32_t **fbp_buffers_ub, u16_t first_mpqs_side)
+/**************************************************/
+/* Put the current report aside for cofact_flush(). */
+/**************************************************/
+{ cof_report_t *r;
+  u32_t s;
+
+  if (cof_n == cof_alloc) {
+    size_t k;
+
+    cof_alloc = cof_alloc == 0 ? 256 : 2 * cof_alloc;
+    cof_reports = xrealloc(cof_reports, cof_alloc * sizeof(*cof_reports));
+    cof_open = xrealloc(cof_open, 2 * cof_alloc * sizeof(*cof_open));
+    for (k = cof_n; k < cof_alloc; k++) {
+      mpz_init(cof_reports[k].a);
+      mpz_init(cof_reports[k].b);
+      cofact_init(cof_reports[k].cf);
+      cofact_init(cof_reports[k].cf + 1);
+    }
+  }
+  if (cof_n == 0)
+    cof_first_spq = special_q;
+  r = cof_reports + cof_n++;
+  mpz_set(r->a, g_sr_a);
+  mpz_set(r->b, g_sr_b);
+  r->first_mpqs_side = first_mpqs_side;
+  for (s = 0; s < 2; s++) {
+    cofact_t *c = r->cf + s;
+    size_t n = fbp_buffers_ub[s] - fbp_buffers[s];
+
+    r->need_mpqs[s] = need_mpqs[s];
+    c->lpbits = max_primebits[s];
+    c->nf = 0;
+    if (need_mpqs[s]) {
+      mpz_set(c->n, large_factors[s]);
+      c->status = CF_OPEN;
+    } else {
+      if (nlp[s] != 0)
+        mpz_set(c->f[c->nf++], large_primes[s][0]);
+      mpz_set_ui(c->n, 1);
+      c->status = CF_SMOOTH;
+    }
+    if (cof_fbp_n + n > cof_fbp_alloc) {
+      cof_fbp_alloc = 2 * (cof_fbp_n + n);
+      cof_fbp = xrealloc(cof_fbp, cof_fbp_alloc * sizeof(*cof_fbp));
+    }
+    memcpy(cof_fbp + cof_fbp_n, fbp_buffers[s], n * sizeof(*cof_fbp));
+    r->fbp[s] = cof_fbp_n;
+    cof_fbp_n += n;
+    r->fbp_ub[s] = cof_fbp_n;
+  }
+}
+
+/**************************************************/
+static void cofact_flush(void)
+/**************************************************/
+/* Factor the cofactors of the saved reports, first */
+/* all of them together by cofact_run(), then those */
+/* which it left open by factor_large(), and write  */
+/* the relations.                                   */
+/**************************************************/
+{ size_t k, n_open;
+  clock_t cl;
+  u32_t ov;
+  u64_t mt;
+
+  if (cof_n == 0)
+    return;
+  cl = clock();
+  mt = 0;
+  if (metrics_file != NULL)
+    mt = metrics_now();
+  if (bsmooth_batch != 0) {
+    mpz_ptr *bn = xmalloc(cof_n * sizeof(*bn));
+    unsigned char *sm = xmalloc(cof_n);
+    size_t nb;
+
+    for (k = 0, nb = 0; k < cof_n; k++)
+      if (cof_reports[k].cf[bs_side].status == CF_OPEN)
+        bn[nb++] = cof_reports[k].cf[bs_side].n;
+    bsmooth_test(bs_P, bn, nb, (u32_t)FB_bound[bs_side], sm);
+    for (k = 0, nb = 0; k < cof_n; k++) {
+      cofact_t *c = cof_reports[k].cf + bs_side;
+
+      if (c->status == CF_OPEN && sm[nb++] == 0) {
+        c->status = CF_NOT_SMOOTH;
+        n_bsdrop++;
+      }
+    }
+    free(bn);
+    free(sm);
+  }
+  for (k = 0, n_open = 0; k < cof_n; k++) {
+    if (cof_reports[k].cf[0].status == CF_OPEN)
+      cof_open[n_open++] = cof_reports[k].cf;
+    if (cof_reports[k].cf[1].status == CF_OPEN)
+      cof_open[n_open++] = cof_reports[k].cf + 1;
+  }
+  if (use_cofact != 0)
+    cofact_run(cof_open, n_open);
+
+  ov = verbose;
+  verbose = 0;
+  for (k = 0; k < cof_n; k++) {
+    cof_report_t *r = cof_reports + k;
+    u32_t s, i, *(fbp_buffers[2]), *(fbp_buffers_ub[2]);
+    size_t nlp[2];
+
+    mpz_set(g_sr_a, r->a);
+    mpz_set(g_sr_b, r->b);
+    for (s = 0; s < 2; s++) {
+      u16_t s1;
+      cofact_t *c;
+
+      s1 = s ^ r->first_mpqs_side;
+      c = r->cf + s1;
+      if (c->status == CF_NOT_SMOOTH) {
+        n_cofdrop[s1]++;
+        break;
+      }
+      nlp[s1] = 0;
+      if (c->status == CF_OPEN) {
+        mpz_set(large_factors[s1], c->n);
+        if (factor_large(s1, ov, nlp) == 0)
+          break;
+      } else if (r->need_mpqs[s1])
+        n_cofsplit[s1]++;
+      for (i = 0; i < c->nf; i++)
+        mpz_set(large_primes[s1][nlp[s1]++], c->f[i]);
+    }
+    if (s != 2)
+      continue;
+    for (s = 0; s < 2; s++) {
+      fbp_buffers[s] = cof_fbp + r->fbp[s];
+      fbp_buffers_ub[s] = cof_fbp + r->fbp_ub[s];
+    }
+    output_relation(nlp, fbp_buffers, fbp_buffers_ub);
+  }
+  verbose = ov;
+  mpqs_clock += (clock_t)((1000.0 * (clock() - cl)) / CLOCKS_PER_SEC);
+  metrics_cofact(mt);
+  cof_n = 0;
+  cof_fbp_n = 0;
+}
 
 /******************************************************************/
 int lasieve()
@@ -641,11 +1971,16 @@ int lasieve()
   n_spq = 0;
   n_spq_discard = 0;
   r_ptr = xmalloc(poldeg_max * sizeof(*r_ptr));
-  special_q = pr32_seek(&special_q_ps, first_spq);
   tStart = lastReport = sTime();
-  for ( ; special_q < last_spq && special_q != 0; special_q = nextprime32(&special_q_ps)) {
-    u32_t nr;
+  for (special_q = next_special_q(0); special_q != 0; special_q = next_special_q(special_q)) {
+    /* Kept in memory, since the root loop below does setjmp(). */
+    volatile u32_t nr;
 
+#ifdef LASIEVE_WORKERS
+    if (wsh != NULL)
+      wsh->cur_spq[worker_id] = cof_n > 0 ? cof_first_spq : special_q;
+#endif
+    metrics_begin();
     special_q_log = log(special_q);
     if (cmdline_first_sieve_side == USHRT_MAX) {
       double nn[2];
@@ -698,6 +2033,12 @@ int lasieve()
           char *hn, *ofn;
           FILE *of;
 
+#ifdef LASIEVE_WORKERS
+          if (wsh != NULL) {
+            all_spq_done = 0;
+            break;
+          }
+#endif
           hn = xmalloc(100);
 #if 0
           if (gethostname(hn, 99) == 0)
@@ -978,6 +2319,7 @@ int lasieve()
       new_clock = clock();
       sch_clock += (clock_t)((1000.0 * (new_clock - last_clock)) / CLOCKS_PER_SEC);
       last_clock = new_clock;
+      metrics_mark(M_CHANGE);
 
       for (oddness_type = 1; oddness_type < 4; oddness_type++) {
         for (s = 0; s < 2; s++) {
@@ -1206,6 +2548,7 @@ int lasieve()
         Schedule_clock +=
           (1000.0 * (clock() - last_clock)) / CLOCKS_PER_SEC;
 #endif
+        metrics_mark(M_SCHED);
 
         last_clock = clock();
 #ifdef ZSS_STAT
@@ -1224,7 +2567,7 @@ int lasieve()
               continue;
             for (ll = 0, sched = (u32_t *) med_sched[s][0], ri = LPri[s];
                  ll < n_medsched_pieces[s]; ll++) {
-              ri = medsched(ri, current_ij[s] + medsched_fbi_bounds[s][ll],
+              ri = medsched_fn(ri, current_ij[s] + medsched_fbi_bounds[s][ll],
                             current_ij[s] + medsched_fbi_bounds[s][ll + 1],
                             &sched, medsched_fbi_bounds[s][ll],
                             j_offset == 0 ? oddness_type : 0);
@@ -1237,6 +2580,7 @@ int lasieve()
             medsched_clock +=
               (clock_t)((1000.0 * (new_clock - last_clock)) / CLOCKS_PER_SEC);
             last_clock = new_clock;
+            metrics_mark(M_SCHED);
           }
 #endif
           for (s = first_sieve_side, stepno = 0; stepno < 2; stepno++, s = 1 - s) {
@@ -1363,6 +2707,7 @@ int lasieve()
             si_clock[s] += clock_diff;
             sieve_clock += clock_diff;
             last_clock = new_clock;
+            metrics_mark(M_SIEVE);
 
 #ifdef ASM_LINESIEVER
             slinie(smallsieve_tinybound[s], smallsieve_auxbound[s][4],
@@ -1608,6 +2953,7 @@ int lasieve()
             s1_clock[s] += clock_diff;
             sieve_clock += clock_diff;
             last_clock = new_clock;
+            metrics_mark(M_SIEVE);
 #ifdef GGNFS_BIGENDIAN
 #define MEDSCHED_SI_OFFS 1
 #else
@@ -1651,6 +2997,7 @@ int lasieve()
 #endif
             sieve_clock += clock_diff;
             last_clock = new_clock;
+            metrics_mark(M_SIEVE);
 #ifdef GGNFS_BIGENDIAN
 #define SCHED_SI_OFFS 1
 #else
@@ -1676,52 +3023,71 @@ int lasieve()
                 (1000.0 * (new_clock - last_clock)) / CLOCKS_PER_SEC;
               last_clock = new_clock;
 #endif
+              metrics_mark(M_SCHED);
 
               for (j = 0; j < n_schedules[s]; j++) {
+                if (schedules[s][j].bucket != NULL) {
+                  u64_t *b, *b_ub;
+
+                  b = schedules[s][j].bucket[schedules[s][j].current_strip];
+                  b_ub = schedules[s][j].bucket_ptr[schedules[s][j].current_strip];
+                  while (b + 3 < b_ub) {
+                    sieve_interval[(u16_t)b[0]] += (unsigned char)(b[0] >> 16);
+                    sieve_interval[(u16_t)b[1]] += (unsigned char)(b[1] >> 16);
+                    sieve_interval[(u16_t)b[2]] += (unsigned char)(b[2] >> 16);
+                    sieve_interval[(u16_t)b[3]] += (unsigned char)(b[3] >> 16);
+                    b += 4;
+                  }
+                  while (b < b_ub) {
+                    sieve_interval[(u16_t)b[0]] += (unsigned char)(b[0] >> 16);
+                    b++;
+                  }
+                } else {
 #ifdef ASM_SCHEDSIEVE1
-                u32_t k;
+                  u32_t k;
 
-                k = schedules[s][j].current_strip;
-                for (i = 0; i <= schedules[s][j].n_pieces; i++) {
-                  schedbuf[i] = schedules[s][j].schedule[i][k];
-                }
-                schedsieve(schedules[s][j].schedlogs,
-                           schedules[s][j].n_pieces, schedbuf,
-                           sieve_interval);
+                  k = schedules[s][j].current_strip;
+                  for (i = 0; i <= schedules[s][j].n_pieces; i++) {
+                    schedbuf[i] = schedules[s][j].schedule[i][k];
+                  }
+                  schedsieve(schedules[s][j].schedlogs,
+                             schedules[s][j].n_pieces, schedbuf,
+                             sieve_interval);
 #else
-                u32_t l, k;
-
-                k = schedules[s][j].current_strip;
-                l = 0;
-                while (l < schedules[s][j].n_pieces) {
-                  unsigned char x;
-                  u16_t *schedule_ptr, *sptr_ub;
-
-                  x = schedules[s][j].schedlogs[l];
-                  schedule_ptr =
-                    schedules[s][j].schedule[l][k] + SCHED_SI_OFFS;
-                  while (l < schedules[s][j].n_pieces)
-                    if (schedules[s][j].schedlogs[++l] != x)
-                      break;
-                  sptr_ub = schedules[s][j].schedule[l][k];
+                  u32_t l, k;
+
+                  k = schedules[s][j].current_strip;
+                  l = 0;
+                  while (l < schedules[s][j].n_pieces) {
+                    unsigned char x;
+                    u16_t *schedule_ptr, *sptr_ub;
+
+                    x = schedules[s][j].schedlogs[l];
+                    schedule_ptr =
+                      schedules[s][j].schedule[l][k] + SCHED_SI_OFFS;
+                    while (l < schedules[s][j].n_pieces)
+                      if (schedules[s][j].schedlogs[++l] != x)
+                        break;
+                    sptr_ub = schedules[s][j].schedule[l][k];
 
 #ifdef ASM_SCHEDSIEVE
-                  schedsieve(x, sieve_interval, schedule_ptr, sptr_ub);
+                    schedsieve(x, sieve_interval, schedule_ptr, sptr_ub);
 #else
-                  while (schedule_ptr + 3 * SE_SIZE < sptr_ub) {
-                    sieve_interval[*schedule_ptr] += x;
-                    sieve_interval[*(schedule_ptr + SE_SIZE)] += x;
-                    sieve_interval[*(schedule_ptr + 2 * SE_SIZE)] += x;
-                    sieve_interval[*(schedule_ptr + 3 * SE_SIZE)] += x;
-                    schedule_ptr += 4 * SE_SIZE;
-                  }
-                  while (schedule_ptr < sptr_ub) {
-                    sieve_interval[*schedule_ptr] += x;
-                    schedule_ptr += SE_SIZE;
+                    while (schedule_ptr + 3 * SE_SIZE < sptr_ub) {
+                      sieve_interval[*schedule_ptr] += x;
+                      sieve_interval[*(schedule_ptr + SE_SIZE)] += x;
+                      sieve_interval[*(schedule_ptr + 2 * SE_SIZE)] += x;
+                      sieve_interval[*(schedule_ptr + 3 * SE_SIZE)] += x;
+                      schedule_ptr += 4 * SE_SIZE;
+                    }
+                    while (schedule_ptr < sptr_ub) {
+                      sieve_interval[*schedule_ptr] += x;
+                      schedule_ptr += SE_SIZE;
+                    }
+#endif
                   }
 #endif
                 }
-#endif
               }
             }
 
@@ -1734,6 +3100,7 @@ int lasieve()
             sieve_clock += clock_diff;
             s3_clock[s] += clock_diff;
             last_clock = new_clock;
+            metrics_mark(M_SIEVE);
 
             if (s == first_sieve_side) {
 #ifdef GCD_SIEVE_BOUND
@@ -1922,6 +3289,7 @@ int lasieve()
             sieve_clock += clock_diff;
             cs_clock[s] += clock_diff;
             last_clock = new_clock;
+            metrics_mark(M_CANDS);
           }
 
 #ifndef NO_TDCODE
@@ -2091,50 +3459,82 @@ int lasieve()
                   u32_t j;
 
                   for (j = 0; j < n_schedules[side]; j++) {
+                    if (schedules[side][j].bucket != NULL) {
+                      u64_t *b, *b_ub;
+                      u32_t fbi_offset, k;
+
+                      k = schedules[side][j].current_strip++;
+                      b = schedules[side][j].bucket[k];
+                      b_ub = schedules[side][j].bucket_ptr[k];
+                      fbi_offset = schedules[side][j].fbi_bounds[0];
+                      for (; b + 3 < b_ub; b += 4) {
+                        unsigned char z;
+
+                        if ((sieve_interval[(u16_t)b[0]] | sieve_interval[(u16_t)b[1]]
+                             | sieve_interval[(u16_t)b[2]] | sieve_interval[(u16_t)b[3]]) == 0) {
+                          continue;
+                        }
+                        if ((z = sieve_interval[(u16_t)b[0]]) != 0)
+                          *(tds_fbi_curpos[z-1]++) = fbi_offset + (u32_t)(b[0] >> 32);
+                        if ((z = sieve_interval[(u16_t)b[1]]) != 0)
+                          *(tds_fbi_curpos[z-1]++) = fbi_offset + (u32_t)(b[1] >> 32);
+                        if ((z = sieve_interval[(u16_t)b[2]]) != 0)
+                          *(tds_fbi_curpos[z-1]++) = fbi_offset + (u32_t)(b[2] >> 32);
+                        if ((z = sieve_interval[(u16_t)b[3]]) != 0)
+                          *(tds_fbi_curpos[z-1]++) = fbi_offset + (u32_t)(b[3] >> 32);
+                      }
+                      for (; b < b_ub; b++) {
+                        unsigned char z;
+
+                        if ((z = sieve_interval[(u16_t)b[0]]) != 0)
+                          *(tds_fbi_curpos[z-1]++) = fbi_offset + (u32_t)(b[0] >> 32);
+                      }
+                    } else {
 #ifdef ASM_SCHEDTDSIEVE
-                    u32_t k;
+                      u32_t k;
 
-                    k = schedules[side][j].current_strip++;
-                    for (i = 0; i <= schedules[side][j].n_pieces; i++) {
-                      schedbuf[i] = schedules[side][j].schedule[i][k];
-                    }
-                    schedtdsieve(schedules[side][j].fbi_bounds, schedules[side][j].n_pieces, 
-                                 schedbuf, sieve_interval, tds_fbi_curpos);
+                      k = schedules[side][j].current_strip++;
+                      for (i = 0; i <= schedules[side][j].n_pieces; i++) {
+                        schedbuf[i] = schedules[side][j].schedule[i][k];
+                      }
+                      schedtdsieve(schedules[side][j].fbi_bounds, schedules[side][j].n_pieces, 
+                                   schedbuf, sieve_interval, tds_fbi_curpos);
 #else
-                    u32_t l, k;
+                      u32_t l, k;
 
-                    k = schedules[side][j].current_strip++;
-                    for (l = 0; l < schedules[side][j].n_pieces; l++) {
-                      u16_t *x, *x_ub;
-                      u32_t fbi_offset;
+                      k = schedules[side][j].current_strip++;
+                      for (l = 0; l < schedules[side][j].n_pieces; l++) {
+                        u16_t *x, *x_ub;
+                        u32_t fbi_offset;
 
-                      x_ub = schedules[side][j].schedule[l + 1][k];
-                      fbi_offset = schedules[side][j].fbi_bounds[l];
-                      for (x=schedules[side][j].schedule[l][k]+SCHED_SI_OFFS; x+6<x_ub; x+=8) {
-                        unsigned char z;
+                        x_ub = schedules[side][j].schedule[l + 1][k];
+                        fbi_offset = schedules[side][j].fbi_bounds[l];
+                        for (x=schedules[side][j].schedule[l][k]+SCHED_SI_OFFS; x+6<x_ub; x+=8) {
+                          unsigned char z;
 
-                        if ((sieve_interval[*x] | sieve_interval[*(x + 2)]
-                             | sieve_interval[*(x + 4)] | sieve_interval[*(x + 6)]) == 0) {
-                          continue;
+                          if ((sieve_interval[*x] | sieve_interval[*(x + 2)]
+                               | sieve_interval[*(x + 4)] | sieve_interval[*(x + 6)]) == 0) {
+                            continue;
+                          }
+                          if ((z = sieve_interval[*x]) != 0)
+                            *(tds_fbi_curpos[z-1]++) = fbi_offset + *(x+1-2*SCHED_SI_OFFS);
+                          if ((z = sieve_interval[*(x + 2)]) != 0)
+                            *(tds_fbi_curpos[z-1]++) = fbi_offset + *(x+3-2*SCHED_SI_OFFS);
+                          if ((z = sieve_interval[*(x + 4)]) != 0)
+                            *(tds_fbi_curpos[z-1]++) = fbi_offset + *(x+5-2*SCHED_SI_OFFS);
+                          if ((z = sieve_interval[*(x + 6)]) != 0)
+                            *(tds_fbi_curpos[z-1]++) = fbi_offset + *(x+7-2*SCHED_SI_OFFS);
                         }
-                        if ((z = sieve_interval[*x]) != 0)
-                          *(tds_fbi_curpos[z-1]++) = fbi_offset + *(x+1-2*SCHED_SI_OFFS);
-                        if ((z = sieve_interval[*(x + 2)]) != 0)
-                          *(tds_fbi_curpos[z-1]++) = fbi_offset + *(x+3-2*SCHED_SI_OFFS);
-                        if ((z = sieve_interval[*(x + 4)]) != 0)
-                          *(tds_fbi_curpos[z-1]++) = fbi_offset + *(x+5-2*SCHED_SI_OFFS);
-                        if ((z = sieve_interval[*(x + 6)]) != 0)
-                          *(tds_fbi_curpos[z-1]++) = fbi_offset + *(x+7-2*SCHED_SI_OFFS);
-                      }
-                      while (x < x_ub) {
-                        unsigned char z;
+                        while (x < x_ub) {
+                          unsigned char z;
 
-                        if ((z = sieve_interval[*x]) != 0)
-                          *(tds_fbi_curpos[z-1]++) = fbi_offset + *(x+1-2*SCHED_SI_OFFS);
-                        x += 2;
+                          if ((z = sieve_interval[*x]) != 0)
+                            *(tds_fbi_curpos[z-1]++) = fbi_offset + *(x+1-2*SCHED_SI_OFFS);
+                          x += 2;
+                        }
                       }
-                    }
 #endif
+                    }
                   }
                 }
                 newclock = clock();
@@ -2407,13 +3807,13 @@ int lasieve()
                       nfbp = fbp_ptr - td_buf[side];
                       continue;
                     }
-#define KLEINJUNG_MPQS
                     {
                       u32_t s, *(fbp_buffers[2]), *(fbp_buffers_ub[2]);
                       i16_t need_mpqs[2];
                       i16_t need_psp[2];
                       size_t nlp[2];
                       clock_t cl;
+                      u64_t mt;
                       u32_t ov;
                       u16_t first_psp_side = cmdline_first_psp_side;
                       u16_t first_mpqs_side = cmdline_first_mpqs_side;
@@ -2486,168 +3886,32 @@ int lasieve()
                       }
                       if (s != 2)
                         continue;
+                      if ((use_cofact != 0 || bsmooth_batch != 0) &&
+                          (need_mpqs[0] || need_mpqs[1])) {
+                        cofact_save(need_mpqs, nlp, fbp_buffers, fbp_buffers_ub,
+                                    first_mpqs_side);
+                        continue;
+                      }
 
                       cl = clock();
+                      mt = 0;
+                      if (metrics_file != NULL)
+                        mt = metrics_now();
                       ov = verbose;
                       verbose = 0;
                       for (s = 0; s < 2; s++) {
                         u16_t s1;
 
                         s1 = s ^ first_mpqs_side;
-                        if (need_mpqs[s1]) {
-#if 0
-#define KLEINJUNG_MPQS
-#endif
-						  long nf;
-                          mpz_t *mf;
-#ifdef KLEINJUNG_MPQS
-
-                          if ((nf = mpqs_factor(large_factors[s1], max_primebits[s1], &mf)) < 0) {
-#if 0
-                            n_mpqsfail[s1]++;
-                            break;
-#else
-                            goto attempt_mpqs4linux;
-#endif
-                          }
-                          if (nf == 0) {
-                            n_mpqsvain[s1]++;
-                            break;
-                          }
-                          for (i = 0; i < nf; i++)
-			    mpz_set(large_primes[s1][i], mf[i]);
-                          nlp[s1] = nf;
-                          continue;
-#endif
-                        attempt_mpqs4linux:
-#if 0
-                          nlp[s1] =
-                            mpqs(large_primes[s1], large_factors[s1],
-                                 NULL);
-#endif
-#define TRY_RHO_ON_FAILURES
-#ifdef TRY_RHO_ON_FAILURES
-                          nlp[s1] = 0;
-                        { unsigned long small_factors[10];
-
-                          nf = rho_factor(small_factors, large_factors[s1]);
-                          if(nf > 0)
-                          {
-                              for (i = 0; i < nf; i++) {
-                                mpz_set_ui(large_primes[s1][i], small_factors[i]);
-                                if (mpz_sizeinbase(large_primes[s1][i],2) > max_primebits[s1]) {
-                                  n_mpqsvain[s1]++;
-                                  break;
-                                }
-                              }
-                              if (i >= nf)
-                                nlp[s1] = nf;
-                            }
-                        }
-#endif
-                          if (nlp[s1] == 0) {
-			    /* did it fail on a square? */
-			    mpz_sqrtrem(large_primes[s1][0],large_primes[s1][1],large_factors[s1]);
-			    if(mpz_sgn(large_primes[s1][1]) == 0) { /* remainder == 0? */
-			      mpz_set(large_primes[s1][1],large_primes[s1][0]);
-			      nlp[s1]= 2;
-			      if(ov > 1) {
-				fprintf(stderr," mpqs on a prime square ");
-				mpz_out_str(stderr,10,large_primes[s1][0]);
-				fprintf(stderr,"^2  ");
-			      }
-			      continue;
-			    }
-                            if (ov > 1) {
-                              fprintf(stderr, "mpqs failed for ");
-                              mpz_out_str(stderr, 10, large_factors[s1]);
-                              fprintf(stderr, "(a,b): ");
-                              mpz_out_str(stderr, 10, g_sr_a);
-                              fprintf(stderr, " ");
-                              mpz_out_str(stderr, 10, g_sr_b);
-                              fprintf(stderr, "\n");
-                            }
-                            n_mpqsfail[s1]++;
-                            break;
-                          }
-#ifdef KLEINJUNG_MPQS
-                          if (ov > 1) {
-                            fprintf(stderr, "mpqs factored ");
-                            mpz_out_str(stderr, 10, large_factors[s1]);
-                            fprintf(stderr, "\n");
-                          }
-#endif
-                          for (i = 0; i < nlp[s1]; i++) {
-                            if (mpz_sizeinbase(large_primes[s1][i], 2) >
-                                max_primebits[s1]) {
-                              n_mpqsvain[s1]++;
-printf("Too large!\n");
-                              break;
-                            }
-                          }
-                          if (i < nlp[s1])
-                            break;
-                        }
+                        if (need_mpqs[s1] && factor_large(s1, ov, nlp) == 0)
+                          break;
                       }
                       verbose = ov;
                       mpqs_clock += (clock_t)((1000.0 * (clock() - cl)) / CLOCKS_PER_SEC);
+                      metrics_cofact(mt);
                       if (s != 2)
                         continue;
-//                        fprintf(ofile, "W ");
-#define OBASE 16
-                      yield++;
-                      mpz_out_str(g_ofile, 10, g_sr_a);
-                      fprintf(g_ofile, ",");
-                      mpz_out_str(g_ofile, 10, g_sr_b);
-
-                      if (short_output == 0) /* Sten: added -s parameter to the command line. */
-                      {
-#ifdef _ORIG_OUTPUT_FORMAT
-                         for (s = 0; s < 2; s++) {
-                           u32_t *x;
-                          
-                           fprintf(ofile, "\n%c", 'X' + s);
-                           for (i = 0; i < nlp[s]; i++) {
-                             fprintf(ofile, " ");
-                             mpz_out_str(ofile, OBASE, large_primes[s][i]);
-                           }
-                           for (x = fbp_buffers[s]; x < fbp_buffers_ub[s]; x++) {
-                             fprintf(ofile, " %X", *x);
-                           }
-                         }
-#else
-                         { int numR=0;
-                          u32_t *x;
-    
-                          fprintf(g_ofile, ":");
-                          for (i = 0; i < nlp[1]; i++) { /* rational first. */
-                            if (i>0) fprintf(g_ofile, ",");
-                            mpz_out_str(g_ofile, OBASE, large_primes[1][i]);
-                            numR++;
-                          }
-                          for (x = fbp_buffers[1]; x < fbp_buffers_ub[1];x++) {
-                            if (numR>0) fprintf(g_ofile, ",%X", (unsigned int)*x);
-                            else { fprintf(g_ofile, "%X", (unsigned int)*x); numR++;}
-                          }
-                        }
-                        { int numA=0;
-                          u32_t *x;
-    
-                          fprintf(g_ofile, ":");
-                          for (i = 0; i < nlp[0]; i++) { /* algebraic next. */
-                            if (i>0) fprintf(g_ofile, ",");
-                            mpz_out_str(g_ofile, OBASE, large_primes[0][i]);
-                            numA++;
-                          }
-                          for (x = fbp_buffers[0]; x < fbp_buffers_ub[0];x++) {
-                            if (numA>0) fprintf(g_ofile, ",%X", (unsigned int)*x);
-                            else { fprintf(g_ofile, "%X", (unsigned int)*x); numA++;}
-                          }
-                        }
-#endif
-                      } /* if (short_output == 0) */
-
-                      fprintf(g_ofile, "\n");
+                      output_relation(nlp, fbp_buffers, fbp_buffers_ub);
                     }
                   } else
                     continue;
@@ -2683,6 +3947,7 @@ printf("Too large!\n");
           new_clock = clock();
           td_clock += (clock_t)((1000.0 * (new_clock - last_clock)) / CLOCKS_PER_SEC);
           last_clock = new_clock;
+          metrics_mark(M_TD);
         }
       }
       last_clock = new_clock;
@@ -2690,6 +3955,21 @@ printf("Too large!\n");
     if (root_no < nr) {
       break;
     }
+    if (bsmooth_batch == 0 || cof_n >= bsmooth_batch)
+      cofact_flush();
+    metrics_end(special_q);
+#ifdef LASIEVE_WORKERS
+    if (spq_server != NULL)
+      spq_heartbeat();
+    if (wsh != NULL) {
+      worker_flush_output();
+      continue;
+    }
+#endif
+#ifdef LASIEVE_ZLIB
+    if (zip_level > 0)
+      zip_flush_output();
+#endif
     tNow = sTime();
     if (tNow > lastReport + 5.0) {
       lastReport = sTime();
@@ -2701,16 +3981,34 @@ printf("Too large!\n");
 
         asprintf(&ofn, ".last_spq%d", process_no);
         if ((of = fopen(ofn, "wb")) != 0) {
-          fprintf(of, "%u\n", (unsigned int)special_q);
+          fprintf(of, "%u\n", (unsigned int)(cof_n > 0 ? cof_first_spq : special_q));
           fclose(of);
         }
         free(ofn);
       }
     }
   }
+#ifdef LASIEVE_WORKERS
+  /* After an interrupt; the reports of the lease are dropped with it. */
+  if (spq_server != NULL)
+    spq_drop();
+#endif
+  metrics_cofact_flush();
+#ifdef LASIEVE_WORKERS
+  if (wsh != NULL) {
+    worker_flush_output();
+    wsh->cur_spq[worker_id] = special_q == 0 ? UINT_MAX : special_q;
+  }
+#endif
+  if (special_q == 0)
+    special_q = last_spq;
+  free(r_ptr);
+#ifdef LASIEVE_WORKERS
+  if (wsh != NULL)
+    return 0;
+#endif
   fprintf(stderr, "\rtotal yield: %u, q=%u (%1.5lf sec/rel)\n", 
 	(unsigned int)yield, (unsigned int)special_q, (sTime() - tStart)/yield);
-  free(r_ptr);
   return 0;
 }
 
@@ -2852,10 +4150,223 @@ int parse_q_from_line(char *buf) {
   return 1;
 }  
 
+#ifdef LASIEVE_ZLIB
+#define ZIP_LINE_SIZE 4096
+#define ZIP_IO_SIZE   65536
+
+/* Inflate the gzip members of f from the current position. Each line is
+   passed to parse_q_from_line(), and if tail is not NULL, the text is also
+   copied there. Returns the offset of the end of the last complete member
+   (relative to the start position); *eol_end is set to the number of bytes
+   of text up to the last end of line. */
+static off_t zip_scan(FILE *f, FILE *tail, off_t *eol_end)
+{ z_stream zs;
+  unsigned char *in, *out;
+  char line[ZIP_LINE_SIZE];
+  size_t n, ll = 0, k;
+  off_t consumed = 0, good = 0, text = 0;
+  int ret = Z_OK;
+
+  in = xmalloc(ZIP_IO_SIZE);
+  out = xmalloc(ZIP_IO_SIZE);
+  memset(&zs, 0, sizeof(zs));
+  if (inflateInit2(&zs, 15 + 16) != Z_OK)
+    complain("Cannot initialize zlib\n");
+  *eol_end = 0;
+  while ((n = fread(in, 1, ZIP_IO_SIZE, f)) > 0) {
+    zs.next_in = in;
+    zs.avail_in = (uInt)n;
+    while (zs.avail_in > 0) {
+      zs.next_out = out;
+      zs.avail_out = ZIP_IO_SIZE;
+      ret = inflate(&zs, Z_NO_FLUSH);
+      if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+        break;
+      for (k = 0; k < ZIP_IO_SIZE - zs.avail_out; k++) {
+        if (ll < ZIP_LINE_SIZE - 1)
+          line[ll++] = out[k];
+        if (out[k] == '\n') {
+          line[ll] = 0;
+          parse_q_from_line(line);
+          ll = 0;
+          *eol_end = text + k + 1;
+        }
+      }
+      if (tail != NULL && fwrite(out, 1, k, tail) != k)
+        complain("Cannot write temporary file: %m\n");
+      text += k;
+      if (ret == Z_STREAM_END) {
+        good = consumed + (n - zs.avail_in);
+        inflateReset(&zs);
+      } else if (ret == Z_BUF_ERROR)
+        break;
+    }
+    if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+      break;
+    consumed += n;
+  }
+  inflateEnd(&zs);
+  free(in);
+  free(out);
+  return good;
+}
+
+/* -R with -z: read the special q of the relations in the gzipped file
+   'name' (as is done for plain files), and open it for appending. If the
+   last gzip member is incomplete (e.g., the file was written through an
+   external gzip which was killed), it is cut off and its complete lines
+   are written back as a new member. */
+static void zip_resume(char *name)
+{ FILE *f, *tail;
+  off_t size, good, eol_end, dummy;
+  size_t n, len;
+  char *in, *out;
+  z_stream zs;
+
+  if ((f = fopen(name, "rb+")) == NULL)
+    complain("Cannot open %s for append: %m\n", name);
+  fseeko(f, 0, SEEK_END);
+  size = ftello(f);
+  rewind(f);
+  good = zip_scan(f, NULL, &dummy);
+  if (good < size) {
+    printf(" Warning: %s ends with an incomplete gzip member; recompressing its complete lines\n", name);
+    if ((tail = tmpfile()) == NULL)
+      complain("Cannot open temporary file: %m\n");
+    fseeko(f, good, SEEK_SET);
+    zip_scan(f, tail, &eol_end);
+    fflush(f);
+    if (ftruncate(fileno(f), good) != 0)
+      complain("Cannot truncate %s: %m\n", name);
+    fseeko(f, good, SEEK_SET);
+    rewind(tail);
+    /* It may be large, so compress it a block at a time. */
+    in = xmalloc(ZIP_IO_SIZE);
+    out = xmalloc(ZIP_IO_SIZE);
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, zip_level, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+      complain("Cannot initialize zlib\n");
+    do {
+      n = (size_t)MIN(eol_end, ZIP_IO_SIZE);
+      if (fread(in, 1, n, tail) != n)
+        complain("Cannot read temporary file: %m\n");
+      eol_end -= n;
+      zs.next_in = (Bytef *)in;
+      zs.avail_in = (uInt)n;
+      do {
+        zs.next_out = (Bytef *)out;
+        zs.avail_out = ZIP_IO_SIZE;
+        deflate(&zs, eol_end > 0 ? Z_NO_FLUSH : Z_FINISH);
+        len = ZIP_IO_SIZE - zs.avail_out;
+        if (fwrite(out, 1, len, f) != len)
+          complain("Cannot write %s: %m\n", name);
+      } while (zs.avail_out == 0);
+    } while (eol_end > 0);
+    deflateEnd(&zs);
+    free(in);
+    free(out);
+    fclose(tail);
+  }
+  fclose(f);
+  if ((g_ofile = fopen(name, "ab")) == NULL)
+    complain("Cannot open %s for append: %m\n", name);
+}
+#endif
+
+#define DEFAULT_I_BITS 13
+#define MIN_L1_BITS 13
+#define MAX_L1_BITS 16
+
+/**************************************************/
+static void cache_sizes(u32_t *l1, u32_t *l2)
+/**************************************************/
+/* The L1 data and L2 cache sizes in bytes, or 0    */
+/* where they cannot be found.                      */
+/**************************************************/
+{
+  *l1 = *l2 = 0;
+#if defined (_SC_LEVEL1_DCACHE_SIZE) && defined (_SC_LEVEL2_CACHE_SIZE)
+  { long x;
+
+    if ((x = sysconf(_SC_LEVEL1_DCACHE_SIZE)) > 0)
+      *l1 = (u32_t)x;
+    if ((x = sysconf(_SC_LEVEL2_CACHE_SIZE)) > 0)
+      *l2 = (u32_t)x;
+  }
+#endif
+#ifdef __linux__
+  /* sysconf() gives 0 on some architectures; sysfs has them. */
+  { u32_t k, level, size;
+    char  name[128], type[32], unit;
+    FILE *fp;
+
+    for (k = 0; k < 8 && (*l1 == 0 || *l2 == 0); k++) {
+      level = size = 0; type[0] = 0; unit = 0;
+      sprintf(name, "/sys/devices/system/cpu/cpu0/cache/index%u/level", k);
+      if ((fp = fopen(name, "r")) == NULL)
+        break;
+      if (fscanf(fp, "%u", &level) != 1)
+        level = 0;
+      fclose(fp);
+      sprintf(name, "/sys/devices/system/cpu/cpu0/cache/index%u/type", k);
+      if ((fp = fopen(name, "r")) != NULL) {
+        if (fscanf(fp, "%31s", type) != 1)
+          type[0] = 0;
+        fclose(fp);
+      }
+      sprintf(name, "/sys/devices/system/cpu/cpu0/cache/index%u/size", k);
+      if ((fp = fopen(name, "r")) != NULL) {
+        if (fscanf(fp, "%u%c", &size, &unit) < 1)
+          size = 0;
+        fclose(fp);
+      }
+      if (unit == 'K') size <<= 10;
+      else if (unit == 'M') size <<= 20;
+      if (level == 1 && *l1 == 0 && strcmp(type, "Instruction") != 0)
+        *l1 = size;
+      else if (level == 2 && *l2 == 0)
+        *l2 = size;
+    }
+  }
+#elif defined (__APPLE__)
+  { uint64_t x;
+    size_t len;
+
+    len = sizeof(x);
+    if (*l1 == 0 && sysctlbyname("hw.l1dcachesize", &x, &len, NULL, 0) == 0)
+      *l1 = (u32_t)x;
+    len = sizeof(x);
+    if (*l2 == 0 && sysctlbyname("hw.l2cachesize", &x, &len, NULL, 0) == 0)
+      *l2 = (u32_t)x;
+  }
+#endif
+}
+
+/**************************************************/
+static u32_t choose_l1_bits(u32_t l1, u32_t l2)
+/**************************************************/
+/* log2 of the sieve strip length for the given     */
+/* cache sizes. A non power of 2 L1 (e.g. 48K) is   */
+/* rounded up if the rest of the strip fits well    */
+/* into L2.                                         */
+/**************************************************/
+{ u32_t b;
+
+  if (l1 == 0)
+    return L1_BITS;
+  for (b = 0; (2UL << b) <= l1; b++);
+  if (l1 > (1UL << b) && l2 >= (16UL << b))
+    b++;
+  if (b < MIN_L1_BITS) b = MIN_L1_BITS;
+  if (b > MAX_L1_BITS) b = MAX_L1_BITS;
+  return b;
+}
+
 /**************************************************/
 int main(int argc, char **argv)
 /**************************************************/
-{ u16_t zip_output, force_aFBcalc;
+{ u16_t zip_output, pipe_output = 0, force_aFBcalc;
   u16_t catch_signals;
   u32_t s, i;
 
@@ -2904,17 +4415,47 @@ int main(int argc, char **argv)
     catch_signals = 0;
 
     J_bits = UINT_MAX;
+    I_bits = 0;
+    l1_bits = 0;
 
 #define NumRead(x) if(sscanf(optarg, "%u" ,(unsigned int*)&x)!=1) Usage()
 #define NumRead16(x) if(sscanf(optarg, "%hu" ,(unsigned short*)&x)!=1) Usage()
 
     while ((option =
-            getopt(argc, argv, "FJ:L:M:N:P:RS:ab:c:f:i:kn:o:rst:vz")) != -1) {
+            getopt(argc, argv, "BC:EFI:J:KL:M:N:P:Q:RS:T:X:Z:ab:c:f:i:kl:m:n:o:rst:vz")) != -1) {
       switch (option) {
+        case 'B':
+          use_buckets = 1; break;
+        case 'C':
+          candsearch_name = optarg; break;
+        case 'E':
+          use_cofact = 1; break;
+        case 'X':
+          bsmooth_batch = strtoul(optarg, NULL, 10);
+          if (bsmooth_batch == 0)
+            complain("-X needs a batch size > 0\n");
+          break;
         case 'R':
           g_resume = 1; break;
         case 'F':
           force_aFBcalc = 1; break;
+        case 'Q':
+#ifdef LASIEVE_WORKERS
+          spq_server = optarg; break;
+#else
+          complain("-Q is not supported on this platform\n");
+#endif
+        case 'K':
+#ifdef LASIEVE_WORKERS
+          use_fbimage = 1; break;
+#else
+          complain("-K is not supported on this platform\n");
+#endif
+        case 'I':
+          NumRead(I_bits);
+          if (I_bits < 11 || I_bits > 16)
+            complain("-I %s: sieve region bits must be in [11,16]\n", optarg);
+          break;
         case 'J':
           NumRead(J_bits); break;
         case 'L':
@@ -2927,6 +4468,16 @@ int main(int argc, char **argv)
           if (sscanf(optarg, "%hu", &cmdline_first_psp_side) != 1)
             complain("-P %s ???\n", optarg);
           break;
+        case 'T':
+          NumRead(n_workers);
+          if (n_workers < 1 || n_workers > MAX_WORKERS)
+            complain("-T %s: number of workers must be in [1,%u]\n",
+                     optarg, MAX_WORKERS);
+#ifndef LASIEVE_WORKERS
+          if (n_workers > 1)
+            complain("-T is not supported on this platform\n");
+#endif
+          break;
         case 'S':
           if (sscanf(optarg, "%f", &sigma) != 1) {
             errprintf("Cannot read floating point number %s\n", optarg);
@@ -2951,10 +4502,18 @@ int main(int argc, char **argv)
           break;
         case 'k':
           keep_factorbase = 1; break;
+        case 'l':
+          NumRead(l1_bits);
+          if (l1_bits < MIN_L1_BITS || l1_bits > MAX_L1_BITS)
+            complain("-l %s: L1 bits must be in [%u,%u]\n", optarg,
+                     MIN_L1_BITS, MAX_L1_BITS);
+          break;
         case 'n':
           catch_signals = 1; //break; /* CJM: added `break'. */
         case 'N':
           NumRead(process_no); break;
+        case 'm':
+          metrics_name = optarg; break;
         case 'o':
           g_ofile_name = optarg; break;
         case 'r':
@@ -2973,31 +4532,91 @@ int main(int argc, char **argv)
           verbose++; break;
         case 'z':
           zip_output = 1; break;
+        case 'Z':
+#ifdef LASIEVE_ZLIB
+          if (sscanf(optarg, "%d", &zip_level) != 1 || zip_level < 1 || zip_level > 9)
+            complain("-Z %s: compression level must be in [1,9]\n", optarg);
+          zip_output = 1;
+#else
+          complain("-Z needs a siever built with zlib\n");
+#endif
+          break;
       }
     }
+#ifdef LASIEVE_ZLIB
+    if (zip_output != 0 && zip_level == 0)
+      zip_level = Z_BEST_COMPRESSION;
+#endif
 
-    if(verbose) { /* first rudimentary test of automatic $Rev reporting */
-      fprintf(stderr, "gnfs-lasieve4I%de: L1_BITS=%d, SVN $Revision$\n", I_bits, L1_BITS);
+    {
+      u32_t l1, l2;
+      char *p;
+
+      /* Without -I, the old binary names gnfs-lasieve4I<n>e still
+         select I_bits=n. */
+      if (I_bits == 0) {
+        if ((p = strstr(argv[0], "lasieve4I")) == NULL ||
+            sscanf(p + 9, "%u", &I_bits) != 1 || I_bits < 11 || I_bits > 16)
+          I_bits = DEFAULT_I_BITS;
+      }
+      cache_sizes(&l1, &l2);
+      if (l1_bits == 0) {
+        l1_bits = choose_l1_bits(l1, l2);
+        if (l1_bits < I_bits - 1)
+          l1_bits = I_bits - 1;
+      }
+      if (sched_kernels_select(I_bits, l1_bits, &lasched_fn, &medsched_fn,
+                               &bucketsched_fn) != 0)
+        complain("-I %u needs at least -l %u\n", I_bits, I_bits - 1);
+#ifdef CANDSEARCH_SIMD
+      {
+        const char *cs;
+
+        if (candsearch_select(candsearch_name, &candsearch_fn, &cs) != 0)
+          complain("-C %s: unknown candidate search kernel, or not supported here\n",
+                   candsearch_name);
+        if (verbose)
+          fprintf(stderr, "candidate search: %s%s\n", cs,
+                  candsearch_name != NULL && strcmp(candsearch_name, "check") == 0 ?
+                  ", checked against scalar" : "");
+      }
+#else
+      if (candsearch_name != NULL)
+        complain("-C needs a siever built for x86-64 with gcc\n");
+#endif
+      if(verbose) { /* first rudimentary test of automatic $Rev reporting */
+        fprintf(stderr, "gnfs-lasieve4e -I %u: L1_BITS=%u (L1 %uK, L2 %uK), SVN $Revision$\n",
+                I_bits, l1_bits, l1 >> 10, l2 >> 10);
+      }
     }
 
 #define LINE_BUF_SIZE 300
 
     if (g_resume != 0) {
       char buf[LINE_BUF_SIZE];
-      int ret;
+      int ret = 0;
       
+#ifndef LASIEVE_ZLIB
       if (zip_output != 0)
 	complain("Cannot resume gzipped file. gunzip, and retry without -z\n");
+#endif
       if (g_ofile_name == NULL)
 	complain("Cannot resume without the file name\n");
       if (strcmp(g_ofile_name, "-") == 0)
 	complain("Cannot resume using stdout\n");
+#ifdef LASIEVE_ZLIB
+      if (zip_output != 0)
+        zip_resume(g_ofile_name);
+      else
+#endif
+      {
       if ((g_ofile = fopen(g_ofile_name, "ab+")) == NULL)
 	complain("Cannot open %s for append: %m\n", g_ofile_name);
       while(fgets(buf, LINE_BUF_SIZE, g_ofile)) {
 	ret = parse_q_from_line(buf);
       }
       if(ret < 0) fprintf(g_ofile, "\n"); /* encapsulating the last incomplete line */
+      }
       printf(" Resuming with -f %d -c %d\n", first_spq, sieve_count);
     }
 
@@ -3005,9 +4624,6 @@ int main(int argc, char **argv)
       J_bits = I_bits - 1;
     if (cmdline_first_psp_side == USHRT_MAX)
       cmdline_first_psp_side = cmdline_first_mpqs_side;
-#ifndef I_bits
-#error Must #define I_bits
-#endif
     if (optind < argc && base_name == NULL) {
       base_name = argv[optind];
       optind++;
@@ -3020,6 +4636,13 @@ int main(int argc, char **argv)
 
     if (parseJobFile(base_name)) 
       complain("Bad job file: %s\ngiving up...\n", base_name);
+#ifdef LASIEVE_WORKERS
+    if (spq_server != NULL) {
+      if (g_resume != 0 || zip_output != 0)
+        complain("-Q cannot be used with -R or -z\n");
+      spq_job(&first_spq, &sieve_count);
+    }
+#endif
 
     last_spq = first_spq + sieve_count;
     if (last_spq >= INT_MAX / 2) {
@@ -3093,27 +4716,48 @@ int main(int argc, char **argv)
   siever_init();
 
   if (sieve_count != 0) {
+    if (metrics_name != NULL)
+      metrics_open(metrics_name);
+#ifdef LASIEVE_WORKERS
+    if (spq_server != NULL) {
+      /* The relations go to the server; see spq_put(). */
+      if ((g_ofile = open_memstream(&worker_obuf, &worker_obuf_len)) == NULL)
+        complain("Cannot open output buffer: %m\n");
+      g_ofile_name = spq_server;
+      goto done_opening_output;
+    }
+#endif
+#ifdef LASIEVE_ZLIB
+    /* Gzip output is written by zip_flush_output(), not through a pipe. */
+    pipe_output = 0;
+#else
+    pipe_output = zip_output;
+#endif
     if (g_ofile_name == NULL) {
       if (zip_output == 0) {
         asprintf(&g_ofile_name, "%s.lasieve-%u.%u-%u", base_name,
                  special_q_side, first_spq, last_spq);
+      } else if (pipe_output == 0) {
+        asprintf(&g_ofile_name, "%s.lasieve-%u.%u-%u.gz", base_name,
+                 special_q_side, first_spq, last_spq);
       } else {
         asprintf(&g_ofile_name,"gzip --best --stdout > %s.lasieve-%u.%u-%u.gz", 
                   base_name, special_q_side, first_spq, last_spq);
       }
     } else {
       if (strcmp(g_ofile_name, "-") == 0) {
-        if (zip_output == 0) {
+        if (pipe_output == 0) {
           g_ofile = stdout;
           g_ofile_name = "to stdout";
           goto done_opening_output;
         } else
           g_ofile_name = "gzip --best --stdout";
-      } else {
-          zip_output = 0;
+      } else if (pipe_output != 0) {
+          /* The external gzip is only used with the default file name. */
+          zip_output = pipe_output = 0;
       }
     }
-    if (zip_output == 0) {
+    if (pipe_output == 0) {
       if (g_resume != 0) {
         goto done_opening_output;
       }
@@ -3142,11 +4786,11 @@ int main(int argc, char **argv)
   if (n_i > L1_SIZE)
     complain("Strip length %u exceeds L1 size %u\n", n_i, L1_SIZE);
   j_per_strip = L1_SIZE / n_i;
-  jps_bits = L1_BITS - i_bits;
+  jps_bits = l1_bits - i_bits;
   jps_mask = j_per_strip - 1;
   if (j_per_strip != 1 << jps_bits)
     Schlendrian("Expected %u j per strip, calculated %u\n",j_per_strip,1<<jps_bits);
-  n_strips = n_j >> (L1_BITS - i_bits);
+  n_strips = n_j >> (l1_bits - i_bits);
   rec_info_init(n_i, n_j);
 
 
@@ -3217,7 +4861,7 @@ int main(int argc, char **argv)
       else
         pvl_max[s] = g_poldeg[s] * log(last_spq / sqrt(sigma));
       pvl_max[s] += log(poly_norm[s]);
-      if (fbi1[s] >= FBsize[s] || i_bits + j_bits <= L1_BITS) {
+      if (fbi1[s] >= FBsize[s] || i_bits + j_bits <= l1_bits) {
         n_schedules[s] = 0;
         continue;
       }
@@ -3236,11 +4880,9 @@ int main(int argc, char **argv)
         u32_t ns;
         size_t allocate, all1;
 
+        /* nextprime32() stops below 2^32, so a bound of 2^32 is fine. */
         if (i == n_schedules[s] - 1)
-		{
-		  assert(FB_bound[s] < UINT_MAX);
-          fbp_ub = (u32_t)FB_bound[s];
-		}
+          fbp_ub = FB_bound[s] < UINT_MAX ? (u32_t)FB_bound[s] : UINT_MAX;
         else
           fbp_ub = schedule_primebounds[i];
         if (i == 0)
@@ -3249,19 +4891,47 @@ int main(int argc, char **argv)
           fbp_lb = schedule_primebounds[i - 1];
 
         if (i_bits + j_bits < schedule_sizebits[i])
-          ns = 1 << (i_bits + j_bits - L1_BITS);
+          ns = 1 << (i_bits + j_bits - l1_bits);
         else
-          ns = 1 << (schedule_sizebits[i] - L1_BITS);
+          ns = 1 << (schedule_sizebits[i] - l1_bits);
         schedules[s][i].n_strips = ns;
-#if I_bits<15
-/* no change here, there were no sched.pathologies, and memory footprint is small */
-#define SCHED_PAD 48
-#define SCHED_TOL 2
-#else
-/* these values are experimental; report SCHED_PATHOLOGY to http://mersenneforum.org/showthread.php?t=11430 */
+        schedules[s][i].bucket = NULL;
+        if (use_buckets != 0) {
+          double d;
+          size_t nb;
+          u32_t k;
+
+          /* Size the buckets from the density of the factor base: prime
+             ideal p hits n_i*j_per_strip/p locations of a strip on average. */
+          for (fbi = fbi_lb, d = 0; fbi < FBsize[s] && FB[s][fbi] <= fbp_ub; fbi++)
+            d += 1.0 / FB[s][fbi];
+          fbi_ub = fbi;
+          nb = (size_t)rint(BUCKET_PAD + BUCKET_TOL * n_i * j_per_strip * d);
+          schedules[s][i].bucket = xmalloc(ns * sizeof(*(schedules[s][i].bucket)));
+          schedules[s][i].bucket_ptr = xmalloc(ns * sizeof(*(schedules[s][i].bucket_ptr)));
+          schedules[s][i].bucket_lim = xmalloc(ns * sizeof(*(schedules[s][i].bucket_lim)));
+          schedules[s][i].bucket_alloc = xmalloc(ns * sizeof(*(schedules[s][i].bucket_alloc)));
+          for (k = 0; k < ns; k++) {
+            schedules[s][i].bucket_alloc[k] = nb + BUCKET_GUARD(k);
+            schedules[s][i].bucket[k] =
+              xmalloc((nb + BUCKET_GUARD(k)) * sizeof(**(schedules[s][i].bucket)));
+            schedules[s][i].bucket_ptr[k] = schedules[s][i].bucket[k];
+            schedules[s][i].bucket_lim[k] = schedules[s][i].bucket[k] + nb;
+          }
+          schedules[s][i].n_pieces = 1;
+          schedules[s][i].schedule = NULL;
+          schedules[s][i].schedlogs = NULL;
+          schedules[s][i].fbi_bounds = xmalloc(2 * sizeof(*(schedules[s][i].fbi_bounds)));
+          schedules[s][i].fbi_bounds[0] = fbi_lb;
+          schedules[s][i].fbi_bounds[1] = fbi_ub;
+          schedules[s][i].ri = LPri[s] + (fbi_lb - fbis[s]) * RI_SIZE;
+          fbi_lb = fbi_ub;
+          continue;
+        }
+/* I_bits<15: no change here, there were no sched.pathologies, and memory footprint is small */
+/* otherwise: these values are experimental; report SCHED_PATHOLOGY to http://mersenneforum.org/showthread.php?t=11430 */
 #define SCHED_PAD 48
-#define SCHED_TOL 1.2
-#endif
+#define SCHED_TOL (I_bits < 15 ? 2 : 1.2)
 		assert(rint(SCHED_PAD + SCHED_TOL * n_i * j_per_strip * log(log(fbp_ub) / log(fbp_lb))) <= ULONG_MAX);
         allocate = (size_t)rint(SCHED_PAD + SCHED_TOL * n_i * j_per_strip * log(log(fbp_ub) / log(fbp_lb)));
         allocate *= SE_SIZE;
@@ -3357,6 +5027,8 @@ int main(int argc, char **argv)
       for (i = 0; i < n_schedules[s]; i++) {
         u32_t sp_i;
 
+        if (schedules[s][i].bucket != NULL)
+          continue;
         for (sp_i = 0; sp_i < schedules[s][i].n_strips; sp_i++)
           schedules[s][i].schedule[0][sp_i] =
             sched_buf + (size_t) (schedules[s][i].schedule[0][sp_i]);
@@ -3425,6 +5097,7 @@ int main(int argc, char **argv)
       tds_fbi[i] = xmalloc(tds_fbi_alloc * sizeof(**tds_fbi));
   }
 
+  td_rests = xmalloc(L1_SIZE * sizeof(*td_rests));
   for (i = 0; i < L1_SIZE; i++) {
     mpz_init(td_rests[i]);
   }
@@ -3442,6 +5115,27 @@ int main(int argc, char **argv)
     mpz_init_set_d(FBb_cu[s],FB_bound[s]);
     mpz_pow_ui(FBb_cu[s],FBb_cu[s],3);
   }
+  if (bsmooth_batch != 0) {
+    char *bsname;
+    u32_t hi;
+
+    if (g_poldeg[1] == 1)
+      bs_side = 1;
+    else if (g_poldeg[0] == 1)
+      bs_side = 0;
+    else
+      complain("-X needs a rational side\n");
+    if (max_primebits[bs_side] > 32)
+      complain("-X: large primes of %u bits are too large\n",
+               (unsigned int)max_primebits[bs_side]);
+    hi = (u32_t)(((u64_t)1 << max_primebits[bs_side]) - 1);
+    asprintf(&bsname, "%s.bsp.%u", base_name, bs_side);
+    if (verbose)
+      fprintf(stderr, "batch smoothness test: primes up to %u, in %s\n", hi, bsname);
+    mpz_init(bs_P);
+    bsmooth_product(bs_P, (u32_t)FB_bound[bs_side], hi, bsname);
+    free(bsname);
+  }
 
   all_spq_done = 1;
 
@@ -3450,10 +5144,22 @@ int main(int argc, char **argv)
     signal(SIGINT, terminate_sieving);
   }
 
+#ifdef LASIEVE_WORKERS
+  if (n_workers > 1 && sieve_count != 0)
+    lasieve_workers();
+  else
+#endif
+#ifdef LASIEVE_ZLIB
+  if (zip_level > 0 && sieve_count != 0) {
+    zip_begin();
+    lasieve();
+    zip_end();
+  } else
+#endif
   lasieve(); /* CJM, 6/17/04. */
 
   if (sieve_count != 0) {
-    if (zip_output != 0)
+    if (pipe_output != 0)
       pclose(g_ofile);
     else
       fclose(g_ofile);
@@ -3477,6 +5183,12 @@ int main(int argc, char **argv)
       logbook(0, "%u/%u mpqs failures, %u/%u vain mpqs\n", n_mpqsfail[0],
               n_mpqsfail[1], n_mpqsvain[0], n_mpqsvain[1]);
     }
+    if (use_cofact != 0)
+      logbook(0, "%u/%u cofactors split by P-1/ECM, %u/%u found not smooth\n",
+              n_cofsplit[0], n_cofsplit[1], n_cofdrop[0], n_cofdrop[1]);
+    if (bsmooth_batch != 0)
+      logbook(0, "%u side %u cofactors not smooth by the batch test\n",
+              n_bsdrop, bs_side);
     logbook(0, "milliseconds total: Sieve %u Sched %u medsched %u\n",
             sieve_clock, Schedule_clock, medsched_clock);
     logbook(0, "TD %u (Init %u, MPQS %u) Sieve-Change %u\n",
@@ -3548,12 +5260,58 @@ u16_t get_plog_lb(unsigned char *lb_array, i16_t ** root_array,
   return nroots;
 }
 
+/****************************************************************/
+static void do_bucket_scheduling(struct schedule_struct *sched, u32_t ns, u32_t ot, u32_t s)
+/****************************************************************/
+/* Fill the buckets of the first ns strips of sched. A bucket which */
+/* becomes too small is doubled in size, so this never fails.       */
+/****************************************************************/
+{ u32_t n1_j, fbi, fbi_lb, fbi_ub, k, *ri;
+
+  n1_j = ns << (l1_bits - i_bits);
+  fbi_lb = sched->fbi_bounds[0];
+  fbi_ub = sched->fbi_bounds[1];
+#ifdef SCHEDULING_FUNCTION_CALCULATES_RI
+  if (ot == 1)
+    lasieve_setup(FB[s] + fbi_lb, proots[s] + fbi_lb, fbi_ub - fbi_lb,
+                  a0, a1, b0, b1, LPri[s] + (fbi_lb - fbis[s]) * RI_SIZE);
+#endif
+  for (k = 0; k < ns; k++)
+    sched->bucket_ptr[k] = sched->bucket[k];
+  for (fbi = fbi_lb, ri = sched->ri; fbi < fbi_ub;) {
+    u32_t n;
+
+    n = bucketsched_fn(ri, current_ij[s] + fbi, fbi_ub - fbi, n1_j, sched->bucket_ptr,
+                       sched->bucket_lim, fbi - fbi_lb, FB_logs[s] + fbi, ot);
+    fbi += n;
+    ri += n * RI_SIZE;
+    if (fbi == fbi_ub)
+      break;
+    for (k = 0; k < ns; k++) {
+      size_t used;
+
+      if (sched->bucket_ptr[k] <= sched->bucket_lim[k])
+        continue;
+      used = sched->bucket_ptr[k] - sched->bucket[k];
+      sched->bucket_alloc[k] *= 2;
+      sched->bucket[k] = xrealloc(sched->bucket[k], sched->bucket_alloc[k] *
+                                  sizeof(**(sched->bucket)));
+      sched->bucket_ptr[k] = sched->bucket[k] + used;
+      sched->bucket_lim[k] = sched->bucket[k] + sched->bucket_alloc[k] - BUCKET_GUARD(k);
+    }
+  }
+}
+
 /****************************************************************/
 void do_scheduling(struct schedule_struct *sched, u32_t ns, u32_t ot, u32_t s)
 /****************************************************************/
 { u32_t ll, n1_j, *ri;
 
-  n1_j = ns << (L1_BITS - i_bits);
+  if (sched->bucket != NULL) {
+    do_bucket_scheduling(sched, ns, ot, s);
+    return;
+  }
+  n1_j = ns << (l1_bits - i_bits);
   for (ll = 0, ri = sched->ri; ll < sched->n_pieces; ll++) {
     u32_t fbi_lb, fbi_ub, fbio;
 
@@ -3566,7 +5324,7 @@ void do_scheduling(struct schedule_struct *sched, u32_t ns, u32_t ot, u32_t s)
       lasieve_setup(FB[s] + fbi_lb, proots[s] + fbi_lb, fbi_ub - fbi_lb,
                     a0, a1, b0, b1, LPri[s] + (fbi_lb - fbis[s]) * RI_SIZE);
 #endif
-    ri = lasched(ri, current_ij[s] + fbi_lb, current_ij[s] + fbi_ub, n1_j, 
+    ri = lasched_fn(ri, current_ij[s] + fbi_lb, current_ij[s] + fbi_ub, n1_j, 
                  (u32_t **) (sched->schedule[ll + 1]), fbi_lb - fbio, ot);
 
     { u32_t k;
@@ -3576,6 +5334,7 @@ void do_scheduling(struct schedule_struct *sched, u32_t ns, u32_t ot, u32_t s)
           if (k == 0 && sched->schedule[ll + 1][k] < sched->schedule[0][k] + sched->alloc1)
             continue;
 /* report SCHED_PATHOLOGY to http://mersenneforum.org/showthread.php?t=11430 */
+/* -B (bucket scheduling) does not have this limit. */
           fprintf(stderr,"\rSCHED_PATHOLOGY q0=%u k=%d excess=%d                      \n",
 		  (unsigned int)special_q, k, sched->schedule[ll+1][k]-(sched->schedule[0][k]+sched->alloc));
           longjmp(termination_jb, SCHED_PATHOLOGY);
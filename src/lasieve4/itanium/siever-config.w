@@ -10,7 +10,9 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 02111-1307, USA.
 
 @(siever-config.h@>=
+#ifndef L1_BITS
 #define L1_BITS 16
+#endif
 #define ULONG_RI
 #define asm_modinv32 modinv32
 
@@ -72,4 +72,36 @@ int psp(mpz_t);
 /* mpqs.c */
 long mpqs_factor(mpz_t N, size_t max_bits, mpz_t **factors);
 
+/* sched-kernels.c */
+typedef u32_t *(*lasched_t)(u32_t*,u32_t*,u32_t*,u32_t,u32_t**,u32_t,u32_t);
+typedef u32_t *(*medsched_t)(u32_t*,u32_t*,u32_t*,u32_t**,u32_t,u32_t);
+typedef u32_t (*bucketsched_t)(u32_t*,u32_t*,u32_t,u32_t,u64_t**,u64_t**,u32_t,
+                               unsigned char*,u32_t);
+int sched_kernels_select(u32_t,u32_t,lasched_t*,medsched_t*,bucketsched_t*);
+
+/* candsearch.c */
+#if defined(__GNUC__) && defined(__x86_64__) && \
+    ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))
+#define CANDSEARCH_SIMD
+#endif
+typedef u32_t (*candsearch_t)(unsigned char,unsigned char*,unsigned char*,unsigned char*,
+                              u16_t*,unsigned char*,unsigned char);
+int candsearch_select(const char*,candsearch_t*,const char**);
+
+/* cofact.c */
+#define CF_MAX_FACTORS 4
+#define CF_OPEN        0
+#define CF_SMOOTH      1
+#define CF_NOT_SMOOTH  2
+typedef struct {
+  mpz_t n, f[CF_MAX_FACTORS];
+  u32_t nf, lpbits, status;
+} cofact_t;
+void cofact_init(cofact_t*);
+void cofact_run(cofact_t**,size_t);
+
+/* bsmooth.c */
+void bsmooth_product(mpz_t,u32_t,u32_t,const char*);
+void bsmooth_test(mpz_t,mpz_ptr*,size_t,u32_t,unsigned char*);
+
 #endif
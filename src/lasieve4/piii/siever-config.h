@@ -20,7 +20,10 @@
 #include "ggnfs.h"
 #include "if.h"
 
-#if defined(__amdfam10__) || defined(__k8__) || defined(__athlon__)
+/* Default only: the siever picks L1_BITS from the L1 data cache size
+   at run time (-l overrides), and sched-kernels.c sets it per variant. */
+#if defined (L1_BITS)
+#elif defined(__amdfam10__) || defined(__k8__) || defined(__athlon__)
 #define L1_BITS 16
 #else
 #define L1_BITS 15
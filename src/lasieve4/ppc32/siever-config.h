@@ -18,7 +18,11 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 
 #include "ggnfs.h"
 
+/* Default only: the siever picks L1_BITS from the L1 data cache size
+   at run time (-l overrides), and sched-kernels.c sets it per variant. */
+#ifndef L1_BITS
 #define L1_BITS 15
+#endif
 /* L1_BITS 15 for Intel Core2 (32Kb L1 data cache) */
 /* L1_BITS 16 for Phenom/Opteron... AMD K7 and up  */
 /* L1_BITS 14 was here before. Pentium3-4 had 16Kb */
@@ -0,0 +1,19 @@
+/* sched-kernel.h
+  Included by sched-kernels.c once for every (I_bits, L1_BITS) variant:
+  compiles asm/lasched.c, asm/medsched.c and bucketsched.c for the
+  current values of the two macros under the names
+  lasched_I<I_bits>_L<L1_BITS> etc. No include guard, on purpose.
+*/
+
+#define lasched  SK_NAME(lasched, I_bits, L1_BITS)
+#define medsched SK_NAME(medsched, I_bits, L1_BITS)
+#define bucketsched SK_NAME(bucketsched, I_bits, L1_BITS)
+
+#include "asm/lasched.c"
+#include "asm/medsched.c"
+#include "bucketsched.c"
+
+#undef lasched
+#undef medsched
+#undef bucketsched
+#undef I_bits
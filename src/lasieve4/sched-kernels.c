@@ -0,0 +1,133 @@
+/**************************************************************/
+/* sched-kernels.c                                            */
+/* The lattice siever used to be built once for every sieve   */
+/* region size, since the scheduling functions lasched() and  */
+/* medsched() are compiled with I_bits and L1_BITS as         */
+/* constants. Here they are compiled for every usable pair,   */
+/* and the siever picks the pair at run time.                 */
+/* The same goes for bucketsched(), which the siever uses     */
+/* instead of lasched() with -B.                              */
+/**************************************************************/
+/*  This file is part of GGNFS.
+*
+*   GGNFS is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   GGNFS is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with GGNFS; if not, write to the Free Software
+*   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <stdlib.h>
+#include "lasieve.h"
+
+/* siever-config.h only gives a default. */
+#undef L1_BITS
+
+#define SK_NAME(f, I, L)  SK_NAME1(f, I, L)
+#define SK_NAME1(f, I, L) f##_I##I##_L##L
+
+/* A strip holds at least one line (I_bits-1 <= L1_BITS), and the
+   offsets in a schedule are 16 bits (L1_BITS <= 16).
+*/
+#define L1_BITS 13
+#define I_bits 11
+#include "sched-kernel.h"
+#define I_bits 12
+#include "sched-kernel.h"
+#define I_bits 13
+#include "sched-kernel.h"
+#define I_bits 14
+#include "sched-kernel.h"
+#undef L1_BITS
+
+#define L1_BITS 14
+#define I_bits 11
+#include "sched-kernel.h"
+#define I_bits 12
+#include "sched-kernel.h"
+#define I_bits 13
+#include "sched-kernel.h"
+#define I_bits 14
+#include "sched-kernel.h"
+#define I_bits 15
+#include "sched-kernel.h"
+#undef L1_BITS
+
+#define L1_BITS 15
+#define I_bits 11
+#include "sched-kernel.h"
+#define I_bits 12
+#include "sched-kernel.h"
+#define I_bits 13
+#include "sched-kernel.h"
+#define I_bits 14
+#include "sched-kernel.h"
+#define I_bits 15
+#include "sched-kernel.h"
+#define I_bits 16
+#include "sched-kernel.h"
+#undef L1_BITS
+
+#define L1_BITS 16
+#define I_bits 11
+#include "sched-kernel.h"
+#define I_bits 12
+#include "sched-kernel.h"
+#define I_bits 13
+#include "sched-kernel.h"
+#define I_bits 14
+#include "sched-kernel.h"
+#define I_bits 15
+#include "sched-kernel.h"
+#define I_bits 16
+#include "sched-kernel.h"
+#undef L1_BITS
+
+typedef struct {
+  u32_t      ibits, l1bits;
+  lasched_t  la;
+  medsched_t me;
+  bucketsched_t bu;
+} sched_kernel_t;
+
+#define SK_ENTRY(I, L) { I, L, SK_NAME(lasched, I, L), SK_NAME(medsched, I, L), \
+                         SK_NAME(bucketsched, I, L) }
+
+static const sched_kernel_t sched_kernels[] = {
+  SK_ENTRY(11, 13), SK_ENTRY(12, 13), SK_ENTRY(13, 13), SK_ENTRY(14, 13),
+  SK_ENTRY(11, 14), SK_ENTRY(12, 14), SK_ENTRY(13, 14), SK_ENTRY(14, 14),
+  SK_ENTRY(15, 14),
+  SK_ENTRY(11, 15), SK_ENTRY(12, 15), SK_ENTRY(13, 15), SK_ENTRY(14, 15),
+  SK_ENTRY(15, 15), SK_ENTRY(16, 15),
+  SK_ENTRY(11, 16), SK_ENTRY(12, 16), SK_ENTRY(13, 16), SK_ENTRY(14, 16),
+  SK_ENTRY(15, 16), SK_ENTRY(16, 16)
+};
+
+/**************************************************/
+int sched_kernels_select(u32_t ibits, u32_t l1bits, lasched_t *la, medsched_t *me,
+                         bucketsched_t *bu)
+/**************************************************/
+/* Find the scheduling functions for I_bits=ibits,  */
+/* L1_BITS=l1bits. Return value: 0 on success, -1   */
+/* if there is no such variant.                     */
+/**************************************************/
+{ size_t k;
+
+  for (k = 0; k < sizeof(sched_kernels) / sizeof(sched_kernels[0]); k++) {
+    if (sched_kernels[k].ibits == ibits && sched_kernels[k].l1bits == l1bits) {
+      *la = sched_kernels[k].la;
+      *me = sched_kernels[k].me;
+      *bu = sched_kernels[k].bu;
+      return 0;
+    }
+  }
+  return -1;
+}
@@ -0,0 +1,427 @@
+/**************************************************************/
+/* lpgraph.c                                                  */
+/* A persistent graph of the large primes in the processed    */
+/* relations, updated as procrels adds relations. Each large  */
+/* prime is a vertex; a relation with two large primes is an  */
+/* edge between them, and one with a single large prime an    */
+/* edge to the vertex '1'. Every edge which closes a cycle    */
+/* (found with union-find) gives a full relation-set, so      */
+/* fulls + cycles is known at any moment without redoing the  */
+/* cycle search over all of the files. Relations with more    */
+/* large primes are only counted. The occurrence count of     */
+/* each large prime is kept too, for the number of            */
+/* singletons. Like the (a,b) index, the graph lives in a     */
+/* mmapped file, <prefix>.lpg, and is only rebuilt from the   */
+/* processed files when it is out of date.                    */
+/**************************************************************/
+/*  This file is part of GGNFS.
+*
+*   GGNFS is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   GGNFS is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with GGNFS; if not, write to the Free Software
+*   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "lpgraph.h"
+#include "rellist.h"
+
+#if !defined(_MSC_VER) && !defined(__MINGW32__) && !defined(MINGW32)
+#define LPG_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#ifdef _MSC_VER
+#pragma warning (disable: 4996) /* warning C4996: 'function' was declared deprecated */
+#endif
+
+#define LPG_MAGIC "GGNFSLPG"
+#define LPG_MIN_CAPACITY 65536
+/* The table is doubled when it gets more than 3/4 full. Vertex 0 is */
+/* not in it, so this also leaves room for it in the parent array.   */
+#define LPG_FULL(_c, _n) (4*(_n) > 3*(_c))
+
+/* Large primes are never 0, so p = 0 marks an empty slot. */
+#define SLOT_EMPTY(_s) ((_s)->p == 0)
+
+/*********************************************************************/
+static INLINE u64 lpg_hash(s32 p, s32 r)
+/*********************************************************************/
+{ u64 h;
+
+  h = (u64)(u32)p*0x9E3779B97F4A7C15ULL ^ (u64)(u32)r*0xC2B2AE3D27D4EB4FULL;
+  h ^= h >> 31;
+  h *= 0xBF58476D1CE4E5B9ULL;
+  h ^= h >> 29;
+  return h;
+}
+
+/*********************************************************************/
+static size_t lpg_size(s64 capacity)
+/*********************************************************************/
+{
+  return sizeof(lp_graph_hdr_t) + capacity*(sizeof(lp_slot_t) + sizeof(u32));
+}
+
+/*********************************************************************/
+static void lpg_setPointers(lp_graph_t *G)
+/*********************************************************************/
+{
+  G->T = (lp_slot_t *)(G->H + 1);
+  G->parent = (u32 *)(G->T + G->H->capacity);
+  G->mask = G->H->capacity - 1;
+}
+
+/*********************************************************************/
+static int lpg_map(lp_graph_t *G, char *fName, s64 capacity)
+/*********************************************************************/
+/* Create (or truncate) fName as an empty graph with 'capacity'      */
+/* slots, and map it.                                                */
+/*********************************************************************/
+{ size_t size = lpg_size(capacity);
+
+#ifdef LPG_MMAP
+  if ((G->fd = open(fName, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+    fprintf(stderr, "lpg_map() : Could not create %s!\n", fName);
+    return -1;
+  }
+  if (ftruncate(G->fd, (off_t)size)) {
+    fprintf(stderr, "lpg_map() : Could not resize %s!\n", fName);
+    close(G->fd);
+    return -1;
+  }
+  G->H = (lp_graph_hdr_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, G->fd, 0);
+  if (G->H == MAP_FAILED) {
+    fprintf(stderr, "lpg_map() : Could not map %s!\n", fName);
+    close(G->fd);
+    G->H = NULL;
+    return -1;
+  }
+#else
+  G->fd = -1;
+  if (!(G->H = (lp_graph_hdr_t *)malloc(size))) {
+    fprintf(stderr, "lpg_map() : Memory allocation error!\n");
+    return -1;
+  }
+#endif
+  G->mapSize = size;
+  memset(G->H, 0x00, size);
+  memcpy(G->H->magic, LPG_MAGIC, 8);
+  G->H->version = LPG_VERSION;
+  G->H->capacity = capacity;
+  lpg_setPointers(G);
+  return 0;
+}
+
+/*********************************************************************/
+static void lpg_unmap(lp_graph_t *G)
+/*********************************************************************/
+{
+  if (G->H == NULL) return;
+#ifdef LPG_MMAP
+  munmap((void *)G->H, G->mapSize);
+  close(G->fd);
+#else
+  { FILE *fp;
+    if ((fp = fopen(G->fName, "wb"))) {
+      fwrite(G->H, 1, G->mapSize, fp);
+      fclose(fp);
+    }
+    free(G->H);
+  }
+#endif
+  G->H = NULL; G->T = NULL; G->parent = NULL;
+}
+
+/*********************************************************************/
+static int lpg_load(lp_graph_t *G)
+/*********************************************************************/
+/* Map an existing graph file. Return value: 0 if it looks sane.     */
+/*********************************************************************/
+{ struct stat    fileInfo;
+  lp_graph_hdr_t H;
+  FILE          *fp;
+
+  if (stat(G->fName, &fileInfo) || !(fp = fopen(G->fName, "rb")))
+    return -1;
+  if (fread(&H, sizeof(H), 1, fp) != 1) {
+    fclose(fp);
+    return -1;
+  }
+  if (memcmp(H.magic, LPG_MAGIC, 8) || (H.version != LPG_VERSION) ||
+      (H.capacity < 1) || (H.capacity & (H.capacity-1)) ||
+      ((s64)fileInfo.st_size != (s64)lpg_size(H.capacity))) {
+    fclose(fp);
+    return -1;
+  }
+  G->mapSize = fileInfo.st_size;
+#ifdef LPG_MMAP
+  fclose(fp);
+  if ((G->fd = open(G->fName, O_RDWR)) < 0)
+    return -1;
+  G->H = (lp_graph_hdr_t *)mmap(NULL, G->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, G->fd, 0);
+  if (G->H == MAP_FAILED) {
+    close(G->fd);
+    G->H = NULL;
+    return -1;
+  }
+#else
+  G->fd = -1;
+  if (!(G->H = (lp_graph_hdr_t *)malloc(G->mapSize))) {
+    fclose(fp);
+    return -1;
+  }
+  rewind(fp);
+  if (fread(G->H, 1, G->mapSize, fp) != G->mapSize) {
+    free(G->H); G->H = NULL;
+    fclose(fp);
+    return -1;
+  }
+  fclose(fp);
+#endif
+  lpg_setPointers(G);
+  return 0;
+}
+
+/*********************************************************************/
+static int lpg_filesMatch(lp_graph_t *G, multi_file_t *prelF)
+/*********************************************************************/
+{ s64   fileSize[ABIDX_MAX_FILES];
+  s32   fileRels[ABIDX_MAX_FILES];
+  int   i;
+
+  if (!G->H->clean || (G->H->numFiles != prelF->numFiles))
+    return 0;
+  prelF_fileState(prelF, fileSize, fileRels);
+  for (i=0; i<prelF->numFiles; i++)
+    if ((G->H->fileSize[i] != fileSize[i]) || (G->H->fileRels[i] != fileRels[i]))
+      return 0;
+  return 1;
+}
+
+/*********************************************************************/
+static lp_slot_t *lpg_slot(lp_graph_t *G, s32 p, s32 r)
+/*********************************************************************/
+/* The slot of (p,r), or the empty slot where it would go.           */
+/*********************************************************************/
+{ s64 h;
+  lp_slot_t *S;
+
+  for (h = lpg_hash(p, r) & G->mask; ; h = (h+1) & G->mask) {
+    S = &G->T[h];
+    if (SLOT_EMPTY(S) || ((S->p == p) && (S->r == r)))
+      return S;
+  }
+}
+
+/*********************************************************************/
+static int lpg_grow(lp_graph_t *G)
+/*********************************************************************/
+/* Double the table: build the new one in <fName>.new, then rename.  */
+/* The vertex numbers stay the same, so the parents are copied.      */
+/*********************************************************************/
+{ lp_graph_t Y;
+  char  newName[520];
+  s64   i;
+
+  sprintf(newName, "%s.new", G->fName);
+  strcpy(Y.fName, G->fName);
+  if (lpg_map(&Y, newName, 2*G->H->capacity))
+    return -1;
+  Y.H->count = G->H->count;
+  Y.H->numRels = G->H->numRels;
+  Y.H->numFull = G->H->numFull;
+  Y.H->numCycles = G->H->numCycles;
+  Y.H->numHeavy = G->H->numHeavy;
+  Y.H->numSingletons = G->H->numSingletons;
+  for (i=0; i<G->H->capacity; i++) {
+    lp_slot_t *S = &G->T[i];
+    if (!SLOT_EMPTY(S))
+      *lpg_slot(&Y, S->p, S->r) = *S;
+  }
+  memcpy(Y.parent, G->parent, (G->H->count+1)*sizeof(u32));
+  lpg_unmap(G);
+#ifdef LPG_MMAP
+  if (rename(newName, G->fName)) {
+    fprintf(stderr, "lpg_grow() : Could not rename %s to %s!\n", newName, G->fName);
+    lpg_unmap(&Y);
+    return -1;
+  }
+#endif
+  *G = Y;
+  return 0;
+}
+
+/*********************************************************************/
+static u32 lpg_vertex(lp_graph_t *G, s32 p, s32 r)
+/*********************************************************************/
+/* Count one more occurrence of (p,r) and return its vertex.         */
+/*********************************************************************/
+{ lp_slot_t *S = lpg_slot(G, p, r);
+  u32        id;
+
+  if (SLOT_EMPTY(S)) {
+    S->p = p; S->r = r; S->cnt = 0;
+    S->id = id = (u32)(++G->H->count);
+    G->parent[id] = id;
+    if (LPG_FULL(G->H->capacity, G->H->count)) {
+      if (lpg_grow(G)) {
+        fprintf(stderr, "lpg_vertex() : Could not grow the large prime graph!\n");
+        exit(-1);
+      }
+      S = lpg_slot(G, p, r);
+    }
+  }
+  if (++S->cnt == 1)
+    G->H->numSingletons++;
+  else if (S->cnt == 2)
+    G->H->numSingletons--;
+  return S->id;
+}
+
+/*********************************************************************/
+static u32 lpg_find(lp_graph_t *G, u32 x)
+/*********************************************************************/
+{ u32 *P = G->parent;
+
+  while (P[x] != x) {
+    P[x] = P[P[x]];
+    x = P[x];
+  }
+  return x;
+}
+
+/*********************************************************************/
+void lpg_addRel(lp_graph_t *G, s32 *relData)
+/*********************************************************************/
+{ u32 sF = relData[0], lrpi, lapi, v[2], x, y;
+  int numLR, numLA, k, n=0;
+
+  numLR = GETNUMLRP(sF);
+  numLA = GETNUMLAP(sF);
+  lrpi = 4 + 2*(GETNUMRFB(sF) + GETNUMAFB(sF) + GETNUMSPB(sF)) + 2;
+  lapi = lrpi + numLR;
+  G->H->numRels++;
+  for (k=0; k<numLR; k++) {
+    x = lpg_vertex(G, relData[lrpi + k], -1);
+    if (n < 2) v[n] = x;
+    n++;
+  }
+  for (k=0; k<numLA; k++) {
+    x = lpg_vertex(G, relData[lapi + 2*k], relData[lapi + 2*k + 1]);
+    if (n < 2) v[n] = x;
+    n++;
+  }
+  if (n == 0) {
+    G->H->numFull++;
+    return;
+  }
+  if (n > 2) {
+    G->H->numHeavy++;
+    return;
+  }
+  x = lpg_find(G, v[0]);
+  y = lpg_find(G, (n == 1) ? 0 : v[1]);
+  if (x == y)
+    G->H->numCycles++;
+  else if (x < y)
+    G->parent[y] = x;
+  else
+    G->parent[x] = y;
+}
+
+/*********************************************************************/
+s64 lpg_numFF(lp_graph_t *G)
+/*********************************************************************/
+{
+  return G->H->numFull + G->H->numCycles;
+}
+
+/*********************************************************************/
+static int lpg_build(lp_graph_t *G, multi_file_t *prelF)
+/*********************************************************************/
+/* Build the graph from scratch, from the processed files.           */
+/*********************************************************************/
+{ u32      r;
+  int      i;
+  rel_list *RL;
+
+  if (lpg_map(G, G->fName, LPG_MIN_CAPACITY))
+    return -1;
+  printf("Building large prime graph %s...", G->fName); fflush(stdout);
+  for (i=0; i<prelF->numFiles; i++) {
+    printf("%d..", i); fflush(stdout);
+    if (!(RL = getRelList(prelF, i)))
+      continue;
+    for (r=0; r<RL->numRels; r++)
+      lpg_addRel(G, &RL->relData[RL->relIndex[r]]);
+    clearRelList(RL);
+    free(RL);
+  }
+  printf("\n");
+  return 0;
+}
+
+/*********************************************************************/
+int lpg_open(lp_graph_t *G, multi_file_t *prelF)
+/*********************************************************************/
+{
+  if (prelF->numFiles > ABIDX_MAX_FILES) {
+    fprintf(stderr, "lpg_open() : Too many processed files (%d)!\n", prelF->numFiles);
+    return -1;
+  }
+  if (strlen(prelF->prefix) + strlen(LPG_SUFFIX) + 2 > sizeof(G->fName)) {
+    fprintf(stderr, "lpg_open() : The file prefix is too long!\n");
+    return -1;
+  }
+  snprintf(G->fName, sizeof(G->fName), "%s.%s", prelF->prefix, LPG_SUFFIX);
+  G->H = NULL;
+  if (lpg_load(G) == 0) {
+    if (lpg_filesMatch(G, prelF)) {
+      printf("Loaded large prime graph %s: %" PRId64 " primes.\n", G->fName, G->H->count);
+    } else {
+      printf("Large prime graph %s is out of date.\n", G->fName);
+      lpg_unmap(G);
+    }
+  }
+  if ((G->H == NULL) && lpg_build(G, prelF))
+    return -1;
+  /* Until lpg_close(), the graph may not match the files. */
+  G->H->clean = 0;
+#ifdef LPG_MMAP
+  msync((void *)G->H, sizeof(lp_graph_hdr_t), MS_SYNC);
+#endif
+  return 0;
+}
+
+/*********************************************************************/
+void lpg_close(lp_graph_t *G, multi_file_t *prelF)
+/*********************************************************************/
+{
+  if (G->H == NULL) return;
+  G->H->numFiles = prelF->numFiles;
+  prelF_fileState(prelF, G->H->fileSize, G->H->fileRels);
+#ifdef LPG_MMAP
+  msync((void *)G->H, G->mapSize, MS_SYNC);
+#endif
+  /* Only now that the graph is on disk, mark it as good. */
+  G->H->clean = 1;
+#ifdef LPG_MMAP
+  msync((void *)G->H, sizeof(lp_graph_hdr_t), MS_SYNC);
+#endif
+  lpg_unmap(G);
+}
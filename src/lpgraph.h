@@ -0,0 +1,103 @@
+/**************************************************************/
+/* lpgraph.h                                                  */
+/* A persistent large prime graph of the processed relations, */
+/* kept in a file next to the processed relation files, so    */
+/* the number of full relation-sets can be estimated as new   */
+/* relations come in.                                         */
+/**************************************************************/
+/*  This file is part of GGNFS.
+*
+*   GGNFS is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   GGNFS is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with GGNFS; if not, write to the Free Software
+*   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#ifndef __LPGRAPH_H__
+#define __LPGRAPH_H__
+#include "ggnfs.h"
+#include "abindex.h"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+/* The graph file is <prel prefix>.lpg. */
+#define LPG_SUFFIX     "lpg"
+#define LPG_VERSION    1
+
+/* The file header, padded to 4096 bytes. The table of slots follows, */
+/* and then the union-find parents, both with 'capacity' entries.     */
+typedef struct {
+  char  magic[8];
+  s32   version;
+  s32   clean;        /* Nonzero if the graph is in sync with the files.  */
+  s64   capacity;     /* Number of slots; a power of 2.                   */
+  s64   count;        /* Number of distinct large primes.                 */
+  s64   numRels;      /* Relations added.                                 */
+  s64   numFull;      /* ... with no large primes.                        */
+  s64   numCycles;    /* Independent cycles among those with 1 or 2.      */
+  s64   numHeavy;     /* ... with more than 2 (not in the graph).         */
+  s64   numSingletons;/* Large primes occurring in only one relation.     */
+  s32   numFiles;
+  s32   reserved;
+  s64   fileSize[ABIDX_MAX_FILES];
+  s32   fileRels[ABIDX_MAX_FILES];
+  char  pad[4096 - 80 - ABIDX_MAX_FILES*(8+4)];
+} lp_graph_hdr_t;
+
+/* A large prime: (p,-1) for a rational one, (p,r) for an algebraic  */
+/* one. 'id' is its vertex in the graph; vertex 0 stands for '1', so */
+/* that a relation with one large prime is an edge from it.          */
+typedef struct {
+  s32  p, r;
+  u32  id, cnt;
+} lp_slot_t;
+
+typedef struct {
+  char            fName[512];
+  lp_graph_hdr_t *H;
+  lp_slot_t      *T;
+  u32            *parent;
+  s64             mask;
+  size_t          mapSize;
+  int             fd;
+} lp_graph_t;
+
+/*********************************************************************/
+/* Open the graph of the processed files 'prelF'. If it is missing,  */
+/* or does not match the files, it is rebuilt from them.             */
+/* Return value: 0 on success, nonzero on error.                     */
+/*********************************************************************/
+int lpg_open(lp_graph_t *G, multi_file_t *prelF);
+
+/*********************************************************************/
+/* Add a relation, in the processed ('data') format, to the graph.   */
+/*********************************************************************/
+void lpg_addRel(lp_graph_t *G, s32 *relData);
+
+/*********************************************************************/
+/* Full relations plus cycles: a lower bound on the number of full   */
+/* relation-sets combParts() can make from the relations added.      */
+/*********************************************************************/
+s64 lpg_numFF(lp_graph_t *G);
+
+/*********************************************************************/
+/* Record the current state of the processed files in the graph,     */
+/* and close it.                                                     */
+/*********************************************************************/
+void lpg_close(lp_graph_t *G, multi_file_t *prelF);
+
+#if defined (__cplusplus)
+};
+#endif
+
+#endif /* __LPGRAPH_H__ */
@@ -57,7 +57,13 @@
 "-prel <file prefix> : File name prefix for input of processed relations.\n"\
 "-minff <int>        : Minimum number of FF's (prevent R-S wt. reduction and\n"\
 "                      writing of the column files if there are fewer than this).\n"\
-"-maxrelsinff <int>  : Max relation-set weight. 0 = automatic adjustment\n"
+"-maxrelsinff <int>  : Max relation-set weight. 0 = automatic adjustment\n"\
+"-maxmem <MB>        : Combine the partial relations on disk, using about this\n"\
+"                      much RAM (plus one processed file), for when the large\n"\
+"                      primes of all the relations do not fit in RAM.\n"\
+"-graph              : Combine the relations with 1 or 2 large primes by\n"\
+"                      taking the cycles of the large prime graph, instead of\n"\
+"                      with repeated merge passes.\n"
 
 #define START_MSG \
 "\n"\
@@ -74,7 +80,7 @@
 #define CC_AUTO 2
 
 /***** Globals *****/
-int  discFact=1, cycleCount=CC_AUTO;
+int  discFact=1, cycleCount=CC_AUTO, graphCycles=0;
 u32  initialFF=0, initialRelations=0, finalFF=0;
 u32  totalLargePrimes=0, minFF;
 
@@ -363,7 +369,10 @@ s32 doRowOps3(llist_t **P, llist_t *R, multi_file_t *prelF, s32 maxRelsInFF, s32
 #ifdef GGNFS_TPIE
   numFull = combParts_tpie(R, PL, maxRelsInFF, minFF, minFull);
 #else
-  numFull = combParts(R, PL, maxRelsInFF, minFF, minFull);
+  if (graphCycles)
+    numFull = combPartsGraph(R, PL, maxRelsInFF, minFF, minFull);
+  else
+    numFull = combParts(R, PL, maxRelsInFF, minFF, minFull);
 #endif
   return numFull;
 }
@@ -371,33 +380,18 @@ s32 doRowOps3(llist_t **P, llist_t *R, multi_file_t *prelF, s32 maxRelsInFF, s32
 
 
 /*********************************************************************/
-s32 getCols(char *colName, multi_file_t *prelF, multi_file_t *lpF, nfs_fb_t *FB,
-             s32 minFull, s32 maxRelsInFF)
+s32 writeFullCols(char *colName, llist_t *Rl, llist_t *P,
+                  s32 *buf, s32 bufMax, s32 *buf2, s32 bufMax2)
 /*********************************************************************/
-{ s32         i, j, k, l, R0, R1;
-  s32         numFulls, rIndex, numFF, tPP;
-  s32         aOffset, spOffset;
-  char         fName[64], prelName[64], indexName[64];
-  FILE         *fp, *ofp, *ofp2;
-  column_t     C;
-  rel_list    *RL;
-  relation_t   R;
-  mpz_t       tmp;
-  llist_t     *P, Rl;
-  s32       *buf=NULL, bufSize, bufMax, bufIndex;
-  s32       *buf2=NULL, bufSize2, bufMax2, bufIndex2;
-
-  mpz_init(tmp);
-  tPP = approxPi_x(FB->maxP_r) + approxPi_x(FB->maxP_a);
-  tPP = tPP - FB->rfb_size - FB->afb_size;
-  memset(&Rl, 0, sizeof(Rl));
-  printf("Max # of large primes is approximately %" PRId32 ".\n", tPP);
-  numFulls = doRowOps3(&P, &Rl, prelF, maxRelsInFF, minFull);
+/* Write the full relation-sets of Rl (those with no large primes    */
+/* left in P) to the unprocessed column file and its index.          */
+/*********************************************************************/
+{ s32         i, j, numFF;
+  s32         bufSize, bufSize2;
+  char        indexName[80];
+  FILE       *ofp, *ofp2;
+  column_t    C;
 
-  if (numFulls < minFull) {
-    ll_clear(P); ll_clear(&Rl); free(P);
-    return numFulls;
-  }
   /**************************************************************/
   /* Convert the full relations into column_t data.             */
   /* This is done in several passes. First, create the column   */
@@ -408,33 +402,22 @@ s32 getCols(char *colName, multi_file_t *prelF, multi_file_t *lpF, nfs_fb_t *FB,
   C.QCB[0] = C.QCB[1] = 0x00000000;
   sprintf(indexName, "%s.index", colName);
   if (!(ofp = fopen(colName, "wb"))) {
-    fprintf(stderr, "getCols() Error opening %s for write!\n", colName);
+    fprintf(stderr, "writeFullCols() Error opening %s for write!\n", colName);
     exit(-1);
   }
   if (!(ofp2 = fopen(indexName, "wb"))) {
-    fprintf(stderr, "getCols() Error opening %s for write!\n", indexName);
+    fprintf(stderr, "writeFullCols() Error opening %s for write!\n", indexName);
     fclose(ofp);
     exit(-1);
   }
-  /* Prep the output buffers: */
-  bufMax = IO_BUFFER_SIZE;
-  if (!(buf = (s32 *)lxmalloc(bufMax*sizeof(s32),0))) {
-    printf("getCols() : Memory allocation error for buf!\n");
-    exit(-1);
-  }
-  bufMax2 = IO_BUFFER_SIZE;
-  if (!(buf2 = (s32 *)lxmalloc(bufMax2*sizeof(s32),0))) {
-    printf("getCols() : Memory allocation error for buf2!\n");
-    exit(-1);
-  }
   bufSize = bufSize2=0;
   /* Rl should contain just full relation-sets now. */
-  for (i=0,numFF=0; i<Rl.numFields; i++) {
-    if ((Rl.index[i+1]-Rl.index[i]>0) && (P->index[i+1]==P->index[i])) {
+  for (i=0,numFF=0; i<Rl->numFields; i++) {
+    if ((Rl->index[i+1]-Rl->index[i]>0) && (P->index[i+1]==P->index[i])) {
       /* This is a full relation, coming from several (a,b) pairs. */
-      C.numRels = Rl.index[i+1] - Rl.index[i];
+      C.numRels = Rl->index[i+1] - Rl->index[i];
       for (j=0; j<C.numRels; j++) {
-        C.Rels[j] = Rl.data[Rl.index[i]+j];
+        C.Rels[j] = Rl->data[Rl->index[i]+j];
 #ifdef _DEBUG
         if ((C.Rels[j] < 0) || (C.Rels[j] > initialRelations)) {
           printf("Error: C.Rels[%ld] = %ld versus %ld relations!\n",j,C.Rels[j],initialRelations);
@@ -478,9 +461,63 @@ s32 getCols(char *colName, multi_file_t *prelF, multi_file_t *lpF, nfs_fb_t *FB,
   bufSize2=0;
 
   fclose(ofp); fclose(ofp2);
-  /* We won't be needing these anymore. */
-  ll_clear(&Rl);
-  ll_clear(P); free(P);
+  return numFF;
+}
+
+/*********************************************************************/
+s32 getCols(char *colName, multi_file_t *prelF, multi_file_t *lpF, nfs_fb_t *FB,
+             s32 minFull, s32 maxRelsInFF, s64 maxMem)
+/*********************************************************************/
+{ s32         i, j, k, l, R0, R1;
+  s32         numFulls, rIndex, numFF, tPP;
+  s32         aOffset, spOffset;
+  char         fName[64], prelName[64];
+  FILE         *fp, *ofp;
+  column_t     C;
+  rel_list    *RL;
+  relation_t   R;
+  mpz_t       tmp;
+  llist_t     *P, Rl;
+  s32       *buf=NULL, bufSize, bufMax, bufIndex;
+  s32       *buf2=NULL, bufSize2, bufMax2, bufIndex2;
+
+  mpz_init(tmp);
+  tPP = approxPi_x(FB->maxP_r) + approxPi_x(FB->maxP_a);
+  tPP = tPP - FB->rfb_size - FB->afb_size;
+  memset(&Rl, 0, sizeof(Rl));
+  printf("Max # of large primes is approximately %" PRId32 ".\n", tPP);
+  if (maxMem > 0) {
+    /* Combine the partials on disk; this also writes the column file. */
+    numFulls = combPartsExt(prelF, colName, maxRelsInFF, minFull, maxMem,
+                            &initialRelations);
+    if (numFulls < minFull)
+      return numFulls;
+  } else {
+    numFulls = doRowOps3(&P, &Rl, prelF, maxRelsInFF, minFull);
+    if (numFulls < minFull) {
+      ll_clear(P); ll_clear(&Rl); free(P);
+      return numFulls;
+    }
+  }
+  /* Prep the output buffers: */
+  bufMax = IO_BUFFER_SIZE;
+  if (!(buf = (s32 *)lxmalloc(bufMax*sizeof(s32),0))) {
+    printf("getCols() : Memory allocation error for buf!\n");
+    exit(-1);
+  }
+  bufMax2 = IO_BUFFER_SIZE;
+  if (!(buf2 = (s32 *)lxmalloc(bufMax2*sizeof(s32),0))) {
+    printf("getCols() : Memory allocation error for buf2!\n");
+    exit(-1);
+  }
+  if (maxMem > 0) {
+    numFF = numFulls;
+  } else {
+    numFF = writeFullCols(colName, &Rl, P, buf, bufMax, buf2, bufMax2);
+    /* We won't be needing these anymore. */
+    ll_clear(&Rl);
+    ll_clear(P); free(P);
+  }
 
 
   printf("After re-scanning files and building column indicies, numFF=%" PRId32 ".\n", numFF);
@@ -715,6 +752,7 @@ int main(int argC, char *args[])
   char       str[128], line[128];
   int        i, qcbSize = DEFAULT_QCB_SIZE, seed=DEFAULT_SEED, retVal=0;
   u32        maxRelsInFF=MAX_RELS_IN_FF;
+  s64        maxMem=0;
   double     startTime, stopTime;
   s32        totalRels, relsInFile;
   nfs_fb_t   FB;
@@ -758,6 +796,11 @@ int main(int argC, char *args[])
     } else if (strcmp(args[i], "-maxrelsinff")==0) {
       if ((++i) < argC) 
         maxRelsInFF = atoi(args[i]);
+    } else if (strcmp(args[i], "-graph")==0) {
+      graphCycles=1;
+    } else if (strcmp(args[i], "-maxmem")==0) {
+      if ((++i) < argC)
+        maxMem = (s64)atoi(args[i])*1048576;
     }
   }
   maxRelsInFF=MIN(MAX_RELS_IN_FF,maxRelsInFF);
@@ -797,7 +840,7 @@ int main(int argC, char *args[])
     totalRels += relsInFile;
   }
 
-  finalFF = getCols(colName, &prelF, &lpF, &FB, minFF, maxRelsInFF);
+  finalFF = getCols(colName, &prelF, &lpF, &FB, minFF, maxRelsInFF, maxMem);
   msgLog("", "Heap stats for matbuild run.");
   logHeapStats();
 
@@ -0,0 +1,279 @@
+/**************************************************************/
+/* matprune-mt.c                                              */
+/* Threaded versions of the full passes over the matrix made  */
+/* by matprune: row weights, singleton rows, the row map and  */
+/* column deletion. The choice of what to delete is left to   */
+/* the serial code in matprune.c, so the pruned matrix does   */
+/* not depend on the number of threads. These are called when */
+/* a thread pool has been started with thr_init().            */
+/**************************************************************/
+/*  This file is part of GGNFS.
+*
+*   GGNFS is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   GGNFS is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with GGNFS; if not, write to the Free Software
+*   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ggnfs.h"
+#include "thrpool.h"
+
+typedef struct {
+  nfs_sparse_mat_t *M;
+  s32 *rowWt;     /* Output: entries per row.                        */
+  s32 *rowCol;    /* Output: singleton column per row, or NULL.      */
+  s32 *part;      /* Per-thread counts (and XORs of the column ids). */
+  int  numParts;
+} mt_rows_t;
+
+typedef struct {
+  s32  *index, *data;
+  u64 **extra;    /* One word per field, e.g. the dense blocks.      */
+  int   numExtra;
+  u8   *dead;
+  s32   n;
+  s32   lo[THR_MAX_THREADS+1], base[THR_MAX_THREADS+1];
+  s32   num[THR_MAX_THREADS], size[THR_MAX_THREADS];
+} mt_compact_t;
+
+typedef struct {
+  s32 *entry, *map;
+  s32  n;
+} mt_map_t;
+
+/*********************************************************************/
+static void mt_countJob(void *arg, int thread, int numThreads)
+/*********************************************************************/
+/* Count the entries of this thread's columns in its own copy of the */
+/* row counts. For singletons, column 0 is skipped (as it is by the  */
+/* serial removeSingletons()) and the column ids are XORed together, */
+/* so a row with one entry names its column.                         */
+/*********************************************************************/
+{ mt_rows_t *S=(mt_rows_t *)arg;
+  nfs_sparse_mat_t *M=S->M;
+  s32 lo, hi, i, j, *cnt, *x;
+
+  cnt = S->part + (size_t)thread*M->numRows;
+  memset(cnt, 0x00, M->numRows*sizeof(s32));
+  thr_range(&lo, &hi, M->numCols, thread, numThreads);
+  if (S->rowCol) {
+    x = S->part + (size_t)(numThreads+thread)*M->numRows;
+    memset(x, 0x00, M->numRows*sizeof(s32));
+    for (j=MAX(lo, 1); j<hi; j++) {
+      for (i=M->cIndex[j]; i<M->cIndex[j+1]; i++) {
+        cnt[M->cEntry[i]]++;
+        x[M->cEntry[i]] ^= j;
+      }
+    }
+  } else {
+    for (i=M->cIndex[lo]; i<M->cIndex[hi]; i++)
+      cnt[M->cEntry[i]]++;
+  }
+}
+
+/*********************************************************************/
+static void mt_sumJob(void *arg, int thread, int numThreads)
+/*********************************************************************/
+/* Add up the per-thread counts over this thread's rows.             */
+/*********************************************************************/
+{ mt_rows_t *S=(mt_rows_t *)arg;
+  s32 lo, hi, r, w, x, n=S->M->numRows;
+  int t;
+
+  thr_range(&lo, &hi, n, thread, numThreads);
+  for (r=lo; r<hi; r++) {
+    for (t=0, w=0, x=0; t<numThreads; t++) {
+      w += S->part[(size_t)t*n + r];
+      if (S->rowCol)
+        x ^= S->part[(size_t)(numThreads+t)*n + r];
+    }
+    if (S->rowWt)
+      S->rowWt[r] = w;
+    if (S->rowCol)
+      S->rowCol[r] = ((w==1) && (r>0)) ? x : 0;
+  }
+}
+
+/*********************************************************************/
+static s32 mt_rows(nfs_sparse_mat_t *M, s32 *rowWt, s32 *rowCol)
+/*********************************************************************/
+{ mt_rows_t S;
+
+  S.M = M;
+  S.rowWt = rowWt;
+  S.rowCol = rowCol;
+  S.numParts = (rowCol ? 2 : 1)*thr_numThreads();
+  S.part = (s32 *)lxmalloc((size_t)S.numParts*M->numRows*sizeof(s32), 1);
+  thr_run(mt_countJob, &S);
+  thr_run(mt_sumJob, &S);
+  free(S.part);
+  return 0;
+}
+
+/*********************************************************************/
+static void mt_compactJob(void *arg, int thread, int numThreads)
+/*********************************************************************/
+/* Squeeze the dead fields out of this thread's share, in place. The */
+/* shares are put back together afterwards by mt_compact().          */
+/*********************************************************************/
+{ mt_compact_t *P=(mt_compact_t *)arg;
+  s32 lo, hi, j, k, s0, s1, out;
+  int e;
+
+  thr_range(&lo, &hi, P->n, thread, numThreads);
+  out = s1 = P->base[thread];
+  for (j=lo, k=lo; j<hi; j++) {
+    s0 = s1;
+    s1 = (j+1 < hi) ? P->index[j+1] : P->base[thread+1];
+    if (P->dead[j]) continue;
+    if (out != s0)
+      memmove(&P->data[out], &P->data[s0], (s1-s0)*sizeof(s32));
+    P->index[k] = out;
+    for (e=0; e<P->numExtra; e++)
+      P->extra[e][k] = P->extra[e][j];
+    out += s1-s0;
+    k++;
+  }
+  P->num[thread] = k-lo;
+  P->size[thread] = out - P->base[thread];
+}
+
+/*********************************************************************/
+static s32 mt_compact(s32 *index, s32 *data, s32 n, u64 **extra,
+                      int numExtra, u8 *dead)
+/*********************************************************************/
+/* Delete the fields j with dead[j] != 0 from the list of n fields   */
+/* (index, data), and the corresponding words of the extra arrays.   */
+/* Returns the new number of fields.                                 */
+/*********************************************************************/
+{ mt_compact_t *P;
+  int t, e, nt = thr_numThreads();
+  s32 k, destField, destData, shift;
+
+  P = (mt_compact_t *)lxmalloc(sizeof(mt_compact_t), 1);
+  P->index = index; P->data = data; P->n = n;
+  P->extra = extra; P->numExtra = numExtra;
+  P->dead = dead;
+  for (t=0; t<nt; t++) {
+    thr_range(&P->lo[t], &k, n, t, nt);
+    P->base[t] = index[P->lo[t]];
+  }
+  P->lo[nt] = n;
+  P->base[nt] = index[n];
+  thr_run(mt_compactJob, P);
+
+  /* Share 0 is already in place; move the others down after it. */
+  destField = P->num[0];
+  destData = P->size[0];
+  for (t=1; t<nt; t++) {
+    shift = P->base[t] - destData;
+    if (shift) {
+      memmove(&data[destData], &data[P->base[t]], P->size[t]*sizeof(s32));
+    }
+    for (k=0; k<P->num[t]; k++)
+      index[destField+k] = index[P->lo[t]+k] - shift;
+    for (e=0; e<numExtra; e++)
+      memmove(&extra[e][destField], &extra[e][P->lo[t]], P->num[t]*sizeof(u64));
+    destField += P->num[t];
+    destData += P->size[t];
+  }
+  index[destField] = destData;
+  free(P);
+  return destField;
+}
+
+/*********************************************************************/
+static s32 mt_deleteCols(nfs_sparse_mat_t *M, llist_t *C, u8 *dead, s32 m)
+/*********************************************************************/
+{ s32 n;
+
+  n = mt_compact(M->cIndex, M->cEntry, M->numCols, M->denseBlocks,
+                 M->numDenseBlocks, dead);
+  if (n != M->numCols - m) {
+    fprintf(stderr, "mt_deleteCols(): Expected %" PRId32 " columns, got %" PRId32 "!\n",
+            M->numCols - m, n);
+    exit(-1);
+  }
+  M->numCols = n;
+  C->numFields = mt_compact(C->index, C->data, C->numFields, NULL, 0, dead);
+  return m;
+}
+
+/*********************************************************************/
+s32 rowWeights_mt(nfs_sparse_mat_t *M, s32 *rowWt)
+/*********************************************************************/
+/* rowWt[r] = number of entries of M->cEntry[] in row r.             */
+/*********************************************************************/
+{
+  return mt_rows(M, rowWt, NULL);
+}
+
+/*********************************************************************/
+s32 rowSingletons_mt(nfs_sparse_mat_t *M, s32 *rowMember)
+/*********************************************************************/
+/* rowMember[r] = the column j > 0 of the one entry of row r > 0, or */
+/* 0 if the row has no such entry or more than one.                  */
+/*********************************************************************/
+{
+  return mt_rows(M, NULL, rowMember);
+}
+
+/*********************************************************************/
+s32 removeCols_mt(nfs_sparse_mat_t *M, llist_t *C, s32 *cols, s32 m)
+/*********************************************************************/
+/* Same as removeCols(), but the matrix and the column map are       */
+/* compacted by the threads of the pool.                             */
+/*********************************************************************/
+{ u8  *dead;
+  s32  i;
+
+  if (m <= 0) return 0;
+  dead = (u8 *)lxcalloc(M->numCols*sizeof(u8), 1);
+  for (i=0; i<m; i++) {
+    if (dead[cols[i]]) {
+      printf("Error: removeCols_mt(): duplicate columns!\n");
+      exit(-1);
+    }
+    dead[cols[i]] = 1;
+  }
+  mt_deleteCols(M, C, dead, m);
+  free(dead);
+  return 0;
+}
+
+/*********************************************************************/
+static void mt_mapJob(void *arg, int thread, int numThreads)
+/*********************************************************************/
+{ mt_map_t *P=(mt_map_t *)arg;
+  s32 lo, hi, i;
+
+  thr_range(&lo, &hi, P->n, thread, numThreads);
+  for (i=lo; i<hi; i++)
+    P->entry[i] = P->map[P->entry[i]];
+}
+
+/*********************************************************************/
+s32 mapRows_mt(nfs_sparse_mat_t *M, s32 *map)
+/*********************************************************************/
+/* Replace each row r in M->cEntry[] with map[r].                    */
+/*********************************************************************/
+{ mt_map_t P;
+
+  P.entry = M->cEntry;
+  P.map = map;
+  P.n = M->cIndex[M->numCols];
+  thr_run(mt_mapJob, &P);
+  return 0;
+}
@@ -32,14 +32,24 @@
 #include <sys/time.h>
 #endif
 #include "ggnfs.h"
+#include "thrpool.h"
 
 #define DEFAULT_WT_FACTOR 0.7
+#define DEFAULT_MERGE_DENSITY 70.0
 #define DEFAULT_COLNAME "cols"
 
-#define USAGE " [-cols <fname>] [-wt <wtFactor>]\n"\
+#define USAGE " [-cols <fname>] [-wt <wtFactor>] [-nt <int>] [-fast]\n"\
+"       [-merge <int>] [-density <float>]\n"\
 "-wt <float>         : Weight factor (for pruning; higher means matrix\n"\
 "                      should be kept as sparse as possible, while lower\n"\
-"                      means to shrink the matrix dimensions as much as possible.\n"
+"                      means to shrink the matrix dimensions as much as possible.\n"\
+"-nt <int>           : Number of threads to use for the pruning passes.\n"\
+"-fast               : Only verify the matrix before and after pruning,\n"\
+"                      not between the passes.\n"\
+"-merge <int>        : After pruning, eliminate rows of weight up to this\n"\
+"                      (at least 2; default is not to merge).\n"\
+"-density <float>    : Highest average column weight merging may reach\n"\
+"                      (default 70).\n"
 
 #define START_MSG \
 "\n"\
@@ -90,6 +100,12 @@ void readColSF(column_t *C, FILE *fp)
 s32 *isDenseRow=NULL;
 #define ISDENSEROW(_j) (isDenseRow[_j/32]&BIT(_j%32))
 
+/* Set by -fast: skip mat_verify() inside the pruning loop. */
+static int fastMode=0;
+/* Set by -merge and -density: see mergeRows(). */
+static s32    mergeMaxWt=0;
+static double mergeDensity=DEFAULT_MERGE_DENSITY;
+
 /*********************************************************/
 int mat_verify(nfs_sparse_mat_t *M)
 /*********************************************************/
@@ -192,55 +208,35 @@ int removeRows(nfs_sparse_mat_t *M, s32 *r, int m)
 /* These rows must already be empty or the matrix will   */
 /* be corrupted! (i.e., the rows numbers r[0],... must   */
 /* not appear anywhere in M->cEntry[].                   */
+/* The other rows are renumbered in order, and the dense */
+/* blocks are moved down with them, wherever they are.   */
 /*********************************************************/
-{ s32 j, i, rT, rj;
-  int  good;
+{ s32 j, i, numKept;
   s32 *rowMap;
 
+  if (m <= 0) return 0;
   rowMap=(s32 *)malloc(M->numRows*sizeof(s32));
   for (i=0; i<M->numRows; i++)
-    rowMap[i]=i;
-
-  rT = M->numRows-64;
+    rowMap[i]=0;
   for (j=0; j<m; j++) {
-
-    rj = r[j];
-    if (ISDENSEROW(rj)) {
+    if (ISDENSEROW(r[j])) {
       fprintf(stderr, "removeRows() Error: attempt to delete a dense row!\n");
       free(rowMap); return -1;
     }
-    rT--;
-    do {
-      good=1;
-      for (i=0; i<m; i++) {
-        if (rT==r[i]) {
-          good=0;
-          rT--;
-        }
-      }
-    } while (!good);
-    /* This shouldn't happen unless an awful lot of rows were deleted,
-       or the matrix had some sparse rows, other then QCB, near the end
-       of the matrix. We should think about fixing this code to handle
-       that case as well, but it can wait.
-    */
-    if (ISDENSEROW(rT)) return -1;
-    if (rT <= rj)
-      break;
-    /* Replace all occurrences of rT with rj. */
-    rowMap[rT]=rj;
+    rowMap[r[j]] = -1;
   }
-
-  /* Finally, apply the map. */
-  for (i=M->cIndex[M->numCols]-1; i>=0; i--)
-    M->cEntry[i] = rowMap[M->cEntry[i]]; 
-
-  /* We will definitely need to adjust the indicies for the QCB blocks: */
-  M->denseBlockIndex[0] -= m;
-  /* There shouldn't be any others dense blocks whose indicies need to be
-     adjusted. If there were, the code above would have bailed out.
-  */
-  M->numRows -= m;
+  for (i=0, numKept=0; i<M->numRows; i++)
+    rowMap[i] = (rowMap[i] < 0) ? -1 : numKept++;
+
+  /* Apply the map. */
+  if (thr_numThreads() > 1)
+    mapRows_mt(M, rowMap);
+  else
+    for (i=M->cIndex[M->numCols]-1; i>=0; i--)
+      M->cEntry[i] = rowMap[M->cEntry[i]]; 
+  for (j=0; j<M->numDenseBlocks; j++)
+    M->denseBlockIndex[j] = rowMap[M->denseBlockIndex[j]];
+  M->numRows = numKept;
 
   setDenseRows(M);
 
@@ -256,6 +252,8 @@ int removeCols(nfs_sparse_mat_t *M, llist_t *C, s32 *cols, s32 m)
   int  i;
 
   if (m <= 0) return 0;
+  if (thr_numThreads() > 1)
+    return removeCols_mt(M, C, cols, m);
   qsort(cols, m, sizeof(s32), cmpS32s);
   for (i=1; i<m; i++)
     if (cols[i-1]==cols[i]) {
@@ -595,14 +593,18 @@ int removeSingletons(nfs_sparse_mat_t *M, llist_t *C)
   rowMember = (s32 *)malloc(M->numRows*sizeof(s32));
 
   /* In this way, we'll never be able to remove column zero, but oh well. */
-  memset(rowMember, 0x00, M->numRows*sizeof(s32));
-  for (j=0; j<M->numCols; j++) {
-    for (i=M->cIndex[j]; i<M->cIndex[j+1]; i++) {
-      r = M->cEntry[i];
-      if ((rowMember[r]==0)&&(r>0)) 
-        rowMember[r] = j;
-      else
-        rowMember[r]=-1;
+  if (thr_numThreads() > 1)
+    rowSingletons_mt(M, rowMember);
+  else {
+    memset(rowMember, 0x00, M->numRows*sizeof(s32));
+    for (j=0; j<M->numCols; j++) {
+      for (i=M->cIndex[j]; i<M->cIndex[j+1]; i++) {
+        r = M->cEntry[i];
+        if ((rowMember[r]==0)&&(r>0)) 
+          rowMember[r] = j;
+        else
+          rowMember[r]=-1;
+      }
     }
   }
 
@@ -680,21 +682,29 @@ int removeSingletons2(nfs_sparse_mat_t *M, llist_t *C)
 /******************************************************/
 int removeEmptyRows(nfs_sparse_mat_t *M)
 /******************************************************/
-{ s32    i, j, *rowWeight, emptyRows[1024];
+{ s32    i, j, *rowWeight, *emptyRows;
   s32    totalEmpty, c;
   int     numEmpty;
 
   rowWeight = (s32 *)malloc(M->numRows*sizeof(s32));
 
-  memset(rowWeight, 0x00, M->numRows*sizeof(s32));
-  for (j=M->cIndex[M->numCols]-1; j>=0; j--) {
-    c = M->cEntry[j];
-    if ((c>=0) && (c<M->numRows))
-      rowWeight[c] = 1; /* Not weight anymore, but whatever. */
+  if (thr_numThreads() > 1)
+    rowWeights_mt(M, rowWeight);
+  else {
+    memset(rowWeight, 0x00, M->numRows*sizeof(s32));
+    for (j=M->cIndex[M->numCols]-1; j>=0; j--) {
+      c = M->cEntry[j];
+      if ((c>=0) && (c<M->numRows))
+        rowWeight[c] = 1; /* Not weight anymore, but whatever. */
+    }
   }
   numEmpty=0; totalEmpty=0;
 
-  for (i=0; (i<(M->numRows-64)) && (numEmpty<1024); i++) {
+  /* removeRows() keeps the dense blocks in place wherever they are,
+     so every empty sparse row can go in one pass.
+  */
+  emptyRows = (s32 *)malloc(M->numRows*sizeof(s32));
+  for (i=0; i<M->numRows; i++) {
     if ((rowWeight[i]==0)&&(!(ISDENSEROW(i)))) {
       totalEmpty++;
       emptyRows[numEmpty++] = i;
@@ -703,6 +713,7 @@ int removeEmptyRows(nfs_sparse_mat_t *M)
   if (numEmpty)
     removeRows(M, emptyRows, numEmpty);
 
+  free(emptyRows);
   free(rowWeight);
   return 0;
 }
@@ -779,11 +790,15 @@ int removeHeavyColumnsByRows(nfs_sparse_mat_t *M, llist_t *C, s32 minC, s32 maxC
     return -1;
   }
 
-  memset(rowWeight, 0x00, M->numRows*sizeof(s32));
-  for (j=M->cIndex[M->numCols]-1; j>=0; j--) {
-    x = M->cEntry[j];
-    if ((x>=0) && (x<M->numRows)) {
-      rowWeight[x] += 1; 
+  if (thr_numThreads() > 1) {
+    rowWeights_mt(M, rowWeight);
+  } else {
+    memset(rowWeight, 0x00, M->numRows*sizeof(s32));
+    for (j=M->cIndex[M->numCols]-1; j>=0; j--) {
+      x = M->cEntry[j];
+      if ((x>=0) && (x<M->numRows)) {
+        rowWeight[x] += 1; 
+      }
     }
   }
   for (i=0; i<512; i++)
@@ -853,7 +868,9 @@ int addLightColumnsByRows(nfs_sparse_mat_t *M, llist_t *C, s32 numC)
   qsort(cwt, M->numCols, 2*sizeof(s32), cmpCW2);
 
   rowWeight = (s32 *)calloc(M->numRows,sizeof(s32));
-  for (j=M->cIndex[M->numCols]-1; j>=0; j--)
+  if (thr_numThreads() > 1)
+    rowWeights_mt(M, rowWeight);
+  else for (j=M->cIndex[M->numCols]-1; j>=0; j--)
     rowWeight[M->cEntry[j]] += 1; 
 
   for (i=0; i<512; i++)
@@ -1132,6 +1149,173 @@ int combineDoubles(nfs_sparse_mat_t *M, llist_t *C)
   return 0;
 }
 
+/* A pivot for mergeRows(): row r is to be eliminated by adding its */
+/* lightest column c to the others. 'cost' is the Markowitz count  */
+/* (w-1)(|c|-1), w being the weight of the row.                    */
+typedef struct {
+  s32 r, c, cost;
+} mg_cand_t;
+/*******************************************/
+int cmp_mg_cand_t(const void *a, const void *b)
+/*******************************************/
+{ mg_cand_t *A=(mg_cand_t *)a, *B=(mg_cand_t *)b;
+
+  if (A->cost < B->cost) return -1;
+  if (A->cost > B->cost) return 1;
+  return 0;
+}
+
+/* The block Lanczos cost of an n-column matrix with sparse weight */
+/* w: about n/64 iterations, each touching w sparse entries and n  */
+/* words per dense block.                                          */
+#define BL_COST(_n, _w, _d) ((double)(_n)*((double)(_w) + (double)(_d)*(_n)))
+
+/******************************************************/
+int mergeRows(nfs_sparse_mat_t *M, llist_t *C, s32 maxWt, double maxDensity)
+/******************************************************/
+/* Structured Gaussian elimination: eliminate rows of */
+/* weight 2..maxWt by adding the lightest of their    */
+/* columns to the others and deleting it. Pivots are  */
+/* taken in order of Markowitz cost, and one is only  */
+/* used if it lowers the estimated block Lanczos cost */
+/* without taking the average column weight past      */
+/* maxDensity. Each pass takes pivots with disjoint   */
+/* columns, so the fill-in can be computed exactly.   */
+/* The column map C records the additions, so         */
+/* dependencies still map back to the `cols' file.    */
+/* Returns the number of rows eliminated.             */
+/******************************************************/
+{ s32    *rowWeight, *rowStart, *rowCols, *stamp, *dest, *src, *pivots;
+  s32     i, j, k, r, c, d, w, n, wt, numCand, numPairs, numPivots;
+  s32     cw, ov, fill, total=0, pass=0;
+  u8     *used;
+  mg_cand_t *cand;
+  double  cost;
+  int     ok;
+
+  if (maxWt < 2) return 0;
+  for (;;) {
+    n = M->numCols;
+    wt = M->cIndex[n];
+    rowWeight = (s32 *)malloc(M->numRows*sizeof(s32));
+    rowStart = (s32 *)malloc((M->numRows+1)*sizeof(s32));
+    stamp = (s32 *)malloc(M->numRows*sizeof(s32));
+    used = (u8 *)calloc(n, sizeof(u8));
+    if (!(rowWeight && rowStart && stamp && used)) {
+      printf("mergeRows() memory allocation error!\n");
+      free(rowWeight); free(rowStart); free(stamp); free(used);
+      return -1;
+    }
+    if (thr_numThreads() > 1)
+      rowWeights_mt(M, rowWeight);
+    else {
+      memset(rowWeight, 0x00, M->numRows*sizeof(s32));
+      for (j=wt-1; j>=0; j--)
+        rowWeight[M->cEntry[j]] += 1;
+    }
+
+    /* Gather the columns of the rows with weight 2..maxWt. */
+    numCand=0;
+    for (r=0, k=0; r<M->numRows; r++) {
+      rowStart[r] = k;
+      if ((rowWeight[r] >= 2) && (rowWeight[r] <= maxWt)) {
+        k += rowWeight[r];
+        numCand++;
+      }
+    }
+    rowStart[r] = k;
+    rowCols = (s32 *)malloc((k+1)*sizeof(s32));
+    cand = (mg_cand_t *)malloc((numCand+1)*sizeof(mg_cand_t));
+    dest = (s32 *)malloc((k+1)*sizeof(s32));
+    src = (s32 *)malloc((k+1)*sizeof(s32));
+    pivots = (s32 *)malloc((numCand+1)*sizeof(s32));
+    if (!(rowCols && cand && dest && src && pivots)) {
+      printf("mergeRows() memory allocation error!\n");
+      free(rowWeight); free(rowStart); free(stamp); free(used);
+      free(rowCols); free(cand); free(dest); free(src); free(pivots);
+      return -1;
+    }
+    memset(stamp, 0x00, M->numRows*sizeof(s32));
+    for (c=0; c<n; c++) {
+      for (i=M->cIndex[c]; i<M->cIndex[c+1]; i++) {
+        r = M->cEntry[i];
+        if (rowStart[r+1] > rowStart[r])
+          rowCols[rowStart[r] + stamp[r]++] = c;
+      }
+    }
+    for (r=0, numCand=0; r<M->numRows; r++) {
+      if ((w = rowStart[r+1] - rowStart[r]) == 0) continue;
+      c = rowCols[rowStart[r]];
+      for (i=rowStart[r]+1; i<rowStart[r+1]; i++) {
+        d = rowCols[i];
+        if (M->cIndex[d+1]-M->cIndex[d] < M->cIndex[c+1]-M->cIndex[c])
+          c = d;
+      }
+      cand[numCand].r = r;
+      cand[numCand].c = c;
+      cand[numCand++].cost = (w-1)*(M->cIndex[c+1]-M->cIndex[c]-1);
+    }
+    qsort(cand, numCand, sizeof(mg_cand_t), cmp_mg_cand_t);
+
+    /* Take the pivots which pay for themselves. */
+    memset(stamp, 0xFF, M->numRows*sizeof(s32));
+    cost = BL_COST(n, wt, M->numDenseBlocks);
+    numPairs = numPivots = 0;
+    for (j=0; j<numCand; j++) {
+      r = cand[j].r;
+      c = cand[j].c;
+      for (i=rowStart[r], ok=1; ok && (i<rowStart[r+1]); i++)
+        ok = !used[rowCols[i]];
+      if (!ok) continue;
+      cw = M->cIndex[c+1] - M->cIndex[c];
+      for (i=M->cIndex[c]; i<M->cIndex[c+1]; i++)
+        stamp[M->cEntry[i]] = j;
+      fill = -cw;
+      for (i=rowStart[r]; ok && (i<rowStart[r+1]); i++) {
+        if ((d = rowCols[i]) == c) continue;
+        for (k=M->cIndex[d], ov=0; k<M->cIndex[d+1]; k++)
+          if (stamp[M->cEntry[k]] == j) ov++;
+        fill += cw - 2*ov;
+        /* Stay well inside what addCols_par() and the column map take. */
+        ok = (cw + M->cIndex[d+1]-M->cIndex[d] < MAXCOLWT/2) &&
+             (C->index[c+1]-C->index[c] + C->index[d+1]-C->index[d] < MAXCOLWT/2);
+      }
+      if (!ok) continue;
+      if ((double)(wt+fill) > maxDensity*(n-1)) continue;
+      if (BL_COST(n-1, wt+fill, M->numDenseBlocks) >= cost) continue;
+      for (i=rowStart[r]; i<rowStart[r+1]; i++) {
+        d = rowCols[i];
+        used[d] = 1;
+        if (d != c) {
+          dest[numPairs] = d;
+          src[numPairs++] = c;
+        }
+      }
+      pivots[numPivots++] = c;
+      n--; wt += fill;
+      cost = BL_COST(n, wt, M->numDenseBlocks);
+    }
+    free(rowWeight); free(rowStart); free(stamp); free(used);
+    free(rowCols); free(cand);
+
+    if (numPivots > 0) {
+      if (addCols_par(M, C, dest, src, numPairs)) 
+        numPivots = 0;
+      else
+        removeCols(M, C, pivots, numPivots);
+    }
+    free(dest); free(src); free(pivots);
+    if (numPivots == 0) break;
+    removeEmptyRows(M);
+    total += numPivots;
+    pass++;
+    printTmp("Merge pass %ld: matrix is %ld x %ld with weight %ld.          ",
+             (long)pass, (long)M->numRows, (long)M->numCols, (long)M->cIndex[M->numCols]);
+  }
+  msgLog("", "mergeRows: %" PRId32 " rows eliminated in %" PRId32 " passes.", total, pass);
+  return total;
+}
+
 /***************************************************/
 int pruneMatrix(nfs_sparse_mat_t *M, s32 minExtraCols, double wtFactor,
                 llist_t *C)
@@ -1160,7 +1344,8 @@ int pruneMatrix(nfs_sparse_mat_t *M, s32 minExtraCols, double wtFactor,
   removeSingletons(M, C);
   removeEmptyRows(M);
   do {
-    mat_verify(M);
+    if (!fastMode)
+      mat_verify(M);
     lastR = M->numRows; lastC = M->numCols;
     extraCols = M->numCols - M->numRows - minExtraCols;
     combineDoubles(M, C);
@@ -1190,6 +1375,16 @@ int pruneMatrix(nfs_sparse_mat_t *M, s32 minExtraCols, double wtFactor,
               M->numRows, M->numCols, M->cIndex[M->numCols]);
   } while (extraCols > 0);
 
+  if (mergeMaxWt >= 2) {
+    mergeRows(M, C, mergeMaxWt, mergeDensity);
+    /* Rows emptied by the merge are gone now, so drop the */
+    /* surplus of heavy columns again.                      */
+    while ((extraCols = M->numCols - M->numRows - minExtraCols) > 0) {
+      removeHeavyColumns(M, C, MIN(extraCols, 2048));
+      removeSingletons(M, C);
+      removeEmptyRows(M);
+    }
+  }
   mat_verify(M);
   sprintf(str, "Matrix pruned to %" PRId32 " x %" PRId32 " with weight %" PRId32 ".",
         M->numRows, M->numCols, M->cIndex[M->numCols]);
@@ -1284,7 +1479,7 @@ int main(int argC, char *args[])
 {
   char colName[64];
   double startTime, stopTime, wtFactor=DEFAULT_WT_FACTOR;
-  int i, retval;
+  int i, retval, numThreads=1;
   
   strcpy(colName, DEFAULT_COLNAME);
 
@@ -1297,11 +1492,26 @@ int main(int argC, char *args[])
     } else if (strcmp(args[i], "-cols")==0) {
       if ((++i) < argC) 
         strncpy(colName, args[i], 64);
+    } else if (strcmp(args[i], "-nt")==0) {
+      if ((++i) < argC)
+        numThreads = atoi(args[i]);
+    } else if (strcmp(args[i], "-fast")==0) {
+      fastMode = 1;
+    } else if (strcmp(args[i], "-merge")==0) {
+      if ((++i) < argC)
+        mergeMaxWt = atoi(args[i]);
+    } else if (strcmp(args[i], "-density")==0) {
+      if ((++i) < argC)
+        mergeDensity = atof(args[i]);
     } else if (strcmp(args[i], "--help")==0) {
       printf("USAGE: %s %s\n", args[0], USAGE);
       exit(0);
     }
   }
+  if (numThreads > 1) {
+    numThreads = thr_init(numThreads);
+    printf("Using %d threads.\n", numThreads);
+  }
 
   msgLog("", "GGNFS-%s : matprune", GGNFS_VERSION);
   
@@ -1320,6 +1530,7 @@ int main(int argC, char *args[])
     msgLog("", "Heap stats for matprune run:");
     logHeapStats();
   }
+  thr_clear();
   
   return 0;  
 }
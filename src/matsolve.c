@@ -26,6 +26,7 @@
 #include <sys/stat.h>
 
 #include "if.h"
+#include "thrpool.h"
 
 #if !defined(_MSC_VER)
 #include <sys/time.h>
@@ -44,6 +45,21 @@
 "-save <int>  : Interval (in minutes) between save files.\n"\
 "-test        : Do not solve matrix; use it to test multiply operations.\n"\
 "               This can help expose hardware problems or miscompilations.\n"\
+"-nt <int>    : Number of threads to use for the matrix multiplies.\n"\
+"-layout <s>  : Matrix layout for the multiplies: 'csc' (default) or 'tiled'.\n"\
+"-tile <int>  : Tile size for the tiled layout (default: from the L2 size).\n"\
+"-kernel <s>  : Kernel for the tiled layout: 'auto' (default), 'scalar',\n"\
+"               'avx2' or 'avx512'.\n"\
+"-speedtest   : Time the matrix multiplies with each layout and kernel, then\n"\
+"               quit.\n"\
+"-bw <int>    : Use block Wiedemann with this many sequences (1..16) instead\n"\
+"               of block Lanczos.\n"\
+"-bwjob <int> : Only do the pending block Wiedemann work for this sequence\n"\
+"               (its terms, or its part of the solution once the generator\n"\
+"               is known), then quit. Several of these can run at once, in\n"\
+"               the same directory; give them all the same -seed and -bw, or\n"\
+"               start one first. A run without -bwjob does what is left and\n"\
+"               writes the dependencies.\n"\
 "--help       : Show this help and quit.\n"
 
 #define START_MSG \
@@ -57,6 +73,84 @@
 
 /***** Globals *****/
 s32 delCols[2048], numDel=0;
+static int bwSeqs=0;
+static u32 bwSeed=DEFAULT_SEED;
+
+/***************************************************/
+static void timeMults(nfs_sparse_mat_t *M, u64 *y, u64 *x, u64 *refB, u64 *refBT,
+                      const char *name)
+/***************************************************/
+/* Check MultB64() and MultB_T64() against refB and refBT, and time */
+/* them, with whatever layout and kernel are in use.                */
+/***************************************************/
+{ double t0, tB, tBT;
+  int    i, iters;
+
+  MultB64(y, x, (void *)M);
+  if (memcmp(y, refB, M->numCols*sizeof(u64))) {
+    printf("%-22s: B*x MISMATCH!\n", name);
+    return;
+  }
+  MultB_T64(y, x, (void *)M);
+  if (memcmp(y, refBT, M->numCols*sizeof(u64))) {
+    printf("%-22s: B^T*x MISMATCH!\n", name);
+    return;
+  }
+  t0 = sTime();
+  MultB64(y, x, (void *)M);
+  MultB_T64(y, x, (void *)M);
+  t0 = sTime() - t0;
+  iters = (t0 > 0.0) ? (int)MIN(1000.0, MAX(3.0, 2.0/t0)) : 1000;
+  t0 = sTime();
+  for (i=0; i<iters; i++)
+    MultB64(y, x, (void *)M);
+  tB = (sTime() - t0)/iters;
+  t0 = sTime();
+  for (i=0; i<iters; i++)
+    MultB_T64(y, x, (void *)M);
+  tBT = (sTime() - t0)/iters;
+  printf("%-22s: B*x %9.3lf ms, B^T*x %9.3lf ms, total %9.3lf ms/iteration.\n",
+         name, 1000.0*tB, 1000.0*tBT, 1000.0*(tB+tBT));
+}
+
+/***************************************************/
+void speedTest(nfs_sparse_mat_t *M, s32 tileDim)
+/***************************************************/
+{ u64   *x, *y, *refB, *refBT;
+  s32    i;
+  int    k;
+  char   name[64];
+
+  x = (u64 *)lxmalloc(M->numCols*sizeof(u64), 1);
+  y = (u64 *)lxmalloc(M->numCols*sizeof(u64), 1);
+  refB = (u64 *)lxmalloc(M->numCols*sizeof(u64), 1);
+  refBT = (u64 *)lxmalloc(M->numCols*sizeof(u64), 1);
+  for (i=0; i<M->numCols; i++)
+    x[i] = ((u64)rand() << 42) ^ ((u64)rand() << 21) ^ (u64)rand();
+  printf("Timing the matrix multiplies (%d thread%s)...\n", thr_numThreads(),
+         (thr_numThreads() > 1) ? "s" : "");
+  tiled_clear();
+  MultB64(refB, x, (void *)M);
+  MultB_T64(refBT, x, (void *)M);
+  printf("csc: %" PRId64 " bytes.\n", (s64)(M->cIndex[M->numCols]+M->numCols+1)*(s64)sizeof(s32));
+  timeMults(M, y, x, refB, refBT, "csc");
+
+  if (tiled_init(M, tileDim)) {
+    printf("Could not build the tiled layout!\n");
+  } else {
+    printf("tiled: %" PRId32 " x %" PRId32 " tiles, %" PRId64 " bytes.\n",
+           tiled_dim(), tiled_dim(), tiled_memUse());
+    for (k=TILED_KERNEL_SCALAR; k<=TILED_KERNEL_AVX512; k++) {
+      sprintf(name, "tiled (%s)", tiled_kernelName(k));
+      if (tiled_setKernel(k) < 0)
+        printf("%-22s: not supported by this CPU.\n", name);
+      else
+        timeMults(M, y, x, refB, refBT, name);
+    }
+    tiled_clear();
+  }
+  free(x); free(y); free(refB); free(refBT);
+}
 
 /***************************************************/
 int getDependencies(nfs_sparse_mat_t *M, llist_t *C, s32 *deps, s32 origC, long testMode)
@@ -69,14 +163,28 @@ int getDependencies(nfs_sparse_mat_t *M, llist_t *C, s32 *deps, s32 origC, long
   difficulty = (M->numCols/64.0)*(M->cIndex[M->numCols] + M->numCols*M->numDenseBlocks);
   difficulty /= 1000000.0;
   printf("Matrix difficulty is about %1.2lf\n", difficulty);
-  if (!testMode) printf("Doing block Lanczos...\n");
-  blstart = sTime();
   tmpDeps = (u64 *)malloc(M->numCols*sizeof(u64));
-  res = blockLanczos64(tmpDeps, MultB64, MultB_T64, (void *)M, M->numCols,
-		       testMode);
-  blstop = sTime();
-  printf("Returned %d. Block Lanczos took %1.2lf seconds.\n", res, blstop-blstart);
-  msgLog("", "BLanczosTime: %1.1lf", blstop-blstart);
+  if (bwSeqs > 0) {
+    printf("Doing block Wiedemann...\n");
+    blstart = sTime();
+    res = blockWiedemann64(tmpDeps, MultB64, (void *)M, M->numCols, bwSeqs, bwSeed);
+    blstop = sTime();
+    printf("Returned %d. Block Wiedemann took %1.2lf seconds.\n", res, blstop-blstart);
+    msgLog("", "BWiedemannTime: %1.1lf", blstop-blstart);
+    if (res == 0) {
+      printf("No dependencies found! Remove the bw.* files and try another seed.\n");
+      res = -1;
+    }
+    if (res < 0) { free(tmpDeps); return res; }
+  } else {
+    if (!testMode) printf("Doing block Lanczos...\n");
+    blstart = sTime();
+    res = blockLanczos64(tmpDeps, MultB64, MultB_T64, (void *)M, M->numCols,
+			 testMode);
+    blstop = sTime();
+    printf("Returned %d. Block Lanczos took %1.2lf seconds.\n", res, blstop-blstart);
+    msgLog("", "BLanczosTime: %1.1lf", blstop-blstart);
+  }
   if (res < 0) return res;
 
   /******************************************************/
@@ -102,6 +210,9 @@ int main(int argC, char *args[])
   s32       *deps, origC;
   u32        seed=DEFAULT_SEED;
   long       testMode=0;
+  int        numThreads=1, tiled=0, kernel=TILED_KERNEL_AUTO, speedtest=0;
+  int        bwJob=-1;
+  s32        tileDim=0;
   struct stat fileInfo;
   nfs_sparse_mat_t M;
   llist_t    C;
@@ -128,17 +239,60 @@ int main(int argC, char *args[])
       }
     } else if (strcmp(args[i], "-test")==0) {
       testMode = 1;
+    } else if (strcmp(args[i], "-nt")==0) {
+      if ((++i) < argC) {
+        numThreads = atoi(args[i]);
+      }
+    } else if (strcmp(args[i], "-layout")==0) {
+      if ((++i) < argC) {
+        if (strcmp(args[i], "tiled")==0) tiled = 1;
+        else if (strcmp(args[i], "csc")==0) tiled = 0;
+        else {
+          printf("Unknown layout '%s'!\n", args[i]);
+          exit(-1);
+        }
+      }
+    } else if (strcmp(args[i], "-tile")==0) {
+      if ((++i) < argC) {
+        tileDim = atol(args[i]);
+      }
+    } else if (strcmp(args[i], "-kernel")==0) {
+      if ((++i) < argC) {
+        if (strcmp(args[i], "auto")==0) kernel = TILED_KERNEL_AUTO;
+        else if (strcmp(args[i], "scalar")==0) kernel = TILED_KERNEL_SCALAR;
+        else if (strcmp(args[i], "avx2")==0) kernel = TILED_KERNEL_AVX2;
+        else if (strcmp(args[i], "avx512")==0) kernel = TILED_KERNEL_AVX512;
+        else {
+          printf("Unknown kernel '%s'!\n", args[i]);
+          exit(-1);
+        }
+      }
+    } else if (strcmp(args[i], "-speedtest")==0) {
+      speedtest = 1;
+    } else if (strcmp(args[i], "-bw")==0) {
+      if ((++i) < argC) {
+        bwSeqs = atoi(args[i]);
+      }
+    } else if (strcmp(args[i], "-bwjob")==0) {
+      if ((++i) < argC) {
+        bwJob = atoi(args[i]);
+      }
     } else if (strcmp(args[i], "--help")==0) {
       printf("USAGE: %s %s\n", args[0], USAGE);
       exit(0);
     }
   }
   srand(seed);
+  bwSeed = seed;
   if (stat("depinf", &fileInfo)) {
     printf("Could not stat depinf! Are you trying to run %s to soon?\n", args[0]);
     return -1;
   }
   seedBlockLanczos(seed);
+  if (numThreads > 1) {
+    numThreads = thr_init(numThreads);
+    printf("Using %d threads.\n", numThreads);
+  }
   startTime = sTime();
   msgLog("", "GGNFS-%s : matsolve (seed=%" PRIu32 ")", GGNFS_VERSION, seed);
   printf("Using PRNG seed=%" PRIu32 ".\n", seed);
@@ -161,6 +315,33 @@ int main(int argC, char *args[])
     printf("checkMat() returned some error! Terminating...\n");
     exit(-1);
   }
+  if (speedtest) {
+    speedTest(&M, tileDim);
+    thr_clear();
+    free(M.cEntry); free(M.cIndex);
+    return 0;
+  }
+  if (tiled) {
+    if ((kernel = tiled_setKernel(kernel)) < 0) {
+      printf("The %s kernel is not supported by this CPU!\n", tiled_kernelName(kernel));
+      exit(-1);
+    }
+    printf("Building the tiled matrix layout..."); fflush(stdout);
+    if (tiled_init(&M, tileDim)) {
+      printf("failed!\n");
+      exit(-1);
+    }
+    printf("done (%" PRId32 " x %" PRId32 " tiles, %s kernel).\n", tiled_dim(), tiled_dim(),
+           tiled_kernelName(kernel));
+  }
+  if (bwJob >= 0) {
+    i = blockWiedemannJob(MultB64, (void *)&M, M.numCols, bwSeqs, bwJob, seed);
+    printf("Total elapsed time: %1.2lf seconds.\n", sTime()-startTime);
+    tiled_clear();
+    thr_clear();
+    free(M.cEntry); free(M.cIndex);
+    return i;
+  }
 
   /* We need to know how many columns there were in the original, unpruned
      matrix, so we know how much memory to allocate for the dependencies.
@@ -207,7 +388,8 @@ int main(int argC, char *args[])
       writeBinField(fp, str);
       fclose(ifp);
       fwrite(deps, sizeof(s32), origC, fp);
-      fclose(fp);
+      if ((fclose(fp) == 0) && (bwSeqs > 0))
+        blockWiedemannClean();
     }
   }
 
@@ -218,6 +400,8 @@ int main(int argC, char *args[])
 
 
 
+  tiled_clear();
+  thr_clear();
   free(M.cEntry); free(M.cIndex); free(deps);
   return 0;
 }  
@@ -27,6 +27,8 @@
 #include <sys/stat.h>
 
 #include "ggnfs.h"
+#include "rellist.h"
+#include "thrpool.h"
 
 #define MAX_IPBSIZE  100
 
@@ -97,6 +99,11 @@ typedef struct {
   s32 e;
 } rat_p_t;
 
+/* Relation files loaded once by msqrtLoadRels(), so that several */
+/* dependencies can be tried without rereading them.              */
+static rel_list **msqrtRL=NULL;
+static int        msqrtRLFiles=0;
+
 
 /* Prototypes for locally used stuff. */
 s32    locateP(s32 p, msqrt_t *M);
@@ -778,22 +785,253 @@ RSQRT_CLEANUP:
   return res;
 }
 
+/*********************************************************************/
+int msqrtLoadRels(multi_file_t *prelF)
+/*********************************************************************/
+/* Load all the relation files in 'prelF' and keep them for later    */
+/* montgomerySqrt() calls (and any process forked after this).       */
+/* Return value: 0 on success, nonzero on error.                     */
+/*********************************************************************/
+{ int i;
+
+  msqrtClearRels();
+  if (!(msqrtRL = (rel_list **)calloc(prelF->numFiles, sizeof(rel_list *)))) {
+    fprintf(stderr, "msqrtLoadRels() memory allocation error!\n");
+    return -1;
+  }
+  for (i=0; i<prelF->numFiles; i++) {
+    if (!(msqrtRL[i] = getRelList(prelF, i))) {
+      fprintf(stderr, "msqrtLoadRels() Error: could not read %s.%d!\n",
+              prelF->prefix, i);
+      msqrtRLFiles = i;
+      msqrtClearRels();
+      return -1;
+    }
+  }
+  msqrtRLFiles = prelF->numFiles;
+  return 0;
+}
+
+/*********************************************************************/
+void msqrtClearRels()
+/*********************************************************************/
+{ int i;
+
+  if (msqrtRL) {
+    for (i=0; i<msqrtRLFiles; i++) {
+      clearRelList(msqrtRL[i]); free(msqrtRL[i]);
+    }
+    free(msqrtRL);
+  }
+  msqrtRL = NULL;
+  msqrtRLFiles = 0;
+}
+
+/*********************************************************************/
+static rel_list *depRelList(multi_file_t *prelF, int fileNum)
+/*********************************************************************/
+/* The relation list of file 'fileNum': the preloaded one, if there  */
+/* is one, or else it is read now.                                   */
+/*********************************************************************/
+{ 
+  if (fileNum < msqrtRLFiles)
+    return msqrtRL[fileNum];
+  return getRelList(prelF, fileNum);
+}
+
+/*********************************************************************/
+static void releaseDepRelList(rel_list *RL)
+/*********************************************************************/
+{ int i;
+
+  for (i=0; i<msqrtRLFiles; i++)
+    if (msqrtRL[i] == RL)
+      return;
+  clearRelList(RL); free(RL);
+}
+
+/*********************************************************************/
+/* The initial CRT residues are those of the product of the (a,b)    */
+/* pairs in the dependency, each contributing                        */
+/*   ((c_d*a + b*bmultiplier*omega_1)/c_d)^e,  e = +/-1.             */
+/* Rather than updating the residues one pair at a time (with a      */
+/* polynomial inverse mod q for every pair with e = -1), each thread */
+/* of the pool multiplies up its share of the pairs mod (T, q_j),    */
+/* separately for e = 1 and e = -1. The partial products are then    */
+/* combined, so only one inverse per q_j is needed.                  */
+/*********************************************************************/
+typedef struct {
+  s64 a, b;
+  s32 e;
+} crt_ab_t;
+
+typedef struct {
+  msqrt_t      *M;
+  crt_ab_t     *ab;
+  s32           numAB;
+  __mpz_struct *w0, *w1; /* c_d*W[k][0], bmultiplier*W[k][1] mod q_j, at [j*d+k]. */
+  mpz_poly_t   *num, *den; /* Partial products, at [thread*ipbSize + j].       */
+} crt_prod_t;
+
+/*********************************************************************/
+static void crtMulMod(mpz_poly res, mpz_poly op1, mpz_poly op2, mpz_poly T,
+                      mpz_t q, __mpz_struct *prod)
+/*********************************************************************/
+/* res <-- op1*op2 mod (T, q), for monic T. Unlike                   */
+/* mpz_poly_mulmod_pp(), this is reentrant: 'prod' is scratch space  */
+/* for 2*MAXPOLYDEGREE initialized mpz_t's. res may be op1 or op2.   */
+/*********************************************************************/
+{ int i, j, d=T->degree, n=op1->degree + op2->degree;
+
+  for (i=0; i<=n; i++)
+    mpz_set_ui(&prod[i], 0);
+  for (i=0; i<=op1->degree; i++)
+    for (j=0; j<=op2->degree; j++)
+      mpz_addmul(&prod[i+j], &op1->coef[i], &op2->coef[j]);
+  /* x^d = -(T_0 + T_1*x + ... + T_{d-1}*x^{d-1}). */
+  for (i=n; i>=d; i--) {
+    mpz_mod(&prod[i], &prod[i], q);
+    if (mpz_sgn(&prod[i]))
+      for (j=0; j<d; j++)
+        mpz_submul(&prod[i-d+j], &prod[i], &T->coef[j]);
+  }
+  for (i=0; i<d; i++) {
+    if (i <= n)
+      mpz_mod(&res->coef[i], &prod[i], q);
+    else
+      mpz_set_ui(&res->coef[i], 0);
+  }
+  res->degree = d-1;
+  mpz_poly_fixDeg(res);
+}
+
+/*********************************************************************/
+static void crtProdJob(void *arg, int thread, int numThreads)
+/*********************************************************************/
+{ crt_prod_t  *P = (crt_prod_t *)arg;
+  msqrt_t     *M = P->M;
+  s32          lo, hi, r;
+  int          j, k, d=M->N->degree;
+  __mpz_struct prod[2*MAXPOLYDEGREE];
+  mpz_t        a, b;
+  mpz_poly     x;
+  mpz_poly_t  *acc;
+
+  thr_range(&lo, &hi, P->numAB, thread, numThreads);
+  for (k=0; k<2*MAXPOLYDEGREE; k++)
+    mpz_init(&prod[k]);
+  mpz_init(a); mpz_init(b);
+  mpz_poly_init(x);
+  for (j=0; j<M->ipbSize; j++) {
+    for (r=lo; r<hi; r++) {
+      mpz_set_si64(a, P->ab[r].a);
+      mpz_set_si64(b, P->ab[r].b);
+      /* x <-- (c_d*a + b*bmultiplier*omega_1) in the \hat{\alpha} basis. */
+      for (k=0; k<d; k++) {
+        mpz_mul(&x->coef[k], a, &P->w0[j*d+k]);
+        mpz_addmul(&x->coef[k], b, &P->w1[j*d+k]);
+        mpz_mod(&x->coef[k], &x->coef[k], &M->q[j]);
+      }
+      x->degree = d-1;
+      mpz_poly_fixDeg(x);
+      acc = (P->ab[r].e > 0) ? &P->num[thread*M->ipbSize + j] : &P->den[thread*M->ipbSize + j];
+      crtMulMod(acc, acc, x, M->N->T, &M->q[j], prod);
+    }
+  }
+  mpz_poly_clear(x);
+  mpz_clear(a); mpz_clear(b);
+  for (k=0; k<2*MAXPOLYDEGREE; k++)
+    mpz_clear(&prod[k]);
+}
+
+/*********************************************************************/
+int crtProducts(msqrt_t *M, crt_ab_t *ab, s32 numAB, mpz_t cd, mpz_t bmultiplier)
+/*********************************************************************/
+/* Multiply the CRT residues by the product of the numAB pairs 'ab', */
+/* as described above. Return value: 0 on success.                  */
+/*********************************************************************/
+{ crt_prod_t P;
+  int        i, j, k, t, d=M->N->degree, numThreads=thr_numThreads();
+  s32        netExp;
+  mpz_poly   tpol1;
+  mpz_t      c, e;
+
+  P.M = M; P.ab = ab; P.numAB = numAB;
+  P.w0 = (__mpz_struct *)malloc(M->ipbSize*d*sizeof(__mpz_struct));
+  P.w1 = (__mpz_struct *)malloc(M->ipbSize*d*sizeof(__mpz_struct));
+  P.num = (mpz_poly_t *)malloc(numThreads*M->ipbSize*sizeof(mpz_poly_t));
+  P.den = (mpz_poly_t *)malloc(numThreads*M->ipbSize*sizeof(mpz_poly_t));
+  if (!(P.w0 && P.w1 && P.num && P.den)) {
+    fprintf(stderr, "crtProducts() memory allocation error!\n");
+    free(P.w0); free(P.w1); free(P.num); free(P.den);
+    return -1;
+  }
+  for (j=0; j<M->ipbSize; j++) {
+    for (k=0; k<d; k++) {
+      mpz_init(&P.w0[j*d+k]); mpz_init(&P.w1[j*d+k]);
+      mpz_mul(&P.w0[j*d+k], &M->N->W->entry[k][0], cd);
+      mpz_mod(&P.w0[j*d+k], &P.w0[j*d+k], &M->q[j]);
+      mpz_mul(&P.w1[j*d+k], &M->N->W->entry[k][1], bmultiplier);
+      mpz_mod(&P.w1[j*d+k], &P.w1[j*d+k], &M->q[j]);
+    }
+  }
+  for (i=0; i<numThreads*M->ipbSize; i++) {
+    mpz_poly_init(&P.num[i]); mpz_poly_init(&P.den[i]);
+    mpz_set_ui(&P.num[i].coef[0], 1); P.num[i].degree = 0;
+    mpz_set_ui(&P.den[i].coef[0], 1); P.den[i].degree = 0;
+  }
+
+  thr_run(crtProdJob, &P);
+
+  /* Each pair also has the denominator W_d*c_d, to the power -e. */
+  for (i=0, netExp=0; i<numAB; i++)
+    netExp -= ab[i].e;
+  mpz_poly_init(tpol1);
+  mpz_init(c); mpz_init_set_si(e, netExp);
+  for (j=0; j<M->ipbSize; j++) {
+    for (t=1; t<numThreads; t++) {
+      mpz_poly_mulmod_pp(&P.num[j], &P.num[j], &P.num[t*M->ipbSize + j], M->N->T, &M->q[j]);
+      mpz_poly_mulmod_pp(&P.den[j], &P.den[j], &P.den[t*M->ipbSize + j], M->N->T, &M->q[j]);
+    }
+    mpz_poly_inv(tpol1, &P.den[j], M->N->T, &M->q[j]);
+    mpz_poly_mulmod_pp(&P.num[j], &P.num[j], tpol1, M->N->T, &M->q[j]);
+    mpz_mul(c, M->N->W_d, cd);
+    mpz_powm(c, c, e, &M->q[j]);
+    for (i=0; i<=P.num[j].degree; i++) {
+      mpz_mul(&P.num[j].coef[i], &P.num[j].coef[i], c);
+      mpz_mod(&P.num[j].coef[i], &P.num[j].coef[i], &M->q[j]);
+    }
+    mpz_poly_mulmod_pp(M->crtRes[j], M->crtRes[j], &P.num[j], M->N->T, &M->q[j]);
+  }
+  mpz_clear(c); mpz_clear(e);
+  mpz_poly_clear(tpol1);
+
+  for (i=0; i<numThreads*M->ipbSize; i++) {
+    mpz_poly_clear(&P.num[i]); mpz_poly_clear(&P.den[i]);
+  }
+  for (i=0; i<M->ipbSize*d; i++) {
+    mpz_clear(&P.w0[i]); mpz_clear(&P.w1[i]);
+  }
+  free(P.w0); free(P.w1); free(P.num); free(P.den);
+  return 0;
+}
+
 /*********************************************************************/
 int initMsqrt(msqrt_t *M,  s32 *relsInDep, multi_file_t *prelF, multi_file_t *lpF)
 /*********************************************************************/
 /* M->N and M->FB must already be set.                               */
 /*********************************************************************/
-{ s32        i, j, k, depSize, R0, R1, Rindex;
+{ s32        i, j, k, depSize, R0, R1;
   s64        a, b, rel;
   int         d=M->N->degree, e, fileNum;
   double      xr, xi, zr, zi, zpr, zpi, tr, ti, c;
   mpz_t       cd, tmp, Zsquare, tmp2, tmp3, bmultiplier;
-  mpz_poly    tpol1;
   mpz_mat_t   H;
-  char        fName[64], str[256];
+  char        fName[sizeof(prelF->prefix) + 16], str[256];
   relation_t  R;
-  FILE       *fp;
+  rel_list   *RL;
   s32        numPairs;
+  crt_ab_t   *crtAB;
 #ifdef _LOUD_DEBUG
   FILE *ofp;
 #endif
@@ -805,7 +1043,6 @@ ABexponentSum=0;
   for (i=0; i<MAX_DIST_FACTS; i++)
     mpz_init(&M->Cd.p[i]);
   mpz_init(tmp); mpz_init(bmultiplier);
-  mpz_poly_init(tpol1);
   mpz_mat_init2(&H, d, d);
   mpz_mat_init2(&M->Beta, d, d);
 
@@ -933,38 +1170,41 @@ ABexponentSum=0;
 
   printf("Reading relations and computing initial <gamma> factorization...\n");
   printf("depSize = %" PRId32 ".\n", depSize);
-  /* Prime the loop by opening the first relation file. */
-  sprintf(fName, "%s.0", prelF->prefix);
-  if (!(fp = fopen(fName, "rb"))) {
+  /* Prime the loop by mapping the first relation file. */
+  fileNum = 0;
+  snprintf(fName, sizeof(fName), "%s.%d", prelF->prefix, fileNum);
+  if (!(RL = depRelList(prelF, fileNum))) {
     fprintf(stderr, "initMsqrt() Fatal error: could not open %s for read!\n", fName);
     exit(-1);
   }
   printf("Reading relations from %s...\n", fName);
   R0 = 0;
-  readRaw32(&R1, fp);
-  Rindex = 0; fileNum = 0;
+  R1 = RL->numRels;
   e=-1;
   /* Throughout this loop: the current file has relations [R0, R1). */
-  /* The relation fp is currently looking at is Rindex.             */
+  /* The relations in a dependency are in increasing order.         */
   mpz_set_ui(Zsquare, 1); numPairs = 0;
+  if (!(crtAB = (crt_ab_t *)malloc((depSize+1)*sizeof(crt_ab_t)))) {
+    fprintf(stderr, "initMsqrt() memory allocation error for crtAB!\n");
+    return -1;
+  }
   for (i=0; i<depSize; i++) {
     rel = relsInDep[i];
-    while (Rindex <= rel) {
-      if (rel >= R1) {
-        fclose(fp); fileNum++;
-        sprintf(fName, "%s.%d", prelF->prefix, fileNum);
-        if (!(fp = fopen(fName, "rb"))) {
-          fprintf(stderr, "initMsqrt() Fatal error: could not open %s for read!\n", fName);
-          exit(-1);
-        }
-        printf("Reading relations from %s...\n", fName);
-        R0 = R1;
-        readRaw32(&R1, fp); R1 += R0;
-        Rindex = R0;
-      }
-      if (readRel(&R, fp)==0) {
-        Rindex++;
+    while (rel >= R1) {
+      releaseDepRelList(RL);
+      fileNum++;
+      snprintf(fName, sizeof(fName), "%s.%d", prelF->prefix, fileNum);
+      if (!(RL = depRelList(prelF, fileNum))) {
+        fprintf(stderr, "initMsqrt() Fatal error: could not open %s for read!\n", fName);
+        exit(-1);
       }
+      printf("Reading relations from %s...\n", fName);
+      R0 = R1;
+      R1 += RL->numRels;
+    }
+    if ((rel < R0) || (dataConvertToRel(&R, &RL->relData[RL->relIndex[rel-R0]]) <= 0)) {
+      fprintf(stderr, "initMsqrt() Fatal error: could not get relation %" PRId64 "!\n", rel);
+      exit(-1);
     }
     /* Finally, 'R' should have the proper relation. */
     a = R.a; b = -R.b;
@@ -1005,27 +1245,20 @@ ABexponentSum=0;
 #endif
 
 
-    /***********************************************************/
-    /* tpol1 must be given with respect to the integral basis: */
-    /* tpol1 <-- (a+b\alpha) = (c_d*a + b*\hat{alpha})/c_d     */
-    /*                       = c_d*a + b*bmultiplier* omega_1  */
-    /***********************************************************/
-    mpz_set_si64(&tpol1->coef[0], a); 
-    mpz_mul(&tpol1->coef[0], &tpol1->coef[0], cd);
-    mpz_set_si64(&tpol1->coef[1], b);
-    mpz_mul(&tpol1->coef[1], &tpol1->coef[1], bmultiplier);
-    tpol1->degree = 1;
 //    e *= -1;
     /* Choose the exponent for this (a,b) pair, using a greedy strategy. */
     e = choose_ab_exponent(M, &R);
 ABexponentSum += e;
 
     updateEps_ab(M, a, -b, e); 
-    updateCRT(M, tpol1, cd, e);
+    /* The CRT residues are done below, for all the pairs at once. */
+    crtAB[numPairs-1].a = a; crtAB[numPairs-1].b = b; crtAB[numPairs-1].e = e;
     updateFactorization_ab(M, &R, e);
     /* Update the rational square root info. */
-    if (ratSqrt(&R, e, depSize, M))
+    if (ratSqrt(&R, e, depSize, M)) {
+      free(crtAB);
       return -1;
+    }
  
     /* Keep track of what the final square should be. */
 #if 1
@@ -1055,7 +1288,13 @@ mpz_abs(tmp, tmp);
   printf("The final square should be: ");
   mpz_out_str(stdout, 10, Zsquare);
   printf("\nWe used %" PRId32 " (a,b) pairs.\n", numPairs);
-  if (Rindex < R1) fclose(fp);
+  releaseDepRelList(RL);
+  printf("Computing the CRT residues of <gamma> (%d threads)...\n", thr_numThreads());
+  if (crtProducts(M, crtAB, numPairs, cd, bmultiplier)) {
+    free(crtAB);
+    return -1;
+  }
+  free(crtAB);
   i=M->aSize-1;
   while ((i>=0) && (M->aExp[i]==0))
     i--;
@@ -1133,7 +1372,6 @@ mpz_abs(tmp, tmp);
 
   mpz_clear(Zsquare); mpz_clear(tmp2);
   mpz_clear(cd); mpz_clear(tmp); mpz_clear(bmultiplier);
-  mpz_poly_clear(tpol1);
   mpz_mat_clear(&H);
 
   return 0;
@@ -1,6 +1,9 @@
 /**************************************************************/
-/* mpi-matolve.c                                              */
+/* mpi-matsolve.c                                             */
 /* Copyright 2004, Chris Monico.                              */
+/* MPI version of matsolve: the matrix written by matprune is */
+/* split in 2D over a pr x pc grid of ranks, and the block    */
+/* Lanczos iteration runs on the distributed pieces.          */
 /**************************************************************/
 /*  This file is part of GGNFS.
 *
@@ -19,609 +22,986 @@
 *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+/*
+   Layout. Rank (i,j) = i*pc + j of the grid holds the block B_ij of
+   the sparse part of the matrix, made of the rows R_i and the columns
+   C_j. The row and column ranges are chosen so that the blocks have
+   about the same weight. Entries of the dense rows are kept apart:
+   every rank holds the dense blocks for the i-th of pr slices of C_j,
+   so that the slices of all ranks cover the columns exactly once.
+
+   A vector indexed by columns (the Lanczos vectors) is split by C_j
+   and each rank holds the piece for its own C_j. A vector indexed by
+   rows holds the piece for R_i, followed by the 64*numDenseBlocks
+   words of the dense rows, which every rank knows in full.
+
+   y = Bx is then a local multiply, an XOR-reduction of the R_i piece
+   across the row of the grid, and one of the dense rows across all
+   ranks. z = (B^T)y is a local multiply and an XOR-reduction of the
+   C_j piece down the column of the grid. All reductions are
+   nonblocking and overlap the local work.
+
+   Only rank 0 reads or writes anything other than the matrix: the
+   checkpoints are gathered to rank 0 and written by matsave.c in the
+   same format as matsolve's, so a run can be resumed by matsolve or
+   by mpi-matsolve on any number of ranks.
+*/
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <signal.h>
+#include <sys/types.h>
 #include <sys/stat.h>
-#include "mpi.h"
-
+#include <mpi.h>
 
-#ifndef _MSC_VER 
-#include <sys/time.h>
-#endif
+#include "if.h"
 #include "ggnfs.h"
+#include "prand.h"
 
 #define DEFAULT_SEED 1
 #define DEFAULT_DEPNAME "deps"
-#define DEFAULT_COLNAME "cols"
-#define DEFAULT_WT_FACTOR 0.7
-
-#ifdef MPI_MATSOLVE
-#define WORKTAG 1
-#define DIETAG  2
-#endif
 
+/* Number of matrix entries read from spmat at a time. */
+#define DM_READ_CHUNK (1<<20)
 
 #define USAGE "[OPTIONS]\n"\
 "-v           : verbose.\n"\
-"-wt <float>  : Weight factor (for pruning; higher means matrix\n"\
-"               should be kept as sparse as possible, while lower\n"\
-"               means to shrink the matrix dimensions as much as possible.\n"\
 "-seed <int>  : Set the seed for the PRNG.\n"\
+"-save <int>  : Interval (in minutes) between save files.\n"\
+"-grid <r>x<c>: Use an r x c grid of ranks (default: as square as possible).\n"\
+"-test        : Do not solve matrix; use it to test multiply operations.\n"\
 "--help       : Show this help and quit.\n"
 
 #define START_MSG \
 "\n"\
 " __________________________________________________________ \n"\
-"|        This is the matsolve program for GGNFS.           |\n"\
+"|      This is the mpi-matsolve program for GGNFS.         |\n"\
 "| Version: %-25s                       |\n"\
 "| This program is copyright 2004, Chris Monico, and subject|\n"\
 "| to the terms of the GNU General Public License version 2.|\n"\
 "|__________________________________________________________|\n"
 
+/* These are in blanczos64.c/blanczos64-no-mmx.c. */
+void multT(u64 *res, u64 *A, u64 *B, s32 n);
+void multS(u64 *D, int *S);
+void mult64x64(u64 *res, u64 *A, u64 *B);
+void preMult(u64 *A, u64 *B);
+void multnx64(u64 *C_n, u64 *A_n, u64 *B, s32 n);
+void addmultnx64(u64 *C_n, u64 *A_n, u64 *B, s32 n);
+void getW_S(u64 *Wi, int *Si, u64 *T, int *Si_1);
+int  isZeroV(u64 *A, s32 size);
+int  doColumnOps(u64 *A, u64 *B, s32 n);
+int  doColumnOps64(u64 *A, u64 *B, s32 n);
 
-/***********************************************************/
-/* This structure is for columns that are being processed. */
-/* Before processing, we know only the relations that      */
-/* comprise each column. After processing, we know all the */
-/* nonzero rows of the matrix (i.e., the primes appearing  */
-/* with odd exponent and the QCB values and sign value).   */
-/* During processing, we will know some of each. That is,  */
-/* we might have already replaced some relations with their*/
-/* factorizations, but not yet all of them. These data are */
-/* what will be stored in the file cols.np.                */
-/***********************************************************/
 typedef struct {
-  s32 numRels;
-  s32 numPrimes;
-  s32 Rels[MAX_RELS_IN_FF];
-  s32 QCB[2];
-  char sign;
-  s32 rows[MAX_ROWS_IN_COL];
-} column_t;
-
-
-
-
-/***** Globals *****/
-int verbose=0;
-
-/******************************************************/
-void writeColIndex(FILE *fp, column_t *C)
-/******************************************************/
-/* This is the indicies of the relations contributing */
-/* to the column. We don't care about anything else.  */
-/******************************************************/
-{ 
-  fwrite(&C->numRels, sizeof(s32), 1, fp);
-  if (C->numRels > 0)
-    fwrite(&C->Rels, sizeof(s32), C->numRels, fp);
-}
-/******************************************************/
-void readColIndex(column_t *C, FILE *fp)
-/******************************************************/
-/* This is the indicies of the relations contributing */
-/* to the column. We don't care about anything else.  */
-/******************************************************/
-{ 
-  fread(&C->numRels, sizeof(s32), 1, fp);
-  if (C->numRels > 0)
-    fread(&C->Rels, sizeof(s32), C->numRels, fp);
+  int  rank, size;
+  int  pr, pc, row, col;      /* Grid shape and our place in it. */
+  MPI_Comm rowComm, colComm;  /* The ranks in our grid row/column. */
+  s32  numRows, numCols, numDenseBlocks;
+  s32  denseBlockIndex[MAX_DENSE_BLOCKS];
+  s32 *rowStart, *colStart;   /* Row/column ranges of the grid.   */
+  s32  r0, nr, c0, nc;        /* Our rows R_i and columns C_j.    */
+  s32  s0, ns;                /* Our slice of C_j.                */
+  s32  t0, nt;                /* Our slice of R_i (for testing).  */
+  s32 *cIndex, *cEntry;       /* B_ij, relative to (r0, c0).      */
+  u64 *denseBlocks[MAX_DENSE_BLOCKS]; /* For columns s0,...,s0+ns-1. */
+  u64 *rbuf, *cbuf, *dbuf;    /* Partial products.                */
+} dmat_t;
+
+/*********************************************************************/
+static void dm_handle_signal(int signum)
+/*********************************************************************/
+{
+  if ((signum == SIGINT) || (signum == SIGTERM))
+    matsave_interval = -1;
 }
 
-/******************************************************/
-void writeColLF(FILE *fp, column_t *C)
-/******************************************************/
-{ 
-  fwrite(&C->numRels, sizeof(s32), 1, fp);
-  fwrite(&C->numPrimes, sizeof(s32), 1, fp);
-  if (C->numRels > 0)
-    fwrite(&C->Rels, sizeof(s32), C->numRels, fp);
-  fwrite(&C->QCB, sizeof(s32), 2, fp);
-  fwrite(&C->rows, sizeof(s32), C->numPrimes, fp);
+/*********************************************************************/
+static void dm_setGrid(dmat_t *D, int pr, int pc)
+/*********************************************************************/
+{
+  if (pr*pc != D->size) {
+    for (pr=1; (pr+1)*(pr+1) <= D->size; pr++) ;
+    while (D->size % pr) pr--;
+    pc = D->size/pr;
+  }
+  D->pr = pr; D->pc = pc;
+  D->row = D->rank / pc;
+  D->col = D->rank % pc;
+  MPI_Comm_split(MPI_COMM_WORLD, D->row, D->col, &D->rowComm);
+  MPI_Comm_split(MPI_COMM_WORLD, D->col, D->row, &D->colComm);
 }
 
-/******************************************************/
-int readColLF(column_t *C, FILE *fp)
-/******************************************************/
-{ 
-  fread(&C->numRels, sizeof(s32), 1, fp);
-  fread(&C->numPrimes, sizeof(s32), 1, fp);
-  if (C->numRels > 0)
-    fread(&C->Rels, sizeof(s32), C->numRels, fp);
-  fread(&C->QCB, sizeof(s32), 2, fp);
-  if (feof(fp)) return -1;
-  fread(&C->rows, sizeof(s32), C->numPrimes, fp);
+/*********************************************************************/
+static int dm_load(dmat_t *D, char *fname)
+/*********************************************************************/
+/* Every rank reads the header and the column index of 'fname', and  */
+/* then only the entries of its own columns.                         */
+/*********************************************************************/
+{ FILE  *fp;
+  s32    hdr[4], *cIndex, *rowWt, *buf, c, r, k, m, cnt, size;
+  s32    pos, end;
+  off_t  entOfs, denseOfs;
+  char  *denseMap;
+  s64    tot, acc;
+  int    i, j;
+
+  if (!(fp = fopen(fname, "rb"))) {
+    fprintf(stderr, "dm_load(): Could not open %s for read!\n", fname);
+    return -1;
+  }
+  if ((fread(hdr, sizeof(s32), 4, fp) != 4) ||
+      (hdr[3] < 0) || (hdr[3] > MAX_DENSE_BLOCKS)) {
+    fprintf(stderr, "dm_load(): %s is corrupt!\n", fname);
+    fclose(fp); return -1;
+  }
+  D->numRows = hdr[0];
+  D->numCols = hdr[1];
+  D->numDenseBlocks = hdr[3];
+  fread(D->denseBlockIndex, sizeof(s32), D->numDenseBlocks, fp);
+  cIndex = (s32 *)lxmalloc((D->numCols+1)*sizeof(s32), 1);
+  fread(cIndex, sizeof(s32), D->numCols+1, fp);
+  entOfs = (off_t)(4 + D->numDenseBlocks + D->numCols + 1)*sizeof(s32);
+  denseOfs = entOfs + (off_t)cIndex[D->numCols]*sizeof(s32);
+
+  /* Columns: split by weight. */
+  D->colStart = (s32 *)lxmalloc((D->pc+1)*sizeof(s32), 1);
+  D->rowStart = (s32 *)lxmalloc((D->pr+1)*sizeof(s32), 1);
+  tot = (s64)cIndex[D->numCols] + D->numCols;
+  D->colStart[0] = 0;
+  for (j=1, c=0; j<D->pc; j++) {
+    while ((c < D->numCols) && (((s64)cIndex[c]+c)*D->pc < tot*j))
+      c++;
+    D->colStart[j] = c;
+  }
+  D->colStart[D->pc] = D->numCols;
+  D->c0 = D->colStart[D->col];
+  D->nc = D->colStart[D->col+1] - D->c0;
+  D->s0 = D->c0 + (s32)(((s64)D->nc*D->row)/D->pr);
+  D->ns = D->c0 + (s32)(((s64)D->nc*(D->row+1))/D->pr) - D->s0;
+
+  denseMap = (char *)lxmalloc(D->numRows, 1);
+  memset(denseMap, 0, D->numRows);
+  for (k=0; k<D->numDenseBlocks; k++) {
+    for (r=D->denseBlockIndex[k]; (r < D->denseBlockIndex[k]+64) && (r < D->numRows); r++)
+      denseMap[r] = (char)(k+1);
+    D->denseBlocks[k] = (u64 *)lxmalloc((D->ns+1)*sizeof(u64), 1);
+    fseeko(fp, denseOfs + ((off_t)k*D->numCols + D->s0)*sizeof(u64), SEEK_SET);
+    if ((s32)fread(D->denseBlocks[k], sizeof(u64), D->ns, fp) != D->ns) {
+      fprintf(stderr, "dm_load(): %s is truncated!\n", fname);
+      fclose(fp); return -1;
+    }
+  }
+
+  /* Rows: split by weight. The weights are counted by every rank */
+  /* over its slice of columns, and summed.                       */
+  buf = (s32 *)lxmalloc(DM_READ_CHUNK*sizeof(s32), 1);
+  rowWt = (s32 *)lxmalloc(D->numRows*sizeof(s32), 1);
+  memset(rowWt, 0, D->numRows*sizeof(s32));
+  pos = cIndex[D->s0]; end = cIndex[D->s0 + D->ns];
+  fseeko(fp, entOfs + (off_t)pos*sizeof(s32), SEEK_SET);
+  while (pos < end) {
+    cnt = MIN(DM_READ_CHUNK, end-pos);
+    if ((s32)fread(buf, sizeof(s32), cnt, fp) != cnt) {
+      fprintf(stderr, "dm_load(): %s is truncated!\n", fname);
+      fclose(fp); return -1;
+    }
+    for (k=0; k<cnt; k++)
+      rowWt[buf[k]]++;
+    pos += cnt;
+  }
+  MPI_Allreduce(MPI_IN_PLACE, rowWt, D->numRows, MPI_INT32_T, MPI_SUM, MPI_COMM_WORLD);
+  for (r=0, tot=0; r<D->numRows; r++)
+    if (!denseMap[r])
+      tot += rowWt[r] + 1;
+  D->rowStart[0] = 0;
+  for (i=1, r=0, acc=0; i<D->pr; i++) {
+    while ((r < D->numRows) && (acc*D->pr < tot*i)) {
+      if (!denseMap[r]) acc += rowWt[r] + 1;
+      r++;
+    }
+    D->rowStart[i] = r;
+  }
+  D->rowStart[D->pr] = D->numRows;
+  free(rowWt);
+  D->r0 = D->rowStart[D->row];
+  D->nr = D->rowStart[D->row+1] - D->r0;
+  D->t0 = D->r0 + (s32)(((s64)D->nr*D->col)/D->pc);
+  D->nt = D->r0 + (s32)(((s64)D->nr*(D->col+1))/D->pc) - D->t0;
+
+  /* Now read our columns again, keeping the entries in our rows.  */
+  /* Any entries in the dense rows are folded into the dense blocks.*/
+  D->cIndex = (s32 *)lxmalloc((D->nc+1)*sizeof(s32), 1);
+  size = MAX(1024, (s32)(((s64)(cIndex[D->c0+D->nc]-cIndex[D->c0])*11)/(10*D->pr)));
+  D->cEntry = (s32 *)lxmalloc(size*sizeof(s32), 1);
+  pos = cIndex[D->c0]; end = cIndex[D->c0 + D->nc];
+  fseeko(fp, entOfs + (off_t)pos*sizeof(s32), SEEK_SET);
+  c = D->c0; m = 0;
+  D->cIndex[0] = 0;
+  while (pos < end) {
+    cnt = MIN(DM_READ_CHUNK, end-pos);
+    if ((s32)fread(buf, sizeof(s32), cnt, fp) != cnt) {
+      fprintf(stderr, "dm_load(): %s is truncated!\n", fname);
+      fclose(fp); return -1;
+    }
+    for (k=0; k<cnt; k++, pos++) {
+      while (cIndex[c+1] <= pos) {
+        D->cIndex[c - D->c0 + 1] = m;
+        c++;
+      }
+      r = buf[k];
+      if (denseMap[r]) {
+        if ((c >= D->s0) && (c < D->s0 + D->ns)) {
+          i = denseMap[r]-1;
+          D->denseBlocks[i][c - D->s0] ^= BIT64(r - D->denseBlockIndex[i]);
+        }
+      } else if ((r >= D->r0) && (r < D->r0 + D->nr)) {
+        if (m >= size) {
+          size += size/2;
+          D->cEntry = (s32 *)realloc(D->cEntry, size*sizeof(s32));
+          if (D->cEntry == NULL) {
+            fprintf(stderr, "dm_load(): Memory allocation error!\n");
+            fclose(fp); return -1;
+          }
+        }
+        D->cEntry[m++] = r - D->r0;
+      }
+    }
+  }
+  while (c < D->c0 + D->nc) {
+    D->cIndex[c - D->c0 + 1] = m;
+    c++;
+  }
+  fclose(fp);
+  free(buf); free(denseMap); free(cIndex);
+
+  D->rbuf = (u64 *)lxmalloc((D->nr+1)*sizeof(u64), 1);
+  D->cbuf = (u64 *)lxmalloc((D->nc+1)*sizeof(u64), 1);
+  D->dbuf = (u64 *)lxmalloc((64*D->numDenseBlocks+1)*sizeof(u64), 1);
   return 0;
 }
 
-/******************************************************/
-void writeColSF(FILE *fp, column_t *C)
-/******************************************************/
-/* For these, all we care about is the prime-indexing */
-/* fields and nothing else.                           */
-/******************************************************/
-{ 
-  fwrite(&C->numPrimes, sizeof(s32), 1, fp);
-  fwrite(&C->QCB, sizeof(s32), 2, fp);
-  fwrite(&C->rows, sizeof(s32), C->numPrimes, fp);
+/*********************************************************************/
+static void dm_clear(dmat_t *D)
+/*********************************************************************/
+{ int k;
+
+  for (k=0; k<D->numDenseBlocks; k++)
+    free(D->denseBlocks[k]);
+  free(D->cIndex); free(D->cEntry);
+  free(D->rbuf); free(D->cbuf); free(D->dbuf);
+  free(D->rowStart); free(D->colStart);
+  MPI_Comm_free(&D->rowComm);
+  MPI_Comm_free(&D->colComm);
 }
 
-/******************************************************/
-void readColSF(column_t *C, FILE *fp)
-/******************************************************/
-{ 
-  fread(&C->numPrimes, sizeof(s32), 1, fp);
-  fread(&C->QCB, sizeof(s32), 2, fp);
-  if (C->numPrimes < MAX_ROWS_IN_COL) 
-    fread(&C->rows, sizeof(s32), C->numPrimes, fp);
-  else {
-    printf("readColSF() : MAX_ROWS_IN_COL exceeded! Cannot continue!\n");
-    exit(-1);
+/*********************************************************************/
+static void dm_MultB(dmat_t *D, u64 *y, u64 *x)
+/*********************************************************************/
+/* y <-- Bx, for a column vector piece x and a row vector piece y.   */
+/*********************************************************************/
+{ MPI_Request req[2];
+  u64 *p = D->rbuf, t;
+  s32  c, k, *e, *s;
+
+  memset(p, 0, D->nr*sizeof(u64));
+  e = D->cEntry;
+  for (c=0; c<D->nc; c++) {
+    t = x[c];
+    s = D->cEntry + D->cIndex[c+1];
+    for (; e < s; e++)
+      p[*e] ^= t;
   }
+  MPI_Iallreduce(p, y, D->nr, MPI_UINT64_T, MPI_BXOR, D->rowComm, &req[0]);
+  for (k=0; k<D->numDenseBlocks; k++)
+    multT(D->dbuf + 64*k, D->denseBlocks[k], x + D->s0 - D->c0, D->ns);
+  MPI_Iallreduce(D->dbuf, y + D->nr, 64*D->numDenseBlocks, MPI_UINT64_T,
+                 MPI_BXOR, MPI_COMM_WORLD, &req[1]);
+  MPI_Waitall(2, req, MPI_STATUSES_IGNORE);
 }
 
-/*********************************************************/
-int cmp2L1(const void *a, const void *b)
-/*********************************************************/
-{ s32 *A=(s32 *)a, *B=(s32 *)b;
+/*********************************************************************/
+static void dm_MultB_T(dmat_t *D, u64 *x, u64 *y)
+/*********************************************************************/
+/* x <-- (B^T)y, for a row vector piece y and a column vector piece  */
+/* x. The columns are done in two halves, so that the reduction of   */
+/* the first half runs while the second one is being computed.       */
+/*********************************************************************/
+{ MPI_Request req[2];
+  u64 *p = D->cbuf, t;
+  s32  c, k, h, *e, *s;
+
+  memset(p, 0, D->nc*sizeof(u64));
+  for (k=0; k<D->numDenseBlocks; k++)
+    addmultnx64(p + D->s0 - D->c0, D->denseBlocks[k], y + D->nr + 64*k, D->ns);
+  h = D->nc/2;
+  e = D->cEntry;
+  for (c=0; c<D->nc; c++) {
+    t = p[c];
+    s = D->cEntry + D->cIndex[c+1];
+    for (; e < s; e++)
+      t ^= y[*e];
+    p[c] = t;
+    if (c+1 == h)
+      MPI_Iallreduce(p, x, h, MPI_UINT64_T, MPI_BXOR, D->colComm, &req[0]);
+  }
+  if (h == 0)
+    MPI_Iallreduce(p, x, 0, MPI_UINT64_T, MPI_BXOR, D->colComm, &req[0]);
+  MPI_Iallreduce(p + h, x + h, D->nc - h, MPI_UINT64_T, MPI_BXOR,
+                 D->colComm, &req[1]);
+  MPI_Waitall(2, req, MPI_STATUSES_IGNORE);
+}
 
-  if (A[0] < B[0]) return -1;
-  if (A[1] > B[1]) return 1;
-  return 0;
+/*********************************************************************/
+static void dm_MultA(dmat_t *D, u64 *x, u64 *y, u64 *tmp)
+/*********************************************************************/
+/* x <-- (B^T)By. 'tmp' is a row vector piece.                       */
+/*********************************************************************/
+{
+  dm_MultB(D, tmp, y);
+  dm_MultB_T(D, x, tmp);
 }
 
-/*********************************************************/
-int colsAreEqual(nfs_sparse_mat_t *M, s32 c0, s32 c1)
-/*********************************************************/
-{ int i, j, found;
-  s32 w0, w1, e;
-
-  w0 = M->cIndex[c0+1]-M->cIndex[c0];
-  w1 = M->cIndex[c1+1]-M->cIndex[c1];
-  if (w0 != w1) return 0;
-  for (i=M->cIndex[c0]; i<M->cIndex[c0+1]; i++) {
-    e = M->cEntry[i];
-    for (j=M->cIndex[c1], found=0; j<M->cIndex[c1+1]; j++)
-      if (M->cEntry[j]==e) found=1;
-    if (!(found)) return 0;
-  }
-  for (i=2; i<M->numDenseBlocks; i++) {
-    if (M->denseBlocks[i][c0] != M->denseBlocks[i][c1])
-      return 0;
-  }
-  return 1; 
+/*********************************************************************/
+static void dm_multT(dmat_t *D, u64 *c, u64 *a, u64 *b)
+/*********************************************************************/
+/* c <-- (a^T)b for column vector pieces a and b.                    */
+/*********************************************************************/
+{
+  multT(c, a + D->s0 - D->c0, b + D->s0 - D->c0, D->ns);
+  MPI_Allreduce(MPI_IN_PLACE, c, 64, MPI_UINT64_T, MPI_BXOR, MPI_COMM_WORLD);
 }
 
+/*********************************************************************/
+static void dm_multT_rows(dmat_t *D, u64 *c, u64 *a, u64 *b)
+/*********************************************************************/
+/* c <-- (a^T)b for row vector pieces a and b.                       */
+/*********************************************************************/
+{ u64 tmp[64];
+  s32 i;
+
+  multT(c, a + D->t0 - D->r0, b + D->t0 - D->r0, D->nt);
+  if ((D->rank == 0) && D->numDenseBlocks) {
+    multT(tmp, a + D->nr, b + D->nr, 64*D->numDenseBlocks);
+    for (i=0; i<64; i++)
+      c[i] ^= tmp[i];
+  }
+  MPI_Allreduce(MPI_IN_PLACE, c, 64, MPI_UINT64_T, MPI_BXOR, MPI_COMM_WORLD);
+}
 
+/*********************************************************************/
+static int dm_isZero(u64 *a, s32 n)
+/*********************************************************************/
+{ int z = isZeroV(a, n);
 
-/*********************************************************/
-int checkMat(nfs_sparse_mat_t *M)
-/*********************************************************/
-/* Do a sanity check on the matrix: Make sure there are  */
-/* no all zero columns and such.                         */
-/*********************************************************/
-{ s32 c, i, w;
-  int nz, warn=0;
-  s32 *colHash, h, hi;
+  MPI_Allreduce(MPI_IN_PLACE, &z, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  return z;
+}
 
-  if (!(colHash = (s32 *)malloc(2*M->numCols*sizeof(s32)))) {
-    printf("checkMat() Memory allocation error!\n");
-    printf("** Cannot do sanity check on the matrix!\n");
-    return -1;
+/*********************************************************************/
+static void dm_random(u64 *a, s32 offset, s32 n, s32 total)
+/*********************************************************************/
+/* Fill a[0..n-1] with entries offset,...,offset+n-1 of a random     */
+/* vector of length 'total'. Every rank steps through the whole      */
+/* stream, so the vector does not depend on the grid.                */
+/*********************************************************************/
+{ u64 r1, r2;
+  s32 j;
+
+  for (j=0; j<total; j++) {
+    r1 = prand(); r2 = prand();
+    if ((j >= offset) && (j < offset+n))
+      a[j-offset] = r1^(r2<<32);
   }
-  for (c=0; c<M->numCols; c++) {
-    w = M->cIndex[c+1] - M->cIndex[c];
-    if (w == 0) {
-      /* Skip QCB & sign entries. */
-      for (i=2, nz=0; i<M->numDenseBlocks; i++) {
-        if (M->denseBlocks[i][c])
-          nz=1;
-      }
-      if (nz==0) {
-        printf("Warning: column %ld is all zero!\n", c);
-        warn=1;
-      }
-    }
-    h = 0x00000000;
-    for (i=M->cIndex[c]; i<M->cIndex[c+1]; i++) {
-      hi = NFS_HASH(0, M->cEntry[i], 0x8FFFFFFF);
-      h ^= hi;
-    }
-    for (i=NUM_QCB_BLOCKS; i<M->numDenseBlocks; i++) 
-      h ^= (M->denseBlocks[i][c] & 0xFFFFFFFF) ^ 
-           ((M->denseBlocks[i][c] & 0xFFFFFFFF00000000ULL) >> 32);
-    colHash[2*c] = h;
-    colHash[2*c+1]=c;
-  }
-  qsort(colHash, M->numCols, 2*sizeof(s32), cmp2L1);
-  for (i=0; i<(M->numCols-1); i++) {
-    if (colHash[2*i]==colHash[2*i+2]) {
-      if (colsAreEqual(M, colHash[2*i+1], colHash[2*i+3])) {
-        printf("Bad matrix: column %ld = column %ld!\n", 
-               colHash[2*i+1], colHash[2*i+3]);
-        warn=2;
-      }
+}
+
+/*********************************************************************/
+static void dm_gatherCols(dmat_t *D, u64 *full, u64 *x)
+/*********************************************************************/
+/* Collect the column vector pieces x into 'full' on rank 0.         */
+/*********************************************************************/
+{ int *cnt, *dsp, j;
+
+  if (D->row) return;
+  cnt = (int *)lxmalloc(2*D->pc*sizeof(int), 1);
+  dsp = cnt + D->pc;
+  for (j=0; j<D->pc; j++) {
+    cnt[j] = D->colStart[j+1] - D->colStart[j];
+    dsp[j] = D->colStart[j];
+  }
+  MPI_Gatherv(x, D->nc, MPI_UINT64_T, full, cnt, dsp, MPI_UINT64_T, 0, D->rowComm);
+  free(cnt);
+}
+
+/*********************************************************************/
+static void dm_scatterCols(dmat_t *D, u64 *x, u64 *full)
+/*********************************************************************/
+/* Distribute 'full' from rank 0 as column vector pieces.            */
+/*********************************************************************/
+{ int *cnt, *dsp, j;
+
+  if (D->row == 0) {
+    cnt = (int *)lxmalloc(2*D->pc*sizeof(int), 1);
+    dsp = cnt + D->pc;
+    for (j=0; j<D->pc; j++) {
+      cnt[j] = D->colStart[j+1] - D->colStart[j];
+      dsp[j] = D->colStart[j];
     }
+    MPI_Scatterv(full, cnt, dsp, MPI_UINT64_T, x, D->nc, MPI_UINT64_T, 0, D->rowComm);
+    free(cnt);
   }
+  MPI_Bcast(x, D->nc, MPI_UINT64_T, 0, D->colComm);
+}
 
-  if (warn) {
-    printf("checkMat() did not like something about the matrix:\n");
-    printf("This is probably a sign that something has gone horribly wrong\n");
-    printf("in the matrix construction (procrels).\n");
+/*********************************************************************/
+static void dm_gatherRows(dmat_t *D, u64 *full, u64 *y)
+/*********************************************************************/
+/* Collect the row vector pieces y into 'full' (which has numCols    */
+/* entries, like the vectors of blanczos64.c) on rank 0.             */
+/*********************************************************************/
+{ int *cnt, *dsp, i;
+  s32  k, r;
+
+  if (D->col) return;
+  cnt = (int *)lxmalloc(2*D->pr*sizeof(int), 1);
+  dsp = cnt + D->pr;
+  for (i=0; i<D->pr; i++) {
+    cnt[i] = D->rowStart[i+1] - D->rowStart[i];
+    dsp[i] = D->rowStart[i];
   }
-  free(colHash);
-  return warn;
+  MPI_Gatherv(y, D->nr, MPI_UINT64_T, full, cnt, dsp, MPI_UINT64_T, 0, D->colComm);
+  free(cnt);
+  if (D->rank) return;
+  for (r=D->numRows; r<D->numCols; r++)
+    full[r] = 0;
+  for (k=0; k<D->numDenseBlocks; k++)
+    for (r=0; (r<64) && (D->denseBlockIndex[k]+r < D->numRows); r++)
+      full[D->denseBlockIndex[k]+r] ^= y[D->nr + 64*k + r];
 }
 
-/*********************************************************/
-s32 loadMat(nfs_sparse_mat_t *M, char *colName)
-/*********************************************************/
-{ FILE  *fp;
-  s32   i, j, k, fileSize, index, nR, r, *rwt, blockWt;
-  struct stat fileInfo;
-  column_t     C;
-  int    bSize;
-  double dW;
+/*********************************************************************/
+static int dm_testMult(dmat_t *D)
+/*********************************************************************/
+/* Check that <Bx, y> = <x, (B^T)y> for random x, y.                 */
+/*********************************************************************/
+{ u64 *x, *y, *Bx, *BTy, a[64], b[64];
+  s32  nrow = D->nr + 64*D->numDenseBlocks;
+  int  i, fail=0;
+
+  x   = (u64 *)lxmalloc((D->nc+1)*sizeof(u64), 1);
+  BTy = (u64 *)lxmalloc((D->nc+1)*sizeof(u64), 1);
+  y   = (u64 *)lxmalloc((nrow+1)*sizeof(u64), 1);
+  Bx  = (u64 *)lxmalloc((nrow+1)*sizeof(u64), 1);
+  dm_random(x, D->c0, D->nc, D->numCols);
+  dm_random(y, D->r0, D->nr, D->numRows);
+  dm_random(y + D->nr, 0, 64*D->numDenseBlocks, 64*D->numDenseBlocks);
+  dm_MultB(D, Bx, x);
+  dm_MultB_T(D, BTy, y);
+  dm_multT_rows(D, a, Bx, y);
+  dm_multT(D, b, x, BTy);
+  for (i=0; i<64; i++)
+    if (a[i] != b[i]) fail++;
+  free(x); free(y); free(Bx); free(BTy);
+  return fail;
+}
 
+/*********************************************************************/
+static void dm_checkpoint(dmat_t *D, u32 iterations, u64 *Wi, u64 *Wi_1,
+                          u64 *Wi_2, u64 *T_1, u64 *tmp, u64 *U_1,
+                          u64 *tmp2, int *Si, int *Si_1, u64 *X, u64 *Y,
+                          u64 *Vi, u64 *Vi_1, u64 *Vi_2)
+/*********************************************************************/
+{ u64 *f[5] = {NULL, NULL, NULL, NULL, NULL}, *v[5];
+  int  i;
+
+  v[0] = X; v[1] = Y; v[2] = Vi; v[3] = Vi_1; v[4] = Vi_2;
+  for (i=0; i<5; i++) {
+    if (D->rank == 0)
+      f[i] = (u64 *)lxmalloc(D->numCols*sizeof(u64), 1);
+    dm_gatherCols(D, f[i], v[i]);
+  }
+  if (D->rank == 0) {
+    matsave(iterations, D->numCols, Wi, Wi_1, Wi_2, T_1, tmp, U_1, tmp2,
+            Si, Si_1, f[0], f[1], f[2], f[3], f[4]);
+    for (i=0; i<5; i++)
+      free(f[i]);
+  }
+}
 
-  if (stat(colName, &fileInfo)) {
-    printf("loadMat() Could not stat %s!\n", colName);
-    return -1;
+/*********************************************************************/
+static u32 dm_resume(dmat_t *D, u64 *Wi, u64 *Wi_1, u64 *Wi_2, u64 *T_1,
+                     u64 *tmp, u64 *U_1, u64 *tmp2, int *Si, int *Si_1,
+                     u64 *X, u64 *Y, u64 *Vi, u64 *Vi_1, u64 *Vi_2)
+/*********************************************************************/
+{ u64 *f[5] = {NULL, NULL, NULL, NULL, NULL}, *v[5], small[7*64];
+  int  i, S[128];
+  u32  iterations=0;
+
+  if (D->rank == 0) {
+    for (i=0; i<5; i++)
+      f[i] = (u64 *)lxmalloc(D->numCols*sizeof(u64), 1);
+    iterations = matresume(D->numCols, Wi, Wi_1, Wi_2, T_1, tmp, U_1, tmp2,
+                           Si, Si_1, f[0], f[1], f[2], f[3], f[4]);
+    memcpy(small,     Wi,   64*sizeof(u64));
+    memcpy(small+64,  Wi_1, 64*sizeof(u64));
+    memcpy(small+128, Wi_2, 64*sizeof(u64));
+    memcpy(small+192, T_1,  64*sizeof(u64));
+    memcpy(small+256, tmp,  64*sizeof(u64));
+    memcpy(small+320, U_1,  64*sizeof(u64));
+    memcpy(small+384, tmp2, 64*sizeof(u64));
+    memcpy(S,    Si,   64*sizeof(int));
+    memcpy(S+64, Si_1, 64*sizeof(int));
+  }
+  MPI_Bcast(&iterations, 1, MPI_UINT32_T, 0, MPI_COMM_WORLD);
+  if (iterations > 0) {
+    MPI_Bcast(small, 7*64, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+    MPI_Bcast(S, 128, MPI_INT, 0, MPI_COMM_WORLD);
+    memcpy(Wi,   small,     64*sizeof(u64));
+    memcpy(Wi_1, small+64,  64*sizeof(u64));
+    memcpy(Wi_2, small+128, 64*sizeof(u64));
+    memcpy(T_1,  small+192, 64*sizeof(u64));
+    memcpy(tmp,  small+256, 64*sizeof(u64));
+    memcpy(U_1,  small+320, 64*sizeof(u64));
+    memcpy(tmp2, small+384, 64*sizeof(u64));
+    memcpy(Si,   S,    64*sizeof(int));
+    memcpy(Si_1, S+64, 64*sizeof(int));
+    v[0] = X; v[1] = Y; v[2] = Vi; v[3] = Vi_1; v[4] = Vi_2;
+    for (i=0; i<5; i++)
+      dm_scatterCols(D, v[i], f[i]);
   }
-  fileSize = fileInfo.st_size;
+  if (D->rank == 0)
+    for (i=0; i<5; i++)
+      free(f[i]);
+  return iterations;
+}
 
-  if (!(fp = fopen(colName, "rb"))) {
-    fprintf(stderr, "loadMat() Unable to open %s for read!\n", colName);
-    return -1;
+/**********************************************************************/
+static int dm_blockLanczos(dmat_t *D, u64 *deps)
+/**********************************************************************/
+/* The same iteration as blockLanczos64(), on distributed vectors.    */
+/* On return, rank 0 has the dependencies in 'deps' (numCols words).  */
+/* Every rank gets the number of dependencies found, or -1.           */
+/**********************************************************************/
+{ u64 *Y=NULL, *X=NULL, *Vi=NULL, *Vi_1=NULL, *Vi_2=NULL, *tmp_n=NULL, *tmp_r=NULL;
+  u64 *V0=NULL, *Z=NULL, *AZ=NULL, *full=NULL;
+  u64 D_[64], E[64], F[64], Wi[64];
+  u64 Wi_1[64], Wi_2[64], T[64], T_1[64];
+  u64 tmp[64];
+  u64 U[64], U_1[64], tmp2[64];
+  int  Si[64], Si_1[64];
+  u64 i, j, mask, isZero;
+  u32  iterations;
+  u32  resume_iterations = 0;
+  int  numDeps=-1, cont, s, act;
+  s32  n = D->numCols, nc = D->nc;
+  double startTime, now, estTotal, save_time;
+
+  if (dm_testMult(D)) {
+    printf("Self test reported some errors! Stopping...\n");
+    MPI_Abort(MPI_COMM_WORLD, -1);
   }
-  fread(&M->numCols, sizeof(s32), 1, fp);
-  /* Scan the file once to find out how many dense rows there are. */
-  rwt = (s32 *)malloc(M->numCols*sizeof(s32));
-  memset(rwt, 0x00, M->numCols*sizeof(s32));
-
-  nR = 0;
-  for (j=0; j<M->numCols ; j++) {
-    C.numPrimes = 0;
-    readColSF(&C, fp);
-    for (i=0; i<C.numPrimes; i++) {
-      r = C.rows[i];
-      rwt[r] += 1;
-      nR = MAX(nR, r);
+
+  Y    = (u64 *)lxmalloc((nc+1)*sizeof(u64), 1);
+  X    = (u64 *)lxmalloc((nc+1)*sizeof(u64), 1);
+  Vi   = (u64 *)lxmalloc((nc+1)*sizeof(u64), 1);
+  V0   = (u64 *)lxmalloc((nc+1)*sizeof(u64), 1);
+  Vi_1 = (u64 *)lxmalloc((nc+1)*sizeof(u64), 1);
+  Vi_2 = (u64 *)lxmalloc((nc+1)*sizeof(u64), 1);
+  tmp_n = (u64 *)lxmalloc((nc+1)*sizeof(u64), 1);
+  tmp_r = (u64 *)lxmalloc((D->nr + 64*D->numDenseBlocks + 1)*sizeof(u64), 1);
+
+  resume_iterations = iterations = dm_resume(D,Wi,Wi_1,Wi_2,T_1,tmp,U_1,tmp2,Si,Si_1,
+                                             X,Y,Vi,Vi_1,Vi_2);
+  if (iterations > 0) {
+    i = iterations;
+    dm_MultA(D, V0, Y, tmp_r);
+    dm_MultA(D, tmp_n, Vi, tmp_r);
+    dm_multT(D, T, Vi, tmp_n);
+    cont = 1;
+  } else {
+    dm_random(Y, D->c0, nc, n);
+    for (j=0; j<(u64)nc; j++)
+      X[j] = Vi_1[j] = Vi_2[j] = tmp_n[j] = 0;
+    for (i=0; i<64; i++) {
+      Wi[i] = Wi_1[i] = Wi_2[i] = 0;
+      T[i] = T_1[i] = U[i] = U_1[i] = tmp[i] = 0;
+      Si[i] = Si_1[i] = i;
     }
+    dm_MultA(D, V0, Y, tmp_r);
+    memcpy(Vi, V0, nc*sizeof(u64));
+
+    dm_MultA(D, tmp_n, Vi, tmp_r); /* tmp_n <-- A*Vi */
+    dm_multT(D, T, Vi, tmp_n);     /* T <-- (Vi^T)A(Vi) */
+
+    cont = 1;
+    i = 0;
+    getW_S(Wi, Si, T, Si_1);
+    dm_multT(D, tmp, V0, V0);  /* tmp <-- (V0^T)(V0). */
+    mult64x64(tmp2, Wi, tmp);  /* tmp2 <-- (W0)(V0^T)(V0). */
+    multnx64(X, V0, tmp2, nc); /* X <-- V0(tmp2). */
+    iterations = 0;
   }
-  M->numRows = nR + 1 + 64; /* '1' b/c we count from zero. '64' for the additional QCB/sign bits. */
-  M->numDenseBlocks = 1;
-  M->denseBlockIndex[0] = M->numRows - 64;
-  bSize=64;
-  /* This condition may need to be adjusted. '2.1' will start to save memory,
-     but is probably a little slower than '4'. */
-  dW=2.8;
-  printf("Matrix scanned: it should be %ld x %ld.\n", M->numRows, M->numCols);
-
-  i=0;
-  /* This could be made a bit slicker, but whatever. */
-  while ((i<nR-bSize) && (M->numDenseBlocks < MAX_DENSE_BLOCKS)) {
-    /* Is the block of rows [i, i+bSize] dense? */
-    for (j=0, blockWt=0; j<bSize; j++) 
-      blockWt += rwt[i+j]; 
-    if (blockWt > dW*M->numCols) {
-      /* Check: Is this particular row fairly dense? */
-      if (rwt[i] > 0.005*M->numCols) {
-        /* Okay - this is a dense block. */
-        M->denseBlockIndex[M->numDenseBlocks] = i;
-        M->numDenseBlocks += 1;
-        /* rwt is reused below, to check which entries are from dense blocks. */
-        for (j=0; j<bSize; j++)
-          rwt[i+j]=1; 
-        i += bSize;
-      } else {
-        rwt[i++]=0;
-      }
+
+  startTime = sTime();
+  save_time = startTime + matsave_interval;
+  do {
+    iterations++;
+
+    dm_multT(D, U, tmp_n, tmp_n); /* U <-- (Vi^T)(A^2)(Vi) */
+    multS(U, Si);
+    memcpy(D_, U, 64*sizeof(u64));
+    for (j=0; j<64; j++)
+      D_[j] ^= T[j];
+    preMult(D_, Wi);
+    for (j=0; j<64; j++)
+      D_[j] ^= BIT64(j);
+
+    mult64x64(E, Wi_1, T);
+    multS(E, Si);
+
+    for (j=0; j<64; j++)
+      F[j] = U_1[j] ^ T_1[j];
+    multS(F, Si);
+
+    mult64x64(tmp, T_1, Wi_1);
+    for (j=0; j<64; j++)
+      tmp[j] ^= BIT64(j);
+    preMult(tmp, Wi_2);
+    preMult(F, tmp);
+
+    mask = 0x00000000;
+    for (j=0; j<64; j++) {
+      s = Si[j];
+      if ((s>=0) && (s<64))
+        mask |= BIT64(s);
+    }
+    for (j=0; j<(u64)nc; j++)
+      tmp_n[j] &= mask;
+
+    addmultnx64(tmp_n, Vi, D_, nc);
+    addmultnx64(tmp_n, Vi_1, E, nc);
+    addmultnx64(tmp_n, Vi_2, F, nc);
+
+    i++;
+    memcpy(Vi_2, Vi_1, nc*sizeof(u64));
+    memcpy(Vi_1, Vi, nc*sizeof(u64));
+    memcpy(Vi, tmp_n, nc*sizeof(u64));
+    memcpy(Wi_2, Wi_1, 64*sizeof(u64));
+    memcpy(Wi_1, Wi, 64*sizeof(u64));
+    memcpy(T_1, T, 64*sizeof(u64));
+    memcpy(U_1, U, 64*sizeof(u64));
+    memcpy(Si_1, Si, 64*sizeof(int));
+
+    dm_MultA(D, tmp_n, Vi, tmp_r);
+    dm_multT(D, T, Vi, tmp_n);
+    getW_S(Wi, Si, T, Si_1);
+
+    if (!(isZeroV(T, 64))) {
+      dm_multT(D, tmp, Vi, V0);
+      preMult(tmp, Wi);
+      addmultnx64(X, Vi, tmp, nc);
     } else {
-      rwt[i++]=0;
+      cont=0;
     }
-  }
-  printf("Found %ld dense blocks. Re-reading matrix...\n", M->numDenseBlocks);
-printf("The dense blocks consist of the following sets of rows:\n");
-for (k=0; k<M->numDenseBlocks; k++) 
-printf("[%ld, %ld]\n", M->denseBlockIndex[k], M->denseBlockIndex[k]+bSize-1);
-
-  rewind(fp);
-  fread(&M->numCols, sizeof(s32), 1, fp);
-
-  /* We could do a little better, by discounting for the QCB and sign entries. */
-  M->maxDataSize = 256 + fileSize/sizeof(s32);
-  if (!(M->cEntry = (s32 *)malloc(M->maxDataSize*sizeof(s32)))) {
-    fprintf(stderr, "loadMat() Error allocating %ld bytes for the sparse matrix!\n",
-            M->maxDataSize*sizeof(s32));
-    fclose(fp); return -1;
-  }
-  if (!(M->cIndex = (s32 *)malloc((M->numCols+1)*sizeof(s32)))) {
-    fprintf(stderr, "loadMat() Error allocating %ld bytes for the sparse matrix indicies!\n",
-            (M->numCols+1)*sizeof(s32));
-    free(M->cEntry); fclose(fp); return -1;
-  }
-  for (i=0; i<M->numDenseBlocks; i++) {
-    if (!(M->denseBlocks[i] = (u64 *)calloc((M->numCols+1),sizeof(u64)))) {
-      fprintf(stderr, "loadMat() Error allocating %ld bytes for the QCB entries!\n",
-              (M->numCols+1)*sizeof(u64));
-      free(M->cIndex); free(M->cEntry); fclose(fp); return -1;
+    now = sTime();
+    estTotal = ((double)1.02*(n-resume_iterations)/((iterations-resume_iterations)*64.0))*(now-startTime);
+    printTmp("Lanczos(MPI): Estimate %1.1lf%% complete (%1.1lf secs / %1.1lf secs)...",
+              (double)100.0*64.0*iterations/(1.02*n), now-startTime, estTotal);
+    if ((double)100.0*64.0*iterations/n > 250) {
+      fprintf(stderr, "Some error has occurred: Lanczos is not converging!\n");
+      fprintf(stderr, "Number of iterations is %" PRIu32 ".\n", iterations);
+      fprintf(stderr, "Terminating...\n");
+      MPI_Abort(MPI_COMM_WORLD, -1);
+    }
+    /* All ranks must agree on whether to save (and stop) now. */
+    act = 0;
+    if (matsave_interval < 0) act = 2;
+    else if ((matsave_interval > 0) && (now > save_time)) act = 1;
+    MPI_Allreduce(MPI_IN_PLACE, &act, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    if (act) {
+      dm_checkpoint(D, iterations, Wi, Wi_1, Wi_2, T_1, tmp, U_1, tmp2, Si, Si_1,
+                    X, Y, Vi, Vi_1, Vi_2);
+      if (act == 2)
+        goto SHORT_CIRC_STOP;
+      save_time += matsave_interval;
     }
+  } while (cont);
+  printf("\nBlock Lanczos used %" PRIu32 " iterations.\n", iterations);
+
+  /* The rest is done on rank 0, using full vectors, except for */
+  /* the matrix multiplies.                                     */
+  for (j=0; j<(u64)nc; j++)
+    X[j] ^= Y[j];
+  if (D->rank == 0) {
+    Z = (u64 *)lxmalloc(2*n*sizeof(u64), 1);
+    AZ = (u64 *)lxmalloc(2*n*sizeof(u64), 1);
+    full = (u64 *)lxmalloc(n*sizeof(u64), 1);
   }
-
-  M->cIndex[0] = 0; index=0;
-  for (j=0; (j<M->numCols) && ((index+50) < M->maxDataSize); j++) {
-    C.numPrimes = 0;
-    readColSF(&C, fp);
-    for (i=0; i<C.numPrimes; i++) {
-      r = C.rows[i];
-      /* Is this entry in a dense block? */
-      if (rwt[r]==1) {
-        /* Find the block (it won't be QCB, though). */
-        for (k=64/bSize; k<M->numDenseBlocks; k++) {
-          if ((r>=M->denseBlockIndex[k]) && (r < bSize+M->denseBlockIndex[k])) {
-            M->denseBlocks[k][j] ^= BIT64(r-M->denseBlockIndex[k]);
-            break;
+  if (dm_isZero(Vi, nc)) {
+    /* Then <X+Y> < ker(A). */
+    printf("After Block Lanczos iteration, Vm=0.\n");
+    dm_gatherCols(D, full, X);
+  } else {
+    printf("After Block Lanczos iteration, Vm is nonzero. Finishing...\n");
+    /* Construct Z=[ X+Y | Vi] and compute AZ=[ A(X+Y) | AVi ] */
+    dm_gatherCols(D, full, X);
+    if (D->rank == 0) for (j=0; j<(u64)n; j++) Z[2*j] = full[j];
+    dm_gatherCols(D, full, Vi);
+    if (D->rank == 0) for (j=0; j<(u64)n; j++) Z[2*j+1] = full[j];
+    dm_MultA(D, tmp_n, X, tmp_r);
+    dm_gatherCols(D, full, tmp_n);
+    if (D->rank == 0) for (j=0; j<(u64)n; j++) AZ[2*j] = full[j];
+    dm_MultA(D, tmp_n, Vi, tmp_r);
+    dm_gatherCols(D, full, tmp_n);
+    if (D->rank == 0) {
+      for (j=0; j<(u64)n; j++)
+        AZ[2*j+1] = full[j];
+      doColumnOps(Z, AZ, n);
+      /* Look for zero columns in AZ, and copy the corresponding */
+      /* columns of Z into 'full'.                               */
+      for (j=0; j<(u64)n; j++)
+        full[j] = 0;
+      numDeps=0;
+      for (i=0; (i<64) && (numDeps < 64); i++) {
+        j=0;
+        while ((j<(u64)n) && ((AZ[2*j + i/64]&BIT64(i%64))==0))
+          j++;
+        if (j==(u64)n) {
+          for (j=0; j<(u64)n; j++) {
+            if (Z[2*j + i/64]&BIT64(i%64))
+              full[j] ^= BIT64(numDeps);
           }
+          numDeps++;
         }
-      } else {
-        M->cEntry[index] = r;
-        index++;
       }
+      printf("Found %d dependencies for A=(B^T)B.\n", numDeps);
     }
-    M->denseBlocks[0][j] = (C.QCB[0]^(((u64)C.QCB[1])<<32))|0x8000000000000000ULL;
-                                                                                                       
-
-
-    /* We have enough room for one extra index, and we use it */
-    /* to determine size, so this is ok even on the last pass */
-    /* through the loop:                                      */
-    M->cIndex[j+1] = index;
   }
-  fclose(fp);
-  free(rwt);
-  return M->numRows;
-}    
-
-#ifdef MPI_MATSOLVE
-/***********************************************************/
-void master()
-/***********************************************************/
-{ char       colName[64], depName[64], str[1024];
-  double     startTime, stopTime, wtFactor=DEFAULT_WT_FACTOR;
-  s32       *deps, origC, seed;
-  struct stat fileInfo;
-  nfs_sparse_mat_t M;
-  int        i;
-  FILE      *fp, *ifp;
-
-  if (stat("depinf", &fileInfo)) {
-    msgLog(NULL, "Could not stat depinf! Terminating...\n");
-    return;
+  if (D->rank == 0) {
+    j=0;
+    while ((j<(u64)n)&&(full[j]==0))
+      j++;
+    if (j==(u64)n)
+      printf("Probable error: The matrix X is identically zero!!!\n");
+    printf("Getting dependencies for original matrix, B...\n");
   }
-  time(&seed);
-  srand(seed);
-  seedBlockLanczos(seed);
-  startTime = sTime();
 
-  msgLog(NULL, "Loading matrix into RAM...\n");
-  loadMat(&M, colName);
-  msgLog(NULL, "Matrix loaded: it is %ld x %ld.\n", M.numRows, M.numCols);
-  if (M.numCols < (M.numRows + 64)) {
-    msgLog(NULL, "More columns needed (current = %ld, min = %ld)\n",
-           M.numCols, M.numRows+64);
-    free(M.cEntry); free(M.cIndex);
-    return;
-  }
-  if (checkMat(&M)) {
-    msgLog(NULL, "checkMat() returned some error! Terminating...\n");
-    return;
-  }
-
-  if (!(deps = (s32 *)malloc(M.numCols*sizeof(s32)))) {
-    msgLog(NULL, "Could not allocate %ld bytes for the dependencies.\n", 
-           M.numCols*sizeof(s32));
-    free(M.cEntry); free(M.cIndex); 
-    return;
-  }
-  origC = M.numCols;
-/* We will need a special version of getDependencies()
-   also built with MPI_MATSOLVE. But it has yet to be written.
-*/
-  getDependencies(&M, wtFactor, deps);
-
-  if (!(ifp = fopen("depinf", "rb"))) {
-    msgLog(NULL, "Error opening depinf for read!\n");
-    return;
-  }
-  if (!(fp = fopen(depName, "wb"))) {
-    msgLog(NULL, "Error opening %s for write!\n", depName);
-    return;
-  } 
-  /* Get the header information from depinf. */
-  readBinField(str, 1024, ifp);
-  while (!(feof(ifp)) && strncmp(str, "END_HEADER",10)) {
-    writeBinField(fp, str);
-    readBinField(str,1024,ifp);
-  }
-  if (strncmp(str, "END_HEADER",10)) {
-    msgLog(NULL, "Error: depinf is corrupt!\n");
-    fclose(ifp); fclose(fp); 
-    return;
-  }
-  writeBinField(fp, str);
-  fclose(ifp);
-  fwrite(deps, sizeof(s32), origC, fp);
-  fclose(fp);
-
-  stopTime = sTime();
-  free(M.cEntry); free(M.cIndex); free(deps);
-  return;
-}  
-
-/***********************************************************/
-static void slave()
-/***********************************************************/
-{ unit_of_work_t work;
-  unit_result_t results;
-  MPI_Status status;
-  nfs_sparse_mat_t M;
-
-  /* The first message should be an initialization,
-     containing the columns that this node is responsible for.
-     Upon receiving this message, we should call
-        setupPartialMat()
-     To setup our local copy of the matrix.
-  */
-  MPI_Recv(&work, 1, MPI_INT, 0, MPI_ANY_TAG,
-           MPI_COMM_WORLD, &status);
-
-  while (1) {
-    /* Receive a message from the master. This should
-       contain a vector and instructions to multiply
-       it with B or B^T.
-    */
-    MPI_Recv(&work, 1, MPI_INT, 0, MPI_ANY_TAG,
-             MPI_COMM_WORLD, &status);
-    /* Check the tag of the received message. */
-    if (status.MPI_TAG == DIETAG) {
-      return;
+  /* BX, with X = 'full' on rank 0. */
+  dm_scatterCols(D, X, full);
+  dm_MultB(D, tmp_r, X);
+  dm_gatherRows(D, AZ, tmp_r);
+  numDeps = 0;
+  if (D->rank == 0) {
+    for (i=0; i<(u64)n; i++)
+      deps[i] = 0;
+    doColumnOps64(full, AZ, n);
+    /* We only want 32 of the dependencies. */
+    for (i=0; i<32; i++) {
+      for (j=0, isZero=1; j<(u64)n; j++)
+        if (AZ[j]&BIT64(i))
+          isZero=0;
+      if (isZero) {
+        for (j=0, isZero=1; j<(u64)n; j++) {
+          if (full[j]&BIT64(i)) {
+            deps[j] ^= BIT64(numDeps);
+            isZero=0;
+          }
+        }
+        if (!(isZero))
+          numDeps++;
+      }
     }
-    /* If we did not get a shutdown message, there is
-       work to do. Call either MultB_partial32() or
-       MultB_T_partial32() as appropriate.
-    */
-    result = do_work(work);
-    /* And send the result back */
-    MPI_Send(&result, 1, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
   }
-}
-
-
-#endif
+  MPI_Bcast(&numDeps, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  if (numDeps) {
+    printf("Found %d dependencies for 'B'. Verifying...\n", numDeps);
+  } else {
+    printf("Some error occurred: all dependencies found seem to be trivial!\n");
+    printf("Is Rank(A) = Rank((B^T)B) too small?\n");
+    goto SHORT_CIRC_STOP;
+  }
 
+  dm_scatterCols(D, X, deps);
+  dm_MultB(D, tmp_r, X);
+  if (!dm_isZero(tmp_r, D->nr + 64*D->numDenseBlocks))
+    printf("Some error occurred: Final product (B)(deps) is nonzero!\n");
+  else
+    printf("Verified.\n");
+
+SHORT_CIRC_STOP:
+  free(Y); free(X); free(Vi); free(V0); free(Vi_1); free(Vi_2);
+  free(tmp_n); free(tmp_r);
+  if (Z) free(Z);
+  if (AZ) free(AZ);
+  if (full) free(full);
+  return numDeps;
+}
 
 /****************************************************/
 int main(int argC, char *args[])
 /****************************************************/
-{
-#ifdef MPI_MATSOLVE
-  int rank, size, i;
-#else
-  char       colName[64], depName[64], str[1024];
-  double     startTime, stopTime, wtFactor=DEFAULT_WT_FACTOR;
-  s32       *deps, origC, seed=DEFAULT_SEED;
+{ char       depName[64], str[1024];
+  double     startTime, stopTime;
+  s32       *deps=NULL, origC=0;
+  u64       *tmpDeps=NULL;
+  u32        seed=DEFAULT_SEED;
+  long       testMode=0;
+  int        i, res, pr=0, pc=0;
+  s32        j, k;
   struct stat fileInfo;
-  nfs_sparse_mat_t M;
-  int        i;
+  llist_t    C;
+  dmat_t     D;
   FILE      *fp, *ifp;
-#endif
 
-  strcpy(colName, DEFAULT_COLNAME);
+  MPI_Init(&argC, &args);
+  memset(&D, 0, sizeof(D));
+  MPI_Comm_rank(MPI_COMM_WORLD, &D.rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &D.size);
+  /* Only rank 0 talks. */
+  if (D.rank)
+    freopen("/dev/null", "w", stdout);
+
   strcpy(depName, DEFAULT_DEPNAME);
   printf(START_MSG, GGNFS_VERSION);
-
-#ifdef MPI_MATSOLVE
-  MPI_Init(&argC, &args);
-  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-  MPI_Comm_size(MPI_COMM_WORLD, &size);
-  msgLog(NULL, "mpi-matsolve %s: %d of %d checking in.\n", GGNFS_VERSION, rank, size);
-  if (rank) {
-    /* I am not the controlling process. */
-    slave();
-    msgLog(NULL, "mpi-matsolve: %d of %d terminating.\n", rank, size);
-    MPI_Finalize();
-    return 0;
-  } 
-  master();
-  /* Shutdown the slave nodes. */
-  for (i=1; i<numNodes; i++) {
-    MPI_Send(0, 0, MPI_INT, i, DIETAG, MPI_COMM_WORLD);
-  }
-  msgLog(NULL, "mpi-matsolve: %d of %d terminating.\n", rank, size);
-  MPI_Finalize();
-  return 0;
-}
-#else
-  if (stat("depinf", &fileInfo)) {
-    printf("Could not stat depinf! Are you trying to run %s to soon?\n", args[0]);
-    return -1;
-  }
+  seed=time(0);
+  seed = ((seed % 1001)*seed) ^ (171*seed);
 
   for (i=1; i<argC; i++) {
     if (strcmp(args[i], "-v")==0) {
       verbose++;
     } else if (strcmp(args[i], "-seed")==0) {
-      if ((+i) < argC)
+      if ((++i) < argC) {
         seed = atol(args[i]);
-    } else if (strcmp(args[i], "-wt")==0) {
-      if ((++i) < argC)
-        wtFactor = atof(args[i]);
+      }
+    } else if (strcmp(args[i], "-save")==0) {
+      if ((++i) < argC) {
+        matsave_interval = 60 * atoi(args[i]);
+      }
+    } else if (strcmp(args[i], "-grid")==0) {
+      if ((++i) < argC) {
+        if ((sscanf(args[i], "%dx%d", &pr, &pc) != 2) || (pr*pc != D.size)) {
+          printf("-grid %s does not match the %d ranks; using the default.\n",
+                 args[i], D.size);
+          pr = pc = 0;
+        }
+      }
+    } else if (strcmp(args[i], "-test")==0) {
+      testMode = 1;
     } else if (strcmp(args[i], "--help")==0) {
       printf("USAGE: %s %s\n", args[0], USAGE);
+      MPI_Finalize();
       exit(0);
     }
   }
+  /* Everybody uses the seed of rank 0. */
+  MPI_Bcast(&seed, 1, MPI_UINT32_T, 0, MPI_COMM_WORLD);
   srand(seed);
-  seedBlockLanczos(seed);
-  startTime = sTime();
-  msgLog("", "GGNFS-%s : matsolve", GGNFS_VERSION);
-
-
-
-  printf("Loading matrix into RAM...\n");
-  loadMat(&M, colName);
-  printf("Matrix loaded: it is %ld x %ld.\n", M.numRows, M.numCols);
-  if (M.numCols < (M.numRows + 64)) {
-    printf("More columns needed (current = %ld, min = %ld)\n",
-           M.numCols, M.numRows+64);
-    free(M.cEntry); free(M.cIndex);
-    exit(-1);
+  if (stat("depinf", &fileInfo)) {
+    printf("Could not stat depinf! Are you trying to run %s to soon?\n", args[0]);
+    MPI_Finalize();
+    return -1;
   }
-  if (checkMat(&M)) {
-    printf("checkMat() returned some error! Terminating...\n");
-    exit(-1);
+  prandseed(seed, 712*seed + 21283, seed^0xF3C91D1A);
+  signal(SIGINT, dm_handle_signal);
+  signal(SIGTERM, dm_handle_signal);
+  startTime = sTime();
+  if (D.rank == 0)
+    msgLog("", "GGNFS-%s : mpi-matsolve (seed=%" PRIu32 ", %d ranks)",
+           GGNFS_VERSION, seed, D.size);
+  printf("Using PRNG seed=%" PRIu32 ".\n", seed);
+
+  dm_setGrid(&D, pr, pc);
+  printf("Using a %d x %d grid of ranks.\n", D.pr, D.pc);
+  if (dm_load(&D, "spmat"))
+    MPI_Abort(MPI_COMM_WORLD, -1);
+  printf("Matrix loaded: it is %" PRId32 " x %" PRId32 ".\n", D.numRows, D.numCols);
+  if (D.numCols < (D.numRows + 64)) {
+    printf("More columns needed (current = %" PRId32 ", min = %" PRId32 ")\n",
+           D.numCols, D.numRows+64);
+    MPI_Abort(MPI_COMM_WORLD, -1);
   }
 
-  if (!(deps = (s32 *)malloc(M.numCols*sizeof(s32)))) {
-    printf("Could not allocate %ld bytes for the dependencies.\n", M.numCols*sizeof(s32));
-    free(M.cEntry); free(M.cIndex); return -1;
+  if (testMode) {
+    printf("Testing multiply routines...\n");
+    for (i=1, j=0; i<=100; i++) {
+      j += dm_testMult(&D);
+      if (!(i%10))
+        printf("***Iteration %d: %" PRId32 " multiply failures.***\n", i, j);
+    }
+    dm_clear(&D);
+    MPI_Finalize();
+    return (j != 0);
   }
-  origC = M.numCols;
-  getDependencies(&M, wtFactor, deps);
 
-
-  if (!(ifp = fopen("depinf", "rb"))) {
-    fprintf(stderr, "Error opening depinf for read!\n");
-    exit(-1);
-  }
-  printf("Writing dependencies to file %s.\n", depName);
-  if (!(fp = fopen(depName, "wb"))) {
-    fprintf(stderr, "Error opening %s for write!\n", depName);
-  } else {
-    /* Get the header information from depinf. */
+  if (D.rank == 0) {
+    /* Same as matsolve: we need the number of columns of the   */
+    /* original matrix and the map from the pruned one to it.   */
+    ll_read(&C, "sp-index");
+    if (!(ifp = fopen("depinf", "rb"))) {
+      fprintf(stderr, "Error opening depinf for read!\n");
+      MPI_Abort(MPI_COMM_WORLD, -1);
+    }
     readBinField(str, 1024, ifp);
     while (!(feof(ifp)) && strncmp(str, "END_HEADER",10)) {
-      writeBinField(fp, str);
-      readBinField(str,1024,ifp);
-    }
-    if (strncmp(str, "END_HEADER",10)) {
-      fprintf(stderr, "Error: depinf is corrupt!\n");
-      fclose(ifp); fclose(fp); exit(-1);
+      if (strncmp(str, "NUMCOLS: ", 9)==0) {
+        sscanf(&str[9], "%" SCNx32, &origC);
+      }
+      readBinField(str, 1024, ifp);
     }
-    writeBinField(fp, str);
     fclose(ifp);
-    fwrite(deps, sizeof(s32), origC, fp);
-    fclose(fp);
+    printf("Original matrix had %" PRId32 " columns.\n", origC);
+    deps = (s32 *)lxmalloc(origC*sizeof(s32), 1);
   }
+  tmpDeps = (u64 *)lxmalloc((D.numCols+1)*sizeof(u64), 1);
 
+  printf("Doing block Lanczos...\n");
+  res = dm_blockLanczos(&D, tmpDeps);
   stopTime = sTime();
-  printf("Total elapsed time: %1.2lf seconds.\n", stopTime-startTime);
-
+  printf("Returned %d. Block Lanczos took %1.2lf seconds.\n", res, stopTime-startTime);
+
+  if ((D.rank == 0) && (res > 0)) {
+    msgLog("", "BLanczosTime: %1.1lf", stopTime-startTime);
+    memset(deps, 0x00, origC*sizeof(s32));
+    for (j=0; j<D.numCols; j++) {
+      for (k=C.index[j]; k<C.index[j+1]; k++)
+        deps[C.data[k]] ^= (s32)(tmpDeps[j]&0xFFFFFFFF);
+    }
+    if (!(ifp = fopen("depinf", "rb"))) {
+      fprintf(stderr, "Error opening depinf for read!\n");
+      MPI_Abort(MPI_COMM_WORLD, -1);
+    }
+    printf("Writing dependencies to file %s.\n", depName);
+    if (!(fp = fopen(depName, "wb"))) {
+      fprintf(stderr, "Error opening %s for write!\n", depName);
+      fclose(ifp);
+    } else {
+      readBinField(str, 1024, ifp);
+      while (!(feof(ifp)) && strncmp(str, "END_HEADER",10)) {
+        writeBinField(fp, str);
+        readBinField(str,1024,ifp);
+      }
+      if (strncmp(str, "END_HEADER",10)) {
+        fprintf(stderr, "Error: depinf is corrupt!\n");
+        fclose(ifp); fclose(fp);
+        MPI_Abort(MPI_COMM_WORLD, -1);
+      }
+      writeBinField(fp, str);
+      fclose(ifp);
+      fwrite(deps, sizeof(s32), origC, fp);
+      fclose(fp);
+    }
+  }
 
-  free(M.cEntry); free(M.cIndex); free(deps);
+  stopTime = sTime();
+  printf("Total elapsed time: %1.2lf seconds.\n", stopTime-startTime);
+  if (D.rank == 0) {
+    ll_clear(&C);
+    free(deps);
+  }
+  free(tmpDeps);
+  dm_clear(&D);
+  MPI_Finalize();
   return 0;
-}  
-#endif
+}
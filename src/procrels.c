@@ -40,22 +40,46 @@
 
 #include "if.h"
 
-/* After reading this many new relations, they will be added to the
-   larger hash table, to reduce sort/searches which would otherwise
-   slow down relation processing when processing many new relaitons.
-   Keep this extraordinarily large for now, because I think it's
-   broken. But it should be fixed and backed down to 100K or so.
-*/
-#define MAX_AB_EXTRA_ENTRIES 80000
-
 
 #if !defined(_MSC_VER)
 #include <sys/time.h>
 #endif
+#if !defined(_MSC_VER) && !defined(__MINGW32__) && !defined(MINGW32)
+#define PROCRELS_FORK
+#define PROCRELS_FOLLOW
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#endif
 #include "ggnfs.h"
 #include "prand.h"
 #include "rellist.h"
 #include "intutils.h"
+#include "abindex.h"
+#include "lpgraph.h"
+
+/* New relation files are read through these, so that with zlib
+   they may be gzipped (plain files are read through unchanged).
+*/
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+typedef gzFile relfile_t;
+#define rf_open(_n)        gzopen((_n), "rb")
+#define rf_read(_f,_b,_n)  gzread((_f), (_b), (unsigned)(_n))
+#define rf_gets(_f,_b,_n)  gzgets((_f), (_b), (_n))
+#define rf_eof(_f)         gzeof(_f)
+#define rf_close(_f)       gzclose(_f)
+#else
+typedef FILE *relfile_t;
+#define rf_open(_n)        fopen((_n), "rb")
+#define rf_read(_f,_b,_n)  ((int)fread((_b), 1, (_n), (_f)))
+#define rf_gets(_f,_b,_n)  fgets((_b), (_n), (_f))
+#define rf_eof(_f)         feof(_f)
+#define rf_close(_f)       fclose(_f)
+#endif
 
 
 /* I need to figure out what is roughly optimal
@@ -75,11 +99,6 @@
 #define MAX_LPMEM_ALLOC 256000000
 #define MAX_SPAIRS_ALLOC 12000000
 
-/* One bit per entry in the (a,b) hash table. Higher means fewer collisions
-   (and so, faster processing).
-*/
-#define AB_HASH_RAM 2*33554432
-
 #define MAX_PBUF_RAM 32000000
 #define DEFAULT_QCB_SIZE 62
 #define DEFAULT_SEED 1
@@ -89,6 +108,10 @@
 #define DEFAULT_COLNAME "cols"
 #define DEFAULT_LPI_NAME "lpindex"
 #define DEFAULT_PRELPREFIX "rels.bin"
+/* Written after each -follow batch: the estimate, and where we are. */
+#define EXCESS_SUFFIX "excess"
+#define FOLLOW_SUFFIX "follow"
+#define FOLLOW_BATCH_BYTES 16000000
 
 #define USAGE " -fb <fname> -prel <fname> -newrel <fname> [-qs <qcb size>] [-v]\n"\
 "-fb <fname>           : Factor base.\n"\
@@ -100,6 +123,13 @@
 "-speedtest            : Do nothing but report a number representing the relative speed\n"\
 "                        of this machine.\n"\
 "-nolpcount            : Don't count large primes.\n"\
+"-nt <int>             : Number of worker processes for parsing and factoring the\n"\
+"                        new relations.\n"\
+"-follow <int>         : Keep running: every <int> seconds, process whatever has\n"\
+"                        been appended to the -newrel file since the last batch,\n"\
+"                        and update the full relation-set estimate.\n"\
+"-minff <int>          : With -follow, stop once there are at least this many\n"\
+"                        fulls + cycles.\n"\
 "-prune <float>        : EXPERIMENTAL! Remove the heaviest <float> fraction of processed\n"\
 "                        relations (and dump them in siever-output format, just in case).\n"\
 "                        ASCII files, then quit.\n"
@@ -122,80 +152,53 @@ s32  totalLargePrimes=0;
 long relsNumLP[8]={0,0,0,0,0,0,0,0};
 
 /********************************************************************************/
-long countLP(multi_file_t *prelF)
+long countLP(multi_file_t *prelF, nfs_fb_t *FB)
 /********************************************************************************/
-/* Find out how many distinct large primes are contained in the processed rels. */
+/* Find out how many distinct large primes are contained in the processed rels, */
+/* and how many full relation-sets they give at least, from the large prime     */
+/* graph (see lpgraph.c). The estimate also goes to <prel prefix>.excess.       */
 /********************************************************************************/
-{ s32 i, j, k, p, r, numRels=0, totalLP=0;
-  s32 *lR=NULL, *lA=NULL, lRSize, lRMax, lASize, lAMax;
-  u32 sF, lrpi, lapi;
-  int  numLR, numLA;
-  rel_list *RL;
+{ lp_graph_t G;
+  s64   numLP, numFF, needed;
+  char  fName[sizeof(prelF->prefix) + 16], tmpName[sizeof(prelF->prefix) + 24];
+  FILE *fp;
 
-  lRSize = lRMax=0;
-  lASize = lAMax=0;
-  for (i=0; i<prelF->numFiles; i++) {
-    printf("Loading processed file %" PRId32 "/%d...", i+1, prelF->numFiles);
-    fflush(stdout);
-    RL = getRelList(prelF, i);
-    printf("Done. Processing...\n");
-    numRels += RL->numRels;
-    for (j=0; j<RL->numRels; j++) {
-      sF = RL->relData[RL->relIndex[j]];
-      numLR = GETNUMLRP(sF);
-      numLA = GETNUMLAP(sF);
-      lrpi = 4 + 2*(GETNUMRFB(sF) + GETNUMAFB(sF) + GETNUMSPB(sF)) + 2;
-      lapi = 4 + 2*(GETNUMRFB(sF) + GETNUMAFB(sF) + GETNUMSPB(sF)) + 2 + numLR;
-      totalLP += numLR + numLA;
-      for (k=0; k<numLR; k++) {
-        p = RL->relData[RL->relIndex[j] + lrpi + k];
-        /* So p is a large rational prime in this relation. */
-        if (lRSize + 8 > lRMax) {
-          lRMax += 65536;
-          lR = realloc(lR, lRMax*sizeof(s32));
-          if (lR == NULL) {
-            printf("countLP() : Memory allocation error for lR!\n");
-            exit(-1); 
-          }
-        }
-        lR[lRSize++] = p;
-      }
-      for (k=0; k<numLA; k++) {
-        p = RL->relData[RL->relIndex[j] + lapi + 2*k];
-        r = RL->relData[RL->relIndex[j] + lapi + 2*k + 1];
-        /* So (p,r) is a large algebraic prime in this relation. */
-        if (lASize + 16 > lAMax) {
-          lAMax += 65536;
-          lA = realloc(lA, 2*lAMax*sizeof(s32));
-          if (lA == NULL) {
-            printf("countLP() : Memory allocation error for lA!\n");
-            exit(-1); 
-          }
-        }
-        lA[2*lASize] = p;
-        lA[2*lASize+1] = r;
-        lASize++;
-      }
-    }
-    /* All done with this relation list. */
-    clearRelList(RL);
-    free(RL);
-    /* Now sort what we've got and remove duplicates: */
-    printf("Sorting and filtering LR..."); fflush(stdout);
-    lRSize = sortRMDups(lR, lRSize);
-    printf("Done.\nSorting and filtering LA..."); fflush(stdout);
-    lASize = sortRMDups2(lA, lASize);
-    printf("Done.\n");
-    printf("Found %" PRId32 " distinct large rprimes and %" PRId32 " large aprimes so far.\n",lRSize, lASize); 
+  if (lpg_open(&G, prelF)) {
+    printf("countLP() : Could not open the large prime graph!\n");
+    exit(-1);
   }
-
-  printf("There are %" PRId32 " large primes versus %" PRId32 " relations.\n", 
-          lRSize+lASize, initialRelations);
-  msgLog(NULL, "largePrimes: %" PRId32 " , relations: %" PRId32,
-         lRSize+lASize, initialRelations);
-  /* Now, check: should we do a cycle count? */
-  free(lA); free(lR);
-  return lRSize + lASize;
+  numLP = G.H->count;
+  numFF = lpg_numFF(&G);
+  /* The same minimum as matbuild's. */
+  needed = (s64)FB->rfb_size + FB->afb_size + 64 + 32;
+  printf("There are %" PRId64 " large primes versus %" PRId64 " relations.\n",
+          numLP, G.H->numRels);
+  printf("Singletons: %" PRId64 ", fulls: %" PRId64 ", cycles: %" PRId64
+         " (%" PRId64 " relations with more large primes not counted).\n",
+         G.H->numSingletons, G.H->numFull, G.H->numCycles, G.H->numHeavy);
+  printf("Full relation-sets: at least %" PRId64 " of %" PRId64 " needed (excess %" PRId64 ").\n",
+         numFF, needed, numFF - needed);
+  msgLog(NULL, "largePrimes: %" PRId64 " , relations: %" PRId64, numLP, G.H->numRels);
+  msgLog(NULL, "fulls: %" PRId64 " , cycles: %" PRId64 " , excess: %" PRId64,
+         G.H->numFull, G.H->numCycles, numFF - needed);
+
+  sprintf(fName, "%s.%s", prelF->prefix, EXCESS_SUFFIX);
+  sprintf(tmpName, "%s.tmp", fName);
+  if ((fp = fopen(tmpName, "w"))) {
+    fprintf(fp, "relations: %" PRId64 "\n", G.H->numRels);
+    fprintf(fp, "largeprimes: %" PRId64 "\n", numLP);
+    fprintf(fp, "singletons: %" PRId64 "\n", G.H->numSingletons);
+    fprintf(fp, "fulls: %" PRId64 "\n", G.H->numFull);
+    fprintf(fp, "cycles: %" PRId64 "\n", G.H->numCycles);
+    fprintf(fp, "heavy: %" PRId64 "\n", G.H->numHeavy);
+    fprintf(fp, "needed: %" PRId64 "\n", needed);
+    fprintf(fp, "excess: %" PRId64 "\n", numFF - needed);
+    fclose(fp);
+    remove(fName);
+    rename(tmpName, fName);
+  }
+  lpg_close(&G, prelF);
+  return (long)numFF;
 }
 
 /******************************************************/
@@ -345,372 +348,599 @@ int set_prelF(multi_file_t *prelF, off_t maxFileSize, int takeAction)
   return 0;
 }
 
-/* Notes: Avoiding duplicate (a,b) pairs is actually a much bigger
-   problem than it may seem at first. After much toiling over possible
-   ways to handle this little predicament, I have arrived at a reasonable
-   (though ugly) method to achieve reasonable speed, with reasonable memory,
-   while completely avoiding the possibility of accidentally throwing out
-   non-duplicate relations. Here's how it goes:
-   (1) Create two hash tables, abHash0 and abHash1, and two empty lists
-       abList and abExtra.
-   (2) Read in all processed relations. For each such relation, apply HASH0
-       and see if it's value is already hashed out in abHash0. If not, hash
-       it out. If the position was already hashed out, check the other
-       table, abHash1, using the second hash function HASH1.
-       In either case, add the relation to the list abList (it takes exactly
-       two s32s to do this).
-   (3) After all relations have been read in, sort the abList list (this
-       takes about 15 seconds for 20M relations).
-   (4) For each new relation to be processed, do the following:
-       (i) compute HASH0, and see if the value is already hashed out of
-           the table abHash0. If not, we know it's not a duplicate. Hash it out
-           of both tables, add it to the list abExtra, and stop.
-       (ii) If the HASH0 value was already hashed out of the table, try HASH1.
-           If this value is not in the table, we know the relation is not
-           a duplicate, so hash it out of abHash1, add it to the list abExtra,
-           and stop.
-       (iii) If the hash value collided in both tables abHash0 and abHash1,
-           do a binary search on the original list, abList, to see if it's there.
-           If so, it's a duplicate so throw it out.
-       (iv) If the relation was not in the original list, check the list where
-           the new relations are living, abExtra. If it's not there either,
-           it's not a duplicate so add it to abExtra and stop. (In fact, we also
-           maintain a hash table of the newly processed relations to prevent
-           excess sorting and searching; actual sorting and searching of the 
-           newly processed relations is a very last resort (hehe - no pun intended)).
-  Note: A semi-obvious alternative at first is to use some binary trees to
-  help. However, we really do need to minimize the amount of memory used in
-  this process, and a btree just uses too much (it would double the amount
-  of RAM needed). Furthermore, it would still need to be used in conjunction
-  with some sort of hashing technique to achieve the speed we've got here.
-  Notice that if everything is set up right, we will only need to do binary
-  searches on rare occassions. For most relations, we will see from the hash
-  tables that they are unique.
-    This brings up another point: Why two hash tables? We cannot afford to
-  use the astronomical amount of RAM that would be needed to make collisions
-  in a single table unlikely. The method we've used here insures that the
-  only relations which will make it to the second hash table are those that
-  would collide with another earlier relation in the first table. This makes
-  collisions in the second table far less likely than collisions would have
-  been in a single table of twice the size (i.e., the birthday problem).
-  It takes a bit of thought to see that this actually works. For example, we
-  rely heavily on the assumption that any relations which have already been
-  processed are unique; the whole method would die a horrible death if that
-  assumption were false.
+/* Notes: Duplicate (a,b) pairs are thrown out with the help of an exact
+   index of all pairs seen so far, kept in <prelF prefix>.abidx (see
+   abindex.c). It is mmapped, so there is no need to read all of the
+   processed files at the start of each run; they are only read if the
+   index is missing or out of date (e.g., the files were rewritten by
+   set_prelF() or -prune, or a run was interrupted).
+     Only pairs which were stored in the processed files go into the
+   index (see markAB()). Pairs which did not factor are left out, so
+   they are retried if they come up again.
 */
-/* These data are shared by the next three functions. */
-u32 *abHash0=NULL, *abHash1=NULL, *abExtraHash=NULL;
-s32 abHashSize=0, abHashWords=0;
-s32 *abList=NULL, abListSize=0, abListMax=0;
-s32 *abExtra=NULL, abExtraSize=0, abExtraMax=0;
-int   abExtraSorted=1;
-#define REL_HASH0(_a, _b, _s) (((u32)((_a)*314159265)+((_b)*577215664))%(_s))
-#define REL_HASH1(_a, _b, _s) (((u32)((_a)*592653141)+((_b)*271828182))%(_s))
-#define REL_HASH2(_a, _b, _s) (((u32)((_a)*531415926)+((_b)*828182271))%(_s))
+/* This is shared by the next three functions. The large prime graph is
+   kept up to date along with the index (see storeNewRel()).
+*/
+static ab_index_t abIndex;
+static lp_graph_t lpGraph;
 
 /*****************************************************************/
 s32 makeABLookup(multi_file_t *prelF)
 /*****************************************************************/
-/* Lookup all processed relations and build some structures for  */
-/* checkAB() to be able to lookup an (a,b) pair to see if it's a */
-/* duplicate.                                                    */
+/* Open (or build) the (a,b) index of the processed relations,   */
+/* so checkAB() can tell if an (a,b) pair is a duplicate.        */
+/* Return value: the number of processed relations.              */
 /*****************************************************************/
-{ int  i;
-  char prelname[256];
-  s32  r, loc, b;
-  s64  a;
-  u32  s;
-  u32  h0, h1;
-  rel_list RL;
-
-  abHashWords = AB_HASH_RAM/(3*4);
-  abHashSize = 32*abHashWords;
-  if (!(abHash0 = (s32 *)malloc(abHashWords*sizeof(u32)))) {
-    printf("Memory allocation error for abHash0!\n");
-    exit(-1);
-  }
-  if (!(abHash1 = (s32 *)malloc(abHashWords*sizeof(u32)))) {
-    printf("Memory allocation error for abHash1!\n");
+{ s64 total=0;
+  int i;
+
+  if (abidx_open(&abIndex, prelF)) {
+    printf("makeABLookup() : Could not open the (a,b) index!\n");
     exit(-1);
   }
-  if (!(abExtraHash = (s32 *)malloc(abHashWords*sizeof(u32)))) {
-    printf("Memory allocation error for abExtraHash!\n");
+  if (lpg_open(&lpGraph, prelF)) {
+    printf("makeABLookup() : Could not open the large prime graph!\n");
     exit(-1);
   }
-  abListMax = 32768;
-  abList = malloc(2*abListMax*sizeof(s32));
-  abListSize=0;
-  
-
-  allocateRelList(prelF, &RL);
-
-  memset(abHash0, 0x00, abHashWords*sizeof(s32));
-  memset(abHash1, 0x00, abHashWords*sizeof(s32));
-  memset(abExtraHash, 0x00, abHashWords*sizeof(s32));
-  printf("Building (a,b) hash table..."); fflush(stdout);
-  for (i=0; i<prelF->numFiles; i++) {
-    printf("%d..", i); fflush(stdout);
-    sprintf(prelname, "%s.%d", prelF->prefix, i);
-    if (readRelList(&RL, prelname)) {
-      printf("makeABList() Failed to open %s for read!\n", prelname);
-      break;
-    }
-    /* Now go through the list and hash out each (a,b) pair. */
-    for (r=0; r<RL.numRels; r++) {
-      loc = RL.relIndex[r];
-      s = RL.relData[loc];
-      relsNumLP[GETNUMLRP(s)+GETNUMLAP(s)] += 1;
-      a = *( (s64*)&(RL.relData[loc+1]) );
-      b = RL.relData[loc+3];
-      h0 = REL_HASH0(a, b, abHashSize);
-      h1 = REL_HASH1(a, b, abHashSize);
-      abHash0[h0/32] |= BIT(h0&0x0000001F);
-      abHash1[h1/32] |= BIT(h1&0x0000001F);
-      if (abListSize +1 > abListMax) {
-        abListMax += 1048576;
-        abList = realloc(abList, 2*abListMax*sizeof(s32));
-        if (abList==NULL) {
-          printf("Fatal memory allocation error for abList!\n");
-          exit(-1);
-        }
-      }
-      abList[2*abListSize]=a;
-      abList[2*abListSize+1]=b;
-      abListSize++;
-    }
+  for (i=0; i<8; i++) {
+    relsNumLP[i] += (long)abIndex.H->numLP[i];
+    total += abIndex.H->numLP[i];
   }
-  printf("\n");
-  clearRelList(&RL);
-  /* Sort the list. */
-  printf("makeABLookup() : Sorting abList..."); fflush(stdout);
-  qsort(abList, abListSize, 2*sizeof(s32), cmp2S32s);
-  printf("Done.\n");
-  return abListSize;
+  return (s32)total;
 }
 
 /*****************************************************************/
-void clearABLookup()
+void clearABLookup(multi_file_t *prelF)
 /*****************************************************************/
-/* Free up memory used for the (a,b) lookup tables.              */
+/* Save and close the (a,b) index. The processed files must be   */
+/* up to date by now.                                            */
 /*****************************************************************/
 {
-  if (abHash0) free(abHash0);
-  if (abHash1) free(abHash1);
-  if (abExtraHash) free(abExtraHash);
-  if (abList) free(abList);
-  if (abExtra) free(abExtra);
-
-  abHash0 = abHash1 = abList = abExtra = NULL;
-  abHashSize = abHashWords = abListSize = abListMax = 0;
-  abExtraSize = abExtraMax = 0;
+  abidx_close(&abIndex, prelF, relsNumLP);
+  lpg_close(&lpGraph, prelF);
 }
 
-s32 sortOps=0;
 /*****************************************************************/
 int checkAB(s64 a, s32 b)
 /*****************************************************************/
-/* Is this an already-processed (a,b) pair? If not, we add it to */
-/* the list of processed pairs and return 0. Otherwise, return   */
-/* some nonzero value.                                           */
-/* This can be done better: I will make some improvements so that
-   it doesn't slow down as much when nearing the end of a large
-   input file.
-*/
-{ u32 h0, h1, h2;
-  s32 key[2], *loc;
-
-  h0 = REL_HASH0(a, b, abHashSize);
-  h1 = REL_HASH1(a, b, abHashSize);
-  if ((abHash0[h0/32]&BIT(h0&0x0000001F))==0) {
-    abHash0[h0/32] |= BIT(h0&0x0000001F);
-    abHash1[h1/32] |= BIT(h1&0x0000001F);
-    if (abExtraSize + 1 >= abExtraMax) {
-      abExtraMax += 32768;
-      abExtra = realloc(abExtra, abExtraMax*2*sizeof(s32));
-      if (abExtra == NULL) {
-        printf("Memory (re-)allocation error for abExtra!\n");
-        exit(-1);
-      }
-    }
-    abExtra[2*abExtraSize] = a;
-    abExtra[2*abExtraSize+1] = b;
-    abExtraSorted=0;
-    abExtraSize++;
-    h2 = REL_HASH2(a, b, abHashSize);
-    abExtraHash[h2/32] |= BIT(h2&0x0000001F);
-    return 0;
+/* Is this an already-processed (a,b) pair? Return 0 if not, and */
+/* some nonzero value if it is.                                  */
+/*****************************************************************/
+{
+  return abidx_lookup(&abIndex, a, b);
+}
+
+/*****************************************************************/
+static void markAB(s64 a, s32 b)
+/*****************************************************************/
+/* Add (a,b) to the processed pairs. Only pairs that made it into */
+/* the processed files go in, so the index is the same as one    */
+/* rebuilt from those files.                                     */
+/*****************************************************************/
+{
+  abidx_insert(&abIndex, a, b);
+}
+
+static char xdigit[256] = {
+  -2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0x00+ */
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0x10+ */
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0x20+ */
+   0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1, /* 0x30+ */
+  -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0x40+ */
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0x50+ */
+  -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0x60+ */
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0x70+ */
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0x80+ */
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0x90+ */
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0xa0+ */
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0xb0+ */
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0xc0+ */
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0xd0+ */
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0xe0+ */
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0xf0+ */
+};
+
+/***************************************************************/
+static int parseRelLine(relation_t *R, unsigned char *fPos, unsigned char *fEol,
+                        nfs_fb_t *FB)
+/***************************************************************/
+/* Parse one line of siever output, [fPos, fEol). *fEol must   */
+/* be '\n' or '\0'. Return value: -1 if the line is not a      */
+/* relation, 1 if it has only (a,b) and 0 if it also has the   */
+/* large factors.                                              */
+/***************************************************************/
+{ s32 r, k, j;
+  s64 p;
+  int c, m;
+  int short_form = 0; /* 0 - we have only a,b.
+                         1 - we have a,b and all large factors. */
+  s32 maxRFB = FB->rfb[2 * (FB->rfb_size - 1)];
+  s32 maxAFB = FB->afb[2 * (FB->afb_size - 1)];
+
+  if (*fPos == '#') { /* comment line */
+    return -1;
   }
-  if ((abHash1[h1/32]&BIT(h1&0x0000001F))==0) {
-    abHash1[h1/32] |= BIT(h1&0x0000001F);
-    if (abExtraSize + 1 >= abExtraMax) {
-      abExtraMax += 32768;
-      abExtra = realloc(abExtra, abExtraMax*2*sizeof(s32));
-      if (abExtra == NULL) {
-        printf("Memory (re-)allocation error for abExtra!\n");
-        exit(-1);
-      }
-    }
-    abExtra[2*abExtraSize] = a;
-    abExtra[2*abExtraSize+1] = b;
-    abExtraSorted=0;
-    abExtraSize++;
-    h2 = REL_HASH2(a, b, abHashSize);
-    abExtraHash[h2/32] |= BIT(h2&0x0000001F);
-    return 0;
+
+  /* expand and optimize parseOutputLine() */
+  /* %ld */
+  fPos += (m = *fPos == '-');
+  if ((unsigned int)(p = *fPos - '0') >= 10) 
+  {
+    return -1;
   }
-  /* Before we sort and search, make sure the size isn't getting too large: */
-  if (abExtraSize > MAX_AB_EXTRA_ENTRIES) {
-    /* Clear it, and add them to the big list, to reduce collisions. */
-    abListMax = abListSize + abExtraSize;
-    abList = realloc(abList, 2*abListMax*sizeof(s32));
-    if (abList==NULL) {
-      printf("Fatal memory allocation error for abList!\n");
-      exit(-1);
-    }
-    memcpy(abList+2*abListSize, abExtra, abExtraSize*2*sizeof(s32));
-    abListSize += abExtraSize;
-    abExtraSize=0;
-    qsort(abList, abListSize, 2*sizeof(s32), cmp2S32s);
-    /* Reset the abExtraHash to empty. */
-    memset(abExtraHash, 0x00, abHashWords*sizeof(s32));
+  
+  fPos++;
+  
+  while ((unsigned int)(c = *fPos - '0') < 10) 
+  {
+    p = (((p << 2) + p) << 1) + c; /* p = p * 10 + c */
+    fPos++;
+  }
+  
+  R->a = m ? -p : p;
+  
+  /* , */
+  fPos++;
+  
+  /* %ld */
+  fPos += (m = *fPos == '-');
+  
+  if ((unsigned int)(p = *fPos - '0') >= 10) 
+  {
+    return -1;
+  }
+  
+  fPos++;
+  
+  while ((unsigned int)(c = *fPos - '0') < 10)
+  {
+    p = (((p << 2) + p) << 1) + c; /* p = p * 10 + c */
+    fPos++;
   }
 
-  /* Ok - we need to check both lists: */
-  key[0]=a; key[1]=b;
-  if (abListSize) {
-    loc = bsearch(key, abList, abListSize, 2*sizeof(s32), cmp2S32s);
-    if (loc) return -1;
+  R->b = m ? -p : p;
+
+  /* : */
+  while (fPos < fEol && (*fPos != ':')) 
+  {
+    fPos++;
   }
+  
+  short_form = (fPos == fEol);
+  fPos++;
+
+  if (short_form == 0)
+  {
+      /* This is long form of the relation.  */
+      /* %lx,%lx,... */
+      for (j=0; j<FB->maxLP; j++)
+      {
+        R->p[j] = 1;
+      }
 
-  h2 = REL_HASH2(a, b, abHashSize);
-  if ((abExtraHash[h2/32]&BIT(h2&0x0000001F))==0) {
-    abExtraHash[h2/32] |= BIT(h2&0x0000001F);
-    if (abExtraSize + 1 >= abExtraMax) {
-      abExtraMax += 32768;
-      abExtra = realloc(abExtra, abExtraMax*2*sizeof(s32));
-      if (abList == NULL) {
-        printf("Memory (re-)allocation error for abList!\n");
-        exit(-1);
+      R->rFSize = 0;
+      m = 0;
+      
+      while (fPos < fEol && *fPos != ':') 
+      {
+        if ((p = xdigit[*fPos++]) < 0) 
+        {
+          continue;
+        }
+        
+        while ((c = xdigit[*fPos]) >= 0) 
+        {
+          p = (p << 4) + c;
+          fPos++;
+        }
+        
+        k = lookupRFB(p, FB);
+        
+        if (k >= 0)
+        {
+          R->rFactors[R->rFSize++] = k;
+        }
+        else if ((p > maxRFB) && (m < FB->maxLP)) 
+        {
+          R->p[m++] = p;
+        }
       }
-    }
-    abExtra[2*abExtraSize] = a;
-    abExtra[2*abExtraSize+1] = b;
-    abExtraSorted=0;
-    abExtraSize++;
-    return 0;
+
+      /* : */
+      fPos += *fPos == ':';
+      
+      /* %lx,%lx,... */
+      
+      for (j=0; j<FB->maxLPA; j++)
+      {
+        R->a_p[j] = R->a_r[j] = 1;
+      }
+
+      R->aFSize = 0;
+      m = 0;
+      
+      while (fPos < fEol && *fPos != ':') 
+      {
+        if ((p = xdigit[*fPos++]) < 0) 
+        {
+          continue;
+        }
+        
+        while ((c = xdigit[*fPos]) >= 0) 
+        {
+          p = (p << 4) + c;
+          fPos++;
+        }
+        
+        if (R->b % p) 
+        { 
+          /* p is always non-zero? */
+          r = mulmod32(p + (R->a % p), inverseModP(R->b, p), p);
+          k = lookupAFB(p, r, FB);
+        
+          if (k >= 0) 
+          {
+            R->aFactors[R->aFSize++] = k;
+          } 
+          else 
+          if ((p > maxAFB) && (m < FB->maxLPA)) 
+          {
+            R->a_p[m] = p; 
+            R->a_r[m++] = r;
+          }
+        }
+      }
+  } /* if (*fPos == ':')  */
+  return short_form;
+}
+
+/* Buffers for new relations, one per processed relation file. */
+typedef struct {
+  multi_file_t *prelF;
+  s32  *data[256], dataIndex[256], numRels[256];
+  s32   bufSize;
+} newrel_buf_t;
+
+/***************************************************************/
+static void flushNewRels(newrel_buf_t *B, int fileno)
+/***************************************************************/
+/* Append the buffered relations for 'fileno' to its file.     */
+/***************************************************************/
+{ FILE *ofp;
+  s32   relsInFile;
+  char  prelname[sizeof(B->prelF->prefix) + 16];
+
+  /* It should be possible to do this with one fopen(), but I don't
+     know about portability of doing it that way. */
+  if (snprintf(prelname, sizeof(prelname), "%s.%d", B->prelF->prefix, fileno)
+      >= (int)sizeof(prelname)) {
+    fprintf(stderr, "flushNewRels(): File name %s.%d is too long!\n",
+            B->prelF->prefix, fileno);
+    exit(-1);
+  }
+  if ((ofp = fopen(prelname, "rb"))) {
+    rewind(ofp);
+    fread(&relsInFile, sizeof(s32), 1, ofp);
+    fclose(ofp);
+  } else {
+    relsInFile=0;
+    /* And create the file. */
+    ofp = fopen(prelname, "wb"); 
+    fclose(ofp);
+  }
+  relsInFile += B->numRels[fileno];
+  if ((ofp = fopen(prelname, "r+b"))) {
+    rewind(ofp);
+    fwrite(&relsInFile, sizeof(s32), 1, ofp);
+    fseek(ofp, 0, SEEK_END);
+    fclose(ofp);
+  } 
+  if ((ofp = fopen(prelname, "ab"))) {
+    fwrite(B->data[fileno], sizeof(s32), B->dataIndex[fileno], ofp);
+    fclose(ofp);
   }
+  B->dataIndex[fileno]=0;
+  B->numRels[fileno]=0;
+}
 
+/***************************************************************/
+static void storeNewRel(newrel_buf_t *B, s32 b, s32 *data, s32 size)
+/***************************************************************/
+/* Add a relation, already converted to the 'data' format.     */
+/***************************************************************/
+{ int fileno = NFS_HASH(b, b, B->prelF->numFiles);
+  u32 s = data[0];
+
+  memcpy(&B->data[fileno][B->dataIndex[fileno]], data, size*sizeof(s32));
+  B->dataIndex[fileno] += size;
+  relsNumLP[GETNUMLRP(s)+GETNUMLAP(s)] += 1;
+  lpg_addRel(&lpGraph, data);
+  B->numRels[fileno] += 1;
+  if (B->bufSize - B->dataIndex[fileno]  < 500)
+    flushNewRels(B, fileno);
+}
 
-  /* Ok - we are having some seriously bad luck, or there actually were two duplicates
-     in the new relation file. Let's check: (we might think about doing this with a
-     binary tree instead).
-  */
-  qsort(abExtra, abExtraSize, 2*sizeof(s32), cmp2S32s);
-  sortOps++;
-  abExtraSorted=1;
-  loc = bsearch(key, abExtra, abExtraSize, 2*sizeof(s32), cmp2S32s);
-  if (loc) return -1;
-  if (abExtraSize + 1 >= abExtraMax) {
-    abExtraMax += 32768;
-    abExtra = realloc(abExtra, abExtraMax*2*sizeof(s32));
-    if (abList == NULL) {
-      printf("Memory (re-)allocation error for abList!\n");
-      exit(-1);
+/* A relation never takes more than this many s32's in 'data' format. */
+#define NR_MAX_REL_S32 512
+
+#ifdef PROCRELS_FORK
+/* The input is cut into batches of about this many bytes. Batch k has   */
+/* the lines that start in [k*NR_BATCH_BYTES, (k+1)*NR_BATCH_BYTES).     */
+#define NR_BATCH_BYTES 262144
+#define NR_MAX_WORKERS 256
+
+/***************************************************************/
+static s64 nr_lineStart(unsigned char *d, s64 size, s64 pos)
+/***************************************************************/
+/* The first line start at or after 'pos'.                     */
+/***************************************************************/
+{
+  if (pos >= size) return size;
+  while ((pos > 0) && (pos < size) && (d[pos-1] != '\n') && (d[pos-1] != '\0'))
+    pos++;
+  return pos;
+}
+
+/***************************************************************/
+static int nr_write(int fd, void *buf, size_t len)
+/***************************************************************/
+{ char *p = (char *)buf;
+  ssize_t n;
+
+  while (len > 0) {
+    if ((n = write(fd, p, len)) <= 0) {
+      if ((n < 0) && (errno == EINTR)) continue;
+      return -1;
     }
+    p += n; len -= n;
   }
-  abExtra[2*abExtraSize] = a;
-  abExtra[2*abExtraSize+1] = b;
-  abExtraSorted=0;
   return 0;
 }
 
+/***************************************************************/
+static int nr_read(int fd, void *buf, size_t len)
+/***************************************************************/
+{ char *p = (char *)buf;
+  ssize_t n;
 
-/*****************************************************************/
-s32 getABHash(u32 *hash0, u32 *hash1, s32 hashSize, multi_file_t *prelF)
-/*****************************************************************/
-/* 'hash' is a hash table, one bit per entry. We will initialize */
-/* it to zero and then turn on each bit corresponding to an      */
-/* existing relation.                                            */
-/*****************************************************************/
-{ int i;
-  char prelname[256];
-  s32 r, loc, a, b, total=0;
-  u32  h;
-  rel_list RL;
-  
+  while (len > 0) {
+    if ((n = read(fd, p, len)) <= 0) {
+      if ((n < 0) && (errno == EINTR)) continue;
+      return -1;
+    }
+    p += n; len -= n;
+  }
+  return 0;
+}
 
-  allocateRelList(prelF, &RL);
+/***************************************************************/
+static void nr_worker(int w, int numWorkers, int fd, unsigned char *d, s64 size,
+                      nf_t *N)
+/***************************************************************/
+/* Parse and factor batches w, w+numWorkers, ... and send the  */
+/* results, one batch at a time, down 'fd'. For each line that */
+/* parses, the record is: a (2 s32's), b, then the number of   */
+/* s32's in 'data' format and the data, or -1 if the relation  */
+/* did not factor.                                             */
+/***************************************************************/
+{ relation_t R;
+  s64  k, s, e, eol;
+  s32 *out, outSize, outIndex;
+  unsigned char *line, *tail=NULL;
+  int  shortForm, factRes;
+
+  outSize = 65536;
+  out = (s32 *)lxmalloc(outSize*sizeof(s32), 1);
+  for (k=w; k*NR_BATCH_BYTES < size; k += numWorkers) {
+    s = nr_lineStart(d, size, k*NR_BATCH_BYTES);
+    e = nr_lineStart(d, size, (k+1)*NR_BATCH_BYTES);
+    outIndex = 0;
+    for (; s < e; s = eol+1) {
+      for (eol = s; (eol < size) && d[eol] && (d[eol] != '\n'); eol++) ;
+      line = d + s;
+      if (eol == size) {
+        /* The last line has no end-of-line: copy it so it does. */
+        tail = (unsigned char *)lxmalloc(eol-s+1, 1);
+        memcpy(tail, d+s, eol-s);
+        tail[eol-s] = '\0';
+        line = tail;
+      }
+      shortForm = parseRelLine(&R, line, line + (eol-s), N->FB);
+      if (shortForm >= 0) {
+        if (outSize - outIndex < NR_MAX_REL_S32 + 4) {
+          outSize *= 2;
+          out = (s32 *)realloc(out, outSize*sizeof(s32));
+          if (out == NULL) {
+            fprintf(stderr, "nr_worker(): Memory allocation error!\n");
+            _exit(-1);
+          }
+        }
+        memcpy(&out[outIndex], &R.a, sizeof(s64));
+        out[outIndex+2] = R.b;
+        factRes = (shortForm ? factRel(&R, N) : completePartialRelFact(&R, N, CLIENT_SKIP_R_PRIMES, CLIENT_SKIP_A_PRIMES));
+        if (factRes == 0) {
+          out[outIndex+3] = relConvertToData(&out[outIndex+4], &R);
+          outIndex += 4 + out[outIndex+3];
+        } else {
+          out[outIndex+3] = -1;
+          outIndex += 4;
+        }
+      }
+      if (tail) {
+        free(tail);
+        tail = NULL;
+      }
+    }
+    if (nr_write(fd, &outIndex, sizeof(s32)) ||
+        nr_write(fd, out, outIndex*sizeof(s32)))
+      _exit(-1);
+  }
+  free(out);
+  close(fd);
+  _exit(0);
+}
 
-  memset(hash0, 0x00, hashSize/32);
-  memset(hash1, 0x00, hashSize/32);
-  printf("Building (a,b) hash table..."); fflush(stdout);
-  for (i=0; i<prelF->numFiles; i++) {
-    printf("%d..", i); fflush(stdout);
-    sprintf(prelname, "%s.%d", prelF->prefix, i);
-    if (readRelList(&RL, prelname))
+/***************************************************************/
+static int addNewRelsForked(newrel_buf_t *B, char *fName, nf_t *N, int numWorkers,
+                            s32 *numRead, s32 *numNew, s32 *collisions)
+/***************************************************************/
+/* The pipelined version of the main loop of addNewRelations5: */
+/* the input is mmapped, 'numWorkers' forked processes parse   */
+/* and factor batches of lines (factRel() and friends keep     */
+/* their scratch space in statics, so they cannot be shared    */
+/* between threads), and this process takes the results in     */
+/* batch order, checks for duplicates and appends them to the  */
+/* processed files. So the output is the same as that of the   */
+/* serial loop. Returns nonzero if the pipeline could not be   */
+/* set up, in which case nothing has been done.                */
+/***************************************************************/
+{ struct stat fileInfo;
+  unsigned char *d;
+  s64    size, k, numBatches;
+  s32   *in=NULL, inSize=0, len, i, n=0, b;
+  s64    a;
+  int    fd, w, status, res=0, pfd[2];
+  int    workerFd[NR_MAX_WORKERS];
+  pid_t  pid[NR_MAX_WORKERS];
+  double startTime, now;
+  s32    nextReportNumRead = 10000;
+
+  numWorkers = MIN(numWorkers, NR_MAX_WORKERS);
+  if ((fd = open(fName, O_RDONLY)) < 0)
+    return -1;
+  if (fstat(fd, &fileInfo) || (fileInfo.st_size == 0)) {
+    close(fd);
+    return -1;
+  }
+  size = fileInfo.st_size;
+  d = (unsigned char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (d == MAP_FAILED)
+    return -1;
+  numBatches = (size + NR_BATCH_BYTES - 1)/NR_BATCH_BYTES;
+  numWorkers = (int)MIN(numWorkers, numBatches);
+
+  /* Build the FB lookup hashes before forking, so the workers share them. */
+  lookupRFB(N->FB->rfb[0], N->FB);
+  lookupAFB(N->FB->afb[0], N->FB->afb[1], N->FB);
+  fflush(stdout); fflush(stderr);
+  for (w=0; w<numWorkers; w++) {
+    if (pipe(pfd) || ((pid[w] = fork()) < 0)) {
+      fprintf(stderr, "addNewRelsForked(): could not start worker %d!\n", w);
+      exit(-1);
+    }
+    if (pid[w] == 0) {
+      int j;
+      for (j=0; j<w; j++) close(workerFd[j]);
+      close(pfd[0]);
+      nr_worker(w, numWorkers, pfd[1], d, size, N);
+    }
+    close(pfd[1]);
+    workerFd[w] = pfd[0];
+  }
+  printf("Processing new relations with %d workers.\n", numWorkers);
+
+  startTime = sTime();
+  for (k=0; k<numBatches; k++) {
+    fd = workerFd[k % numWorkers];
+    if (nr_read(fd, &len, sizeof(s32))) {
+      res = -2;
+      break;
+    }
+    if (len > inSize) {
+      inSize = len;
+      in = (s32 *)realloc(in, inSize*sizeof(s32));
+      if (in == NULL) {
+        fprintf(stderr, "addNewRelsForked(): Memory allocation error!\n");
+        exit(-1);
+      }
+    }
+    if (nr_read(fd, in, len*sizeof(s32))) {
+      res = -2;
       break;
-    /* Now go through the list and hash out each (a,b) pair from both tables. */
-    for (r=0; r<RL.numRels; r++) {
-      loc = RL.relIndex[r];
-      a = RL.relData[loc+1];
-      b = RL.relData[loc+2];
-      h = REL_HASH0(a, b, hashSize);
-      hash0[h/32] |= BIT(h&0x0000001F);
-      h = REL_HASH1(a, b, hashSize);
-      hash1[h/32] |= BIT(h&0x0000001F);
-      total++;
+    }
+    for (i=0; i<len; i += 4 + MAX(n, 0)) {
+      memcpy(&a, &in[i], sizeof(s64));
+      b = in[i+2];
+      n = in[i+3];
+      (*numRead)++;
+      if (checkAB(a, b)==0) {
+        if (n >= 0) {
+          markAB(a, b);
+          storeNewRel(B, b, &in[i+4], n);
+          (*numNew)++;
+        }
+      } else {
+        (*collisions)++;
+      }
+      if (*numRead >= nextReportNumRead) {
+        nextReportNumRead += 10000;
+        now = sTime();
+        printTmp("Status: processed %ld relations from %s... (at %1.2lf rels/sec)",
+                   *numRead, fName,
+                   now != startTime ? (double)*numRead / (now - startTime) : 0.0);
+      }
     }
   }
-  printf("\n");
-  clearRelList(&RL);
-  return total;
+  for (w=0; w<numWorkers; w++) {
+    close(workerFd[w]);
+    waitpid(pid[w], &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+      res = -2;
+  }
+  if (res) {
+    fprintf(stderr, "addNewRelsForked(): a worker failed!\n");
+    exit(-1);
+  }
+  if (in) free(in);
+  munmap(d, size);
+  return 0;
 }
+#endif
+
+/***************************************************************/
+static int isGzipped(char *fName)
+/***************************************************************/
+/* Does fName start with the gzip magic bytes?                 */
+/***************************************************************/
+{ FILE *fp;
+  unsigned char m[2];
+  int   res=0;
 
+  if ((fp = fopen(fName, "rb"))) {
+    res = ((fread(m, 1, 2, fp) == 2) && (m[0] == 0x1f) && (m[1] == 0x8b));
+    fclose(fp);
+  }
+  return res;
+}
 
 /***************************************************************/
-s32 addNewRelations5(multi_file_t *prelF, char *fName,  nf_t *N)
+s32 addNewRelations5(multi_file_t *prelF, char *fName,  nf_t *N, int numWorkers)
 /***************************************************************/
 /* Read new relations from fName and add them to the processed */
 /* relation files. This function is very different from its    */
 /* predecessor, addNewRelations4() in that it does everything  */
 /* (and does it more efficiently).                             */
+/* With numWorkers > 1, the parsing and factoring is done by   */
+/* that many worker processes (see addNewRelsForked()).        */
+/* fName may be gzipped if we have zlib; it is then read       */
+/* serially.                                                   */
 /* NOT DONE YET! */
 /***************************************************************/
 { s32        numNew=0, numRead=0, total=0;
   relation_t R;
   FILE      *fp, *ofp;
-  int        factRes, i, j;
+  relfile_t  rf;
+  int        factRes, i, shortForm, gzipped, fMore=0;
   char       thisLine[512];
   double     startTime, now;
   s32        nextReportNumRead = 10000, collisions=0;
-  s32        fSize, fBlockSize, fRemainSize, fTotalRead=0;
-  u32        s;
+  s32        fSize, fBufSize, fBlockSize, fRemainSize;
+  s32        relData[NR_MAX_REL_S32];
   unsigned char *fData, *fPos, *fLimit = NULL, *fEol = NULL;
   unsigned char *fWarningTrack=NULL;
-  static char xdigit[256] = {
-    -2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0x00+ */
-    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0x10+ */
-    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0x20+ */
-     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1, /* 0x30+ */
-    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0x40+ */
-    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0x50+ */
-    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0x60+ */
-    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0x70+ */
-    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0x80+ */
-    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0x90+ */
-    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0xa0+ */
-    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0xb0+ */
-    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0xc0+ */
-    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0xd0+ */
-    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0xe0+ */
-    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, /* 0xf0+ */
-  };
-  nfs_fb_t *FB = N->FB;
-  s32 maxRFB = FB->rfb[2 * (FB->rfb_size - 1)];
-  s32 maxAFB = FB->afb[2 * (FB->afb_size - 1)];
-  s32 bufSize;
-  s32 *newData[256], newDataIndex[256], newRels[256], relsInFile;
-  int  fileno;
+  newrel_buf_t B;
+  s32 relsInFile;
   char prelname[256];
 
   /* If there is nothing to add, we still must return the
@@ -728,256 +958,111 @@ s32 addNewRelations5(multi_file_t *prelF, char *fName,  nf_t *N)
     }
     return total;
   }
+  fclose(fp);
 
   total = makeABLookup(prelF);
   printf("Before processing new relations, there are %" PRId32 " total.\n", total);
 
   /* Set up to prepare for the new data: */
-  bufSize = MAX_PBUF_RAM/(MAX(1,prelF->numFiles)*sizeof(s32));
+  B.prelF = prelF;
+  B.bufSize = MAX_PBUF_RAM/(MAX(1,prelF->numFiles)*sizeof(s32));
   for (i=0; i<prelF->numFiles; i++) {
-    if (!(newData[i] = (s32 *)malloc(bufSize*sizeof(s32)))) {
+    if (!(B.data[i] = (s32 *)malloc(B.bufSize*sizeof(s32)))) {
       printf("Mem. allocation error for newData!\n");
       exit(-1);
     }
-    newDataIndex[i]=0;
-    newRels[i]=0;
+    B.dataIndex[i]=0;
+    B.numRels[i]=0;
   }
-  if (!(fp = fopen(fName, "r"))) {
+  gzipped = isGzipped(fName);
+#ifdef PROCRELS_FORK
+  if (gzipped && (numWorkers > 1))
+    printf("%s is gzipped; it will be read serially.\n", fName);
+  else if ((numWorkers > 1) &&
+      (addNewRelsForked(&B, fName, N, numWorkers, &numRead, &numNew, &collisions) == 0)) {
+    fData = NULL;
+    goto done;
+  }
+#endif
+  if (!(fp = fopen(fName, "rb"))) {
     fprintf(stderr, "Error opening %s for read.\n", fName);
+    clearABLookup(prelF);
     return 0;
   }
   fseek(fp, 0, SEEK_END);
   fSize = ftell(fp);
+  fclose(fp);
   if (fSize == 0) {
-    fclose(fp);
+    clearABLookup(prelF);
     return 0;
   }
-  fseek(fp, 0, SEEK_SET);
-  fBlockSize = MIN(fSize, MAX_SPAIRS_ALLOC);
-  if ((fData = (unsigned char *)malloc(fBlockSize + 1)) != NULL) {
-    fTotalRead = fread(fData, 1, fBlockSize, fp);
-    fLimit = fWarningTrack = fData + fBlockSize;
-    if (fBlockSize >= MAX_SPAIRS_ALLOC)
+  if (!(rf = rf_open(fName))) {
+    fprintf(stderr, "Error opening %s for read.\n", fName);
+    clearABLookup(prelF);
+    return 0;
+  }
+#if defined (HAVE_ZLIB) && (ZLIB_VERNUM >= 0x1235)
+  gzbuffer(rf, 1<<17);
+#endif
+  /* The uncompressed size of a gzipped file is not known up front. */
+  fBufSize = gzipped ? MAX_SPAIRS_ALLOC : MIN(fSize, MAX_SPAIRS_ALLOC);
+  if ((fData = (unsigned char *)malloc(fBufSize + 1)) != NULL) {
+    fBlockSize = rf_read(rf, fData, fBufSize);
+    fBlockSize = MAX(0, fBlockSize);
+    fMore = (fBufSize >= MAX_SPAIRS_ALLOC) && (fBlockSize == fBufSize);
+    fLimit = fData + fBlockSize;
+    fWarningTrack = fData + fBufSize;
+    if (fBufSize >= MAX_SPAIRS_ALLOC)
       fWarningTrack -= 512; /* Where we stop and read the next block from file. */
     *fLimit = '\0';
     fEol = fData - 1;
   }
   startTime = sTime();
   for (;;) {
-    s32 r, k;
-    s64 p;
-    int c, m;
-    int short_form = 0; /* 0 - we have only a,b.
-                           1 - we have a,b and all large factors. */
-
     if (fData != NULL) {
       fPos = fEol + 1;
       if (fPos >= fLimit) {
         break;
-      } else if ((fPos > fWarningTrack)&&(fTotalRead < fSize)) {
+      } else if ((fPos > fWarningTrack)&&fMore) {
         /* Read the next block of data from file. */
         fRemainSize = fLimit-fPos;
         memmove(fData, fPos, fRemainSize*sizeof(char));
-        fBlockSize = fRemainSize + fread(fData+fRemainSize, 1, fBlockSize-fRemainSize,fp);
-        fTotalRead += fBlockSize;
+        i = rf_read(rf, fData+fRemainSize, fBufSize-fRemainSize);
+        i = MAX(0, i);
+        fMore = (i == fBufSize-fRemainSize);
+        fBlockSize = fRemainSize + i;
         fPos = fData;
 //        fEol = fData - 1;
         fLimit = fData + fBlockSize;
         *fLimit = '\0';
       }
     } else {
-      if (feof(fp)) {
+      if (rf_eof(rf)) {
         break;
       }
       thisLine[0] = '\0';
-      fgets(thisLine, 512, fp);
+      if (rf_gets(rf, thisLine, 512) == NULL)
+        break;
       fPos = thisLine;
     }
     for (fEol = fPos; *fEol && *fEol != '\n'; fEol++) { /* search end-of-line */
       ;
     }
-    if (*fPos == '#') { /* comment line */
+    if ((shortForm = parseRelLine(&R, fPos, fEol, N->FB)) < 0)
       continue;
-    }
     *fEol = '\0';
 
-    /* expand and optimize parseOutputLine() */
-    /* %ld */
-    fPos += (m = *fPos == '-');
-    if ((unsigned int)(p = *fPos - '0') >= 10) 
-    {
-      continue;
-    }
-    
-    fPos++;
-    
-    while ((unsigned int)(c = *fPos - '0') < 10) 
-    {
-      p = (((p << 2) + p) << 1) + c; /* p = p * 10 + c */
-      fPos++;
-    }
-    
-    R.a = m ? -p : p;
-    
-    /* , */
-    fPos++;
-    
-    /* %ld */
-    fPos += (m = *fPos == '-');
-    
-    if ((unsigned int)(p = *fPos - '0') >= 10) 
-    {
-      continue;
-    }
-    
-    fPos++;
-    
-    while ((unsigned int)(c = *fPos - '0') < 10)
-    {
-      p = (((p << 2) + p) << 1) + c; /* p = p * 10 + c */
-      fPos++;
-    }
-
-    R.b = m ? -p : p;
-
-    /* : */
-    while (fPos < fEol && (*fPos != ':')) 
-    {
-      fPos++;
-    }
-    
-    short_form = (fPos == fEol);
-    fPos++;
-
-    if (short_form == 0)
-    {
-        /* This is long form of the relation.  */
-        /* %lx,%lx,... */
-        for (j=0; j<FB->maxLP; j++)
-        {
-          R.p[j] = 1;
-        }
-
-        R.rFSize = 0;
-        m = 0;
-        
-        while (fPos < fEol && *fPos != ':') 
-        {
-          if ((p = xdigit[*fPos++]) < 0) 
-          {
-            continue;
-          }
-          
-          while ((c = xdigit[*fPos]) >= 0) 
-          {
-            p = (p << 4) + c;
-            fPos++;
-          }
-          
-          k = lookupRFB(p, FB);
-          
-          if (k >= 0)
-          {
-            R.rFactors[R.rFSize++] = k;
-          }
-          else if ((p > maxRFB) && (m < FB->maxLP)) 
-          {
-            R.p[m++] = p;
-          }
-        }
-
-        /* : */
-        fPos += *fPos == ':';
-        
-        /* %lx,%lx,... */
-        
-        for (j=0; j<FB->maxLPA; j++)
-        {
-          R.a_p[j] = R.a_r[j] = 1;
-        }
-
-        R.aFSize = 0;
-        m = 0;
-        
-        while (fPos < fEol && *fPos != ':') 
-        {
-          if ((p = xdigit[*fPos++]) < 0) 
-          {
-            continue;
-          }
-          
-          while ((c = xdigit[*fPos]) >= 0) 
-          {
-            p = (p << 4) + c;
-            fPos++;
-          }
-          
-          if (R.b % p) 
-          { 
-            /* p is always non-zero? */
-            r = mulmod32(p + (R.a % p), inverseModP(R.b, p), p);
-            k = lookupAFB(p, r, FB);
-          
-            if (k >= 0) 
-            {
-              R.aFactors[R.aFSize++] = k;
-            } 
-            else 
-            if ((p > maxAFB) && (m < FB->maxLPA)) 
-            {
-              R.a_p[m] = p; 
-              R.a_r[m++] = r;
-            }
-          }
-        }
-    } /* if (*fPos == ':')  */
-
     numRead++;
 
 //    printf("Read (%" PRId64 ", %ld) from file\n", R.a, R.b );
 
     if (checkAB(R.a, R.b)==0) {
-      fileno = NFS_HASH(R.b, R.b, prelF->numFiles);
       /* Sten: we smartly choose here if this is short format or long and thus if
                we should try to factor relation completely or only partly. */
-      factRes = (short_form ? factRel(&R, N) : completePartialRelFact(&R, N, CLIENT_SKIP_R_PRIMES, CLIENT_SKIP_A_PRIMES));
+      factRes = (shortForm ? factRel(&R, N) : completePartialRelFact(&R, N, CLIENT_SKIP_R_PRIMES, CLIENT_SKIP_A_PRIMES));
       if (factRes == 0) {
-        k = newDataIndex[fileno];
-        newDataIndex[fileno] += relConvertToData(&newData[fileno][newDataIndex[fileno]], &R);
-        s = newData[fileno][k];
-        relsNumLP[GETNUMLRP(s)+GETNUMLAP(s)] += 1;
-
-        newRels[fileno] += 1;
-        if (bufSize - newDataIndex[fileno]  < 500) {
-          /* Append to file and clear. */
-          /* It should be possible to do this with one fopen(), but I don't
-             know about portability of doing it that way. */
-          sprintf(prelname, "%s.%d", prelF->prefix, fileno);
-          if ((ofp = fopen(prelname, "rb"))) {
-            rewind(ofp);
-            fread(&relsInFile, sizeof(s32), 1, ofp);
-            fclose(ofp);
-          } else {
-            relsInFile=0;
-            /* And create the file. */
-            ofp = fopen(prelname, "wb"); 
-            fclose(ofp);
-          }
-          relsInFile += newRels[fileno];
-          if ((ofp = fopen(prelname, "r+b"))) {
-            rewind(ofp);
-            fwrite(&relsInFile, sizeof(s32), 1, ofp);
-            fseek(ofp, 0, SEEK_END);
-            fclose(ofp);
-          } 
-          if ((ofp = fopen(prelname, "ab"))) {
-            fwrite(newData[fileno], sizeof(s32), newDataIndex[fileno], ofp);
-            fclose(ofp);
-          }
-          newDataIndex[fileno]=0;
-          newRels[fileno]=0;
-        }
-         
+        markAB(R.a, R.b);
+        storeNewRel(&B, R.b, relData, relConvertToData(relData, &R));
         numNew++;
       } else {
 #ifdef _DEBUG
@@ -997,51 +1082,133 @@ s32 addNewRelations5(multi_file_t *prelF, char *fName,  nf_t *N)
                  now != startTime ? (double)numRead / (now - startTime) : 0.0);
     }
   }
-  fclose(fp);
+  rf_close(rf);
+#ifdef PROCRELS_FORK
+done:
+#endif
 
   /* Dump any remaining relations to their files. */
   for (i=0; i<prelF->numFiles; i++) {
-    if (newRels[i] > 0) {
-      sprintf(prelname, "%s.%d", prelF->prefix, i);
-      if ((ofp = fopen(prelname, "rb"))) {
-        rewind(ofp);
-        fread(&relsInFile, sizeof(s32), 1, ofp);
-        fclose(ofp);
-      } else { 
-        relsInFile=0;  
-        /* Create the file. */
-        ofp = fopen(prelname, "wb"); 
-        fclose(ofp);
-      }
-      relsInFile += newRels[i];
-      if ((ofp = fopen(prelname, "r+b"))) {
-        rewind(ofp);
-        fwrite(&relsInFile, sizeof(s32), 1, ofp);
-        fseek(ofp, 0, SEEK_END);
-        fclose(ofp);
-      } 
-      if ((ofp = fopen(prelname, "ab"))) {
-        fwrite(newData[i], sizeof(s32), newDataIndex[i], ofp);
-        fclose(ofp);
-      }
-      newDataIndex[i]=0;
-      newRels[i]=0;
-    }
+    if (B.numRels[i] > 0)
+      flushNewRels(&B, i);
   }
   printf("\n");
 
   if (fData != NULL) 
     free(fData);
   for (i=0; i<prelF->numFiles; i++) 
-    free(newData[i]);
-  clearABLookup();
-  printf("   abExtra was sorted %" PRId32 " times.\n", sortOps);
+    free(B.data[i]);
+  clearABLookup(prelF);
   msgLog("", "There were %" PRId32 "/%" PRId32 " duplicates.",
          collisions, numRead);
   total += numNew;
   return total;
 }
 
+#ifdef PROCRELS_FOLLOW
+static volatile sig_atomic_t followStop=0;
+
+/***************************************************************/
+static void followSignal(int sig)
+/***************************************************************/
+{
+  followStop = sig;
+}
+
+/***************************************************************/
+static int followNewRels(multi_file_t *prelF, char *fName, nf_t *N,
+                         int numWorkers, int secs, s64 minFF)
+/***************************************************************/
+/* The -follow mode: keep adding the complete lines appended   */
+/* to fName, a batch at a time, until there are minFF fulls +  */
+/* cycles (if minFF > 0) or we get SIGINT/SIGTERM. Each batch  */
+/* is copied to <prefix>.batch and goes through                */
+/* addNewRelations5(), so the (a,b) index and the large prime  */
+/* graph are only updated, never rebuilt. How far we got is    */
+/* kept in <prefix>.follow, so a restart carries on from there */
+/* (a batch which was processed but not recorded there has its */
+/* relations thrown out as duplicates the next time).          */
+/***************************************************************/
+{ char   stateName[512], tmpName[520], batchName[512], line[1024];
+  char  *buf, *eol;
+  s64    offset=0, numFF;
+  off_t  size;
+  size_t len;
+  struct stat fileInfo;
+  FILE  *fp, *ofp;
+
+  if (isGzipped(fName)) {
+    printf("-follow: %s is gzipped; it cannot be followed.\n", fName);
+    return -1;
+  }
+  sprintf(stateName, "%s.%s", prelF->prefix, FOLLOW_SUFFIX);
+  sprintf(tmpName, "%s.tmp", stateName);
+  sprintf(batchName, "%s.batch", prelF->prefix);
+  if ((fp = fopen(stateName, "r"))) {
+    if (fgets(line, sizeof(line), fp) &&
+        (sscanf(line, "%" SCNd64, &offset) == 1) &&
+        fgets(line, sizeof(line), fp)) {
+      line[strcspn(line, "\r\n")] = 0;
+      if (strcmp(line, fName))
+        offset = 0;
+    } else offset = 0;
+    fclose(fp);
+  }
+  if (!(buf = (char *)malloc(FOLLOW_BATCH_BYTES))) {
+    printf("followNewRels() : Memory allocation error!\n");
+    return -1;
+  }
+  signal(SIGINT, followSignal);
+  signal(SIGTERM, followSignal);
+  printf("Following %s from byte %" PRId64 ".\n", fName, offset);
+  numFF = countLP(prelF, N->FB);
+  while (!followStop && ((minFF <= 0) || (numFF < minFF))) {
+    size = stat(fName, &fileInfo) ? 0 : fileInfo.st_size;
+    if ((s64)size < offset) {
+      printf("%s shrank; starting over at its beginning.\n", fName);
+      offset = 0;
+    }
+    len = 0;
+    if (((s64)size > offset) && (fp = fopen(fName, "rb"))) {
+      if (fseeko(fp, (off_t)offset, SEEK_SET) == 0)
+        len = fread(buf, 1, (size_t)MIN((s64)size - offset, FOLLOW_BATCH_BYTES), fp);
+      fclose(fp);
+    }
+    /* Only whole lines; the rest is still being written. */
+    for (eol = buf + len; (eol > buf) && (eol[-1] != '\n'); eol--) ;
+    len = eol - buf;
+    if (len == 0) {
+      sleep(secs);
+      continue;
+    }
+    if (!(ofp = fopen(batchName, "wb")) || (fwrite(buf, 1, len, ofp) != len)) {
+      printf("followNewRels() : Could not write %s!\n", batchName);
+      free(buf);
+      return -1;
+    }
+    fclose(ofp);
+    set_prelF(prelF, DEFAULT_MAX_FILESIZE, 1);
+    memset(relsNumLP, 0, sizeof(relsNumLP));
+    addNewRelations5(prelF, batchName, N, numWorkers);
+    remove(batchName);
+    offset += len;
+    if ((fp = fopen(tmpName, "w"))) {
+      fprintf(fp, "%" PRId64 "\n%s\n", offset, fName);
+      fclose(fp);
+      remove(stateName);
+      rename(tmpName, stateName);
+    }
+    numFF = countLP(prelF, N->FB);
+  }
+  free(buf);
+  if (followStop)
+    printf("Stopped by signal %d at byte %" PRId64 " of %s.\n", (int)followStop, offset, fName);
+  else
+    printf("There are now %" PRId64 " fulls + cycles (minff %" PRId64 ").\n", numFF, minFF);
+  return 0;
+}
+#endif
+
 
 #define MAX_DUMP_PER_FILE 250000
 /****************************************************/
@@ -1148,7 +1315,9 @@ int main(int argC, char *args[])
 { char       fbName[64], prelName[40], newRelName[64], depName[64], colName[64];
   char       tmpStr[1024], line[128];
   int        i, qcbSize = DEFAULT_QCB_SIZE, seed=DEFAULT_SEED, retVal=0, dump=0;
-  int        fr=0, maxRelsInFF=MAX_RELS_IN_FF, doCountLP=1;
+  int        fr=0, maxRelsInFF=MAX_RELS_IN_FF, doCountLP=1, numWorkers=1;
+  int        followSecs=0;
+  s64        minFF=0;
   double     startTime, rStart, rStop, pruneFrac=0.0;
   off_t      oldSize, newSize, maxSize;
   s32        totalRels, numNewRels;
@@ -1156,7 +1325,7 @@ int main(int argC, char *args[])
   nf_t       N;
   mpz_fact_t D;
   multi_file_t prelF, lpF;
-  FILE            *fp;
+  relfile_t        rf;
 
   prelF.numFiles = DEFAULT_NUM_FILES;
   lpF.numFiles = 0;
@@ -1205,6 +1374,15 @@ int main(int argC, char *args[])
         pruneFrac = atof(args[i]);
     } else if (strcmp(args[i], "-nolpcount")==0) {
       doCountLP=0;
+    } else if (strcmp(args[i], "-nt")==0) {
+      if ((++i) < argC) 
+        numWorkers = atoi(args[i]);
+    } else if (strcmp(args[i], "-follow")==0) {
+      if ((++i) < argC) 
+        followSecs = MAX(1, atoi(args[i]));
+    } else if (strcmp(args[i], "-minff")==0) {
+      if ((++i) < argC) 
+        minFF = strtoll(args[i], NULL, 10);
     } else if (strcmp(args[i], "-speedtest")==0) {
       u32 a,b[1024],c=rand();
       double start=sTime(), now;
@@ -1295,6 +1473,14 @@ int main(int argC, char *args[])
     dumpPairs("spairs.dump", &prelF, N.FB);
     exit(0);
   }
+  if (followSecs) {
+#ifdef PROCRELS_FOLLOW
+    return followNewRels(&prelF, newRelName, &N, numWorkers, followSecs, minFF) ? -1 : 0;
+#else
+    printf("-follow is not supported on this system.\n");
+    exit(-1);
+#endif
+  }
 
   numNewRels=0;
   if (stat(newRelName, &fileInfo)) {
@@ -1303,12 +1489,12 @@ int main(int argC, char *args[])
   } else {
     newSize = fileInfo.st_size;
     printf("     New file is %1.5lfMB.\n", (double)newSize/(1024.0*1024.0));
-    if ((fp = fopen(newRelName, "r"))) {
-      while (!(feof(fp))) {
-        fgets(tmpStr, 1023, fp);
+    if ((rf = rf_open(newRelName))) {
+      while (!(rf_eof(rf))) {
+        rf_gets(rf, tmpStr, 1023);
         numNewRels++;
       }
-      fclose(fp);
+      rf_close(rf);
     }
     /* Each rel ends with <nl>, so that when the last rel is read from
      * the file it STILL does not indicate EOF.  The "while" loop therefore
@@ -1319,7 +1505,7 @@ int main(int argC, char *args[])
 
   totalRels = 0;
   rStart = sTime();
-  totalRels = addNewRelations5(&prelF, newRelName, &N);
+  totalRels = addNewRelations5(&prelF, newRelName, &N, numWorkers);
   rStop = sTime();
   msgLog("", "RelProcTime: %1.1lf", rStop-rStart);
 
@@ -1342,7 +1528,7 @@ int main(int argC, char *args[])
     }
   }
   if (doCountLP)
-    countLP(&prelF);
+    countLP(&prelF, N.FB);
   return retVal;
 }  
 
@@ -26,6 +26,13 @@
 #include <string.h>
 #include <sys/stat.h>
 
+#if !defined(_MSC_VER) && !defined(__MINGW32__) && !defined(MINGW32)
+#define RELLIST_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
 #ifdef _MSC_VER
 #pragma warning (disable: 4996) /* warning C4996: 'function' was declared deprecated */
 #endif
@@ -53,6 +60,8 @@ int allocateRelList(multi_file_t *prelF, rel_list *RL)
 	}
 
 	RL->numRels = 0;
+	RL->mapBase = NULL;
+	RL->mapSize = 0;
 	RL->maxDataSize = 1000 + maxSize/sizeof(s32);
 
 	if (!(RL->relData = (s32 *)lxmalloc(RL->maxDataSize * sizeof(s32), 0))) 
@@ -79,6 +88,77 @@ int allocateRelList(multi_file_t *prelF, rel_list *RL)
 	return 0;
 }
 
+/*********************************************************************/
+/* Map the specified relation file, and index it. relData points     */
+/* straight into the (private, copy-on-write) mapping, so nothing is */
+/* copied; only relIndex is allocated.                               */
+/*********************************************************************/
+rel_list *mapRelList(multi_file_t *prelF, int index)
+{
+#ifdef RELLIST_MMAP
+	rel_list *RL;
+	char      fName[sizeof(prelF->prefix) + 16];
+	struct stat fileInfo;
+	void     *base;
+	size_t    size, dataSize, pos;
+	u32       r;
+	int       fd;
+
+	sprintf(fName, "%s.%d", prelF->prefix, index);
+	if ((fd = open(fName, O_RDONLY)) < 0)
+		return NULL;
+	if (fstat(fd, &fileInfo) || (fileInfo.st_size < (off_t)sizeof(s32)))
+	{
+		close(fd);
+		return NULL;
+	}
+	size = fileInfo.st_size;
+	base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return NULL;
+#ifdef MADV_SEQUENTIAL
+	madvise(base, size, MADV_SEQUENTIAL);
+#endif
+
+	RL = (rel_list *)lxmalloc(sizeof(rel_list), 1);
+	RL->mapBase = base;
+	RL->mapSize = size;
+	RL->numRels = ((u32 *)base)[0];
+	RL->relData = (s32 *)base + 1;
+	RL->maxDataSize = dataSize = size/sizeof(s32) - 1;
+	RL->maxRels = RL->numRels + 1;
+	if (!(RL->relIndex = (u32 *)lxmalloc(RL->maxRels * sizeof(s32), 0)))
+	{
+		fprintf(stderr, "Error allocating %" PRIu32 "MB for relation pointers!\n",
+			(u32)(RL->maxRels * sizeof(s32)/1048576) );
+		munmap(base, size);
+		free(RL);
+		return NULL;
+	}
+
+	for (r = 0, pos = 0; r < RL->numRels; r++)
+	{
+		if (pos >= dataSize)
+			break;
+		RL->relIndex[r] = (u32)pos;
+		pos += S32S_IN_ENTRY(RL->relData[pos]);
+	}
+	if ((r < RL->numRels) || (pos > dataSize))
+	{
+		fprintf(stderr, "mapRelList() Error: File %s appears corrupted!\n", fName);
+		if (pos > dataSize)
+			r--;
+		RL->numRels = r;
+		pos = (r > 0) ? RL->relIndex[r-1] + S32S_IN_ENTRY(RL->relData[RL->relIndex[r-1]]) : 0;
+	}
+	RL->relIndex[RL->numRels] = (u32)pos;
+	return RL;
+#else
+	return NULL;
+#endif
+}
+
 /*********************************************************************/
 /* Allocate for and read in the specified relation file. Caller is   */
 /* obviously responsible for freeing the memory when done!           */
@@ -87,11 +167,16 @@ rel_list *getRelList(multi_file_t *prelF, int index)
 { 
 	rel_list *RL;
 	FILE     *fp;
-	char      fName[256];
+	char      fName[sizeof(prelF->prefix) + 16];
 	struct stat fileInfo;
 
+	if ((RL = mapRelList(prelF, index)))
+		return RL;
+
 	RL = (rel_list *)lxmalloc(sizeof(rel_list), 1);
 	RL->maxDataSize = 0;
+	RL->mapBase = NULL;
+	RL->mapSize = 0;
 	sprintf(fName, "%s.%d", prelF->prefix, index);
 
 	if (stat(fName, &fileInfo)) 
@@ -138,6 +223,11 @@ rel_list *getRelList(multi_file_t *prelF, int index)
 /*********************************************************************/
 void clearRelList(rel_list *RL)
 {
+#ifdef RELLIST_MMAP
+	if (RL->mapBase != NULL)
+		munmap(RL->mapBase, RL->mapSize);
+	else
+#endif
 	if (RL->relData != NULL) 
 		free(RL->relData);
 
@@ -145,6 +235,8 @@ void clearRelList(rel_list *RL)
 		free(RL->relIndex);
 
 	RL->relData = RL->relIndex = NULL;
+	RL->mapBase = NULL;
+	RL->mapSize = 0;
 	RL->maxDataSize = RL->maxRels = 0;
 }
 
@@ -37,9 +37,17 @@ extern "C" {
 /******************************************************/
 int allocateRelList(multi_file_t *prelF, rel_list *RL);
 
+/*********************************************************************/
+/* Map the specified relation file read-only (copy-on-write) and     */
+/* index it, without copying the relation data. Returns NULL if the  */
+/* file cannot be mapped. clearRelList() unmaps it.                  */
+/*********************************************************************/
+rel_list *mapRelList(multi_file_t *prelF, int index);
+
 /*********************************************************************/
 /* Allocate for and read in the specified relation file. Caller is   */
 /* obviously responsible for freeing the memory when done!           */
+/* The file is mapped with mapRelList() when possible.               */
 /*********************************************************************/
 rel_list *getRelList(multi_file_t *prelF, int index);
 
@@ -0,0 +1,530 @@
+/**************************************************************/
+/* spqserver.c                                                */
+/* Hands out the special q of one lattice sieving job, in     */
+/* leased chunks, to any number of gnfs-lasieve4I*e -Q        */
+/* clients, and collects their relations.                     */
+/**************************************************************/
+/*  This file is part of GGNFS.
+*
+*   GGNFS is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   GGNFS is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with GGNFS; if not, write to the Free Software
+*   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Protocol. Each request is one line from the client, answered by one
+   line from the server:
+
+     JOB             -> JOB <q0> <q1>       the whole range [q0,q1)
+     LEASE           -> RANGE <id> <lb> <ub> <secs>
+                        WAIT <secs>         all chunks are leased; ask again
+                        DONE                all chunks are done
+     RENEW <id>      -> OK | LOST           extends the lease by <secs>
+     PUT <id> <n>    -> OK | LOST           followed by n bytes of relations
+     DROP <id>       -> OK                  gives the chunk back
+     STAT            -> STAT <done> <leased> <free> <clients>
+
+   A lease which is not renewed within its time becomes free again and
+   is handed to the next client that asks. The relations of a chunk are
+   accepted once, from the holder of its latest lease, even after it has
+   expired, as long as no other client has leased the chunk since.
+   They are appended to the output file, and the chunk is recorded as
+   done in the state file after the relations are on disk; a server which
+   is restarted with the same state file leases only the chunks which
+   are not recorded there.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ggnfs.h"
+
+#define DEFAULT_PORT 7117
+#define DEFAULT_CHUNK 1000
+#define DEFAULT_LEASE 600
+#define DEFAULT_OUTNAME "spairs.add"
+#define DEFAULT_STATENAME "spqserver.state"
+#define MAX_CLIENTS 1024
+#define MAX_LINE 256
+
+#define USAGE " -f <q0> -c <count> [options]\n"\
+"-f <int>        : first special q.\n"\
+"-c <int>        : number of special q to sieve (the range is [q0,q0+count)).\n"\
+"-chunk <int>    : special q per lease (default 1000).\n"\
+"-lease <int>    : seconds until a lease which is not renewed expires\n"\
+"                  (default 600).\n"\
+"-port <int>     : TCP port (default 7117).\n"\
+"-bind <addr>    : address to listen on (default 127.0.0.1).\n"\
+"-sock <path>    : listen on this Unix socket instead of TCP.\n"\
+"-o <fname>      : relation output, appended to (default spairs.add).\n"\
+"-state <fname>  : file of the completed chunks (default spqserver.state).\n"
+
+#define START_MSG \
+"\n"\
+" __________________________________________________________ \n"\
+"|        This is the spqserver program for GGNFS.          |\n"\
+"| Version: %-25s                       |\n"\
+"| This program is subject to the terms of the GNU General  |\n"\
+"| Public License version 2.                                |\n"\
+"|__________________________________________________________|\n"
+
+#define CHUNK_FREE   0
+#define CHUNK_LEASED 1
+#define CHUNK_DONE   2
+
+typedef struct {
+  u32    lb, ub, lease, state;
+  time_t expires;
+} chunk_t;
+
+typedef struct {
+  int    fd;
+  char  *in;
+  size_t inlen, inalloc;
+  size_t need;       /* Bytes of PUT data still to come. */
+  u32    put_lease;
+} client_t;
+
+static chunk_t  *chunks;
+static u32       numChunks, numDone, nextLease = 1, leaseSecs = DEFAULT_LEASE;
+static u32       q0, q1;
+static client_t  clients[MAX_CLIENTS];
+static u32       numClients;
+static FILE     *outFile, *stateFile;
+
+/******************************************************/
+static void sendLine(client_t *C, const char *fmt, ...)
+/******************************************************/
+{ char    buf[MAX_LINE];
+  va_list ap;
+  size_t  len, off;
+  ssize_t n;
+
+  va_start(ap, fmt);
+  vsnprintf(buf, MAX_LINE, fmt, ap);
+  va_end(ap);
+  len = strlen(buf);
+  /* The replies are short, and the client waits for them; a client */
+  /* which does not take them is dropped by the next read.          */
+  for (off = 0; off < len; off += n) {
+    n = write(C->fd, buf + off, len - off);
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR) {
+        n = 0;
+        continue;
+      }
+      return;
+    }
+  }
+}
+
+/******************************************************/
+static chunk_t *chunkOfLease(u32 lease)
+/******************************************************/
+{ u32 i;
+
+  if (lease == 0)
+    return NULL;
+  for (i = 0; i < numChunks; i++)
+    if (chunks[i].lease == lease)
+      return &chunks[i];
+  return NULL;
+}
+
+/******************************************************/
+static void expireLeases(time_t now)
+/******************************************************/
+{ u32 i;
+
+  for (i = 0; i < numChunks; i++) {
+    if (chunks[i].state == CHUNK_LEASED && chunks[i].expires < now) {
+      chunks[i].state = CHUNK_FREE;
+      printf("Lease %u on [%u,%u) expired.\n", chunks[i].lease,
+             chunks[i].lb, chunks[i].ub);
+    }
+  }
+}
+
+/******************************************************/
+static int readState(char *stateName, u32 chunkSize)
+/******************************************************/
+/* Mark the chunks recorded in the state file as    */
+/* done, or start a new state file.                 */
+/******************************************************/
+{ char line[MAX_LINE];
+  u32  a, b, c, i;
+  FILE *fp;
+
+  if ((fp = fopen(stateName, "r")) != NULL) {
+    if (fgets(line, MAX_LINE, fp) == NULL ||
+        sscanf(line, "spqserver %u %u %u", &a, &b, &c) != 3) {
+      fprintf(stderr, "Error: %s is not a spqserver state file.\n", stateName);
+      return -1;
+    }
+    if (a != q0 || b != q1 || c != chunkSize) {
+      fprintf(stderr, "Error: %s is for -f %u -c %u -chunk %u.\n",
+              stateName, a, b - a, c);
+      return -1;
+    }
+    while (fgets(line, MAX_LINE, fp) != NULL) {
+      /* An incomplete last line is from a crash before the fsync(). */
+      if (sscanf(line, "done %u %u", &a, &b) != 2 || a < q0 || a >= q1)
+        continue;
+      i = (a - q0) / chunkSize;
+      if (chunks[i].lb == a && chunks[i].state != CHUNK_DONE) {
+        chunks[i].state = CHUNK_DONE;
+        numDone++;
+      }
+    }
+    fclose(fp);
+    if ((stateFile = fopen(stateName, "a")) == NULL) {
+      fprintf(stderr, "Error opening %s for append!\n", stateName);
+      return -1;
+    }
+    printf("%u of %u chunks were already done.\n", numDone, numChunks);
+    return 0;
+  }
+  if ((stateFile = fopen(stateName, "w")) == NULL) {
+    fprintf(stderr, "Error opening %s for write!\n", stateName);
+    return -1;
+  }
+  fprintf(stateFile, "spqserver %u %u %u\n", q0, q1, chunkSize);
+  fflush(stateFile);
+  fsync(fileno(stateFile));
+  return 0;
+}
+
+/******************************************************/
+static void finishPut(client_t *C)
+/******************************************************/
+/* The C->in[0..need) are the relations of the      */
+/* lease C->put_lease.                              */
+/******************************************************/
+{ chunk_t *ch = chunkOfLease(C->put_lease);
+
+  if (ch == NULL || ch->state == CHUNK_DONE) {
+    printf("Relations for lease %u dropped: the chunk was reissued.\n",
+           C->put_lease);
+    sendLine(C, "LOST\n");
+    return;
+  }
+  if (C->need > 0 && C->in[C->need - 1] != '\n') {
+    /* Never leave a partial line in the output. */
+    printf("Relations for lease %u dropped: incomplete last line.\n",
+           C->put_lease);
+    sendLine(C, "LOST\n");
+    return;
+  }
+  if (fwrite(C->in, 1, C->need, outFile) != C->need || fflush(outFile) != 0 ||
+      fsync(fileno(outFile)) != 0) {
+    fprintf(stderr, "Error writing the relations: %s\n", strerror(errno));
+    exit(-1);
+  }
+  fprintf(stateFile, "done %u %u\n", ch->lb, ch->ub);
+  fflush(stateFile);
+  fsync(fileno(stateFile));
+  ch->state = CHUNK_DONE;
+  numDone++;
+  printf("[%u,%u) done (%u of %u).\n", ch->lb, ch->ub, numDone, numChunks);
+  sendLine(C, "OK\n");
+}
+
+/******************************************************/
+static void doCommand(client_t *C, char *line)
+/******************************************************/
+{ chunk_t *ch;
+  u32      id, i, nLeased, nFree;
+  unsigned long n;
+  time_t   now = time(NULL);
+
+  if (strcmp(line, "JOB") == 0) {
+    sendLine(C, "JOB %u %u\n", q0, q1);
+  } else if (strcmp(line, "LEASE") == 0) {
+    expireLeases(now);
+    for (i = 0; i < numChunks && chunks[i].state != CHUNK_FREE; i++);
+    if (i < numChunks) {
+      ch = &chunks[i];
+      ch->state = CHUNK_LEASED;
+      ch->lease = nextLease++;
+      ch->expires = now + leaseSecs;
+      sendLine(C, "RANGE %u %u %u %u\n", ch->lease, ch->lb, ch->ub, leaseSecs);
+    } else if (numDone < numChunks) {
+      sendLine(C, "WAIT %u\n", leaseSecs < 60 ? 1 : 10);
+    } else
+      sendLine(C, "DONE\n");
+  } else if (sscanf(line, "RENEW %u", &id) == 1) {
+    ch = chunkOfLease(id);
+    if (ch != NULL && ch->state == CHUNK_LEASED) {
+      ch->expires = now + leaseSecs;
+      sendLine(C, "OK\n");
+    } else
+      sendLine(C, "LOST\n");
+  } else if (sscanf(line, "DROP %u", &id) == 1) {
+    ch = chunkOfLease(id);
+    if (ch != NULL && ch->state == CHUNK_LEASED)
+      ch->state = CHUNK_FREE;
+    sendLine(C, "OK\n");
+  } else if (sscanf(line, "PUT %u %lu", &id, &n) == 2) {
+    C->put_lease = id;
+    C->need = n;
+  } else if (strcmp(line, "STAT") == 0) {
+    expireLeases(now);
+    for (i = 0, nLeased = nFree = 0; i < numChunks; i++) {
+      if (chunks[i].state == CHUNK_LEASED)
+        nLeased++;
+      else if (chunks[i].state == CHUNK_FREE)
+        nFree++;
+    }
+    sendLine(C, "STAT %u %u %u %u\n", numDone, nLeased, nFree, numClients);
+  } else
+    sendLine(C, "ERROR\n");
+}
+
+/******************************************************/
+static int readClient(client_t *C)
+/******************************************************/
+/* Returns -1 when the client has gone away.        */
+/******************************************************/
+{ ssize_t n;
+  char   *eol;
+  size_t  used;
+
+  if (C->inalloc - C->inlen < 65536) {
+    C->inalloc = C->inalloc * 2 + 65536;
+    C->in = realloc(C->in, C->inalloc);
+    if (C->in == NULL) {
+      fprintf(stderr, "Memory allocation error!\n");
+      exit(-1);
+    }
+  }
+  n = read(C->fd, C->in + C->inlen, C->inalloc - C->inlen);
+  if (n < 0 && errno == EINTR)
+    return 0;
+  if (n <= 0)
+    return -1;
+  C->inlen += n;
+
+  for (;;) {
+    if (C->need > 0 || C->put_lease != 0) {
+      /* The whole PUT is collected first, so that the relations */
+      /* of two clients are never interleaved in the output.     */
+      if (C->inlen < C->need)
+        break;
+      finishPut(C);
+      used = C->need;
+      C->need = 0;
+      C->put_lease = 0;
+    } else {
+      if ((eol = memchr(C->in, '\n', C->inlen)) == NULL) {
+        if (C->inlen > MAX_LINE)
+          return -1;
+        break;
+      }
+      *eol = 0;
+      if (eol > C->in && eol[-1] == '\r')
+        eol[-1] = 0;
+      used = eol + 1 - C->in;
+      doCommand(C, C->in);
+    }
+    memmove(C->in, C->in + used, C->inlen - used);
+    C->inlen -= used;
+  }
+  return 0;
+}
+
+/******************************************************/
+static int openListener(char *sockName, char *bindAddr, int port)
+/******************************************************/
+{ int fd, one = 1;
+
+  if (sockName != NULL) {
+    struct sockaddr_un sun;
+
+    if (strlen(sockName) >= sizeof(sun.sun_path)) {
+      fprintf(stderr, "Error: socket name %s is too long.\n", sockName);
+      return -1;
+    }
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, sockName);
+    unlink(sockName);
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+        bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+      fprintf(stderr, "Error binding %s: %s\n", sockName, strerror(errno));
+      return -1;
+    }
+  } else {
+    struct sockaddr_in sin;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    if (inet_pton(AF_INET, bindAddr, &sin.sin_addr) != 1) {
+      fprintf(stderr, "Error: bad address %s\n", bindAddr);
+      return -1;
+    }
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+      return -1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+      fprintf(stderr, "Error binding %s:%d: %s\n", bindAddr, port,
+              strerror(errno));
+      return -1;
+    }
+  }
+  if (listen(fd, 64) < 0) {
+    fprintf(stderr, "listen: %s\n", strerror(errno));
+    return -1;
+  }
+  return fd;
+}
+
+/****************************************************/
+int main(int argC, char *args[])
+/****************************************************/
+{ char   *outName = DEFAULT_OUTNAME, *stateName = DEFAULT_STATENAME;
+  char   *sockName = NULL, *bindAddr = "127.0.0.1";
+  u32     count = 0, chunkSize = DEFAULT_CHUNK, i;
+  int     port = DEFAULT_PORT, lfd;
+  struct pollfd pfd[MAX_CLIENTS + 1];
+
+  printf(START_MSG, GGNFS_VERSION);
+  q0 = 0;
+  for (i = 1; i < (u32)argC; i++) {
+    if (strcmp(args[i], "-f") == 0) {
+      if ((++i) < (u32)argC)
+        q0 = strtoul(args[i], NULL, 10);
+    } else if (strcmp(args[i], "-c") == 0) {
+      if ((++i) < (u32)argC)
+        count = strtoul(args[i], NULL, 10);
+    } else if (strcmp(args[i], "-chunk") == 0) {
+      if ((++i) < (u32)argC)
+        chunkSize = strtoul(args[i], NULL, 10);
+    } else if (strcmp(args[i], "-lease") == 0) {
+      if ((++i) < (u32)argC)
+        leaseSecs = strtoul(args[i], NULL, 10);
+    } else if (strcmp(args[i], "-port") == 0) {
+      if ((++i) < (u32)argC)
+        port = atoi(args[i]);
+    } else if (strcmp(args[i], "-bind") == 0) {
+      if ((++i) < (u32)argC)
+        bindAddr = args[i];
+    } else if (strcmp(args[i], "-sock") == 0) {
+      if ((++i) < (u32)argC)
+        sockName = args[i];
+    } else if (strcmp(args[i], "-o") == 0) {
+      if ((++i) < (u32)argC)
+        outName = args[i];
+    } else if (strcmp(args[i], "-state") == 0) {
+      if ((++i) < (u32)argC)
+        stateName = args[i];
+    } else if (strcmp(args[i], "--help") == 0) {
+      printf("USAGE: %s %s\n", args[0], USAGE);
+      exit(0);
+    }
+  }
+  if (q0 == 0 || count == 0 || chunkSize == 0 || leaseSecs == 0 ||
+      q0 + count < q0) {
+    printf("USAGE: %s %s\n", args[0], USAGE);
+    exit(-1);
+  }
+  q1 = q0 + count;
+
+  numChunks = (count + chunkSize - 1) / chunkSize;
+  if ((chunks = calloc(numChunks, sizeof(chunk_t))) == NULL) {
+    fprintf(stderr, "Memory allocation error!\n");
+    exit(-1);
+  }
+  for (i = 0; i < numChunks; i++) {
+    chunks[i].lb = q0 + i * chunkSize;
+    chunks[i].ub = (q1 - chunks[i].lb > chunkSize) ? chunks[i].lb + chunkSize : q1;
+    chunks[i].state = CHUNK_FREE;
+  }
+  if (readState(stateName, chunkSize) < 0)
+    exit(-1);
+  if ((outFile = fopen(outName, "ab")) == NULL) {
+    fprintf(stderr, "Error opening %s for append!\n", outName);
+    exit(-1);
+  }
+  if ((lfd = openListener(sockName, bindAddr, port)) < 0)
+    exit(-1);
+  signal(SIGPIPE, SIG_IGN);
+  if (sockName != NULL)
+    printf("Serving [%u,%u) in %u chunks on %s.\n", q0, q1, numChunks, sockName);
+  else
+    printf("Serving [%u,%u) in %u chunks on %s:%d.\n", q0, q1, numChunks,
+           bindAddr, port);
+  fflush(stdout);
+
+  /* Run until every chunk is done and every client has been told so. */
+  while (numDone < numChunks || numClients > 0) {
+    int n;
+
+    pfd[0].fd = lfd;
+    pfd[0].events = POLLIN;
+    for (i = 0; i < numClients; i++) {
+      pfd[i + 1].fd = clients[i].fd;
+      pfd[i + 1].events = POLLIN;
+    }
+    n = poll(pfd, numClients + 1, 1000);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      fprintf(stderr, "poll: %s\n", strerror(errno));
+      exit(-1);
+    }
+    expireLeases(time(NULL));
+    /* Clients first, since accepting may renumber them. */
+    for (i = numClients; i > 0; i--) {
+      client_t *C = &clients[i - 1];
+
+      if (pfd[i].revents == 0)
+        continue;
+      if (readClient(C) < 0) {
+        close(C->fd);
+        free(C->in);
+        *C = clients[--numClients];
+      }
+    }
+    if (pfd[0].revents & POLLIN) {
+      int fd = accept(lfd, NULL, NULL);
+
+      if (fd >= 0) {
+        if (numClients < MAX_CLIENTS) {
+          memset(&clients[numClients], 0, sizeof(client_t));
+          clients[numClients++].fd = fd;
+        } else
+          close(fd);
+      }
+    }
+    fflush(stdout);
+  }
+  close(lfd);
+  if (sockName != NULL)
+    unlink(sockName);
+  fclose(outFile);
+  fclose(stateFile);
+  printf("All %u chunks of [%u,%u) are done.\n", numChunks, q0, q1);
+  return 0;
+}
@@ -29,15 +29,26 @@
 #if !defined(_MSC_VER)
 #include <sys/time.h>
 #endif
+#if !defined(_MSC_VER) && !defined(__MINGW32__) && !defined(MINGW32)
+#define SQRT_FORK
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#endif
 #include "ggnfs.h"
+#include "thrpool.h"
 
 #define QCB_SIZE 50
+#define MAX_DEPS 32
 
 
 #define USAGE " -fb <fname> -prel <prefix> -deps <fname> -depnum <int>\n"\
 "-fb     <fname>  : File containing the factor base.\n"\
 "-deps   <fname>  : Output of `matsolve'. i.e., the file with the dependencies.\n"\
 "-depnum <int>    : Which dependency to try.\n"\
+"-alldeps         : Try the dependencies in turn until one of them factors n.\n"\
+"-nt <int>        : Use this many threads for the CRT products or, with\n"\
+"                   -alldeps, run this many dependencies at once.\n"\
 "-knowndiv <int>  : The product of known small divisors of n\n"\
 "-nodfactor       : Don't try to factor the discriminant again.\n"
 
@@ -110,18 +121,221 @@ int cmpRels(const void *a, const void *b)
 static nf_t  g_N;
 /****************************************************/
 
+/****************************************************/
+s32 *getRelsInDep(u32 *ridMask, s32 maxRels, int depNum)
+/****************************************************/
+/* The relations used an odd number of times by     */
+/* dependency 'depNum' (i.e., those with bit depNum */
+/* set in ridMask), terminated by -1.               */
+/****************************************************/
+{ s32 i, numRels, *relsInDep;
+
+  for (i=0, numRels=0; i<maxRels; i++)
+    if (ridMask[i]&BIT(depNum))
+      numRels++;
+  if (!(relsInDep = (s32 *)malloc(sizeof(s32)*(numRels+1)))) {
+    fprintf(stderr, "Error allocating %" PRIu32 " bytes for relsInDep!\n", (u32)((numRels+1)*sizeof(s32)) );
+    return NULL;
+  }
+  for (i=0, numRels=0; i<maxRels; i++)
+    if (ridMask[i]&BIT(depNum))
+      relsInDep[numRels++] = i;
+  relsInDep[numRels] = -1; /* Terminator. */
+  return relsInDep;
+}
+
+/****************************************************/
+int sqrtDep(mpz_t p, int depNum, u32 *ridMask, s32 maxRels,
+            multi_file_t *prelF, multi_file_t *lpF)
+/****************************************************/
+/* Do the square root for dependency 'depNum', and  */
+/* set p <-- gcd(rSqrt - aSqrt, n).                 */
+/* Return value: 0 on success, nonzero on error.    */
+/****************************************************/
+{ s32   *relsInDep, numRels;
+  mpz_t  rSqrt, aSqrt;
+  int    res;
+
+  if (!(relsInDep = getRelsInDep(ridMask, maxRels, depNum)))
+    return -1;
+  for (numRels=0; relsInDep[numRels] >= 0; numRels++) ;
+  printf("Dependency %d consists of %" PRId32 " (a,b) pairs.\n", depNum, numRels);  
+
+  mpz_init(rSqrt); mpz_init(aSqrt);
+  res = montgomerySqrt(rSqrt, aSqrt, relsInDep, prelF, lpF, g_N.FB, &g_N);
+  mpz_sub(p, rSqrt, aSqrt);
+  mpz_gcd(p, p, g_N.FB->n);
+  mpz_clear(rSqrt); mpz_clear(aSqrt);
+  free(relsInDep);
+  return res;
+}
+
+/****************************************************/
+int reportFactors(mpz_t p, int depNum)
+/****************************************************/
+/* Print and log the factorization n = p*(n/p) that */
+/* dependency 'depNum' gave.                        */
+/* Return value:                                    */
+/*   -2 : not factored                              */
+/*    0 : completely factored                       */
+/*    1 : incompletely factored                     */
+/****************************************************/
+{ mpz_t q;
+  char  str[1024];
+  int   res;
+
+  mpz_init(q);
+  mpz_div(q, g_N.FB->n, p);
+  printf("Square root computations result in N=(r1)(r2) where:\n");
+  printf("r1 = "); mpz_out_str(stdout, 10, p); printf("\n");
+  printf("r2 = "); mpz_out_str(stdout, 10, q); printf("\n");
+  msgLog("", "From dependence %d, sqrt obtained:", depNum);
+  res = -2;
+  mpz_get_str(str, 10, p);
+  if ((mpz_cmp_ui(p, 1)>0) && (mpz_cmp(p, g_N.FB->n)<0)) {
+    res = 0;
+    if (mpz_probab_prime_p(p, 10))
+      sprintf(str, "%s (pp%u)", str, (unsigned int)strlen(str));
+    else {
+      sprintf(str, "%s (c%u)", str, (unsigned int)strlen(str));
+      res=1;
+    }
+  }
+  msgLog("", "  r1=%s", str);
+  mpz_get_str(str, 10, q);
+  if ((mpz_cmp_ui(q, 1)>0) && (mpz_cmp(q, g_N.FB->n)<0)) {
+    if (mpz_probab_prime_p(q, 10)) 
+      sprintf(str, "%s (pp%u)", str, (unsigned int)strlen(str));
+    else {
+      sprintf(str, "%s (c%u)", str, (unsigned int)strlen(str));
+      res=1;
+    }
+  }
+  msgLog("", "  r2=%s", str);
+  if (res>=0) 
+    msgLog("", "(pp=probable prime, c=composite)");
+  mpz_clear(q);
+  return res;
+}
+
+#ifdef SQRT_FORK
+/****************************************************/
+int sqrtDepsForked(int *deps, int numDeps, int numWorkers, char *depName,
+                   u32 *ridMask, s32 maxRels, multi_file_t *prelF, multi_file_t *lpF)
+/****************************************************/
+/* Run the dependencies deps[0..numDeps-1], up to   */
+/* 'numWorkers' at a time, each in a forked child   */
+/* (montgomerySqrt() keeps its state in statics).   */
+/* The children share the number field and the      */
+/* relations loaded by the parent. As soon as one   */
+/* of them gives a nontrivial factor, the others    */
+/* are stopped.                                     */
+/* Each child sends its gcd back as a decimal string*/
+/* on a pipe; with several workers, a child's output*/
+/* goes to <depName>.<dep>.log.                     */
+/* Return value: as reportFactors(), or -2 if no    */
+/* dependency factored n.                           */
+/****************************************************/
+{ pid_t  pid[MAX_DEPS], w;
+  int    fd[MAX_DEPS], fds[2], status, next, running, res, k, n;
+  char   buf[4096], logName[512], *s;
+  mpz_t  p;
+
+  mpz_init(p);
+  for (k=0; k<numDeps; k++)
+    pid[k] = 0;
+  next = running = 0;
+  res = -2;
+  while ((res < 0) && ((next < numDeps) || running)) {
+    while ((running < numWorkers) && (next < numDeps)) {
+      if (pipe(fds)) {
+        perror("pipe");
+        break;
+      }
+      fflush(stdout); fflush(stderr);
+      if ((pid[next] = fork()) < 0) {
+        perror("fork");
+        close(fds[0]); close(fds[1]);
+        pid[next] = 0;
+        break;
+      }
+      if (pid[next] == 0) {
+        /* The child. */
+        close(fds[0]);
+        if (numWorkers > 1) {
+          sprintf(logName, "%s.%d.log", depName, deps[next]);
+          if (!freopen(logName, "w", stdout))
+            fprintf(stderr, "Warning: could not open %s for write!\n", logName);
+          /* It may be stopped with SIGTERM, so don't keep output back. */
+          setvbuf(stdout, NULL, _IOLBF, 0);
+        }
+        n = 1;
+        if (sqrtDep(p, deps[next], ridMask, maxRels, prelF, lpF)==0) {
+          s = mpz_get_str(NULL, 10, p);
+          n = (write(fds[1], s, strlen(s)) == (ssize_t)strlen(s)) ? 0 : 1;
+        }
+        close(fds[1]);
+        exit(n);
+      }
+      close(fds[1]);
+      fd[next] = fds[0];
+      if (numWorkers > 1)
+        printf("Started dependency %d (output in %s.%d.log).\n", deps[next], depName, deps[next]);
+      next++; running++;
+    }
+    if (running == 0)
+      break;
+    if ((w = waitpid(-1, &status, 0)) <= 0)
+      break;
+    for (k=0; (k<next) && (pid[k] != w); k++) ;
+    if (k == next)
+      continue;
+    pid[k] = 0; running--;
+    /* The child has exited, so everything it wrote is in the pipe. */
+    n = 0;
+    while (n < (int)sizeof(buf)-1) {
+      ssize_t r = read(fd[k], buf+n, sizeof(buf)-1-n);
+      if (r <= 0) break;
+      n += (int)r;
+    }
+    buf[n] = 0;
+    close(fd[k]);
+    if (WIFEXITED(status) && (WEXITSTATUS(status)==0) && (n > 0) &&
+        (mpz_set_str(p, buf, 10)==0)) {
+      res = reportFactors(p, deps[k]);
+      if (res < 0)
+        printf("Dependency %d gave only the trivial factorization.\n", deps[k]);
+    } else
+      printf("The square root for dependency %d failed.\n", deps[k]);
+  }
+  /* Stop whatever is still running. */
+  for (k=0; k<next; k++) {
+    if (pid[k] > 0) {
+      kill(pid[k], SIGTERM);
+      waitpid(pid[k], &status, 0);
+      close(fd[k]);
+      printf("Stopped dependency %d.\n", deps[k]);
+    }
+  }
+  mpz_clear(p);
+  return res;
+}
+#endif
+
 /****************************************************/
 int main(int argC, char *args[])
 /****************************************************/
 { char       fbName[64], depName[64], colIndex[64];
-  char       *rid_hash, str[1024], token[512], value[512];
-  mpz_t      p, q, rSqrt, aSqrt, kDiv;
+  char       str[1024], token[512], value[512];
+  mpz_t      p, kDiv;
   double     startTime, now;
   FILE       *fp;
   mpz_fact_t D;
-  int        depNum=-1, res=0, cont;
-  s32      *colsInDep=NULL, maxCols, numCols, t, i, j, k;
-  s32      *relsInDep=NULL, maxRels, numRels;
+  int        depNum=-1, res=0, cont, allDeps=0, numWorkers=1;
+  int        deps[MAX_DEPS], numDeps;
+  s32        maxCols, numCols, i, j, k;
+  s32        maxRels, numRels;
+  u32        *depWords=NULL, *ridMask=NULL, want, m;
   struct     stat fileInfo;
   multi_file_t prelF, lpF;
   column_t   C;
@@ -142,6 +356,11 @@ int main(int argC, char *args[])
     } else if (strcmp(args[i], "-depnum")==0) {
       if ((++i) < argC) 
         depNum = atoi(args[i]);
+    } else if (strcmp(args[i], "-alldeps")==0) {
+      allDeps=1;
+    } else if (strcmp(args[i], "-nt")==0) {
+      if ((++i) < argC) 
+        numWorkers = atoi(args[i]);
     } else if (strcmp(args[i], "-knowndiv")==0) {
       if ((++i) < argC)
         mpz_set_str(kDiv, args[i], 10);
@@ -150,14 +369,16 @@ int main(int argC, char *args[])
     }
   }
  
-  if ((fbName[0]==0) || (depNum < 0)) {
+  if ((fbName[0]==0) || ((depNum < 0) && !allDeps)) {
     printf("USAGE: %s %s\n", args[0], USAGE);
     exit(0);
   }
-  if (depNum > 31) {
+  if (!allDeps && (depNum >= MAX_DEPS)) {
     printf("depNum=%d is invalid. It should be in [0,31].\n", depNum);
     exit(0);
   }
+  if (numWorkers < 1) numWorkers = 1;
+  if (numWorkers > MAX_DEPS) numWorkers = MAX_DEPS;
   msgLog("", "GGNFS-%s : sqrt", GGNFS_VERSION);
 
 
@@ -191,7 +412,16 @@ int main(int argC, char *args[])
   mpz_fact_factorEasy(&D, D.N, discFact);
   getIntegralBasis(&g_N, &D, discFact);
 
-  printf("Reading dependency %d from file %s...\n", depNum, depName);
+  /* Take the known divisors out of n once, here, rather than in */
+  /* each montgomerySqrt() call.                                 */
+  if (mpz_divisible_p(g_N.FB->n, g_N.FB->knownDiv))
+    mpz_divexact(g_N.FB->n, g_N.FB->n, g_N.FB->knownDiv);
+  mpz_set_ui(g_N.FB->knownDiv, 1);
+
+  if (allDeps)
+    printf("Reading dependencies from file %s...\n", depName);
+  else
+    printf("Reading dependency %d from file %s...\n", depNum, depName);
   if (!(fp = fopen(depName, "rb"))) {
     fprintf(stderr, "Error opening %s for read!\n", depName);
     res = -1; goto SS_DONE;
@@ -213,18 +443,24 @@ int main(int argC, char *args[])
     if (feof(fp)) cont=0;
   } 
 
-  if (!(colsInDep = (s32 *)malloc(maxCols*sizeof(s32)))) {
+  if (!(depWords = (u32 *)malloc(maxCols*sizeof(u32)))) {
     fclose(fp);
-    fprintf(stderr, "Error allocating %" PRIu32 " bytes for columns in dependency!\n", 
-            (u32)(maxCols*sizeof(s32)) );
+    fprintf(stderr, "Error allocating %" PRIu32 " bytes for the dependencies!\n", 
+            (u32)(maxCols*sizeof(u32)) );
     res = -1; goto SS_DONE;
   }
-  for (i=0, numCols=0; i<maxCols; i++) {
-    fread(&t, sizeof(s32), 1, fp);
-    if (t&BIT(depNum)) 
-      colsInDep[numCols++] = i;
+  if (fread(depWords, sizeof(u32), maxCols, fp) != (size_t)maxCols) {
+    fclose(fp);
+    fprintf(stderr, "Error: %s is truncated!\n", depName);
+    res = -1; goto SS_DONE;
   }
   fclose(fp);
+  want = (allDeps) ? 0xFFFFFFFF : (u32)BIT(depNum);
+  for (i=0, numCols=0; i<maxCols; i++) {
+    depWords[i] &= want;
+    if (depWords[i])
+      numCols++;
+  }
 
   printf("NUMCOLS = %" PRId32 "\n", maxCols);
   printf("COLNAME = %s\n", colIndex);
@@ -233,7 +469,8 @@ int main(int argC, char *args[])
   printf("RELFILES = %d\n", prelF.numFiles);
   printf("LPFPREFIX = %s\n", lpF.prefix);
   printf("LPFFILES = %d\n", lpF.numFiles);
-  printf("There are %" PRId32 " columns in this dependency. Getting corresponding (a,b) pairs...\n", numCols);
+  printf("There are %" PRId32 " columns in %s. Getting corresponding (a,b) pairs...\n", 
+         numCols, (allDeps) ? "the dependencies" : "this dependency");
 
   /* Sten: check for empty relations set. */
   if (numCols == 0) {
@@ -248,31 +485,31 @@ int main(int argC, char *args[])
 
   /********************************************************************/
   /* Now, open and scan the colIndex file to find out which relations */
-  /* go with the columns in our dependency - do this by hash, so that */
-  /* we don't need to consider an (a,b) pair more than once. That is, */
-  /* it's possible that the dependency uses an (a,b) pair multiple    */
-  /* times, but it always suffices to reduce this to 0 or 1 times.    */
+  /* go with the columns in our dependencies. Bit d of ridMask[r] is  */
+  /* the parity of the number of times relation r is used by          */
+  /* dependency d: it's possible that a dependency uses an (a,b) pair */
+  /* multiple times, but it always suffices to reduce this to 0 or 1  */
+  /* times. One pass over the file does all 32 dependencies.          */
   /********************************************************************/
-  if (!(rid_hash = (char *)malloc(maxRels*sizeof(char)))) {
-    fprintf(stderr, "Error allocating %" PRIu32 " bytes for rid_hash!\n", (u32)(maxRels*sizeof(char)) );
+  if (!(ridMask = (u32 *)calloc(maxRels, sizeof(u32)))) {
+    fprintf(stderr, "Error allocating %" PRIu32 " bytes for ridMask!\n", (u32)(maxRels*sizeof(u32)) );
     res = -1; goto SS_DONE;
   }
-  for (i=0; i<maxRels; i++)
-    rid_hash[i] = 0x00;
   if (!(fp = fopen(colIndex, "rb"))) {
     fprintf(stderr, "Error opening column index file %s for read!\n", colIndex);
     res = -1; goto SS_DONE;
   }
-  for (i=0, j=0; i<numCols; i++) {
-    /* j is the column number waiting on 'fp', and colsInDep[i] is         */
-    /* the next column we need (already sorted b/c the way it was read in. */
-    while (j <= colsInDep[i]) {
+  for (i=0, j=0; i<maxCols; i++) {
+    if (!depWords[i])
+      continue;
+    /* j is the column number waiting on 'fp'. */
+    while (j <= i) {
       readColIndex(&C, fp);
       j++;
     }
     for (k=0; k<C.numRels; k++) {
       if (C.Rels[k] < maxRels)
-        rid_hash[C.Rels[k]] ^= 0x01;
+        ridMask[C.Rels[k]] ^= depWords[i];
       else {
         fprintf(stderr, "Error: Column claims use of relation %" PRId32 " (maxRels = %" PRId32 ")!\n",
                 C.Rels[k], maxRels);
@@ -282,72 +519,58 @@ int main(int argC, char *args[])
     }
   }
   fclose(fp);
-  free(colsInDep); colsInDep = NULL; /* No longer needed. */
-  numRels = 0;
-  for (i=0; i<maxRels; i++) {
-    if (rid_hash[i]==0x01)
-      numRels++;
-  }
-  printf("This dependency consists of %" PRId32 " (a,b) pairs.\n", numRels);  
-  
-  if (!(relsInDep = (s32 *)malloc(sizeof(s32)*(numRels+1)))) {
-    fprintf(stderr, "Error allocating %" PRIu32 " bytes for relsInDep!\n", (u32)((numRels+1)*sizeof(s32)) );
-    res = -1; goto SS_DONE;
-  }
-  numRels = 0;
-  for (i=0; i<maxRels; i++) {
-    if (rid_hash[i]==0x01) 
-      relsInDep[numRels++] = i;
+  free(depWords); depWords = NULL; /* No longer needed. */
+
+  /* The dependencies to try, in order. */
+  for (k=0, numDeps=0; k<MAX_DEPS; k++) {
+    if (!(want&BIT(k)))
+      continue;
+    for (i=0, numRels=0, m=BIT(k); i<maxRels; i++)
+      if (ridMask[i]&m)
+        numRels++;
+    if (allDeps)
+      printf("Dependency %d consists of %" PRId32 " (a,b) pairs.\n", k, numRels);  
+    if (numRels > 0)
+      deps[numDeps++] = k;
   }
-  relsInDep[numRels] = -1; /* Terminator. */
-  free(rid_hash); /* No longer needed. */
 
-
-  mpz_init(rSqrt); mpz_init(aSqrt);
-  /* The montgomerySqrt() call goes here. */
-  montgomerySqrt(rSqrt, aSqrt, relsInDep, &prelF, &lpF, g_N.FB, &g_N);
-  mpz_init(p); mpz_init(q);
-  mpz_sub(p, rSqrt, aSqrt);
-  mpz_gcd(p, p, g_N.FB->n);
-  mpz_div(q, g_N.FB->n, p);
-  printf("Square root computations result in N=(r1)(r2) where:\n");
-  printf("r1 = "); mpz_out_str(stdout, 10, p); printf("\n");
-  printf("r2 = "); mpz_out_str(stdout, 10, q); printf("\n");
-  now = sTime();
-  msgLog("", "From dependence %d, sqrt obtained:", depNum);
-/*
-   res = -2 : not factored
-   res =  0 : completely factored
-   res =  1 : incompletely factored
-*/
-  res = -2;
-  mpz_get_str(str, 10, p);
-  if ((mpz_cmp_ui(p, 1)>0) && (mpz_cmp(p, g_N.FB->n)<0)) {
-    res = 0;
-    if (mpz_probab_prime_p(p, 10))
-      sprintf(str, "%s (pp%u)", str, (unsigned int)strlen(str));
-    else {
-      sprintf(str, "%s (c%u)", str, (unsigned int)strlen(str));
-      res=1;
+  mpz_init(p);
+  if (!allDeps) {
+    if (numDeps == 0) {
+      fprintf(stderr, "Error: dependency %d is empty!\n", depNum);
+      res=-1; goto SS_DONE;
     }
-  }
-  msgLog("", "  r1=%s", str);
-  mpz_get_str(str, 10, q);
-  if ((mpz_cmp_ui(q, 1)>0) && (mpz_cmp(q, g_N.FB->n)<0)) {
-    if (mpz_probab_prime_p(q, 10)) 
-      sprintf(str, "%s (pp%u)", str, (unsigned int)strlen(str));
-    else {
-      sprintf(str, "%s (c%u)", str, (unsigned int)strlen(str));
-      res=1;
+    if (numWorkers > 1)
+      printf("Using %d threads.\n", thr_init(numWorkers));
+    /* The montgomerySqrt() call goes here. */
+    sqrtDep(p, depNum, ridMask, maxRels, &prelF, &lpF);
+    res = reportFactors(p, depNum);
+    thr_clear();
+  } else {
+    /* Read the relations once, for all the dependencies. */
+    if (msqrtLoadRels(&prelF)) {
+      res=-1; goto SS_DONE;
+    }
+    printf("Trying %d dependencies, %d at a time.\n", numDeps, numWorkers);
+#ifdef SQRT_FORK
+    res = sqrtDepsForked(deps, numDeps, numWorkers, depName, ridMask, maxRels, &prelF, &lpF);
+#else
+    /* No fork(), so do them one after another. */
+    for (k=0, res=-2; (k<numDeps) && (res<0); k++) {
+      if (sqrtDep(p, deps[k], ridMask, maxRels, &prelF, &lpF)==0)
+        res = reportFactors(p, deps[k]);
     }
+#endif
+    msqrtClearRels();
+    if (res < 0)
+      printf("No dependency gave a nontrivial factorization.\n");
   }
-  msgLog("", "  r2=%s", str);
-  if (res>=0) 
-    msgLog("", "(pp=probable prime, c=composite)");
+  now = sTime();
   printf("Elapsed time: %1.4lf seconds.\n", now - startTime);
   msgLog("", "sqrtTime: %1.1lf", now - startTime);
 
-  mpz_clear(p); mpz_clear(q);
+  mpz_clear(p);
+  free(ridMask);
 
 SS_DONE:
   return res;
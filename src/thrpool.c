@@ -0,0 +1,182 @@
+/**************************************************************/
+/* thrpool.c                                                  */
+/* A small pool of worker threads for the data-parallel parts */
+/* of the linear algebra and the relation processing.         */
+/**************************************************************/
+/*  This file is part of GGNFS.
+*
+*   GGNFS is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   GGNFS is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with GGNFS; if not, write to the Free Software
+*   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "ggnfs.h"
+#include "thrpool.h"
+
+#if !defined(_MSC_VER) && !defined(__MINGW32__) && !defined(MINGW32)
+#define HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+static int thr_size = 1;
+
+#ifdef HAVE_PTHREADS
+static pthread_t       thr_tid[THR_MAX_THREADS];
+static pthread_mutex_t thr_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t thr_glock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  thr_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  thr_done = PTHREAD_COND_INITIALIZER;
+static THR_FUNC_PTR    thr_func;
+static void           *thr_arg;
+static unsigned        thr_generation = 0, thr_startGen = 0;
+static int             thr_pending = 0, thr_quit = 0;
+
+/*********************************************************************/
+static void *thr_worker(void *p)
+/*********************************************************************/
+{ int      thread = (int)(size_t)p;
+  unsigned generation;
+  THR_FUNC_PTR f;
+  void    *arg;
+
+  /* Jobs run before this pool was started are not ours, but the */
+  /* first thr_run() may come before this thread gets going.     */
+  generation = thr_startGen;
+  for (;;) {
+    pthread_mutex_lock(&thr_mutex);
+    while (thr_generation == generation && !thr_quit)
+      pthread_cond_wait(&thr_start, &thr_mutex);
+    if (thr_quit) {
+      pthread_mutex_unlock(&thr_mutex);
+      break;
+    }
+    generation = thr_generation;
+    f = thr_func;
+    arg = thr_arg;
+    pthread_mutex_unlock(&thr_mutex);
+
+    f(arg, thread, thr_size);
+
+    pthread_mutex_lock(&thr_mutex);
+    if (--thr_pending == 0)
+      pthread_cond_signal(&thr_done);
+    pthread_mutex_unlock(&thr_mutex);
+  }
+  return NULL;
+}
+#endif
+
+/*********************************************************************/
+int thr_init(int numThreads)
+/*********************************************************************/
+{
+  thr_clear();
+  if (numThreads > THR_MAX_THREADS)
+    numThreads = THR_MAX_THREADS;
+#ifdef HAVE_PTHREADS
+  {
+    int i;
+
+    thr_quit = 0;
+    thr_startGen = thr_generation;
+    for (i=1; i<numThreads; i++) {
+      if (pthread_create(&thr_tid[i], NULL, thr_worker, (void *)(size_t)i)) {
+        fprintf(stderr, "thr_init(): could only start %d threads.\n", i);
+        break;
+      }
+      thr_size = i+1;
+    }
+  }
+#endif
+  return thr_size;
+}
+
+/*********************************************************************/
+void thr_clear(void)
+/*********************************************************************/
+{
+#ifdef HAVE_PTHREADS
+  int i;
+
+  if (thr_size > 1) {
+    pthread_mutex_lock(&thr_mutex);
+    thr_quit = 1;
+    pthread_cond_broadcast(&thr_start);
+    pthread_mutex_unlock(&thr_mutex);
+    for (i=1; i<thr_size; i++)
+      pthread_join(thr_tid[i], NULL);
+  }
+#endif
+  thr_size = 1;
+}
+
+/*********************************************************************/
+int thr_numThreads(void)
+/*********************************************************************/
+{
+  return thr_size;
+}
+
+/*********************************************************************/
+void thr_run(THR_FUNC_PTR f, void *arg)
+/*********************************************************************/
+{
+#ifdef HAVE_PTHREADS
+  if (thr_size > 1) {
+    pthread_mutex_lock(&thr_mutex);
+    thr_func = f;
+    thr_arg = arg;
+    thr_pending = thr_size - 1;
+    thr_generation++;
+    pthread_cond_broadcast(&thr_start);
+    pthread_mutex_unlock(&thr_mutex);
+
+    f(arg, 0, thr_size);
+
+    pthread_mutex_lock(&thr_mutex);
+    while (thr_pending > 0)
+      pthread_cond_wait(&thr_done, &thr_mutex);
+    pthread_mutex_unlock(&thr_mutex);
+    return;
+  }
+#endif
+  f(arg, 0, 1);
+}
+
+/*********************************************************************/
+void thr_range(s32 *lo, s32 *hi, s32 n, int thread, int numThreads)
+/*********************************************************************/
+{
+  *lo = (s32)(((s64)n*thread)/numThreads);
+  *hi = (s32)(((s64)n*(thread+1))/numThreads);
+}
+
+/*********************************************************************/
+void thr_lock(void)
+/*********************************************************************/
+{
+#ifdef HAVE_PTHREADS
+  pthread_mutex_lock(&thr_glock);
+#endif
+}
+
+/*********************************************************************/
+void thr_unlock(void)
+/*********************************************************************/
+{
+#ifdef HAVE_PTHREADS
+  pthread_mutex_unlock(&thr_glock);
+#endif
+}
@@ -0,0 +1,77 @@
+/**************************************************************/
+/* thrpool.h                                                  */
+/* A small pool of worker threads for the data-parallel parts */
+/* of the linear algebra and the relation processing.         */
+/**************************************************************/
+/*  This file is part of GGNFS.
+*
+*   GGNFS is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   GGNFS is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with GGNFS; if not, write to the Free Software
+*   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#ifndef __THRPOOL_H__
+#define __THRPOOL_H__
+#include "ggnfs.h"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+/* Hard limit on the pool size. */
+#define THR_MAX_THREADS 256
+
+/* A job is run once on every thread of the pool, with the */
+/* thread number in [0, numThreads).                       */
+typedef void (* THR_FUNC_PTR)(void *arg, int thread, int numThreads);
+
+/*********************************************************************/
+/* Start a pool of 'numThreads' threads (the calling thread counts   */
+/* as thread 0). Returns the number of threads actually available,   */
+/* which is 1 if threads are not supported on this platform.         */
+/*********************************************************************/
+int  thr_init(int numThreads);
+
+/*********************************************************************/
+/* Stop the pool.                                                    */
+/*********************************************************************/
+void thr_clear(void);
+
+/*********************************************************************/
+/* The current pool size (1 if thr_init() was never called).         */
+/*********************************************************************/
+int  thr_numThreads(void);
+
+/*********************************************************************/
+/* Run f(arg, k, numThreads) on every thread k of the pool and wait  */
+/* until all of them have returned. Must only be called from the     */
+/* thread which called thr_init(), and never from inside a job.      */
+/*********************************************************************/
+void thr_run(THR_FUNC_PTR f, void *arg);
+
+/*********************************************************************/
+/* Split [0,n) into 'numThreads' contiguous pieces of nearly equal   */
+/* size, and return the piece [*lo, *hi) belonging to 'thread'.      */
+/*********************************************************************/
+void thr_range(s32 *lo, s32 *hi, s32 n, int thread, int numThreads);
+
+/*********************************************************************/
+/* A global lock, for the rare places where jobs must serialize.     */
+/*********************************************************************/
+void thr_lock(void);
+void thr_unlock(void);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif /* __THRPOOL_H__ */
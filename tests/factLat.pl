@@ -85,6 +85,10 @@ $maxRelsInFF=32;
 # the polynomial selection phase will last.
 $polySelTimeMultiplier=1.0;
 
+# Number of threads for the steps which can use them. With more than one,
+# sqrt tries that many dependencies at once.
+$NUM_THREADS=1;
+
 ################################################################
 # Nothing configurable below here - don't mess with it unless  #
 # you're fixing a bug or adding functionality.                 #
@@ -1541,6 +1545,7 @@ while (!(-e $COLS)) {
     # Find out how many Relations and total large primes there are.
 
     # this needs to be fixed.
+    $tff = 0;
     open(LOG, $LOGFILE) || return;
     while ($_ = <LOG>) {
       chomp;
@@ -1553,12 +1558,22 @@ while (!(-e $COLS)) {
         $tlp=$_[0];
         $trel=$_[1];
       }
+      # procrels' count of fulls + cycles from the large prime graph,
+      # a lower bound on what matbuild will find.
+      if ( /CYCLES:/) {
+        s/\[.*]\s*//;
+        s/(FULLS: |CYCLES: |EXCESS: )//g;
+        s/\s//g;
+        @_ = split /,/;
+        $tff=$_[0]+$_[1];
+      }
     }
     if (($tlp <= 0) || ($trel <= 0)) {
       print "-> Warning: Failed to read total large primes and/or total rels from log!\n";
     } else {
       print "-> Found $tlp total LP vs. $trel relations.\n";
-      if ((($tlp - $trel) < 0.8*$trel)||($FORCECC=="on")) {
+      print "-> procrels counted at least $tff fulls + cycles.\n" if ($tff > 0);
+      if ((($tlp - $trel) < 0.8*$trel)||($FORCECC=="on")||($tff >= $minFF)) {
         $cmd="$NICE \"$MATBUILD\" -fb $NAME.fb -prel $RELSBIN -maxrelsinff $maxRelsInFF -minff $minFF";
         print "=>$cmd\n" if($ECHO_CMDLINE);
         $res=system($cmd);
@@ -1621,18 +1636,22 @@ if (!(-e $DEPFILE)) {
   printf "-> File 'deps' already exists. Proceeding to sqrt step.\n";
 }
 #############################################
-# Do as many square root jobs as needed to  #
-# get the final factorization.              #
+# One sqrt run loads the relations once and #
+# tries the dependencies until one of them  #
+# factors N.                                #
 #############################################
-$depnum=0;
-my $done = getPrimes;
-while (!($done)) {
-  $cmd="$NICE \"$SQRT\" $DISC -fb $NAME.fb -deps $DEPFILE -depnum $depnum $KNOWNDIVOPT";
+if (!(getPrimes)) {
+  $cmd="$NICE \"$SQRT\" $DISC -fb $NAME.fb -deps $DEPFILE -alldeps $KNOWNDIVOPT";
+  $cmd .= " -nt $NUM_THREADS" if ($NUM_THREADS > 1);
   print "=>$cmd\n" if($ECHO_CMDLINE);
   $res=system($cmd);
-  $done = getPrimes;
-  if ($depnum++ >= 32) { $done=1; }
-} 
+  # sqrt returns 0 (completely factored) or 1 (incompletely factored).
+  $res = ($res == -1) ? -1 : ($res >> 8);
+  if (($res != 0) && ($res != 1)) {
+    print "-> sqrt did not factor N (return value $res).\n";
+  }
+  getPrimes;
+}
 
 if ($CLEANUP) {
   unlink $LOGFILE, <cols*>, <deps*>, 'factor.easy', <lpindex*>;
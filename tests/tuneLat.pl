@@ -0,0 +1,398 @@
+#!/usr/bin/perl
+# The path where the binaries are:
+$GGNFS_BIN_PATH="../../bin";
+########################################################################
+# tuneLat.pl
+#
+#   This file is part of GGNFS.
+#   GGNFS is free software; you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation; either version 2 of the License, or
+#   (at your option) any later version.
+#
+#   GGNFS is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with GGNFS; if not, write to the Free Software
+#   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+########################################################################
+# Tunes the lattice siever parameters of <name>.poly with short test
+# runs, and writes them to a job file.
+#
+# Usage: tuneLat.pl [options] <name>
+#
+# Starting from the parameters in <name>.poly (and def-par.txt for the
+# ones which are not there), the siever is run for -t seconds at each of
+# a few special q spread over the range which the job will probably
+# sieve. The metrics file of the siever (-m) gives the relations and the
+# seconds per special q, without the factor base setup. From these,
+#     rate   = relations per second,
+#     yield  = relations per unit of q,
+#     needed = relfrac * (pi(2^lpbr) + pi(2^lpba)),
+# and the estimated sieving time is needed/rate. I, lpb, mfb, lambda,
+# lim and the first sieve side are then changed one at a time, and each
+# change which lowers the estimated time is kept, until a pass over all
+# of them changes nothing (or -passes is reached). The best parameters
+# are written to <name>.job (or -o), with q0 and qintsize for the
+# estimated range, and the siever to use in a comment.
+########################################################################
+use POSIX ":sys_wait_h";
+
+$DEFAULT_PAR_FILE=$GGNFS_BIN_PATH."/def-par.txt";
+$EXEC_SUFFIX = ($^O =~ /MSWin32|cygwin|msys/) ? ".exe" : "";
+
+$SAMPLE_TIME=20;     # Seconds of sieving per sample.
+$NUM_SAMPLES=3;      # Special q sampled per parameter set.
+$MAX_PASSES=3;       # Passes over the parameters.
+$REL_FRAC=0.7;       # Fraction of pi(2^lpbr)+pi(2^lpba) needed.
+$LATSIEVE_SIDE=0;    # 0: algebraic special q, 1: rational.
+$SETUP_TIME=300;     # Seconds allowed for the factor base setup.
+$JOBFILE="";
+
+$USAGE = "USAGE: tuneLat.pl [options] <name>\n".
+"  -t <int>         : seconds of sieving per sample (default $SAMPLE_TIME).\n".
+"  -samples <int>   : special q sampled per parameter set (default $NUM_SAMPLES).\n".
+"  -passes <int>    : passes over the parameters (default $MAX_PASSES).\n".
+"  -relfrac <float> : relations needed, as a fraction of the number of\n".
+"                     primes below the large prime bounds (default $REL_FRAC).\n".
+"  -r               : rational special q (default algebraic).\n".
+"  -bin <path>      : where the sievers are (default $GGNFS_BIN_PATH).\n".
+"  -o <fname>       : job file to write (default <name>.job).\n";
+
+######################################################
+sub loadDefaultParams {
+######################################################
+# The def-par.txt line closest to the given number of
+# digits; see factLat.pl for the format.
+  my ($digits, $type) = @_;
+  my $best = 1000;
+  my @row;
+
+  return () unless open(IF, $DEFAULT_PAR_FILE);
+  while (<IF>) {
+    s/#.*//;
+    s/\s*//g;
+    next unless length($_) > 0;
+    my @f = split /,/;
+    next unless $f[0] eq $type;
+    if (abs($f[1] - $digits) < $best) {
+      $best = abs($f[1] - $digits);
+      @row = @f;
+    }
+  }
+  close(IF);
+  return () unless @row;
+  return (rlim => $row[11], alim => $row[12], lpbr => $row[13],
+          lpba => $row[14], mfbr => $row[15], mfba => $row[16],
+          rlambda => $row[17], alambda => $row[18]);
+}
+
+######################################################
+sub readPoly {
+######################################################
+# Fills %PARAMS from the poly file, and keeps the other
+# lines (n, polynomials, skew, ...) for the job files.
+  my $fname = shift;
+  my ($digits, $type) = (0, "gnfs");
+  my %def;
+
+  open(PF, $fname) or die "Cannot open $fname: $!\n";
+  while (<PF>) {
+    chomp;
+    if (/^(\w+):\s*(\S+)/) {
+      my ($key, $val) = ($1, $2);
+      if ($key =~ /^(rlim|alim|lpbr|lpba|mfbr|mfba|rlambda|alambda)$/) {
+        $PARAMS{$key} = $val;
+        next;
+      }
+      next if ($key =~ /^(q0|qintsize)$/);
+      $digits = length($val) if ($key eq 'n');
+      $type = $val if ($key eq 'type');
+      $I = $val if ($key eq 'I');
+      $LATSIEVE_SIDE = $val if ($key eq 'lss');
+      next if ($key =~ /^(I|lss)$/);
+    }
+    push @POLYLINES, $_;
+  }
+  close(PF);
+  die "-> $fname has no n:\n" unless $digits;
+  %def = loadDefaultParams($digits, $type);
+  foreach my $key (keys %def) {
+    $PARAMS{$key} = $def{$key} unless defined $PARAMS{$key};
+  }
+  foreach my $key (qw(rlim alim lpbr lpba mfbr mfba rlambda alambda)) {
+    die "-> Error: '$key' is neither in $fname nor in $DEFAULT_PAR_FILE\n"
+      unless defined $PARAMS{$key};
+  }
+  unless ($I) {
+    # The same choice as factLat.pl.
+    if ($type eq "snfs") {
+      $I = ($digits < 150) ? 12 : ($digits < 180) ? 13 : 14;
+    } else {
+      $I = ($digits < 110) ? 12 : ($digits < 135) ? 13 : 14;
+    }
+  }
+  $PARAMS{I} = $I;
+  $PARAMS{fss} = -1;
+}
+
+######################################################
+sub siever {
+######################################################
+  my $I = shift;
+  return "$GGNFS_BIN_PATH/gnfs-lasieve4I${I}e$EXEC_SUFFIX";
+}
+
+######################################################
+sub numPrimes {
+######################################################
+# pi(2^b), from the logarithmic integral.
+  my $x = 2**shift;
+  my $l = log($x);
+  return $x / $l * (1 + 1/$l + 2/($l*$l));
+}
+
+######################################################
+sub paramKey {
+######################################################
+  my $p = shift;
+  return join(",", map { "$_=$p->{$_}" } sort keys %$p);
+}
+
+######################################################
+sub writeJob {
+######################################################
+  my ($fname, $p, $q0, $qint) = @_;
+
+  open(OUTF, ">$fname") or die "Cannot write $fname: $!\n";
+  print OUTF "$_\n" foreach (@POLYLINES);
+  foreach my $key (qw(rlim alim lpbr lpba mfbr mfba rlambda alambda)) {
+    print OUTF "$key: $p->{$key}\n";
+  }
+  if (defined $q0) {
+    print OUTF "q0: $q0\n";
+    print OUTF "qintsize: $qint\n";
+  }
+  close(OUTF);
+}
+
+######################################################
+sub runSample {
+######################################################
+# Sieve special q from q0 for $SAMPLE_TIME seconds after
+# the factor base setup. Returns (relations, seconds,
+# width of q sieved).
+  my ($p, $q0) = @_;
+  my $job = "$NAME.tune.job";
+  my $metrics = "$NAME.tune.metrics";
+  my $out = "$NAME.tune.out";
+  my @cmd = (siever($p->{I}), ($LATSIEVE_SIDE ? '-r' : '-a'),
+             '-f', $q0, '-c', 100000000, '-o', $out, '-m', $metrics);
+  push @cmd, ('-i', $p->{fss}) if ($p->{fss} >= 0);
+  push @cmd, $job;
+  my ($pid, $start, $rels, $sec, $qmax, $n);
+
+  writeJob($job, $p);
+  unlink $metrics, $out;
+  $pid = fork();
+  die "fork: $!\n" unless defined $pid;
+  if ($pid == 0) {
+    open(STDOUT, ">/dev/null");
+    open(STDERR, ">/dev/null");
+    exec(@cmd) or POSIX::_exit(1);
+  }
+  # The clock starts with the first special q, after the setup;
+  # the first line of the metrics file only has the parameters.
+  $start = time;
+  $n = 0;
+  while (waitpid($pid, WNOHANG) == 0) {
+    sleep 1;
+    if ($n < 2) {
+      $n = 0;
+      if (open(MF, $metrics)) {
+        $n++ while (<MF>);
+        close(MF);
+      }
+      last if ($n < 2 && time - $start > $SETUP_TIME);
+      $start = time if ($n >= 2);
+    } else {
+      last if (time - $start >= $SAMPLE_TIME);
+    }
+  }
+  kill 'TERM', $pid;
+  waitpid($pid, 0);
+
+  ($rels, $sec, $qmax) = (0, 0, 0);
+  if (open(MF, $metrics)) {
+    while (<MF>) {
+      next unless /"q":(\d+)/;
+      my $q = $1;
+      $rels += $1 if (/"rels":(\d+)/);
+      $sec += $1 if (/"sec":([\d.]+)/);
+      $qmax = $q if ($q > $qmax);
+    }
+    close(MF);
+  }
+  unlink $metrics, $out, $job, ".last_spq0";
+  return ($rels, $sec, $qmax >= $q0 ? $qmax - $q0 + 1 : 0);
+}
+
+######################################################
+sub evaluate {
+######################################################
+# Estimated seconds to sieve enough relations with the
+# parameters $p; also sets $p->{rate} and $p->{yield}.
+  my $p = shift;
+  my $key = paramKey($p);
+  my ($rels, $sec, $width) = (0, 0, 0);
+
+  return $CACHE{$key}->{time} if (defined $CACHE{$key});
+  unless (-x siever($p->{I})) {
+    $CACHE{$key} = { time => 1e99 };
+    return 1e99;
+  }
+  foreach my $q0 (@SAMPLE_Q) {
+    my ($r, $s, $w) = runSample($p, $q0);
+    # Each sample counts for the same width of q.
+    next unless ($w > 0 && $s > 0);
+    $rels += $r / $w;
+    $sec += $s / $w;
+    $width++;
+  }
+  my $needed = $REL_FRAC * (numPrimes($p->{lpbr}) + numPrimes($p->{lpba}));
+  my %res = (time => 1e99, rate => 0, yield => 0, needed => $needed);
+  if ($width > 0 && $rels > 0) {
+    $res{rate} = $rels / $sec;
+    $res{yield} = $rels / $width;
+    $res{time} = $needed / $res{rate};
+  }
+  $CACHE{$key} = \%res;
+  printf "-> I=%d lpb=%d/%d mfb=%d/%d lambda=%.2f/%.2f lim=%d/%d fss=%s: ".
+         "%.2f rels/sec, %.2f rels/q, %.0f needed, %.1f hours\n",
+         $p->{I}, $p->{lpbr}, $p->{lpba}, $p->{mfbr}, $p->{mfba},
+         $p->{rlambda}, $p->{alambda}, $p->{rlim}, $p->{alim},
+         ($p->{fss} < 0 ? "auto" : $p->{fss}), $res{rate}, $res{yield},
+         $needed, $res{time} / 3600;
+  return $res{time};
+}
+
+######################################################
+sub neighbours {
+######################################################
+# The parameter sets which differ from $p by one step
+# of the parameter $what.
+  my ($p, $what) = @_;
+  my @n;
+  my $add = sub {
+    my %c = (%$p, @_);
+    return if ($c{I} < 11 || $c{I} > 16);
+    foreach my $s ('r', 'a') {
+      return if ($c{"lpb$s"} < 20 || $c{"lpb$s"} > 33);
+      return if ($c{"mfb$s"} < $c{"lpb$s"} || $c{"mfb$s"} > 3 * $c{"lpb$s"});
+      return if ($c{"${s}lambda"} < 1.0 || $c{"${s}lambda"} > 3.5);
+    }
+    push @n, \%c;
+  };
+
+  if ($what eq 'I') {
+    $add->(I => $p->{I} + $_) foreach (-1, 1);
+  } elsif ($what eq 'lpb') {
+    # The cofactor bounds move with the large prime bounds.
+    foreach my $d (-1, 1) {
+      $add->(lpbr => $p->{lpbr} + $d, lpba => $p->{lpba} + $d,
+             mfbr => $p->{mfbr} + 2 * $d, mfba => $p->{mfba} + 2 * $d);
+    }
+  } elsif ($what =~ /^mfb([ra])$/) {
+    $add->("mfb$1" => $p->{"mfb$1"} + $_) foreach (-2, 2);
+  } elsif ($what =~ /^([ra])lambda$/) {
+    $add->("$1lambda" => sprintf("%.2f", $p->{"$1lambda"} + $_))
+      foreach (-0.1, 0.1);
+  } elsif ($what eq 'lim') {
+    foreach my $f (0.7, 1.4) {
+      $add->(rlim => int($p->{rlim} * $f), alim => int($p->{alim} * $f));
+    }
+  } elsif ($what eq 'fss') {
+    $add->(fss => $_) foreach (grep { $_ != $p->{fss} } (-1, 0, 1));
+  }
+  return @n;
+}
+
+###########################################################
+# Main
+###########################################################
+while (@ARGV) {
+  my $arg = shift @ARGV;
+  if ($arg eq '-t') { $SAMPLE_TIME = shift @ARGV; }
+  elsif ($arg eq '-samples') { $NUM_SAMPLES = shift @ARGV; }
+  elsif ($arg eq '-passes') { $MAX_PASSES = shift @ARGV; }
+  elsif ($arg eq '-relfrac') { $REL_FRAC = shift @ARGV; }
+  elsif ($arg eq '-r') { $LATSIEVE_SIDE = 1; }
+  elsif ($arg eq '-bin') {
+    $GGNFS_BIN_PATH = shift @ARGV;
+    $DEFAULT_PAR_FILE = $GGNFS_BIN_PATH."/def-par.txt";
+  }
+  elsif ($arg eq '-o') { $JOBFILE = shift @ARGV; }
+  elsif ($arg =~ /^-/) { die $USAGE; }
+  else { $NAME = $arg; }
+}
+die $USAGE unless $NAME;
+$NAME =~ s/\.poly$//;
+$JOBFILE = "$NAME.job" unless $JOBFILE;
+die $USAGE unless ($NUM_SAMPLES >= 1 && $SAMPLE_TIME >= 1);
+
+readPoly("$NAME.poly");
+
+# The special q sampled, the same for all parameter sets: spread over
+# [lim/2, 2*lim] of the special q side, like the range factLat.pl sieves.
+{
+  my $lim = $LATSIEVE_SIDE ? $PARAMS{rlim} : $PARAMS{alim};
+  for (my $k = 0; $k < $NUM_SAMPLES; $k++) {
+    my $f = ($NUM_SAMPLES > 1) ? 0.5 + 1.5 * $k / ($NUM_SAMPLES - 1) : 1.0;
+    push @SAMPLE_Q, int($lim * $f);
+  }
+}
+printf "-> Sampling special q %s for %d seconds each.\n",
+       join(", ", @SAMPLE_Q), $SAMPLE_TIME;
+
+$best = { %PARAMS };
+$bestTime = evaluate($best);
+die "-> The siever produced no relations; check the poly file and the binaries.\n"
+  if ($bestTime >= 1e99);
+
+for ($pass = 0; $pass < $MAX_PASSES; $pass++) {
+  my $changed = 0;
+
+  foreach my $what (qw(I lpb mfbr mfba rlambda alambda lim fss)) {
+    foreach my $c (neighbours($best, $what)) {
+      my $t = evaluate($c);
+      if ($t < $bestTime) {
+        $best = $c;
+        $bestTime = $t;
+        $changed = 1;
+        print "->   (new best)\n";
+        # Go on with the next parameter from here.
+        last;
+      }
+    }
+  }
+  last unless $changed;
+}
+
+{
+  my $res = $CACHE{paramKey($best)};
+  my $q0 = int(($LATSIEVE_SIDE ? $best->{rlim} : $best->{alim}) / 2);
+  my $qint = int($res->{needed} / $res->{yield}) + 1;
+
+  writeJob($JOBFILE, $best, $q0, $qint);
+  open(OUTF, ">>$JOBFILE");
+  printf OUTF "# siever: gnfs-lasieve4I%de %s%s\n", $best->{I},
+         ($LATSIEVE_SIDE ? '-r' : '-a'), ($best->{fss} >= 0 ? " -i $best->{fss}" : "");
+  printf OUTF "# tuneLat.pl: %.2f rels/sec, %.0f relations needed, %.1f CPU hours\n",
+         $res->{rate}, $res->{needed}, $bestTime / 3600;
+  close(OUTF);
+  printf "-> Wrote $JOBFILE: I=%d, %.0f relations in about %.1f CPU hours, q in [%d,%d).\n",
+         $best->{I}, $res->{needed}, $bestTime / 3600, $q0, $q0 + $qint;
+}